@@ -125,28 +125,278 @@ void CL_StopPlayback (void)
 
 /*
 ====================
-CL_WriteDemoMessage
+CL_WriteDemoData
 
-Dumps the current net message, prefixed by the length and view angles
+Dumps a message, prefixed by the length and view angles
 ====================
 */
-static void CL_WriteDemoMessage (void)
+static void CL_WriteDemoData (const byte *data, int size, const vec3_t angles)
 {
 	int	len;
 	int	i;
 	float	f;
 
-	len = LittleLong (net_message.cursize);
+	len = LittleLong (size);
 	fwrite (&len, 4, 1, cls.demofile);
 	for (i = 0; i < 3; i++)
 	{
-		f = LittleFloat (cl.viewangles[i]);
+		f = LittleFloat (angles[i]);
 		fwrite (&f, 4, 1, cls.demofile);
 	}
-	fwrite (net_message.data, net_message.cursize, 1, cls.demofile);
+	fwrite (data, size, 1, cls.demofile);
 	fflush (cls.demofile);
 }
 
+/*
+====================
+CL_WriteDemoMessage
+
+Dumps the current net message
+====================
+*/
+static void CL_WriteDemoMessage (void)
+{
+	CL_WriteDemoData (net_message.data, net_message.cursize, cl.viewangles);
+}
+
+/*
+==============================================================================
+
+DEMO ENTITY UPDATES
+
+Other engines (and older builds) can't play svc_deltaentities back, so while
+recording, each message from the server is held until it has been parsed,
+and any svc_deltaentities in it is replaced by fast updates for every entity
+in the resulting snapshot, which is what the client shows.
+==============================================================================
+*/
+
+static struct
+{
+	qboolean	pending;				// raw is yet to be written
+	vec3_t		viewangles;				// as of when the message arrived
+	int			rawsize;
+	int			copied;					// bytes of raw already in msg
+	sizebuf_t	msg;
+	byte		raw[NET_MAXMESSAGE];
+	byte		msgbuf[NET_MAXMESSAGE];
+} demo_held;
+
+/*
+====================
+CL_AppendHeldMessage
+
+Starts a new demo message when this wouldn't fit for playback
+====================
+*/
+static void CL_AppendHeldMessage (const void *data, int size)
+{
+	if (demo_held.msg.cursize + size > MAX_MSGLEN)
+	{
+		CL_WriteDemoData (demo_held.msg.data, demo_held.msg.cursize, demo_held.viewangles);
+		SZ_Clear (&demo_held.msg);
+	}
+	SZ_Write (&demo_held.msg, data, size);
+}
+
+/*
+====================
+CL_FlushDemoMessage
+
+Writes out the held message, converted as far as it was parsed
+====================
+*/
+static void CL_FlushDemoMessage (void)
+{
+	if (!demo_held.pending)
+		return;
+	demo_held.pending = false;
+
+	if (!demo_held.copied)
+	{	// nothing to convert
+		CL_WriteDemoData (demo_held.raw, demo_held.rawsize, demo_held.viewangles);
+		return;
+	}
+
+	CL_AppendHeldMessage (demo_held.raw + demo_held.copied, demo_held.rawsize - demo_held.copied);
+	CL_WriteDemoData (demo_held.msg.data, demo_held.msg.cursize, demo_held.viewangles);
+}
+
+/*
+====================
+CL_HoldDemoMessage
+
+Keeps a copy of the net message just received, to be written once parsed
+====================
+*/
+static void CL_HoldDemoMessage (void)
+{
+	CL_FlushDemoMessage ();
+
+	if (cl.protocol == PROTOCOL_NETQUAKE)
+	{	// never asks for svc_deltaentities
+		CL_WriteDemoMessage ();
+		return;
+	}
+
+	memcpy (demo_held.raw, net_message.data, net_message.cursize);
+	demo_held.rawsize = net_message.cursize;
+	VectorCopy (cl.viewangles, demo_held.viewangles);
+	demo_held.copied = 0;
+	demo_held.msg.data = demo_held.msgbuf;
+	demo_held.msg.maxsize = sizeof (demo_held.msgbuf);
+	SZ_Clear (&demo_held.msg);
+	demo_held.pending = true;
+}
+
+/*
+====================
+CL_FinishDemoMessage
+
+Called once the net message has been parsed
+====================
+*/
+void CL_FinishDemoMessage (void)
+{
+	CL_FlushDemoMessage ();
+}
+
+/*
+====================
+CL_WriteDemoEntity
+
+Same as the fast updates SV_WriteEntitiesToClient sends
+====================
+*/
+static void CL_WriteDemoEntity (sizebuf_t *msg, const snapentity_t *e)
+{
+	const entity_state_t	*base = &cl_entities[e->num].baseline;	// CL_EntityNum checked it
+	const entity_state_t	*s = &e->state;
+	int		i, bits;
+	float	miss;
+
+	bits = 0;
+
+	for (i=0 ; i<3 ; i++)
+	{
+		miss = s->origin[i] - base->origin[i];
+		if ( miss < -0.1 || miss > 0.1 )
+			bits |= U_ORIGIN1<<i;
+	}
+
+	if (s->angles[0] != base->angles[0])
+		bits |= U_ANGLE1;
+	if (s->angles[1] != base->angles[1])
+		bits |= U_ANGLE2;
+	if (s->angles[2] != base->angles[2])
+		bits |= U_ANGLE3;
+
+	if (e->flags & SNAP_STEP)
+		bits |= U_STEP;
+	if (base->colormap != s->colormap)
+		bits |= U_COLORMAP;
+	if (base->skin != s->skin)
+		bits |= U_SKIN;
+	if (base->frame != s->frame)
+		bits |= U_FRAME;
+	if (base->effects != s->effects)
+		bits |= U_EFFECTS;
+	if (base->modelindex != s->modelindex)
+		bits |= U_MODEL;
+
+	// only FitzQuake and RMQ get here
+	if (base->alpha != s->alpha) bits |= U_ALPHA;
+	if (base->scale != s->scale) bits |= U_SCALE;
+	if (bits & U_FRAME && s->frame & 0xFF00) bits |= U_FRAME2;
+	if (bits & U_MODEL && s->modelindex & 0xFF00) bits |= U_MODEL2;
+	if (e->flags & SNAP_LERPFINISH) bits |= U_LERPFINISH;
+	if (bits >= 65536) bits |= U_EXTEND1;
+	if (bits >= 16777216) bits |= U_EXTEND2;
+
+	if (e->num >= 256)
+		bits |= U_LONGENTITY;
+
+	if (bits >= 256)
+		bits |= U_MOREBITS;
+
+	MSG_WriteByte (msg, bits | U_SIGNAL);
+	if (bits & U_MOREBITS)
+		MSG_WriteByte (msg, bits>>8);
+	if (bits & U_EXTEND1)
+		MSG_WriteByte (msg, bits>>16);
+	if (bits & U_EXTEND2)
+		MSG_WriteByte (msg, bits>>24);
+
+	if (bits & U_LONGENTITY)
+		MSG_WriteShort (msg, e->num);
+	else
+		MSG_WriteByte (msg, e->num);
+
+	if (bits & U_MODEL)
+		MSG_WriteByte (msg, s->modelindex);
+	if (bits & U_FRAME)
+		MSG_WriteByte (msg, s->frame);
+	if (bits & U_COLORMAP)
+		MSG_WriteByte (msg, s->colormap);
+	if (bits & U_SKIN)
+		MSG_WriteByte (msg, s->skin);
+	if (bits & U_EFFECTS)
+		MSG_WriteByte (msg, s->effects);
+	if (bits & U_ORIGIN1)
+		MSG_WriteCoord (msg, s->origin[0], cl.protocolflags);
+	if (bits & U_ANGLE1)
+		MSG_WriteAngle (msg, s->angles[0], cl.protocolflags);
+	if (bits & U_ORIGIN2)
+		MSG_WriteCoord (msg, s->origin[1], cl.protocolflags);
+	if (bits & U_ANGLE2)
+		MSG_WriteAngle (msg, s->angles[1], cl.protocolflags);
+	if (bits & U_ORIGIN3)
+		MSG_WriteCoord (msg, s->origin[2], cl.protocolflags);
+	if (bits & U_ANGLE3)
+		MSG_WriteAngle (msg, s->angles[2], cl.protocolflags);
+	if (bits & U_ALPHA)
+		MSG_WriteByte (msg, s->alpha);
+	if (bits & U_SCALE)
+		MSG_WriteByte (msg, s->scale);
+	if (bits & U_FRAME2)
+		MSG_WriteByte (msg, s->frame >> 8);
+	if (bits & U_MODEL2)
+		MSG_WriteByte (msg, s->modelindex >> 8);
+	if (bits & U_LERPFINISH)
+		MSG_WriteByte (msg, e->lerpfinish);
+}
+
+/*
+====================
+CL_RecordDeltaEntities
+
+Replaces the svc_deltaentities between start and end in the held message
+with fast updates for snap.  A message that gets too big for demo playback
+is split, the rest going out right after it.
+====================
+*/
+void CL_RecordDeltaEntities (int start, int end, const entsnapshot_t *snap)
+{
+	int		i, count;
+
+	if (!demo_held.pending)
+		return;
+
+	CL_AppendHeldMessage (demo_held.raw + demo_held.copied, start - demo_held.copied);
+	demo_held.copied = end;
+
+	for (i = 0, count = VEC_SIZE (snap->ents); i < count; i++)
+	{
+		// largest fast update is 40 bytes, see SV_WriteEntitiesToClient
+		if (demo_held.msg.cursize + 40 > MAX_MSGLEN)
+		{
+			CL_WriteDemoData (demo_held.msg.data, demo_held.msg.cursize, demo_held.viewangles);
+			SZ_Clear (&demo_held.msg);
+		}
+		CL_WriteDemoEntity (&demo_held.msg, &snap->ents[i]);
+	}
+}
+
 /*
 ===============
 CL_AddDemoRewindSound
@@ -500,7 +750,7 @@ int CL_GetMessage (void)
 	}
 
 	if (cls.demorecording)
-		CL_WriteDemoMessage ();
+		CL_HoldDemoMessage ();
 
 	if (cls.signon < 2)
 	{
@@ -533,6 +783,7 @@ void CL_Stop_f (void)
 	}
 
 // write a disconnect message to the demo file
+	CL_FlushDemoMessage ();
 	SZ_Clear (&net_message);
 	MSG_WriteByte (&net_message, svc_disconnect);
 	CL_WriteDemoMessage ();
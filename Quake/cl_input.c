@@ -430,6 +430,15 @@ void CL_SendMove (const usercmd_t *cmd)
 
 		MSG_WriteByte (&buf, in_impulse);
 		in_impulse = 0;
+
+	//
+	// acknowledge the last delta entity snapshot
+	//
+		if (cl.snapsequence)
+		{
+			MSG_WriteByte (&buf, clc_ackentities);
+			MSG_WriteLong (&buf, cl.snapack);
+		}
 	}
 
 //
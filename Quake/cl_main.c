@@ -77,6 +77,8 @@ void CL_FreeState(void)
 	int i;
 	for (i = 0; i < MAX_CL_STATS; i++)
 		free (cl.statss[i]);
+	for (i = 0; i < SNAPSHOT_BACKUP; i++)
+		VEC_FREE (cl.snapshots[i].ents);
 	PR_ClearProgs (&cl.qcvm);
 	memset (&cl, 0, sizeof(cl));
 }
@@ -228,6 +230,12 @@ void CL_SignonReply (void)
 		MSG_WriteByte (&cls.message, clc_stringcmd);
 		MSG_WriteString (&cls.message, va("color %i %i\n", ((int)cl_color.value)>>4, ((int)cl_color.value)&15));
 
+		if (cl.protocol != PROTOCOL_NETQUAKE)
+		{
+			MSG_WriteByte (&cls.message, clc_stringcmd);
+			MSG_WriteString (&cls.message, "deltaents\n");
+		}
+
 		MSG_WriteByte (&cls.message, clc_stringcmd);
 		sprintf (str, "spawn %s", cls.spawnparms);
 		MSG_WriteString (&cls.message, str);
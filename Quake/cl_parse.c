@@ -95,7 +95,8 @@ const char *svc_strings[] =
 	"svc_chat", // 53
 	"svc_levelcompleted", // 54
 	"svc_backtolobby", // 55
-	"svc_localsound" // 56
+	"svc_localsound", // 56
+	"svc_deltaentities", // 57
 };
 #define NUM_SVC_STRINGS Q_COUNTOF(svc_strings)
 
@@ -442,14 +443,87 @@ void CL_ParseServerInfo (void)
 
 /*
 ==================
-CL_ParseUpdate
+CL_ReadEntityFields
 
-Parse an entity update message from the server
+Reads the fields selected by bits over what's already in e
+==================
+*/
+static void CL_ReadEntityFields (int bits, snapentity_t *e)
+{
+	if (bits & U_MODEL)
+		e->state.modelindex = MSG_ReadByte ();
+	if (bits & U_FRAME)
+		e->state.frame = MSG_ReadByte ();
+	if (bits & U_COLORMAP)
+		e->state.colormap = MSG_ReadByte();
+	if (bits & U_SKIN)
+		e->state.skin = MSG_ReadByte();
+	if (bits & U_EFFECTS)
+		e->state.effects = MSG_ReadByte();
+
+	if (bits & U_ORIGIN1)
+		e->state.origin[0] = MSG_ReadCoord (cl.protocolflags);
+	if (bits & U_ANGLE1)
+		e->state.angles[0] = MSG_ReadAngle(cl.protocolflags);
+	if (bits & U_ORIGIN2)
+		e->state.origin[1] = MSG_ReadCoord (cl.protocolflags);
+	if (bits & U_ANGLE2)
+		e->state.angles[1] = MSG_ReadAngle(cl.protocolflags);
+	if (bits & U_ORIGIN3)
+		e->state.origin[2] = MSG_ReadCoord (cl.protocolflags);
+	if (bits & U_ANGLE3)
+		e->state.angles[2] = MSG_ReadAngle(cl.protocolflags);
+
+	//johnfitz -- PROTOCOL_FITZQUAKE and PROTOCOL_NEHAHRA
+	if (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ)
+	{
+		if (bits & U_ALPHA)
+			e->state.alpha = MSG_ReadByte();
+		if (bits & U_SCALE)
+			e->state.scale = MSG_ReadByte();
+		if (bits & U_FRAME2)
+			e->state.frame = (e->state.frame & 0x00FF) | (MSG_ReadByte() << 8);
+		if (bits & U_MODEL2)
+			e->state.modelindex = (e->state.modelindex & 0x00FF) | (MSG_ReadByte() << 8);
+		if (bits & U_LERPFINISH)
+			e->lerpfinish = MSG_ReadByte();
+	}
+	else if (cl.protocol == PROTOCOL_NETQUAKE)
+	{
+		//HACK: if this bit is set, assume this is PROTOCOL_NEHAHRA
+		if (bits & U_TRANS)
+		{
+			float a, b;
+
+			if (warn_about_nehahra_protocol)
+			{
+				Con_Warning ("nonstandard update bit, assuming Nehahra protocol\n");
+				warn_about_nehahra_protocol = false;
+			}
+
+			a = MSG_ReadFloat();
+			b = MSG_ReadFloat(); //alpha
+			if (a == 2)
+				MSG_ReadFloat(); //fullbright (not using this yet)
+			e->state.alpha = ENTALPHA_ENCODE(b);
+		}
+	}
+	//johnfitz
+
+	if (bits & U_SNAPFLAGS)
+		e->flags = MSG_ReadByte ();
+}
+
+/*
+==================
+CL_UpdateEntity
+
+Sets an entity to the state it was just sent in
 If an entities model or origin changes from frame to frame, it must be
 relinked.  Other attributes can change without relinking.
 ==================
 */
-void CL_ParseUpdate (int bits)
+static void CL_UpdateEntity (const snapentity_t *e)
 {
 	int		i;
 	qmodel_t	*model;
@@ -459,33 +533,7 @@ void CL_ParseUpdate (int bits)
 	int		num;
 	int		skin;
 
-	if (cls.signon == SIGNONS - 1)
-	{	// first update is the final signon stage
-		cls.signon = SIGNONS;
-		CL_SignonReply ();
-	}
-
-	if (bits & U_MOREBITS)
-	{
-		i = MSG_ReadByte ();
-		bits |= (i<<8);
-	}
-
-	//johnfitz -- PROTOCOL_FITZQUAKE
-	if (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ)
-	{
-		if (bits & U_EXTEND1)
-			bits |= MSG_ReadByte() << 16;
-		if (bits & U_EXTEND2)
-			bits |= MSG_ReadByte() << 24;
-	}
-	//johnfitz
-
-	if (bits & U_LONGENTITY)
-		num = MSG_ReadShort ();
-	else
-		num = MSG_ReadByte ();
-
+	num = e->num;
 	ent = CL_EntityNum (num);
 
 	if (ent->msgtime != cl.mtime[1])
@@ -500,24 +548,13 @@ void CL_ParseUpdate (int bits)
 
 	ent->msgtime = cl.mtime[0];
 
-	if (bits & U_MODEL)
-	{
-		modnum = MSG_ReadByte ();
-		if (modnum >= MAX_MODELS)
-			Host_Error ("CL_ParseModel: bad modnum");
-	}
-	else
-		modnum = ent->baseline.modelindex;
+	modnum = e->state.modelindex;
+	if (modnum >= MAX_MODELS)
+		Host_Error ("CL_ParseModel: bad modnum");
 
-	if (bits & U_FRAME)
-		ent->frame = MSG_ReadByte ();
-	else
-		ent->frame = ent->baseline.frame;
+	ent->frame = e->state.frame;
 
-	if (bits & U_COLORMAP)
-		i = MSG_ReadByte();
-	else
-		i = ent->baseline.colormap;
+	i = e->state.colormap;
 	if (!i)
 		ent->colormap = vid.colormap;
 	else
@@ -526,54 +563,23 @@ void CL_ParseUpdate (int bits)
 			Sys_Error ("i >= cl.maxclients");
 		ent->colormap = cl.scores[i-1].translations;
 	}
-	if (bits & U_SKIN)
-		skin = MSG_ReadByte();
-	else
-		skin = ent->baseline.skin;
+	skin = e->state.skin;
 	if (skin != ent->skinnum)
 	{
 		ent->skinnum = skin;
 		if (num > 0 && num <= cl.maxclients)
 			R_TranslateNewPlayerSkin (num - 1); //johnfitz -- was R_TranslatePlayerSkin
 	}
-	if (bits & U_EFFECTS)
-		ent->effects = MSG_ReadByte();
-	else
-		ent->effects = ent->baseline.effects;
+	ent->effects = e->state.effects;
 
 // shift the known values for interpolation
 	VectorCopy (ent->msg_origins[0], ent->msg_origins[1]);
 	VectorCopy (ent->msg_angles[0], ent->msg_angles[1]);
-
-	if (bits & U_ORIGIN1)
-		ent->msg_origins[0][0] = MSG_ReadCoord (cl.protocolflags);
-	else
-		ent->msg_origins[0][0] = ent->baseline.origin[0];
-	if (bits & U_ANGLE1)
-		ent->msg_angles[0][0] = MSG_ReadAngle(cl.protocolflags);
-	else
-		ent->msg_angles[0][0] = ent->baseline.angles[0];
-
-	if (bits & U_ORIGIN2)
-		ent->msg_origins[0][1] = MSG_ReadCoord (cl.protocolflags);
-	else
-		ent->msg_origins[0][1] = ent->baseline.origin[1];
-	if (bits & U_ANGLE2)
-		ent->msg_angles[0][1] = MSG_ReadAngle(cl.protocolflags);
-	else
-		ent->msg_angles[0][1] = ent->baseline.angles[1];
-
-	if (bits & U_ORIGIN3)
-		ent->msg_origins[0][2] = MSG_ReadCoord (cl.protocolflags);
-	else
-		ent->msg_origins[0][2] = ent->baseline.origin[2];
-	if (bits & U_ANGLE3)
-		ent->msg_angles[0][2] = MSG_ReadAngle(cl.protocolflags);
-	else
-		ent->msg_angles[0][2] = ent->baseline.angles[2];
+	VectorCopy (e->state.origin, ent->msg_origins[0]);
+	VectorCopy (e->state.angles, ent->msg_angles[0]);
 
 	//johnfitz -- lerping for movetype_step entities
-	if (bits & U_STEP)
+	if (e->flags & SNAP_STEP)
 	{
 		ent->lerpflags |= LERP_MOVESTEP;
 		ent->forcelink = true;
@@ -582,53 +588,15 @@ void CL_ParseUpdate (int bits)
 		ent->lerpflags &= ~LERP_MOVESTEP;
 	//johnfitz
 
-	//johnfitz -- PROTOCOL_FITZQUAKE and PROTOCOL_NEHAHRA
-	if (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ)
+	ent->alpha = e->state.alpha;
+	ent->scale = e->state.scale;
+	if (e->flags & SNAP_LERPFINISH)
 	{
-		if (bits & U_ALPHA)
-			ent->alpha = MSG_ReadByte();
-		else
-			ent->alpha = ent->baseline.alpha;
-		if (bits & U_SCALE)
-			ent->scale = MSG_ReadByte();
-		else
-			ent->scale = ent->baseline.scale;
-		if (bits & U_FRAME2)
-			ent->frame = (ent->frame & 0x00FF) | (MSG_ReadByte() << 8);
-		if (bits & U_MODEL2)
-			modnum = (modnum & 0x00FF) | (MSG_ReadByte() << 8);
-		if (bits & U_LERPFINISH)
-		{
-			ent->lerpfinish = ent->msgtime + ((float)(MSG_ReadByte()) / 255);
-			ent->lerpflags |= LERP_FINISH;
-		}
-		else
-			ent->lerpflags &= ~LERP_FINISH;
+		ent->lerpfinish = ent->msgtime + ((float)(e->lerpfinish) / 255);
+		ent->lerpflags |= LERP_FINISH;
 	}
-	else if (cl.protocol == PROTOCOL_NETQUAKE)
-	{
-		//HACK: if this bit is set, assume this is PROTOCOL_NEHAHRA
-		if (bits & U_TRANS)
-		{
-			float a, b;
-
-			if (warn_about_nehahra_protocol)
-			{
-				Con_Warning ("nonstandard update bit, assuming Nehahra protocol\n");
-				warn_about_nehahra_protocol = false;
-			}
-
-			a = MSG_ReadFloat();
-			b = MSG_ReadFloat(); //alpha
-			if (a == 2)
-				MSG_ReadFloat(); //fullbright (not using this yet)
-			ent->alpha = ENTALPHA_ENCODE(b);
-		}
-		else
-			ent->alpha = ent->baseline.alpha;
-		ent->scale = ent->baseline.scale;
-	}
-	//johnfitz
+	else
+		ent->lerpflags &= ~LERP_FINISH;
 
 	//johnfitz -- moved here from above
 	model = cl.model_precache[modnum];
@@ -663,6 +631,244 @@ void CL_ParseUpdate (int bits)
 	}
 }
 
+/*
+==================
+CL_ParseUpdate
+
+Parse an entity update message from the server
+==================
+*/
+void CL_ParseUpdate (int bits)
+{
+	int		i;
+	snapentity_t	e;
+
+	if (cls.signon == SIGNONS - 1)
+	{	// first update is the final signon stage
+		cls.signon = SIGNONS;
+		CL_SignonReply ();
+	}
+
+	if (bits & U_MOREBITS)
+	{
+		i = MSG_ReadByte ();
+		bits |= (i<<8);
+	}
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ)
+	{
+		if (bits & U_EXTEND1)
+			bits |= MSG_ReadByte() << 16;
+		if (bits & U_EXTEND2)
+			bits |= MSG_ReadByte() << 24;
+	}
+	//johnfitz
+
+	if (bits & U_LONGENTITY)
+		e.num = MSG_ReadShort ();
+	else
+		e.num = MSG_ReadByte ();
+
+	// fields that aren't sent are at their baseline values
+	e.state = CL_EntityNum (e.num)->baseline;
+	e.lerpfinish = 0;
+	CL_ReadEntityFields (bits & ~U_SNAPFLAGS, &e);
+
+	e.flags = 0;
+	if (bits & U_STEP)
+		e.flags |= SNAP_STEP;
+	if ((bits & U_LERPFINISH) && (cl.protocol == PROTOCOL_FITZQUAKE || cl.protocol == PROTOCOL_RMQ))
+		e.flags |= SNAP_LERPFINISH;
+
+	CL_UpdateEntity (&e);
+}
+
+static int	cl_snapindex[MAX_EDICTS];	// index+1 in the snapshot being parsed
+
+/*
+==================
+CL_FindSnapEntity
+
+Checked against the snapshot, in case a Host_Error left stale indices
+==================
+*/
+static snapentity_t *CL_FindSnapEntity (entsnapshot_t *snap, int num)
+{
+	int i;
+
+	if (num >= MAX_EDICTS)
+		return NULL;
+	i = cl_snapindex[num] - 1;
+	if (i < 0 || i >= (int) VEC_SIZE (snap->ents) || snap->ents[i].num != num)
+		return NULL;
+	return &snap->ents[i];
+}
+
+/*
+==================
+CL_ReadDeltaBits
+==================
+*/
+static int CL_ReadDeltaBits (void)
+{
+	int bits;
+
+	bits = MSG_ReadByte ();
+	if (bits & U_MOREBITS)
+		bits |= MSG_ReadByte () << 8;
+	if (bits & U_EXTEND1)
+		bits |= MSG_ReadByte () << 16;
+	if (bits & U_EXTEND2)
+		bits |= MSG_ReadByte () << 24;
+	return bits;
+}
+
+/*
+==================
+CL_SkipDeltaEntities
+
+Reads past the entities of a message we can't use
+==================
+*/
+static void CL_SkipDeltaEntities (void)
+{
+	snapentity_t	skipped;
+	int				num;
+
+	while (1)
+	{
+		num = MSG_ReadShort () & 0xFFFF;
+		if (!num || msg_badread)
+			break;
+		if (num & SNAP_REMOVE)
+			continue;
+		CL_ReadEntityFields (CL_ReadDeltaBits (), &skipped);
+	}
+}
+
+/*
+==================
+CL_ParseDeltaEntities
+
+Rebuilds a snapshot from the one it was delta compressed against, then
+updates every entity in it, same as if they had all been sent as fast
+updates.  Entities that aren't in it disappear, as usual.
+==================
+*/
+static void CL_ParseDeltaEntities (void)
+{
+	static entsnapshot_t	nosnapshot;
+	entsnapshot_t	*from, *to;
+	snapentity_t	added, *e;
+	int				start, seq, delta, num, bits, i, count;
+
+	start = msg_readcount - 1;	// svc_deltaentities itself
+
+	if (cls.signon == SIGNONS - 1)
+	{	// first update is the final signon stage
+		cls.signon = SIGNONS;
+		CL_SignonReply ();
+	}
+
+	seq = MSG_ReadLong ();
+	delta = MSG_ReadByte ();
+
+	from = NULL;
+	if (delta && delta < SNAPSHOT_BACKUP)
+	{
+		from = &cl.snapshots[(seq - delta) & SNAPSHOT_MASK];
+		if (from->sequence != seq - delta)
+			from = NULL;
+	}
+
+	// the snapshot it's against is gone (or was never recorded in a demo),
+	// so treat it as a dropped message: entities stay as they were in the
+	// last one we got right, and the server starts over from the baselines
+	if (delta && !from)
+	{
+		CL_SkipDeltaEntities ();
+		cl.snapack = 0;
+
+		to = &cl.snapshots[cl.snapsequence & SNAPSHOT_MASK];
+		if (!cl.snapsequence || to->sequence != cl.snapsequence)
+			to = &nosnapshot;
+		for (i = 0, count = VEC_SIZE (to->ents); i < count; i++)
+			CL_UpdateEntity (&to->ents[i]);
+
+		if (cls.demorecording)
+			CL_RecordDeltaEntities (start, msg_readcount, to);
+		return;
+	}
+
+	to = &cl.snapshots[seq & SNAPSHOT_MASK];
+	if (from != to)
+	{
+		VEC_CLEAR (to->ents);
+		if (from && VEC_SIZE (from->ents))
+			Vec_Append ((void **)&to->ents, sizeof (snapentity_t), from->ents, VEC_SIZE (from->ents));
+	}
+	to->sequence = 0;
+	for (i = 0, count = VEC_SIZE (to->ents); i < count; i++)
+		cl_snapindex[to->ents[i].num] = i + 1;
+
+	while (1)
+	{
+		num = MSG_ReadShort () & 0xFFFF;
+		if (!num || msg_badread)
+			break;
+
+		if (num & SNAP_REMOVE)
+		{
+			num &= ~SNAP_REMOVE;
+			if ((e = CL_FindSnapEntity (to, num)) != NULL)
+			{
+				e->num = 0;
+				cl_snapindex[num] = 0;
+			}
+			continue;
+		}
+
+		bits = CL_ReadDeltaBits ();
+
+		if ((e = CL_FindSnapEntity (to, num)) == NULL)
+		{
+			// new to us, so it's against the baseline
+			memset (&added, 0, sizeof (added));
+			added.num = num;
+			added.state = CL_EntityNum (num)->baseline;
+			VEC_PUSH (to->ents, added);
+			count = VEC_SIZE (to->ents);
+			cl_snapindex[num] = count;
+			e = &to->ents[count - 1];
+		}
+
+		CL_ReadEntityFields (bits, e);
+	}
+
+// drop the removals and reset the index
+	for (i = 0, count = 0; i < (int) VEC_SIZE (to->ents); i++)
+	{
+		e = &to->ents[i];
+		if (!e->num)
+			continue;
+		cl_snapindex[e->num] = 0;
+		to->ents[count++] = *e;
+	}
+	VEC_POP_N (to->ents, VEC_SIZE (to->ents) - count);
+
+	to->sequence = seq;
+	cl.snapsequence = seq;
+	cl.snapack = seq;
+
+	for (i = 0; i < count; i++)
+		CL_UpdateEntity (&to->ents[i]);
+
+	// demos get plain fast updates
+	if (cls.demorecording)
+		CL_RecordDeltaEntities (start, msg_readcount, to);
+}
+
 /*
 ==================
 CL_ParseBaseline
@@ -1097,6 +1303,7 @@ void CL_ParseServerMessage (void)
 				CL_ParseStuffText("\n");	//there's a few mods that forget to write \ns, that then fuck up other things too. So make sure it gets flushed to the cbuf. the cursize check is to reduce backbuffer overflows that would give a false positive.
 
 			CL_FinishDemoFrame ();
+			CL_FinishDemoMessage ();
 			return;		// end of message
 		}
 
@@ -1372,6 +1579,10 @@ void CL_ParseServerMessage (void)
 		case svc_localsound:
 			CL_ParseLocalSound();
 			break;
+
+		case svc_deltaentities:
+			CL_ParseDeltaEntities ();
+			break;
 		}
 
 		lastcmd = cmd; //johnfitz
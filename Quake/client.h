@@ -247,6 +247,11 @@ typedef struct
 	unsigned	protocol; //johnfitz
 	unsigned	protocolflags;
 
+// svc_deltaentities
+	int			snapsequence;		// last snapshot parsed
+	int			snapack;			// sent with every move, 0 = resend against the baselines
+	entsnapshot_t	snapshots[SNAPSHOT_BACKUP];
+
 	qboolean	sendprespawn;
 
 	char		stuffcmdbuf[1024];	//comment-extensions are a thing with certain servers, make sure we can handle them properly without further hacks/breakages. there's also some server->client only console commands that we might as well try to handle a bit better, like reconnect
@@ -373,6 +378,8 @@ int CL_GetMessage (void);
 void CL_ClearSignons (void);
 void CL_AdvanceTime (void);
 void CL_FinishDemoFrame (void);
+void CL_FinishDemoMessage (void);
+void CL_RecordDeltaEntities (int start, int end, const entsnapshot_t *snap);
 void CL_AddDemoRewindSound (int entnum, int channel, sfx_t *sfx, vec3_t pos, int vol, float atten);
 
 void CL_Stop_f (void);
@@ -1793,6 +1793,38 @@ static void Mod_FindUsedTextures (qmodel_t *mod)
 	//Con_Printf("%s: %d/%d textures\n", mod->name, count, mod->numtextures);
 }
 
+/*
+=================
+Mod_FlattenClipnodes
+
+Builds the layout the hull walks in world.c use, with each node's plane
+copied in next to its children
+=================
+*/
+static mhullnode_t *Mod_FlattenClipnodes (const mclipnode_t *in, int count)
+{
+	mhullnode_t	*out, *nodes;
+	mplane_t	*plane;
+	byte		*mem;
+	int			i;
+
+	mem = (byte *) Hunk_AllocName (count*sizeof(*out) + 63, loadname);
+	nodes = out = (mhullnode_t *) (((uintptr_t) mem + 63) & ~(uintptr_t) 63);
+
+	for (i=0 ; i<count ; i++, in++, out++)
+	{
+		plane = loadmodel->planes + in->planenum;
+		VectorCopy (plane->normal, out->normal);
+		out->dist = plane->dist;
+		out->type = plane->type;
+		out->children[0] = in->children[0];
+		out->children[1] = in->children[1];
+		out->planenum = in->planenum;
+	}
+
+	return nodes;
+}
+
 /*
 =================
 Mod_LoadClipnodes
@@ -1897,6 +1929,8 @@ static void Mod_LoadClipnodes (lump_t *l, qboolean bsp2)
 			//johnfitz
 		}
 	}
+
+	loadmodel->hulls[1].nodes = loadmodel->hulls[2].nodes = Mod_FlattenClipnodes (loadmodel->clipnodes, count);
 }
 
 /*
@@ -1936,6 +1970,8 @@ static void Mod_MakeHull0 (void)
 				out->children[j] = child - loadmodel->nodes;
 		}
 	}
+
+	hull->nodes = Mod_FlattenClipnodes (hull->clipnodes, count);
 }
 
 /*
@@ -213,11 +213,25 @@ typedef struct mclipnode_s
 } mclipnode_t;
 //johnfitz
 
+// clipnode with its plane copied in, so that walking a hull only touches one
+// array; two nodes to a cache line
+typedef struct mhullnode_s
+{
+	float		normal[3];
+	float		dist;
+	int			type;		// plane type, < 3 is axial and only uses normal for trace planes
+	int			children[2]; // negative numbers are contents
+	int			planenum;
+} mhullnode_t;
+
+COMPILE_TIME_ASSERT (mhullnode_size, sizeof (mhullnode_t) == 32);
+
 // !!! if this is changed, it must be changed in asm_i386.h too !!!
 typedef struct
 {
 	mclipnode_t	*clipnodes; //johnfitz -- was dclipnode_t
 	mplane_t	*planes;
+	mhullnode_t	*nodes;		// clipnodes and planes flattened, 64-byte aligned
 	int			firstclipnode;
 	int			lastclipnode;
 	vec3_t		clip_mins;
@@ -216,7 +216,13 @@ void	Host_FindMaxClients (void)
 	svs.maxclients = 1;
 
 	i = COM_CheckParm ("-dedicated");
-	if (i)
+	if (!i && COM_CheckParm ("-replay"))
+	{
+		// replays bring their own client count
+		cls.state = ca_dedicated;
+		svs.maxclients = MAX_SCOREBOARD;
+	}
+	else if (i)
 	{
 		cls.state = ca_dedicated;
 		if (i != (com_argc - 1))
@@ -502,6 +508,8 @@ void SV_DropClient (qboolean crash)
 		Sys_Printf ("Client %s removed\n",host_client->name);
 	}
 
+	SV_RecordDrop (crash);
+
 // break the net connection
 	NET_Close (host_client->netconnection);
 	host_client->netconnection = NULL;
@@ -538,12 +546,15 @@ This only happens at the end of a game, not between levels
 */
 void Host_ShutdownServer(qboolean crash)
 {
-	int		i;
+	int		i, j;
 	int		count;
 	sizebuf_t	buf;
 	byte		message[4];
 	double	start;
 
+	SV_StopRecording ();
+	SV_StopReplay ();
+
 	if (!sv.active)
 		return;
 
@@ -595,10 +606,17 @@ void Host_ShutdownServer(qboolean crash)
 
 	PR_SwitchQCVM(NULL);
 
+	SV_ShutdownTraceWorkers ();
+	SV_FreeNetScratch ();
+
 //
 // clear structures
 //
 //	memset (&sv, 0, sizeof(sv)); // ServerSpawn already do this by Host_ClearMemory
+	// the delta snapshots are heap VECs, clearing the clients would leak them
+	for (i = 0, host_client = svs.clients; i < svs.maxclientslimit; i++, host_client++)
+		for (j = 0; j < SNAPSHOT_BACKUP; j++)
+			VEC_FREE (host_client->snapshots[j].ents);
 	memset (svs.clients, 0, svs.maxclientslimit*sizeof(client_t));
 }
 
@@ -918,6 +936,11 @@ void Host_ServerFrame (void)
 {
 	int		i, active; //johnfitz
 	edict_t	*ent; //johnfitz
+	double	start;
+
+	start = Sys_DoubleTime ();
+
+	SV_RecordFrame ();
 
 // run the world state
 	pr_global_struct->frametime = host_frametime;
@@ -933,7 +956,7 @@ void Host_ServerFrame (void)
 
 // move things around and think
 // always pause in single player if in console or menus
-	if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game) )
+	if (SV_PhysicsActive ())
 		SV_Physics ();
 
 //johnfitz -- devstats
@@ -952,9 +975,19 @@ void Host_ServerFrame (void)
 	}
 //johnfitz
 
+// a replay has nobody to send to
+	if (svs.replaying)
+	{
+		SV_ReplayEndFrame ();
+		return;
+	}
+
 // send all messages to the clients
 	SV_SendClientMessages ();
 
+// the bots read what was sent to them and make their moves for the next frame
+	SV_RunBots (Sys_DoubleTime () - start);
+
 	Host_CheckAutosave ();
 }
 
@@ -1273,11 +1306,26 @@ void _Host_Frame (double time)
 			pass[2] /= numframes;
 
 			Host_PrintTimes (pass, names, countof (pass), host_speeds.value < 0.f);
+			if (sv.active && numserverframes)
+				Con_Printf ("%5.1f touch checks | %5.1f reused | %5.1f triggers tested | %5.1f touches\n",
+					(double) sv_touchstats.checks / numserverframes, (double) sv_touchstats.reused / numserverframes,
+					(double) sv_touchstats.tested / numserverframes, (double) sv_touchstats.calls / numserverframes);
+			if (sv.active && numserverframes && sv_netstats.clients)
+				Con_Printf ("%5.2f ms entity updates | %4.1f clients | %4.1f pvs cached | %4.1f lists shared\n",
+					sv_netstats.time * 1000.0 / numserverframes, (double) sv_netstats.clients / numserverframes,
+					(double) sv_netstats.pvshits / numserverframes, (double) sv_netstats.shared / numserverframes);
 
 			pass[0] = pass[1] = pass[2] = elapsed = 0.0;
 			numframes = numserverframes = 0;
+			memset (&sv_touchstats, 0, sizeof (sv_touchstats));
+			memset (&sv_netstats, 0, sizeof (sv_netstats));
 		}
 	}
+	else
+	{
+		memset (&sv_touchstats, 0, sizeof (sv_touchstats));
+		memset (&sv_netstats, 0, sizeof (sv_netstats));
+	}
 
 	host_framecount++;
 }
@@ -1325,6 +1373,8 @@ Host_Init
 */
 void Host_Init (void)
 {
+	int		i;
+
 	if (standard_quake)
 		minimum_memory = MINIMUM_MEMORY;
 	else	minimum_memory = MINIMUM_MEMORY_LEVELPAK;
@@ -1406,7 +1456,10 @@ void Host_Init (void)
 		Cbuf_AddText ("exec autoexec.cfg\n");
 		Cbuf_AddText ("stuffcmds");
 		Cbuf_Execute ();
-		if (!sv.active)
+		i = COM_CheckParm ("-replay");
+		if (i && i < com_argc - 1)
+			Cbuf_AddText (va ("sv_replay \"%s\"\nquit\n", com_argv[i+1]));
+		else if (!sv.active)
 			Cbuf_AddText ("map start\n");
 	}
 }
@@ -1442,6 +1495,8 @@ void Host_Shutdown(void)
 // stop downloads before shutting down networking
 	Modlist_ShutDown ();
 
+	SV_ShutdownTraceWorkers ();
+	SV_FreeNetScratch ();
 	NET_Shutdown ();
 
 	if (cls.state != ca_dedicated)
@@ -2608,6 +2608,12 @@ static void Host_Loadgame_f (void)
 	sv.paused = true;		// pause until all clients connect
 	sv.loadgame = true;
 
+	if (svs.recordfile)
+	{
+		Con_Printf ("Saved games can't be replayed, ");
+		SV_StopRecording ();
+	}
+
 // load the light styles
 	for (i = 0; i < MAX_LIGHTSTYLES; i++)
 	{
@@ -2720,6 +2726,7 @@ static void Host_Name_f (void)
 	}
 	Q_strcpy (host_client->name, newName);
 	host_client->edict->v.netname = PR_SetEngineString(host_client->name);
+	SV_EdictChanged (host_client->edict);
 
 // send notification to all clients
 	MSG_WriteByte (&sv.reliable_datagram, svc_updatename);
@@ -3056,6 +3063,7 @@ static void Host_Spawn_f (void)
 		ent->v.colormap = NUM_FOR_EDICT(ent);
 		ent->v.team = (host_client->colors & 15) + 1;
 		ent->v.netname = PR_SetEngineString(host_client->name);
+		SV_EdictChanged (ent);
 
 		// copy spawn parms out of the client_t
 		for (i=0 ; i< NUM_SPAWN_PARMS ; i++)
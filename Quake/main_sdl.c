@@ -139,7 +139,7 @@ int main(int argc, char *argv[])
 
 	COM_InitArgv(parms.argc, parms.argv);
 
-	isDedicated = (COM_CheckParm("-dedicated") != 0);
+	isDedicated = (COM_CheckParm("-dedicated") != 0 || COM_CheckParm("-replay") != 0);
 
 	Sys_InitSDL ();
 
@@ -55,6 +55,14 @@ struct qsocket_s	*NET_CheckNewConnections (void);
 struct qsocket_s	*NET_Connect (const char *host);
 // called by client to connect to a host.  Returns -1 if not able to
 
+struct qsocket_s	*NET_ConnectBot (const char *name);
+// called by the server to connect one of its own bots over the loopback
+// driver.  Returns the client end, or NULL if there's no room.  The server
+// picks up the other end in NET_CheckNewConnections.
+
+void	NET_CloseBot (struct qsocket_s *sock);
+// frees the client end of a bot connection
+
 double NET_QSocketGetTime (const struct qsocket_s *sock);
 const char *NET_QSocketGetAddressString (const struct qsocket_s *sock);
 
@@ -110,6 +118,7 @@ extern	qboolean	ipxAvailable;
 extern	qboolean	tcpipAvailable;
 extern	char		my_ipx_address[NET_NAMELEN];
 extern	char		my_tcpip_address[NET_NAMELEN];
+extern	int		loop_droppedDatagrams;	/* unreliable loopback messages that didn't fit */
 
 #endif	/* _QUAKE_NET_H */
 
@@ -53,6 +53,11 @@ struct qsockaddr
 
 #define NET_PROTOCOL_VERSION	3
 
+// optional reliable window negotiated during the connection handshake
+#define NET_WINDOW_EXTENSION	0x57			// 'W', trailer tag on CCREQ_CONNECT/CCREP_ACCEPT
+#define NET_WINDOW_MAX		32			// max reliable fragments in flight
+#define NET_WINDOW_FRAGMENT	DATAGRAM_MTU		// reliable fragment payload when windowed
+
 /**
 
 This is the network info/connection protocol.  It is used to find Quake
@@ -67,6 +72,8 @@ General notes:
 CCREQ_CONNECT
 		string	game_name		"QUAKE"
 		byte	net_protocol_version	NET_PROTOCOL_VERSION
+		[byte	extension		NET_WINDOW_EXTENSION]
+		[byte	window_size]
 
 CCREQ_SERVER_INFO
 		string	game_name		"QUAKE"
@@ -80,6 +87,8 @@ CCREQ_RULE_INFO
 
 CCREP_ACCEPT
 		long	port
+		[byte	extension		NET_WINDOW_EXTENSION]
+		[byte	window_size]
 
 CCREP_REJECT
 		string	reason
@@ -114,6 +123,12 @@ CCREP_RULE_INFO
 		a full address and port in a string.  It is used for returning the
 		address of a server that is not running locally.
 
+		The bracketed window fields are optional.  A client that can keep
+		several reliable fragments in flight appends them to its connect
+		request; a server that can too answers with the window size both
+		sides will use.  Vanilla peers ignore the trailing bytes, and
+		without them both ends fall back to one fragment at a time.
+
 **/
 
 #define CCREQ_CONNECT		0x01
@@ -142,6 +157,7 @@ typedef struct qsocket_s
 	int		landriver;
 	sys_socket_t	socket;
 	void		*driverdata;
+	struct netwindow_s	*window;	// reliable window state, NULL for stop-and-wait
 
 	unsigned int	ackSequence;
 	unsigned int	sendSequence;
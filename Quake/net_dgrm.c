@@ -42,6 +42,10 @@ static int packetsReceived = 0;
 static int receivedDuplicateCount = 0;
 static int shortPacketCount = 0;
 static int droppedDatagrams;
+static int packetsOutOfOrder = 0;
+static int windowStalls = 0;
+
+static cvar_t net_window = {"net_window", "32", CVAR_NONE};
 
 static struct
 {
@@ -129,6 +133,340 @@ static void NET_Ban_f (void)
 #endif	// BAN_TEST
 
 
+/*
+===============================================================================
+
+RELIABLE WINDOW
+
+When both ends advertise NET_WINDOW_EXTENSION during the handshake,
+reliable messages are cut into NET_WINDOW_FRAGMENT sized pieces and up to
+window->size of them are kept in flight instead of one.  Every fragment
+still carries its own sequence number and is acknowledged on its own, so
+a lost packet only costs that fragment: it is sent again once its
+retransmit timer, derived from the measured round trip time, runs out.
+The receiver buffers fragments that arrive ahead of a gap and hands the
+messages up in order.
+
+Sequence numbers are assigned when a fragment is queued, so ackSequence
+is the oldest unacknowledged fragment and sendSequence the next one to be
+queued, the same as for stop-and-wait connections.
+
+===============================================================================
+*/
+
+#define WINDOW_QUEUE		128	// queued reliable fragments, power of two
+#define WINDOW_MSGFRAGMENTS	((NET_MAXMESSAGE + NET_WINDOW_FRAGMENT - 1) / NET_WINDOW_FRAGMENT)
+#define WINDOW_MINRTO		0.1
+#define WINDOW_MAXRTO		1.0
+
+typedef struct
+{
+	double		sendtime;	// last transmission
+	int			length;
+	qboolean	eom;
+	qboolean	acked;
+	qboolean	resent;		// don't take round trip samples from resent fragments
+	qboolean	present;	// received, waiting to be delivered
+	byte		data[NET_WINDOW_FRAGMENT];
+} windowfrag_t;
+
+typedef struct netwindow_s
+{
+	int				size;			// fragments allowed in flight
+	unsigned int	nextSequence;	// next queued fragment to go out for the first time
+
+	double			srtt;
+	double			rttvar;
+	double			rto;			// retransmit timeout
+	int				rttsamples;
+
+	windowfrag_t	send[WINDOW_QUEUE];
+	windowfrag_t	receive[NET_WINDOW_MAX];
+
+	// statistics
+	int				inFlight;		// sent but not acknowledged
+	int				peakInFlight;
+	double			inFlightSum;	// inFlight summed over new transmissions
+	int				transmissions;
+	int				stalls;			// updates held back by a full window
+	int				timeouts;
+	int				outOfOrder;
+} netwindow_t;
+
+static int Window_LocalSize (void)
+{
+	return CLAMP (0, (int)net_window.value, NET_WINDOW_MAX);
+}
+
+static void Window_WriteExtension (int size)
+{
+	MSG_WriteByte (&net_message, NET_WINDOW_EXTENSION);
+	MSG_WriteByte (&net_message, size);
+}
+
+/*
+=============
+Window_Open
+
+Switches a freshly connected socket to the windowed transport.  Sizes
+below two gain nothing over stop-and-wait, so those keep the classic path.
+=============
+*/
+static void Window_Open (qsocket_t *sock, int size)
+{
+	netwindow_t	*w;
+
+	if (size < 2)
+		return;
+
+	w = (netwindow_t *) calloc (1, sizeof (*w));
+	if (!w)
+		return;
+
+	w->size = q_min (size, NET_WINDOW_MAX);
+	w->nextSequence = sock->sendSequence;
+	w->rto = WINDOW_MAXRTO;
+	sock->window = w;
+}
+
+static int Window_SendFragment (qsocket_t *sock, unsigned int sequence)
+{
+	windowfrag_t	*frag = &sock->window->send[sequence & (WINDOW_QUEUE - 1)];
+	unsigned int	packetLen = NET_HEADERSIZE + frag->length;
+
+	packetBuffer.length = BigLong(packetLen | NETFLAG_DATA | (frag->eom ? NETFLAG_EOM : 0));
+	packetBuffer.sequence = BigLong(sequence);
+	Q_memcpy (packetBuffer.data, frag->data, frag->length);
+
+	frag->sendtime = net_time;
+
+	if (sfunc.Write (sock->socket, (byte *)&packetBuffer, packetLen, &sock->addr) == -1)
+		return -1;
+
+	sock->lastSendTime = net_time;
+	return 1;
+}
+
+/*
+=============
+Window_Update
+
+Resends fragments whose timer ran out, then fills the window with
+fragments that haven't been sent yet.
+=============
+*/
+static int Window_Update (qsocket_t *sock)
+{
+	netwindow_t		*w = sock->window;
+	windowfrag_t	*frag;
+	unsigned int	sequence;
+	qboolean		timedout = false;
+
+	sock->canSend = WINDOW_QUEUE - (sock->sendSequence - sock->ackSequence) >= WINDOW_MSGFRAGMENTS;
+
+	for (sequence = sock->ackSequence; sequence != w->nextSequence; sequence++)
+	{
+		frag = &w->send[sequence & (WINDOW_QUEUE - 1)];
+		if (frag->acked || net_time - frag->sendtime < w->rto)
+			continue;
+		frag->resent = true;
+		if (Window_SendFragment (sock, sequence) == -1)
+			return -1;
+		packetsReSent++;
+		w->timeouts++;
+		timedout = true;
+	}
+
+	// back off until the link answers again
+	if (timedout)
+		w->rto = q_min (w->rto * 2.0, WINDOW_MAXRTO);
+
+	while (w->nextSequence != sock->sendSequence)
+	{
+		if (w->nextSequence - sock->ackSequence >= (unsigned int) w->size)
+		{
+			w->stalls++;
+			windowStalls++;
+			break;
+		}
+		if (Window_SendFragment (sock, w->nextSequence) == -1)
+			return -1;
+		w->nextSequence++;
+		packetsSent++;
+
+		w->inFlight++;
+		w->peakInFlight = q_max (w->peakInFlight, w->inFlight);
+		w->inFlightSum += w->inFlight;
+		w->transmissions++;
+	}
+
+	return 1;
+}
+
+static int Window_SendMessage (qsocket_t *sock, sizebuf_t *data)
+{
+	netwindow_t		*w = sock->window;
+	windowfrag_t	*frag;
+	int				offset, length;
+
+#ifdef DEBUG
+	if (WINDOW_QUEUE - (sock->sendSequence - sock->ackSequence) < WINDOW_MSGFRAGMENTS)
+		Sys_Error("Window_SendMessage: reliable queue full");
+#endif
+
+	for (offset = 0; offset < data->cursize; offset += length)
+	{
+		length = q_min (data->cursize - offset, NET_WINDOW_FRAGMENT);
+		frag = &w->send[sock->sendSequence & (WINDOW_QUEUE - 1)];
+		Q_memcpy (frag->data, data->data + offset, length);
+		frag->length = length;
+		frag->eom = (offset + length == data->cursize);
+		frag->acked = false;
+		frag->resent = false;
+		sock->sendSequence++;
+	}
+
+	return Window_Update (sock);
+}
+
+static void Window_Ack (qsocket_t *sock, unsigned int sequence)
+{
+	netwindow_t		*w = sock->window;
+	windowfrag_t	*frag;
+	double			sample;
+
+	if (sequence - sock->ackSequence >= w->nextSequence - sock->ackSequence)
+	{
+		Con_DPrintf("Stale ACK received\n");
+		return;
+	}
+
+	frag = &w->send[sequence & (WINDOW_QUEUE - 1)];
+	if (frag->acked)
+	{
+		Con_DPrintf("Duplicate ACK received\n");
+		return;
+	}
+	frag->acked = true;
+	w->inFlight--;
+
+	if (!frag->resent)
+	{
+		sample = net_time - frag->sendtime;
+		if (w->rttsamples++ == 0)
+		{
+			w->srtt = sample;
+			w->rttvar = sample * 0.5;
+		}
+		else
+		{
+			w->rttvar += (fabs (w->srtt - sample) - w->rttvar) * 0.25;
+			w->srtt += (sample - w->srtt) * 0.125;
+		}
+		w->rto = CLAMP (WINDOW_MINRTO, w->srtt + 4.0 * w->rttvar, WINDOW_MAXRTO);
+	}
+
+	// slide past everything acknowledged so far
+	while (sock->ackSequence != w->nextSequence && w->send[sock->ackSequence & (WINDOW_QUEUE - 1)].acked)
+		sock->ackSequence++;
+}
+
+/*
+=============
+Window_Deliver
+
+Appends buffered in-order fragments to the message being assembled.
+Returns 1 with the message in net_message once an end of message is
+reached, 0 when waiting for more fragments and -1 on an oversized message.
+=============
+*/
+static int Window_Deliver (qsocket_t *sock)
+{
+	netwindow_t		*w = sock->window;
+	windowfrag_t	*frag;
+
+	while (1)
+	{
+		frag = &w->receive[sock->receiveSequence % NET_WINDOW_MAX];
+		if (!frag->present)
+			return 0;
+
+		frag->present = false;
+		sock->receiveSequence++;
+
+		if (sock->receiveMessageLength + frag->length > NET_MAXMESSAGE)
+		{
+			Con_Printf("Oversized reliable message\n");
+			sock->receiveMessageLength = 0;
+			return -1;
+		}
+		Q_memcpy (sock->receiveMessage + sock->receiveMessageLength, frag->data, frag->length);
+		sock->receiveMessageLength += frag->length;
+
+		if (frag->eom)
+		{
+			SZ_Clear (&net_message);
+			SZ_Write (&net_message, sock->receiveMessage, sock->receiveMessageLength);
+			sock->receiveMessageLength = 0;
+			return 1;
+		}
+	}
+}
+
+/*
+=============
+Window_Receive
+
+Buffers a reliable fragment and acknowledges it.  Fragments beyond the
+window can only come from a misbehaving peer and are dropped unanswered,
+so they'll be resent once there's room for them.
+=============
+*/
+static int Window_Receive (qsocket_t *sock, unsigned int sequence, unsigned int flags, unsigned int length)
+{
+	netwindow_t		*w = sock->window;
+	windowfrag_t	*frag;
+	unsigned int	offset = sequence - sock->receiveSequence;
+
+	if (length < NET_HEADERSIZE || length - NET_HEADERSIZE > NET_WINDOW_FRAGMENT)
+	{
+		shortPacketCount++;
+		return 0;
+	}
+	length -= NET_HEADERSIZE;
+
+	if ((int) offset >= 0)
+	{
+		if (offset >= (unsigned int) w->size)
+			return 0;
+
+		frag = &w->receive[sequence % NET_WINDOW_MAX];
+		if (frag->present)
+			receivedDuplicateCount++;
+		else
+		{
+			Q_memcpy (frag->data, packetBuffer.data, length);
+			frag->length = length;
+			frag->eom = (flags & NETFLAG_EOM) != 0;
+			frag->present = true;
+			if (offset)
+			{
+				w->outOfOrder++;
+				packetsOutOfOrder++;
+			}
+		}
+	}
+	else	// already delivered, the ACK must have been lost
+		receivedDuplicateCount++;
+
+	packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
+	packetBuffer.sequence = BigLong(sequence);
+	sfunc.Write (sock->socket, (byte *)&packetBuffer, NET_HEADERSIZE, &sock->addr);
+
+	return Window_Deliver (sock);
+}
+
+
 int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 {
 	unsigned int	packetLen;
@@ -146,6 +484,9 @@ int Datagram_SendMessage (qsocket_t *sock, sizebuf_t *data)
 		Sys_Error("SendMessage: called with canSend == false");
 #endif
 
+	if (sock->window)
+		return Window_SendMessage (sock, data);
+
 	Q_memcpy(sock->sendMessage, data->data, data->cursize);
 	sock->sendMessageLength = data->cursize;
 
@@ -244,7 +585,9 @@ static int ReSendMessage (qsocket_t *sock)
 
 qboolean Datagram_CanSendMessage (qsocket_t *sock)
 {
-	if (sock->sendNext)
+	if (sock->window)
+		Window_Update (sock);
+	else if (sock->sendNext)
 		SendMessageNext (sock);
 
 	return sock->canSend;
@@ -292,7 +635,14 @@ int	Datagram_GetMessage (qsocket_t *sock)
 	unsigned int	sequence;
 	unsigned int	count;
 
-	if (!sock->canSend)
+	if (sock->window)
+	{
+		// hand up messages completed by an earlier read first
+		ret = Window_Deliver (sock);
+		if (ret)
+			return ret;
+	}
+	else if (!sock->canSend)
 		if ((net_time - sock->lastSendTime) > 1.0)
 			ReSendMessage (sock);
 
@@ -364,6 +714,11 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 		if (flags & NETFLAG_ACK)
 		{
+			if (sock->window)
+			{
+				Window_Ack (sock, sequence);
+				continue;
+			}
 			if (sequence != (sock->sendSequence - 1))
 			{
 				Con_DPrintf("Stale ACK received\n");
@@ -396,6 +751,13 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 		if (flags & NETFLAG_DATA)
 		{
+			if (sock->window)
+			{
+				ret = Window_Receive (sock, sequence, flags, length);
+				if (ret)
+					break;
+				continue;
+			}
 			packetBuffer.length = BigLong(NET_HEADERSIZE | NETFLAG_ACK);
 			packetBuffer.sequence = BigLong(sequence);
 			sfunc.Write (sock->socket, (byte *)&packetBuffer, NET_HEADERSIZE, &readaddr);
@@ -426,7 +788,9 @@ int	Datagram_GetMessage (qsocket_t *sock)
 		}
 	}
 
-	if (sock->sendNext)
+	if (sock->window)
+		Window_Update (sock);
+	else if (sock->sendNext)
 		SendMessageNext (sock);
 
 	return ret;
@@ -435,9 +799,26 @@ int	Datagram_GetMessage (qsocket_t *sock)
 
 static void PrintStats(qsocket_t *s)
 {
+	netwindow_t	*w = s->window;
+
 	Con_Printf("canSend = %4u   \n", s->canSend);
 	Con_Printf("sendSeq = %4u   ", s->sendSequence);
 	Con_Printf("recvSeq = %4u   \n", s->receiveSequence);
+	if (w)
+	{
+		Con_Printf("window  = %4i   ", w->size);
+		Con_Printf("inFlight = %4i   ", w->inFlight);
+		Con_Printf("queued  = %4u\n", s->sendSequence - w->nextSequence);
+		Con_Printf("peak    = %4i   ", w->peakInFlight);
+		Con_Printf("avgUsed  = %3.0f%%   ", w->transmissions ? 100.0 * w->inFlightSum / w->transmissions / w->size : 0.0);
+		Con_Printf("stalls  = %4i\n", w->stalls);
+		Con_Printf("srtt    = %4.0fms ", w->srtt * 1000.0);
+		Con_Printf("rto      = %4.0fms ", w->rto * 1000.0);
+		Con_Printf("timeouts = %i\n", w->timeouts);
+		Con_Printf("outOfOrder = %i\n", w->outOfOrder);
+	}
+	else
+		Con_Printf("window  = stop-and-wait\n");
 	Con_Printf("\n");
 }
 
@@ -457,6 +838,8 @@ static void NET_Stats_f (void)
 		Con_Printf("receivedDuplicateCount     = %i\n", receivedDuplicateCount);
 		Con_Printf("shortPacketCount           = %i\n", shortPacketCount);
 		Con_Printf("droppedDatagrams           = %i\n", droppedDatagrams);
+		Con_Printf("packetsOutOfOrder          = %i\n", packetsOutOfOrder);
+		Con_Printf("windowStalls               = %i\n", windowStalls);
 	}
 	else if (Q_strcmp(Cmd_Argv(1), "*") == 0)
 	{
@@ -791,6 +1174,7 @@ int Datagram_Init (void)
 	myDriverLevel = net_driverlevel;
 
 	Cmd_AddCommand ("net_stats", NET_Stats_f);
+	Cvar_RegisterVariable (&net_window);
 
 	if (safemode || COM_CheckParm("-nolan"))
 		return -1;
@@ -867,6 +1251,7 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	int			command;
 	int			control;
 	int			ret;
+	int			window;
 
 	acceptsock = dfunc.CheckNewConnections();
 	if (acceptsock == INVALID_SOCKET)
@@ -997,6 +1382,11 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 		return NULL;
 	}
 
+	// clients that support the reliable window say how large theirs is
+	window = 0;
+	if (MSG_ReadByte() == NET_WINDOW_EXTENSION)
+		window = q_max (MSG_ReadByte(), 0);
+
 #ifdef BAN_TEST
 	// check for a ban
 	if (clientaddr.qsa_family == AF_INET)
@@ -1036,6 +1426,8 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 				MSG_WriteByte(&net_message, CCREP_ACCEPT);
 				dfunc.GetSocketAddr(s->socket, &newaddr);
 				MSG_WriteLong(&net_message, dfunc.GetSocketPort(&newaddr));
+				if (s->window)
+					Window_WriteExtension(s->window->size);
 				*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
 				dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
 				SZ_Clear(&net_message);
@@ -1084,6 +1476,7 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	sock->landriver = net_landriverlevel;
 	sock->addr = clientaddr;
 	Q_strcpy(sock->address, dfunc.AddrToString(&clientaddr));
+	Window_Open(sock, q_min (window, Window_LocalSize ()));
 
 	// send him back the info about the server connection he has been allocated
 	SZ_Clear(&net_message);
@@ -1093,6 +1486,8 @@ static qsocket_t *_Datagram_CheckNewConnections (void)
 	dfunc.GetSocketAddr(newsock, &newaddr);
 	MSG_WriteLong(&net_message, dfunc.GetSocketPort(&newaddr));
 //	MSG_WriteString(&net_message, dfunc.AddrToString(&newaddr));
+	if (sock->window)
+		Window_WriteExtension(sock->window->size);
 	*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
 	dfunc.Write (acceptsock, net_message.data, net_message.cursize, &clientaddr);
 	SZ_Clear(&net_message);
@@ -1240,6 +1635,7 @@ static qsocket_t *_Datagram_Connect (const char *host)
 	int			reps;
 	double		start_time;
 	int			control;
+	int			window = 0;
 	const char		*reason;
 
 	// see if we can resolve the host name
@@ -1276,6 +1672,8 @@ static qsocket_t *_Datagram_Connect (const char *host)
 		MSG_WriteByte(&net_message, CCREQ_CONNECT);
 		MSG_WriteString(&net_message, "QUAKE");
 		MSG_WriteByte(&net_message, NET_PROTOCOL_VERSION);
+		if (Window_LocalSize () > 1)
+			Window_WriteExtension(Window_LocalSize ());
 		*((int *)net_message.data) = BigLong(NETFLAG_CTL | (net_message.cursize & NETFLAG_LENGTH_MASK));
 		dfunc.Write (newsock, net_message.data, net_message.cursize, &sendaddr);
 		SZ_Clear(&net_message);
@@ -1363,6 +1761,9 @@ static qsocket_t *_Datagram_Connect (const char *host)
 	{
 		Q_memcpy(&sock->addr, &sendaddr, sizeof(struct qsockaddr));
 		dfunc.SetSocketPort (&sock->addr, MSG_ReadLong());
+		// servers without the reliable window don't answer with its size
+		if (MSG_ReadByte() == NET_WINDOW_EXTENSION)
+			window = q_max (MSG_ReadByte(), 0);
 	}
 	else
 	{
@@ -1386,6 +1787,10 @@ static qsocket_t *_Datagram_Connect (const char *host)
 		goto ErrorReturn;
 	}
 
+	Window_Open (sock, window);
+	if (sock->window)
+		Con_DPrintf ("Reliable window: %i fragments\n", sock->window->size);
+
 	m_return_onerror = false;
 	return sock;
 
@@ -30,10 +30,15 @@ static qboolean	localconnectpending = false;
 static qsocket_t	*loop_client = NULL;
 static qsocket_t	*loop_server = NULL;
 
+// server ends of bot connections the server hasn't picked up yet
+static qsocket_t	*loop_pendingbots[MAX_SCOREBOARD];
+static int		loop_numpendingbots = 0;
+
+int		loop_droppedDatagrams = 0;
+
 int Loop_Init (void)
 {
-	if (cls.state == ca_dedicated)
-		return -1;
+	// dedicated servers keep it for bots
 	return 0;
 }
 
@@ -106,8 +111,83 @@ qsocket_t *Loop_Connect (const char *host)
 }
 
 
+/*
+===================
+Loop_ConnectBot
+
+Makes a loopback connection for one of the server's bots, named after it
+on the server end.  The client end doesn't come from the qsocket pool, which
+only has room for the server's connections plus the local client.
+===================
+*/
+qsocket_t *Loop_ConnectBot (const char *name)
+{
+	qsocket_t	*client, *server;
+
+	if (loop_numpendingbots == MAX_SCOREBOARD)
+		return NULL;
+
+	if ((server = NET_NewQSocket ()) == NULL)
+		return NULL;
+	q_strlcpy (server->address, name, sizeof (server->address));
+
+	client = (qsocket_t *) calloc (1, sizeof (qsocket_t));
+	if (!client)
+		Sys_Error ("Loop_ConnectBot: out of memory");
+	Q_strcpy (client->address, "localhost");
+	client->driver = server->driver;
+	client->canSend = true;
+
+	client->driverdata = (void *)server;
+	server->driverdata = (void *)client;
+
+	loop_pendingbots[loop_numpendingbots++] = server;
+
+	return client;
+}
+
+
+/*
+===================
+Loop_CloseBot
+
+Frees the client end of a bot connection.  The server drops the client on
+its next send if it's still connected.
+===================
+*/
+void Loop_CloseBot (qsocket_t *sock)
+{
+	qsocket_t	*server = (qsocket_t *)sock->driverdata;
+	int		i;
+
+	if (server)
+	{
+		server->driverdata = NULL;
+		for (i = 0; i < loop_numpendingbots; i++)
+		{
+			if (loop_pendingbots[i] == server)
+			{
+				loop_pendingbots[i] = loop_pendingbots[--loop_numpendingbots];
+				NET_FreeQSocket (server);
+				break;
+			}
+		}
+	}
+
+	free (sock);
+}
+
+
 qsocket_t *Loop_CheckNewConnections (void)
 {
+	if (loop_numpendingbots)
+	{
+		qsocket_t *sock = loop_pendingbots[0];
+		loop_numpendingbots--;
+		memmove (loop_pendingbots, loop_pendingbots + 1, loop_numpendingbots * sizeof (loop_pendingbots[0]));
+		return sock;
+	}
+
 	if (!localconnectpending)
 		return NULL;
 
@@ -200,7 +280,10 @@ int Loop_SendUnreliableMessage (qsocket_t *sock, sizebuf_t *data)
 	bufferLength = &((qsocket_t *)sock->driverdata)->receiveMessageLength;
 
 	if ((*bufferLength + data->cursize + sizeof(byte) + sizeof(short)) > NET_MAXMESSAGE)
+	{
+		loop_droppedDatagrams++;
 		return 0;
+	}
 
 	buffer = ((qsocket_t *)sock->driverdata)->receiveMessage + *bufferLength;
 
@@ -244,7 +327,7 @@ void Loop_Close (qsocket_t *sock)
 	sock->canSend = true;
 	if (sock == loop_client)
 		loop_client = NULL;
-	else
+	else if (sock == loop_server)
 		loop_server = NULL;
 }
 
@@ -36,5 +36,8 @@ qboolean	Loop_CanSendUnreliableMessage (qsocket_t *sock);
 void		Loop_Close (qsocket_t *sock);
 void		Loop_Shutdown (void);
 
+qsocket_t	*Loop_ConnectBot (const char *name);
+void		Loop_CloseBot (qsocket_t *sock);
+
 #endif	/* __NET_LOOP_H */
 
@@ -24,6 +24,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "arch_def.h"
 #include "net_sys.h"
 #include "net_defs.h"
+#include "net_loop.h"
 
 #ifndef WITHOUT_CURL
 #include <curl/curl.h>
@@ -114,6 +115,7 @@ qsocket_t *NET_NewQSocket (void)
 	sock->driver = net_driverlevel;
 	sock->socket = 0;
 	sock->driverdata = NULL;
+	sock->window = NULL;
 	sock->canSend = true;
 	sock->sendNext = false;
 	sock->lastMessageTime = net_time;
@@ -151,6 +153,10 @@ void NET_FreeQSocket(qsocket_t *sock)
 			Sys_Error ("NET_FreeQSocket: not active");
 	}
 
+	// drop any reliable window state
+	free (sock->window);
+	sock->window = NULL;
+
 	// add it to free list
 	sock->next = net_freeSockets;
 	net_freeSockets = sock;
@@ -160,12 +166,16 @@ void NET_FreeQSocket(qsocket_t *sock)
 
 double NET_QSocketGetTime (const qsocket_t *s)
 {
+	if (!s)
+		return 0.0;
 	return s->connecttime;
 }
 
 
 const char *NET_QSocketGetAddressString (const qsocket_t *s)
 {
+	if (!s)
+		return "(none)";
 	return s->address;
 }
 
@@ -496,6 +506,37 @@ JustDoIt:
 }
 
 
+/*
+===================
+NET_ConnectBot
+
+Called by the server to connect one of its bots over the loopback driver,
+returns the client end
+===================
+*/
+qsocket_t *NET_ConnectBot (const char *name)
+{
+	if (!net_drivers[0].initialized)
+		return NULL;
+
+	SetNetTime();
+	net_driverlevel = 0;
+	return Loop_ConnectBot (name);
+}
+
+
+/*
+===================
+NET_CloseBot
+===================
+*/
+void NET_CloseBot (qsocket_t *sock)
+{
+	if (sock)
+		Loop_CloseBot (sock);
+}
+
+
 /*
 ===================
 NET_CheckNewConnections
@@ -734,7 +775,10 @@ int NET_SendToAll (sizebuf_t *data, double blocktime)
 
 			if (! msg_sent[i])
 			{
-				if (NET_CanSendMessage (host_client->netconnection))
+				// a windowed connection can accept more data before
+				// everything sent so far has been acknowledged
+				if (NET_CanSendMessage (host_client->netconnection) &&
+					host_client->netconnection->ackSequence == host_client->netconnection->sendSequence)
 				{
 					msg_sent[i] = true;
 				}
@@ -813,14 +857,15 @@ void NET_Init (void)
 	{
 		if (net_drivers[net_driverlevel].Init() == -1)
 			continue;
-		i++;
+		if (!IS_LOOP_DRIVER(net_driverlevel))
+			i++;
 		net_drivers[net_driverlevel].initialized = true;
 		if (listening)
 			net_drivers[net_driverlevel].Listen (true);
 	}
 
-	/* Loop_Init() returns -1 for dedicated server case,
-	 * therefore the i == 0 check is correct */
+	/* the loop driver doesn't count, a dedicated server
+	 * only uses it for bots */
 	if (i == 0
 			&& cls.state == ca_dedicated
 	   )
@@ -24,21 +24,52 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #include "quakedef.h"
 #include "q_ctype.h"
 
-#define	STRINGTEMP_BUFFERS		1024
 #define	STRINGTEMP_LENGTH		1024
-static	char	pr_string_temp[STRINGTEMP_BUFFERS][STRINGTEMP_LENGTH];
-static	byte	pr_string_tempindex = 0;
+static	char	pr_string_temp[(PR_MAX_TEMPSTRINGS + 2) * STRINGTEMP_LENGTH];
+static	size_t	pr_string_tempofs = 0;
+static	char	*pr_string_templast = NULL;
 
+/*
+=================
+PR_GetTempString
+
+Temp strings are packed into a ring buffer. Each one reserves STRINGTEMP_LENGTH
+bytes, and gives back what it didn't use in PR_FinishTempString, so the buffer
+always has room for more than PR_MAX_TEMPSTRINGS of them.
+=================
+*/
 static char *PR_GetTempString (void)
 {
-	return pr_string_temp[(STRINGTEMP_BUFFERS-1) & ++pr_string_tempindex];
+	char *s;
+
+	if (pr_string_tempofs + STRINGTEMP_LENGTH > sizeof (pr_string_temp))
+		pr_string_tempofs = 0;
+	s = pr_string_temp + pr_string_tempofs;
+	pr_string_tempofs += STRINGTEMP_LENGTH;
+	pr_string_templast = s;
+
+	return s;
+}
+
+static int PR_FinishTempString (char *s)
+{
+	size_t len = strlen (s) + 1;
+
+	if (s == pr_string_templast)
+	{
+		pr_string_tempofs = (s - pr_string_temp) + ((len + 15) & ~15);
+		pr_string_templast = NULL;
+	}
+	qcvm->stringstats.tempbytes += len;
+
+	return PR_SetTempString (s);
 }
 
 int PR_MakeTempString (const char *val)
 {
 	char *tmp = PR_GetTempString();
 	q_strlcpy(tmp, val, STRINGTEMP_LENGTH);
-	return PR_SetEngineString(tmp);
+	return PR_FinishTempString(tmp);
 }
 
 #define	RETURN_EDICT(e) (((int *)qcvm->globals)[OFS_RETURN] = EDICT_TO_PROG(e))
@@ -324,6 +355,7 @@ static void PF_setmodel (void)
 	}
 	e->v.model = PR_SetEngineString(*check);
 	e->v.modelindex = i; //SV_ModelIndex (m);
+	SV_EdictChanged (e);
 
 	mod = sv.models[ (int)e->v.modelindex];  // Mod_ForName (m, true);
 
@@ -694,6 +726,27 @@ static void PF_break (void)
 //	PR_RunError ("break statement");
 }
 
+/*
+=================
+PF_SetTraceGlobals
+=================
+*/
+static void PF_SetTraceGlobals (const trace_t *trace)
+{
+	pr_global_struct->trace_allsolid = trace->allsolid;
+	pr_global_struct->trace_startsolid = trace->startsolid;
+	pr_global_struct->trace_fraction = trace->fraction;
+	pr_global_struct->trace_inwater = trace->inwater;
+	pr_global_struct->trace_inopen = trace->inopen;
+	VectorCopy (trace->endpos, pr_global_struct->trace_endpos);
+	VectorCopy (trace->plane.normal, pr_global_struct->trace_plane_normal);
+	pr_global_struct->trace_plane_dist =  trace->plane.dist;
+	if (trace->ent)
+		pr_global_struct->trace_ent = EDICT_TO_PROG(trace->ent);
+	else
+		pr_global_struct->trace_ent = EDICT_TO_PROG(qcvm->edicts);
+}
+
 /*
 =================
 PF_traceline
@@ -733,18 +786,90 @@ static void PF_traceline (void)
 
 	trace = SV_Move (v1, vec3_origin, vec3_origin, v2, nomonsters, ent);
 
-	pr_global_struct->trace_allsolid = trace.allsolid;
-	pr_global_struct->trace_startsolid = trace.startsolid;
-	pr_global_struct->trace_fraction = trace.fraction;
-	pr_global_struct->trace_inwater = trace.inwater;
-	pr_global_struct->trace_inopen = trace.inopen;
-	VectorCopy (trace.endpos, pr_global_struct->trace_endpos);
-	VectorCopy (trace.plane.normal, pr_global_struct->trace_plane_normal);
-	pr_global_struct->trace_plane_dist =  trace.plane.dist;
-	if (trace.ent)
-		pr_global_struct->trace_ent = EDICT_TO_PROG(trace.ent);
-	else
-		pr_global_struct->trace_ent = EDICT_TO_PROG(qcvm->edicts);
+	PF_SetTraceGlobals (&trace);
+}
+
+/*
+=================
+PF_tracebatch_add
+
+Queues a MOVE_NOMONSTERS traceline for the next tracebatch_run and returns
+its index.  Adding after a run starts a new batch.
+
+float(vector v1, vector v2, entity ignore) tracebatch_add
+=================
+*/
+#define MAX_TRACEBATCH	65536
+
+static void PF_tracebatch_add (void)
+{
+	tracejob_t	job;
+
+	if (qcvm->tracebatchdone)
+	{
+		VEC_CLEAR (qcvm->tracebatch);
+		qcvm->tracebatchdone = false;
+	}
+	if (VEC_SIZE (qcvm->tracebatch) >= MAX_TRACEBATCH)
+		PR_RunError ("tracebatch_add: more than %d traces queued", MAX_TRACEBATCH);
+
+	memset (&job, 0, sizeof (job));
+	VectorCopy (G_VECTOR(OFS_PARM0), job.start);
+	VectorCopy (G_VECTOR(OFS_PARM1), job.end);
+	job.passedict = G_EDICT(OFS_PARM2);
+
+	if (IS_NAN(job.start[0]) || IS_NAN(job.start[1]) || IS_NAN(job.start[2]))
+		job.start[0] = job.start[1] = job.start[2] = 0;
+	if (IS_NAN(job.end[0]) || IS_NAN(job.end[1]) || IS_NAN(job.end[2]))
+		job.end[0] = job.end[1] = job.end[2] = 0;
+
+	G_FLOAT(OFS_RETURN) = VEC_SIZE (qcvm->tracebatch);
+	VEC_PUSH (qcvm->tracebatch, job);
+}
+
+/*
+=================
+PF_tracebatch_run
+
+Runs every queued trace, using worker threads for large batches, and
+returns how many there were.  The results stay available through
+tracebatch_result until the next tracebatch_add.
+
+float() tracebatch_run
+=================
+*/
+static void PF_tracebatch_run (void)
+{
+	int		count = VEC_SIZE (qcvm->tracebatch);
+
+	if (!qcvm->tracebatchdone)
+		SV_TraceBatch (qcvm->tracebatch, count);
+	qcvm->tracebatchdone = true;
+
+	G_FLOAT(OFS_RETURN) = count;
+}
+
+/*
+=================
+PF_tracebatch_result
+
+Sets the trace_* globals from one trace of the last batch, as traceline
+would have, and returns its fraction.
+
+float(float index) tracebatch_result
+=================
+*/
+static void PF_tracebatch_result (void)
+{
+	int		i = G_FLOAT(OFS_PARM0);
+
+	if (!qcvm->tracebatchdone)
+		PR_RunError ("tracebatch_result: batch has not been run");
+	if (i < 0 || i >= (int) VEC_SIZE (qcvm->tracebatch))
+		PR_RunError ("tracebatch_result: bad index %d", i);
+
+	PF_SetTraceGlobals (&qcvm->tracebatch[i].trace);
+	G_FLOAT(OFS_RETURN) = qcvm->tracebatch[i].trace.fraction;
 }
 
 /*
@@ -974,44 +1099,7 @@ findradius (origin, radius)
 */
 static void PF_findradius (void)
 {
-	edict_t	*ent, *chain;
-	float	rad;
-	float	*org;
-	int		i;
-
-	chain = (edict_t *)qcvm->edicts;
-
-	org = G_VECTOR(OFS_PARM0);
-	rad = G_FLOAT(OFS_PARM1);
-	rad *= rad;
-
-	ent = NEXT_EDICT(qcvm->edicts);
-	for (i = 1; i < qcvm->num_edicts; i++, ent = NEXT_EDICT(ent))
-	{
-		float d, lensq;
-		if (ent->free)
-			continue;
-		if (ent->v.solid == SOLID_NOT)
-			continue;
-
-		d = org[0] - (ent->v.origin[0] + (ent->v.mins[0] + ent->v.maxs[0]) * 0.5);
-		lensq = d * d;
-		if (lensq > rad)
-			continue;
-		d = org[1] - (ent->v.origin[1] + (ent->v.mins[1] + ent->v.maxs[1]) * 0.5);
-		lensq += d * d;
-		if (lensq > rad)
-			continue;
-		d = org[2] - (ent->v.origin[2] + (ent->v.mins[2] + ent->v.maxs[2]) * 0.5);
-		lensq += d * d;
-		if (lensq > rad)
-			continue;
-
-		ent->v.chain = EDICT_TO_PROG(chain);
-		chain = ent;
-	}
-
-	RETURN_EDICT(chain);
+	RETURN_EDICT(SV_FindRadius (G_VECTOR(OFS_PARM0), G_FLOAT(OFS_PARM1)));
 }
 
 /*
@@ -1035,7 +1123,7 @@ static void PF_ftos (void)
 		sprintf (s, "%d",(int)v);
 	else
 		sprintf (s, "%5.1f",v);
-	G_INT(OFS_RETURN) = PR_SetEngineString(s);
+	G_INT(OFS_RETURN) = PR_FinishTempString(s);
 }
 
 static void PF_fabs (void)
@@ -1051,7 +1139,7 @@ static void PF_vtos (void)
 
 	s = PR_GetTempString();
 	sprintf (s, "'%5.1f %5.1f %5.1f'", G_VECTOR(OFS_PARM0)[0], G_VECTOR(OFS_PARM0)[1], G_VECTOR(OFS_PARM0)[2]);
-	G_INT(OFS_RETURN) = PR_SetEngineString(s);
+	G_INT(OFS_RETURN) = PR_FinishTempString(s);
 }
 
 static void PF_Spawn (void)
@@ -1086,6 +1174,16 @@ static void PF_Find (void)
 	if (!s)
 		PR_RunError ("PF_Find: bad search string");
 
+	if (qcvm == &sv.qcvm)
+	{
+		int found = SV_FindString (e, f, s);
+		if (found >= 0)
+		{
+			RETURN_EDICT(EDICT_NUM(found));
+			return;
+		}
+	}
+
 	for (e++ ; e < qcvm->num_edicts ; e++)
 	{
 		ed = EDICT_NUM(e);
@@ -1258,6 +1356,7 @@ static void PF_droptofloor (void)
 		SV_LinkEdict (ent, false);
 		ent->v.flags = (int)ent->v.flags | FL_ONGROUND;
 		ent->v.groundentity = EDICT_TO_PROG(trace.ent);
+		SV_GroundChanged (ent);
 		G_FLOAT(OFS_RETURN) = 1;
 	}
 }
@@ -1990,7 +2089,7 @@ static void PF_cl_getstat_string(void)
 	{
 		char *result = PR_GetTempString();
 		q_strlcpy(result, cl.statss[stnum], STRINGTEMP_LENGTH);
-		G_INT(OFS_RETURN) = PR_SetEngineString(result);
+		G_INT(OFS_RETURN) = PR_FinishTempString(result);
 	}
 }
 
@@ -2474,7 +2573,7 @@ static void PF_strcat(void)
 		}
 	}
 
-	G_INT(OFS_RETURN) = PR_SetEngineString(out);
+	G_INT(OFS_RETURN) = PR_FinishTempString(out);
 }
 static void PF_substring(void)
 {
@@ -2519,18 +2618,17 @@ static void PF_substring(void)
 	string = PR_GetTempString();
 	memcpy(string, s, length);
 	string[length] = '\0';
-	G_INT(OFS_RETURN) = PR_SetEngineString(string);
+	G_INT(OFS_RETURN) = PR_FinishTempString(string);
 }
 
 /*our zoned strings implementation is somewhat specific to quakespasm, so good luck porting*/
 static void PF_strzone(void)
 {
-	char *buf;
+	char buf[1024], *p;
 	size_t len = 0;
 	const char *s[8];
 	size_t l[8];
 	int i;
-	size_t id;
 
 	for (i = 0; i < qcvm->argc; i++)
 	{
@@ -2540,38 +2638,31 @@ static void PF_strzone(void)
 	}
 	len++; /*for the null*/
 
-	buf = Z_Malloc(len);
-	G_INT(OFS_RETURN) = PR_SetEngineString(buf);
-	id = -1-G_INT(OFS_RETURN);
-	if (id >= qcvm->knownzonesize)
+	if (qcvm->argc == 1)
 	{
-		qcvm->knownzonesize = (id+32)&~7;
-		qcvm->knownzone = Z_Realloc(qcvm->knownzone, (qcvm->knownzonesize+7)>>3);
+		G_INT(OFS_RETURN) = PR_ZoneString(s[0]);
+		return;
 	}
-	qcvm->knownzone[id>>3] |= 1u<<(id&7);
 
-	for (i = 0; i < qcvm->argc; i++)
+	p = (len > sizeof(buf)) ? (char *) malloc(len) : buf;
+	if (!p)
+		Sys_Error ("PF_strzone: failed to allocate %" SDL_PRIu64 " bytes", (uint64_t)len);
+	for (len = 0, i = 0; i < qcvm->argc; i++)
 	{
-		memcpy(buf, s[i], l[i]);
-		buf += l[i];
+		memcpy(p + len, s[i], l[i]);
+		len += l[i];
 	}
-	*buf = '\0';
+	p[len] = '\0';
+
+	G_INT(OFS_RETURN) = PR_ZoneString(p);
+	if (p != buf)
+		free(p);
 }
 static void PF_strunzone(void)
 {
-	size_t id;
-	const char *foo = G_STRING(OFS_PARM0);
-
 	if (!G_INT(OFS_PARM0))
 		return;	//don't bug out if they gave a null string
-	id = -1-G_INT(OFS_PARM0);
-	if (id < qcvm->knownzonesize && (qcvm->knownzone[id>>3] & (1u<<(id&7))))
-	{
-		qcvm->knownzone[id>>3] &= ~(1u<<(id&7));
-		PR_ClearEngineString(G_INT(OFS_PARM0));
-		Z_Free((void*)foo);
-	}
-	else
+	if (!PR_UnzoneString(G_INT(OFS_PARM0)))
 		Con_Warning("PF_strunzone: string wasn't strzoned\n");
 }
 
@@ -2609,7 +2700,7 @@ static void PF_chr2str(void)
 			*out++ = '?';	//no unicode support
 	}
 	*out = 0;
-	G_INT(OFS_RETURN) = PR_SetEngineString(ret);
+	G_INT(OFS_RETURN) = PR_FinishTempString(ret);
 }
 
 //part of PF_strconv
@@ -2741,7 +2832,7 @@ static void PF_strconv (void)
 	}
 	*result = '\0';
 
-	G_INT(OFS_RETURN) = PR_SetEngineString((char*)resbuf);
+	G_INT(OFS_RETURN) = PR_FinishTempString((char*)resbuf);
 }
 
 static void PF_sprintf_internal (const char *s, int firstarg, char *outbuf, int outbuflen)
@@ -3117,7 +3208,7 @@ static void PF_sprintf(void)
 {
 	char *outbuf = PR_GetTempString();
 	PF_sprintf_internal(G_STRING(OFS_PARM0), 1, outbuf, STRINGTEMP_LENGTH);
-	G_INT(OFS_RETURN) = PR_SetEngineString(outbuf);
+	G_INT(OFS_RETURN) = PR_FinishTempString(outbuf);
 }
 
 //string tokenizing (gah)
@@ -3295,7 +3386,7 @@ static void PF_ArgV(void)
 	{
 		char *ret = PR_GetTempString();
 		q_strlcpy(ret, qctoken[idx].token, STRINGTEMP_LENGTH);
-		G_INT(OFS_RETURN) = PR_SetEngineString(ret);
+		G_INT(OFS_RETURN) = PR_FinishTempString(ret);
 	}
 }
 
@@ -3307,7 +3398,7 @@ static void PF_strtoupper(void)
 	for (out = result; *in && out < result+STRINGTEMP_LENGTH-1;)
 		*out++ = q_toupper(*in++);
 	*out = 0;
-	G_INT(OFS_RETURN) = PR_SetEngineString(result);
+	G_INT(OFS_RETURN) = PR_FinishTempString(result);
 }
 static void PF_strtolower(void)
 {
@@ -3316,7 +3407,7 @@ static void PF_strtolower(void)
 	for (out = result; *in && out < result+STRINGTEMP_LENGTH-1;)
 		*out++ = q_tolower(*in++);
 	*out = 0;
-	G_INT(OFS_RETURN) = PR_SetEngineString(result);
+	G_INT(OFS_RETURN) = PR_FinishTempString(result);
 }
 #include <time.h>
 static void PF_strftime(void)
@@ -3344,7 +3435,7 @@ static void PF_strftime(void)
 
 	strftime(result, STRINGTEMP_LENGTH, in, tm);
 
-	G_INT(OFS_RETURN) = PR_SetEngineString(result);
+	G_INT(OFS_RETURN) = PR_FinishTempString(result);
 }
 static void PF_stof(void)
 {
@@ -3368,13 +3459,13 @@ static void PF_itos(void)
 {
 	char *result = PR_GetTempString();
 	q_snprintf(result, STRINGTEMP_LENGTH, "%i", G_INT(OFS_PARM0));
-	G_INT(OFS_RETURN) = PR_SetEngineString(result);
+	G_INT(OFS_RETURN) = PR_FinishTempString(result);
 }
 static void PF_etos(void)
 {	//yes, this is lame
 	char *result = PR_GetTempString();
 	q_snprintf(result, STRINGTEMP_LENGTH, "entity %i", G_EDICTNUM(OFS_PARM0));
-	G_INT(OFS_RETURN) = PR_SetEngineString(result);
+	G_INT(OFS_RETURN) = PR_FinishTempString(result);
 }
 static void PF_stoh(void)
 {
@@ -3384,7 +3475,7 @@ static void PF_htos(void)
 {
 	char *result = PR_GetTempString();
 	q_snprintf(result, STRINGTEMP_LENGTH, "%x", G_INT(OFS_PARM0));
-	G_INT(OFS_RETURN) = PR_SetEngineString(result);
+	G_INT(OFS_RETURN) = PR_FinishTempString(result);
 }
 static void PF_ftoi(void)
 {
@@ -3637,6 +3728,10 @@ builtindef_t pr_builtindefs[] =
 	{"tokenize_console",		PF_BOTH(PF_tokenize_console),	514,	DP_QC_TOKENIZE_CONSOLE},		// float(string str)
 
 	{"sprintf",					PF_BOTH(PF_sprintf),			627,	DP_QC_SPRINTF},					// string(string fmt, ...)
+
+	{"tracebatch_add",			PF_SSQC(PF_tracebatch_add)},			// float(vector v1, vector v2, entity ignore)
+	{"tracebatch_run",			PF_SSQC(PF_tracebatch_run)},			// float()
+	{"tracebatch_result",		PF_SSQC(PF_tracebatch_result)},			// float(float index)
 };
 int pr_numbuiltindefs = Q_COUNTOF(pr_builtindefs);
 
@@ -40,6 +40,7 @@ int		type_size[8] = {
 
 static ddef_t	*ED_FieldAtOfs (int ofs);
 static qboolean	ED_ParseEpair (void *base, ddef_t *key, const char *s, qboolean zoned);
+static void		PR_FreeStringArena (void);
 
 cvar_t	nomonsters = {"nomonsters", "0", CVAR_NONE};
 cvar_t	gamecfg = {"gamecfg", "0", CVAR_NONE};
@@ -140,6 +141,21 @@ static void PR_InitHashTables (void)
 	PR_HashInit (&qcvm->ht_globals, qcvm->progs->numglobaldefs, "ht_globals");
 	for (i = 0; i < qcvm->progs->numglobaldefs; i++)
 		PR_HashAdd (&qcvm->ht_globals, qcvm->globaldefs[i].s_name, i);
+
+	// reverse lookups by offset, going backwards so the first def at each offset wins
+	qcvm->fieldatofs = (int *) Hunk_AllocName (qcvm->progs->entityfields * sizeof (int), "fieldatofs");
+	for (i = 0; i < qcvm->progs->entityfields; i++)
+		qcvm->fieldatofs[i] = -1;
+	for (i = qcvm->progs->numfielddefs - 1; i >= 0; i--)
+		if (qcvm->fielddefs[i].ofs < qcvm->progs->entityfields)
+			qcvm->fieldatofs[qcvm->fielddefs[i].ofs] = i;
+
+	qcvm->globalatofs = (int *) Hunk_AllocName (qcvm->progs->numglobals * sizeof (int), "globalatofs");
+	for (i = 0; i < qcvm->progs->numglobals; i++)
+		qcvm->globalatofs[i] = -1;
+	for (i = qcvm->progs->numglobaldefs - 1; i >= 0; i--)
+		if (qcvm->globaldefs[i].ofs < qcvm->progs->numglobals)
+			qcvm->globalatofs[qcvm->globaldefs[i].ofs] = i;
 }
 
 /*
@@ -183,6 +199,7 @@ void ED_ClearEdict (edict_t *e)
 {
 	memset (&e->v, 0, qcvm->progs->entityfields * 4);
 	ED_RemoveFromFreeList (e);
+	SV_EdictChanged (e);
 }
 
 /*
@@ -220,6 +237,7 @@ edict_t *ED_Alloc (void)
 	e = EDICT_NUM(qcvm->num_edicts++);
 	memset(e, 0, qcvm->edict_size); // ericw -- switched sv.edicts to malloc(), so we are accessing uninitialized memory and must fully zero it, not just ED_ClearEdict
 	e->baseline.scale = ENTSCALE_DEFAULT;
+	SV_EdictChanged (e);
 
 	return e;
 }
@@ -251,6 +269,7 @@ void ED_Free (edict_t *ed)
 	ed->scale = ENTSCALE_DEFAULT;
 
 	ed->freetime = qcvm->time;
+	SV_EdictChanged (ed);
 }
 
 //===========================================================================
@@ -265,6 +284,13 @@ static ddef_t *ED_GlobalAtOfs (int ofs)
 	ddef_t		*def;
 	int			i;
 
+	if (qcvm->globalatofs)
+	{
+		if (ofs < 0 || ofs >= qcvm->progs->numglobals || qcvm->globalatofs[ofs] < 0)
+			return NULL;
+		return qcvm->globaldefs + qcvm->globalatofs[ofs];
+	}
+
 	for (i = 0; i < qcvm->progs->numglobaldefs; i++)
 	{
 		def = &qcvm->globaldefs[i];
@@ -284,6 +310,13 @@ static ddef_t *ED_FieldAtOfs (int ofs)
 	ddef_t		*def;
 	int			i;
 
+	if (qcvm->fieldatofs)
+	{
+		if (ofs < 0 || ofs >= qcvm->progs->entityfields || qcvm->fieldatofs[ofs] < 0)
+			return NULL;
+		return qcvm->fielddefs + qcvm->fieldatofs[ofs];
+	}
+
 	for (i = 0; i < qcvm->progs->numfielddefs; i++)
 	{
 		def = &qcvm->fielddefs[i];
@@ -1196,34 +1229,13 @@ static string_t ED_NewString (const char *string)
 
 static void ED_RezoneString (string_t *ref, const char *str)
 {
-	char *buf;
-	size_t len = strlen(str)+1;
-	size_t id;
-
-	if (*ref)
-	{	//if the reference is already a zoned string then free it first.
-		id = -1-*ref;
-		if (id < qcvm->knownzonesize && (qcvm->knownzone[id>>3] & (1u<<(id&7))))
-		{	//okay, it was zoned.
-			qcvm->knownzone[id>>3] &= ~(1u<<(id&7));
-			buf = (char*)PR_GetString(*ref);
-			PR_ClearEngineString(*ref);
-			Z_Free(buf);
-		}
-//		else
-//			Con_Warning("ED_RezoneString: string wasn't strzoned\n");	//warnings would trigger from the default cvar value that autocvars are initialised with
-	}
+	string_t old = *ref;
 
-	buf = Z_Malloc(len);
-	memcpy(buf, str, len);
-	id = -1-(*ref = PR_SetEngineString(buf));
-	//make sure its flagged as zoned so we can clean up properly after.
-	if (id >= qcvm->knownzonesize)
-	{
-		qcvm->knownzonesize = (id+32)&~7;
-		qcvm->knownzone = Z_Realloc(qcvm->knownzone, (qcvm->knownzonesize+7)>>3);
-	}
-	qcvm->knownzone[id>>3] |= 1u<<(id&7);
+	// zone the new string first, str might point to the old one
+	*ref = PR_ZoneString (str);
+	//if the reference was already a zoned string then release it.
+	if (old)
+		PR_UnzoneString (old);
 }
 
 /*
@@ -1316,6 +1328,119 @@ static qboolean ED_ParseEpair (void *base, ddef_t *key, const char *s, qboolean
 	return true;
 }
 
+/*
+==============================================================================
+
+ENTITY LUMP PARSING
+
+==============================================================================
+*/
+
+typedef struct
+{
+	const char	*start;
+	int			len;
+} edtoken_t;
+
+typedef struct
+{
+	char		*classname;
+	unsigned	hash;
+	int			func;		// spawn function index, 0 if there is none
+	int			count;
+	double		time;
+	double		maxtime;
+} edspawn_t;
+
+static struct
+{
+	edspawn_t	*table;		// open addressing, power of two size
+	int			size;
+	int			used;
+	int			entities;
+	int			inhibited;
+	double		loadtime;
+	double		spawntime;
+	char		mapname[64];
+} ed_spawns;
+
+static inline qboolean ED_TokenIs (const edtoken_t *tok, const char *s, int len)
+{
+	return tok->len == len && !memcmp (tok->start, s, len);
+}
+
+/*
+====================
+ED_NextToken
+
+Same rules as COM_Parse, but the token is left in place in the source
+text rather than being copied out to com_token.  Returns NULL at the
+end of the data.
+====================
+*/
+static const char *ED_NextToken (const char *data, edtoken_t *tok)
+{
+	int		c;
+
+	tok->start = "";
+	tok->len = 0;
+
+	if (!data)
+		return NULL;
+
+skipwhite:
+	while ((c = *data) <= ' ')
+	{
+		if (c == 0)
+			return NULL;
+		data++;
+	}
+
+	if (c == '/' && data[1] == '/')
+	{
+		while (*data && *data != '\n')
+			data++;
+		goto skipwhite;
+	}
+
+	if (c == '/' && data[1] == '*')
+	{
+		data += 2;
+		while (*data && !(*data == '*' && data[1] == '/'))
+			data++;
+		if (*data)
+			data += 2;
+		goto skipwhite;
+	}
+
+	if (c == '\"')
+	{
+		tok->start = ++data;
+		while (*data && *data != '\"')
+			data++;
+		tok->len = data - tok->start;
+		return *data ? data + 1 : data;
+	}
+
+	tok->start = data;
+	if (c == '{' || c == '}'|| c == '('|| c == ')' || c == '\'' || c == ':')
+	{
+		tok->len = 1;
+		return data + 1;
+	}
+
+	do
+	{
+		data++;
+		c = *data;
+		if (c == '{' || c == '}'|| c == '('|| c == ')' || c == '\'')
+			break;
+	} while (c > 32);
+
+	tok->len = data - tok->start;
+	return data;
+}
+
 /*
 ====================
 ED_ParseEdict
@@ -1328,7 +1453,9 @@ Used for initial level load and for savegames.
 const char *ED_ParseEdict (const char *data, edict_t *ent)
 {
 	ddef_t		*key;
+	edtoken_t	keytok, valtok;
 	char		keyname[256];
+	char		value[Q_COUNTOF(com_token)];
 	qboolean	anglehack, init;
 	int		n;
 
@@ -1336,51 +1463,53 @@ const char *ED_ParseEdict (const char *data, edict_t *ent)
 
 	// clear it
 	if (ent != qcvm->edicts)	// hack
+	{
 		memset (&ent->v, 0, qcvm->progs->entityfields * 4);
+		SV_EdictChanged (ent);
+	}
 
 	// go through all the dictionary pairs
 	while (1)
 	{
 		// parse key
-		data = COM_Parse (data);
-		if (com_token[0] == '}')
+		data = ED_NextToken (data, &keytok);
+		if (ED_TokenIs (&keytok, "}", 1))
 			break;
-		if (!data)
+		if (!data || keytok.len >= (int) sizeof (value))
 			Host_Error ("ED_ParseEntity: EOF without closing brace");
 
+		// another hack to fix keynames with trailing spaces
+		n = q_min (keytok.len, (int) sizeof (keyname) - 1);
+		while (n && keytok.start[n-1] == ' ')
+			n--;
+		memcpy (keyname, keytok.start, n);
+		keyname[n] = 0;
+
 		// anglehack is to allow QuakeEd to write single scalar angles
 		// and allow them to be turned into vectors. (FIXME...)
-		if (!strcmp(com_token, "angle"))
-		{
-			strcpy (com_token, "angles");
-			anglehack = true;
-		}
-		else
-			anglehack = false;
+		anglehack = ED_TokenIs (&keytok, "angle", 5);
+		if (anglehack)
+			strcpy (keyname, "angles");
 
 		// FIXME: change light to _light to get rid of this hack
-		if (!strcmp(com_token, "light"))
-			strcpy (com_token, "light_lev");	// hack for single light def
-
-		q_strlcpy (keyname, com_token, sizeof(keyname));
-
-		// another hack to fix keynames with trailing spaces
-		n = strlen(keyname);
-		while (n && keyname[n-1] == ' ')
-		{
-			keyname[n-1] = 0;
-			n--;
-		}
+		if (ED_TokenIs (&keytok, "light", 5))
+			strcpy (keyname, "light_lev");	// hack for single light def
 
 		// parse value
 		// HACK: we allow truncation when reading the wad field,
 		// otherwise maps using lots of wads with absolute paths
 		// could cause a parse error
-		data = COM_ParseEx (data, !strcmp (keyname, "wad") ? CPE_ALLOWTRUNC : CPE_NOTRUNC);
+		data = ED_NextToken (data, &valtok);
 		if (!data)
 			Host_Error ("ED_ParseEntity: EOF without closing brace");
+		if (valtok.len >= (int) sizeof (value))
+		{
+			if (strcmp (keyname, "wad"))
+				Host_Error ("ED_ParseEntity: EOF without closing brace");
+			valtok.len = sizeof (value) - 1;
+		}
 
-		if (com_token[0] == '}')
+		if (ED_TokenIs (&valtok, "}", 1))
 			Host_Error ("ED_ParseEntity: closing brace without data");
 
 		init = true;
@@ -1392,7 +1521,10 @@ const char *ED_ParseEdict (const char *data, edict_t *ent)
 
 		//johnfitz -- hack to support .alpha even when progs.dat doesn't know about it
 		if (!strcmp(keyname, "alpha"))
-			ent->alpha = ENTALPHA_ENCODE(Q_atof(com_token));
+		{
+			q_strlcpy (value, valtok.start, q_min (valtok.len + 1, (int) sizeof (value)));
+			ent->alpha = ENTALPHA_ENCODE(Q_atof(value));
+		}
 		//johnfitz
 
 		key = ED_FindField (keyname);
@@ -1404,14 +1536,29 @@ const char *ED_ParseEdict (const char *data, edict_t *ent)
 			continue;
 		}
 
+		// plain numbers are read straight out of the lump, the
+		// token always ends on a character that stops the conversion
+		switch (key->type & ~DEF_SAVEGLOBAL)
+		{
+		case ev_float:
+			((float *)&ent->v)[key->ofs] = atof (valtok.start);
+			continue;
+		case ev_entity:
+			((int *)&ent->v)[key->ofs] = EDICT_TO_PROG(EDICT_NUM(atoi (valtok.start)));
+			continue;
+		default:
+			break;
+		}
+
 		if (anglehack)
+			q_snprintf (value, sizeof (value), "0 %.*s 0", q_min (valtok.len, 31), valtok.start);
+		else
 		{
-			char	temp[32];
-			strcpy (temp, com_token);
-			sprintf (com_token, "0 %s 0", temp);
+			memcpy (value, valtok.start, valtok.len);
+			value[valtok.len] = 0;
 		}
 
-		if (!ED_ParseEpair ((void *)&ent->v, key, com_token, qcvm != &sv.qcvm))
+		if (!ED_ParseEpair ((void *)&ent->v, key, value, qcvm != &sv.qcvm))
 			Host_Error ("ED_ParseEdict: parse error");
 	}
 
@@ -1421,6 +1568,148 @@ const char *ED_ParseEdict (const char *data, edict_t *ent)
 	return data;
 }
 
+/*
+====================
+ED_ClearSpawnCache
+====================
+*/
+static void ED_ClearSpawnCache (void)
+{
+	int			i;
+
+	for (i = 0; i < ed_spawns.size; i++)
+		free (ed_spawns.table[i].classname);
+	free (ed_spawns.table);
+	memset (&ed_spawns, 0, sizeof (ed_spawns));
+}
+
+/*
+====================
+ED_SpawnSlot
+
+Returns the table slot holding the classname, or the empty slot it belongs in
+====================
+*/
+static edspawn_t *ED_SpawnSlot (const char *classname, unsigned hash)
+{
+	edspawn_t	*spawn;
+	unsigned	mask = ed_spawns.size - 1;
+	unsigned	pos;
+
+	for (pos = hash & mask; ; pos = (pos + 1) & mask)
+	{
+		spawn = &ed_spawns.table[pos];
+		if (!spawn->classname)
+			return spawn;
+		if (spawn->hash == hash && !strcmp (spawn->classname, classname))
+			return spawn;
+	}
+}
+
+/*
+====================
+ED_FindSpawn
+
+Returns the cache entry for a classname, looking up its spawn function
+the first time the classname is seen during this load
+====================
+*/
+static edspawn_t *ED_FindSpawn (const char *classname)
+{
+	edspawn_t	*spawn, *old;
+	dfunction_t	*func;
+	unsigned	hash = COM_HashString (classname);
+	int			i, oldsize;
+
+	if ((ed_spawns.used + 1) * 2 > ed_spawns.size)
+	{
+		old = ed_spawns.table;
+		oldsize = ed_spawns.size;
+		ed_spawns.size = q_max (ed_spawns.size * 2, 256);
+		ed_spawns.table = (edspawn_t *) calloc (ed_spawns.size, sizeof (edspawn_t));
+		if (!ed_spawns.table)
+			Sys_Error ("ED_FindSpawn: out of memory");
+		for (i = 0; i < oldsize; i++)
+			if (old[i].classname)
+				*ED_SpawnSlot (old[i].classname, old[i].hash) = old[i];
+		free (old);
+	}
+
+	spawn = ED_SpawnSlot (classname, hash);
+	if (!spawn->classname)
+	{
+		spawn->classname = strdup (classname);
+		spawn->hash = hash;
+		func = ED_FindFunction (classname);
+		spawn->func = func ? (int)(func - qcvm->functions) : 0;
+		ed_spawns.used++;
+	}
+	return spawn;
+}
+
+/*
+====================
+ED_CompareSpawnTime
+====================
+*/
+static int ED_CompareSpawnTime (const void *pa, const void *pb)
+{
+	const edspawn_t *a = *(const edspawn_t **) pa;
+	const edspawn_t *b = *(const edspawn_t **) pb;
+
+	if (a->time != b->time)
+		return a->time < b->time ? 1 : -1;
+	return b->count - a->count;
+}
+
+/*
+====================
+ED_SpawnProfile_f
+
+Prints the time spent in each classname's spawn function during the
+last map load
+====================
+*/
+void ED_SpawnProfile_f (void)
+{
+	edspawn_t	**list;
+	int			i, count, limit;
+
+	if (!ed_spawns.used)
+	{
+		Con_Printf ("no map has been loaded\n");
+		return;
+	}
+
+	limit = Cmd_Argc () >= 2 ? Q_atoi (Cmd_Argv (1)) : 20;
+	if (limit <= 0)
+		limit = ed_spawns.used;
+
+	list = (edspawn_t **) malloc (ed_spawns.used * sizeof (*list));
+	for (i = count = 0; i < ed_spawns.size; i++)
+		if (ed_spawns.table[i].classname)
+			list[count++] = &ed_spawns.table[i];
+	qsort (list, count, sizeof (*list), ED_CompareSpawnTime);
+
+	Con_Printf ("%s: %i entities, %i inhibited, %i classnames\n",
+		ed_spawns.mapname, ed_spawns.entities, ed_spawns.inhibited, count);
+	Con_Printf ("load %.2f ms: spawn functions %.2f ms, parsing %.2f ms\n",
+		ed_spawns.loadtime * 1000.0, ed_spawns.spawntime * 1000.0,
+		(ed_spawns.loadtime - ed_spawns.spawntime) * 1000.0);
+	Con_Printf ("   total ms     max ms  count  classname\n");
+	for (i = 0; i < count && i < limit; i++)
+	{
+		if (!list[i]->func)
+			Con_Printf ("                       %5i  %s (no spawn function)\n", list[i]->count, list[i]->classname);
+		else
+			Con_Printf ("%11.3f %10.3f  %5i  %s\n", list[i]->time * 1000.0, list[i]->maxtime * 1000.0,
+				list[i]->count, list[i]->classname);
+	}
+	if (count > limit)
+		Con_Printf ("(%i more)\n", count - limit);
+
+	free (list);
+}
 
 /*
 ================
@@ -1440,27 +1729,34 @@ to call ED_CallSpawnFunctions () to let the objects initialize themselves.
 void ED_LoadFromFile (const char *data)
 {
 	const char	*classname;
-	dfunction_t	*func;
+	edspawn_t	*spawn;
+	edtoken_t	tok;
 	edict_t		*ent = NULL;
 	int		inhibit = 0;
+	double		start, spawnstart, spawntime;
 
 	pr_global_struct->time = qcvm->time;
 
+	ED_ClearSpawnCache ();
+	q_strlcpy (ed_spawns.mapname, sv.name, sizeof (ed_spawns.mapname));
+	start = Sys_DoubleTime ();
+
 	// parse ents
 	while (1)
 	{
 		// parse the opening brace
-		data = COM_Parse (data);
+		data = ED_NextToken (data, &tok);
 		if (!data)
 			break;
-		if (com_token[0] != '{')
-			Host_Error ("ED_LoadFromFile: found %s when expecting {",com_token);
+		if (!ED_TokenIs (&tok, "{", 1))
+			Host_Error ("ED_LoadFromFile: found %.*s when expecting {", q_min (tok.len, 64), tok.start);
 
 		if (!ent)
 			ent = EDICT_NUM(0);
 		else
 			ent = ED_Alloc ();
 		data = ED_ParseEdict (data, ent);
+		ed_spawns.entities++;
 
 		// remove things from different skill levels or deathmatch
 		if (deathmatch.value)
@@ -1501,9 +1797,10 @@ void ED_LoadFromFile (const char *data)
 		}
 
 	// look for the spawn function
-		func = ED_FindFunction (classname);
+		spawn = ED_FindSpawn (classname);
+		spawn->count++;
 
-		if (!func)
+		if (!spawn->func)
 		{
 			Con_SafePrintf ("No spawn function for:\n"); //johnfitz -- was Con_Printf
 			ED_Print (ent);
@@ -1514,25 +1811,24 @@ void ED_LoadFromFile (const char *data)
 		SV_ReserveSignonSpace (512);
 
 		pr_global_struct->self = EDICT_TO_PROG(ent);
-		PR_ExecuteProgram (func - qcvm->functions);
+		spawnstart = Sys_DoubleTime ();
+		PR_ExecuteProgram (spawn->func);
+		spawntime = Sys_DoubleTime () - spawnstart;
+
+		spawn->time += spawntime;
+		spawn->maxtime = q_max (spawn->maxtime, spawntime);
+		ed_spawns.spawntime += spawntime;
 	}
 
+	ed_spawns.inhibited = inhibit;
+	ed_spawns.loadtime = Sys_DoubleTime () - start;
+
 	Con_DPrintf ("%i entities inhibited\n", inhibit);
 }
 
 void PR_UnzoneAll(void)
 {	//called to clean up all zoned strings.
-	while (qcvm->knownzonesize --> 0)
-	{
-		size_t id = qcvm->knownzonesize;
-		if (qcvm->knownzone[id>>3] & (1u<<(id&7)))
-		{
-			string_t s = -1-(int)id;
-			char *ptr = (char*)PR_GetString(s);
-			PR_ClearEngineString(s);
-			Z_Free(ptr);
-		}
-	}
+	PR_FreeStringArena ();
 	if (qcvm->knownzone)
 		Z_Free(qcvm->knownzone);
 	qcvm->knownzonesize = 0;
@@ -1583,6 +1879,7 @@ void PR_PopQCVM(qcvm_t *oldvm)
 void PR_ClearProgs(qcvm_t *vm)
 {
 	qcvm_t *oldvm = qcvm;
+	int i;
 	if (!vm->progs)
 		return;	//wasn't loaded.
 	if (vm == &sv.qcvm)
@@ -1593,6 +1890,13 @@ void PR_ClearProgs(qcvm_t *vm)
 
 	if (qcvm->knownstrings)
 		Z_Free ((void *)qcvm->knownstrings);
+	if (qcvm->knownstringhash)
+		Z_Free (qcvm->knownstringhash);
+	PR_FreeProfiler (qcvm);
+	PR_FreeIsolation (qcvm);
+	VEC_FREE (qcvm->tracebatch);
+	for (i = 0; i < qcvm->num_edicts; i++)
+		VEC_FREE (EDICT_NUM (i)->leafbits);
 	free(qcvm->edicts); // ericw -- sv.edicts switched to use malloc()
 	if (qcvm->fielddefs != (ddef_t *)((byte *)qcvm->progs + qcvm->progs->ofs_fielddefs))
 		free(qcvm->fielddefs);
@@ -2035,6 +2339,14 @@ qboolean PR_LoadProgs (const char *filename, qboolean fatal)
 		Z_Free ((void *)qcvm->knownstrings);
 	qcvm->knownstrings = NULL;
 	qcvm->firstfreeknownstring = NULL;
+	if (qcvm->knownstringhash)
+		Z_Free (qcvm->knownstringhash);
+	qcvm->knownstringhash = NULL;
+	qcvm->knownstringhashsize = 0;
+	memset (qcvm->tempstringslots, 0, sizeof (qcvm->tempstringslots));
+	qcvm->tempstringnext = 0;
+	memset (&qcvm->stringstats, 0, sizeof (qcvm->stringstats));
+	qcvm->stringstats.starttime = Sys_DoubleTime ();
 	PR_SetEngineString("");
 
 	qcvm->globaldefs = (ddef_t *)((byte *)qcvm->progs + qcvm->progs->ofs_globaldefs);
@@ -2103,6 +2415,9 @@ qboolean PR_LoadProgs (const char *filename, qboolean fatal)
 	PR_EnableExtensions ();
 	PR_FindSavegameFields ();
 	PR_FindEntityFields ();
+	PR_TranslateProgram ();
+
+	qcvm->fieldwatch = (byte *) Hunk_AllocName (qcvm->progs->entityfields, "fieldwatch");
 
 	qcvm->effects_mask = PR_FindSupportedEffects ();
 
@@ -2136,6 +2451,13 @@ void PR_Init (void)
 	Cmd_AddCommand ("edicts", ED_PrintEdicts);
 	Cmd_AddCommand ("edictcount", ED_Count);
 	Cmd_AddCommand ("profile", PR_Profile_f);
+	Cmd_AddCommand ("pr_fusionstats", PR_FusionStats_f);
+	Cmd_AddCommand ("qcprofile", PR_QCProfile_f);
+	Cmd_AddCommand ("pr_stringstats", PR_StringStats_f);
+	Cmd_AddCommand ("spawnprofile", ED_SpawnProfile_f);
+	Cvar_RegisterVariable (&pr_predecode);
+	Cvar_RegisterVariable (&pr_verify);
+	Cvar_SetCallback (&pr_verify, PR_Verify_f);
 	Cvar_RegisterVariable (&nomonsters);
 	Cvar_SetCallback (&nomonsters, ED_Nomonsters_f);
 	Cvar_RegisterVariable (&gamecfg);
@@ -2191,6 +2513,106 @@ int SAVE_NUM_FOR_EDICT (savedata_t *save, edict_t *e)
 
 #define	PR_STRING_ALLOCSLOTS	256
 
+/*
+===============================================================================
+
+KNOWN STRING LOOKUP
+
+Engine strings are looked up by pointer to avoid handing out a new slot every
+time the same string is passed to QC. This used to be a linear search over
+all the known strings, which got slow with a lot of temp and zoned strings.
+
+===============================================================================
+*/
+
+static unsigned int PR_HashStringPointer (const char *s)
+{
+	uint64_t p = (uintptr_t) s;
+	return (unsigned int) ((p * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static qboolean PR_IsValidString (const char *p);
+
+/*
+=================
+PR_FindKnownString
+
+Returns the slot holding pointer s, or -1
+=================
+*/
+static int PR_FindKnownString (const char *s)
+{
+	unsigned int mask, pos;
+	int slot;
+
+	if (!qcvm->knownstringhashsize)
+		return -1;
+
+	mask = qcvm->knownstringhashsize - 1;
+	for (pos = PR_HashStringPointer (s) & mask; (slot = qcvm->knownstringhash[pos]) != 0; pos = (pos + 1) & mask)
+		if (qcvm->knownstrings[slot - 1] == s)
+			return slot - 1;
+
+	return -1;
+}
+
+static void PR_InsertKnownString (int slot)
+{
+	unsigned int mask = qcvm->knownstringhashsize - 1;
+	unsigned int pos = PR_HashStringPointer (qcvm->knownstrings[slot]) & mask;
+
+	while (qcvm->knownstringhash[pos])
+		pos = (pos + 1) & mask;
+	qcvm->knownstringhash[pos] = slot + 1;
+}
+
+/*
+=================
+PR_RemoveKnownString
+
+Must be called while the slot still holds its string
+=================
+*/
+static void PR_RemoveKnownString (int slot)
+{
+	unsigned int mask, pos, next, home;
+
+	if (!qcvm->knownstringhashsize)
+		return;
+
+	mask = qcvm->knownstringhashsize - 1;
+	for (pos = PR_HashStringPointer (qcvm->knownstrings[slot]) & mask; qcvm->knownstringhash[pos] != slot + 1; pos = (pos + 1) & mask)
+		if (!qcvm->knownstringhash[pos])
+			return;
+
+	// shift back the entries that would otherwise become unreachable
+	for (next = (pos + 1) & mask; qcvm->knownstringhash[next]; next = (next + 1) & mask)
+	{
+		home = PR_HashStringPointer (qcvm->knownstrings[qcvm->knownstringhash[next] - 1]) & mask;
+		if (((next - home) & mask) >= ((next - pos) & mask))
+		{
+			qcvm->knownstringhash[pos] = qcvm->knownstringhash[next];
+			pos = next;
+		}
+	}
+	qcvm->knownstringhash[pos] = 0;
+}
+
+static void PR_RehashKnownStrings (void)
+{
+	int i;
+
+	qcvm->knownstringhashsize = 64;
+	while (qcvm->knownstringhashsize < qcvm->maxknownstrings * 2)
+		qcvm->knownstringhashsize <<= 1;
+	qcvm->knownstringhash = (int *) Z_Realloc (qcvm->knownstringhash, qcvm->knownstringhashsize * sizeof (int));
+	memset (qcvm->knownstringhash, 0, qcvm->knownstringhashsize * sizeof (int));
+
+	for (i = 0; i < qcvm->numknownstrings; i++)
+		if (PR_IsValidString (qcvm->knownstrings[i]) && PR_FindKnownString (qcvm->knownstrings[i]) < 0)
+			PR_InsertKnownString (i);
+}
+
 static int PR_AllocStringSlot (void)
 {
 	ptrdiff_t i;
@@ -2210,6 +2632,8 @@ static int PR_AllocStringSlot (void)
 			qcvm->maxknownstrings += PR_STRING_ALLOCSLOTS;
 			Con_DPrintf2 ("PR_AllocStringSlot: realloc'ing for %d slots\n", qcvm->maxknownstrings);
 			qcvm->knownstrings = (const char **) Z_Realloc ((void *)qcvm->knownstrings, qcvm->maxknownstrings * sizeof(char *));
+			qcvm->knownstrings[i] = NULL;
+			PR_RehashKnownStrings ();
 		}
 	}
 
@@ -2226,6 +2650,20 @@ static qboolean PR_IsValidString (const char *p)
 	return d >= qcvm->maxknownstrings * sizeof (*qcvm->knownstrings);
 }
 
+/*
+=================
+PR_SetKnownString
+
+Puts s in a slot returned by PR_AllocStringSlot
+=================
+*/
+static void PR_SetKnownString (int slot, const char *s)
+{
+	qcvm->knownstrings[slot] = s;
+	if (PR_FindKnownString (s) < 0)
+		PR_InsertKnownString (slot);
+}
+
 const char *PR_GetString (int num)
 {
 	if (num >= 0 && num < qcvm->stringssize)
@@ -2251,6 +2689,8 @@ void PR_ClearEngineString (int num)
 	if (num < 0 && num >= -qcvm->numknownstrings)
 	{
 		num = -1 - num;
+		if (PR_IsValidString (qcvm->knownstrings[num]))
+			PR_RemoveKnownString (num);
 		qcvm->knownstrings[num] = (const char*) qcvm->firstfreeknownstring;
 		qcvm->firstfreeknownstring = &qcvm->knownstrings[num];
 	}
@@ -2269,15 +2709,14 @@ int PR_SetEngineString (const char *s)
 	if (s >= qcvm->strings && s <= qcvm->strings + qcvm->stringssize - 2)
 		return (int)(s - qcvm->strings);
 #endif
-	for (i = 0; i < qcvm->numknownstrings; i++)
-	{
-		if (qcvm->knownstrings[i] == s)
-			return -1 - i;
-	}
+	qcvm->stringstats.lookups++;
+	i = PR_FindKnownString (s);
+	if (i >= 0)
+		return -1 - i;
 	// new unknown engine string
 	//Con_DPrintf ("PR_SetEngineString: new engine string %p\n", s);
 	i = PR_AllocStringSlot ();
-	qcvm->knownstrings[i] = s;
+	PR_SetKnownString (i, s);
 	return -1 - i;
 }
 
@@ -2288,12 +2727,327 @@ int PR_AllocString (int size, char **ptr)
 	if (!size)
 		return 0;
 	i = PR_AllocStringSlot ();
-	qcvm->knownstrings[i] = (char *)Hunk_AllocName(size, "string");
+	PR_SetKnownString (i, (char *)Hunk_AllocName(size, "string"));
 	if (ptr)
 		*ptr = (char *) qcvm->knownstrings[i];
 	return -1 - i;
 }
 
+/*
+=================
+PR_SetTempString
+
+Temp strings cycle through a fixed set of slots, so a temp string stays valid
+until PR_MAX_TEMPSTRINGS more have been made, and they don't use up new slots
+=================
+*/
+int PR_SetTempString (const char *s)
+{
+	int		*slot;
+
+	if (s >= qcvm->strings && s <= qcvm->strings + qcvm->stringssize - 2)
+		return (int)(s - qcvm->strings);
+
+	qcvm->stringstats.tempstrings++;
+	slot = &qcvm->tempstringslots[qcvm->tempstringnext];
+	qcvm->tempstringnext = (qcvm->tempstringnext + 1) % PR_MAX_TEMPSTRINGS;
+
+	if (!*slot)
+		*slot = 1 + PR_AllocStringSlot ();
+	else if (PR_IsValidString (qcvm->knownstrings[*slot - 1]))
+		PR_RemoveKnownString (*slot - 1);
+	PR_SetKnownString (*slot - 1, s);
+
+	return -*slot;
+}
+
+/*
+===============================================================================
+
+ZONED STRINGS
+
+Strings made with strzone (and rezoned fields/autocvars) live in a dedicated
+arena, with size classes and free lists instead of individual zone allocations.
+Every strzone gets its own copy and string number, so unzoning one twice can't
+release a string somebody else still uses.
+
+===============================================================================
+*/
+
+#define PR_ZONE_MINSHIFT		5			// 32 bytes
+#define PR_ZONE_NUMCLASSES		8			// up to 4096 bytes, larger strings are malloc'ed
+#define PR_ZONE_BLOCKSIZE		(64 * 1024)
+
+typedef struct przonestr_s
+{
+	struct przonestr_s	*next;		// live list, or free list
+	struct przonestr_s	*prev;		// live list
+	int					slot;
+	int					sizeclass;	// -1 if malloc'ed
+	char				str[1];
+} przonestr_t;
+
+typedef struct prstrarena_s
+{
+	przonestr_t		*live;
+	int				numstrings;
+	int				numlarge;
+	size_t			usedbytes;			// in strings that are still zoned
+	byte			**blocks;			// VEC
+	byte			*blockcursor;
+	byte			*blockend;
+	przonestr_t		*freelist[PR_ZONE_NUMCLASSES];
+} prstrarena_t;
+
+static przonestr_t *PR_ZoneStringHeader (const char *s)
+{
+	return (przonestr_t *) (s - offsetof (przonestr_t, str));
+}
+
+static qboolean PR_IsZonedString (int num)
+{
+	size_t id = -1 - num;
+	return num < 0 && id < qcvm->knownzonesize && (qcvm->knownzone[id>>3] & (1u<<(id&7)));
+}
+
+static void PR_SetZonedBit (int num, qboolean zoned)
+{
+	size_t id = -1 - num;
+
+	if (zoned)
+	{
+		if (id >= qcvm->knownzonesize)
+		{
+			qcvm->knownzonesize = (id+32)&~7;
+			qcvm->knownzone = Z_Realloc(qcvm->knownzone, (qcvm->knownzonesize+7)>>3);
+		}
+		qcvm->knownzone[id>>3] |= 1u<<(id&7);
+	}
+	else
+		qcvm->knownzone[id>>3] &= ~(1u<<(id&7));
+}
+
+static przonestr_t *PR_AllocZoneString (prstrarena_t *arena, size_t size)
+{
+	przonestr_t	*z;
+	int			sizeclass;
+
+	size += offsetof (przonestr_t, str);
+	for (sizeclass = 0; sizeclass < PR_ZONE_NUMCLASSES; sizeclass++)
+		if (size <= (size_t)1 << (sizeclass + PR_ZONE_MINSHIFT))
+			break;
+
+	if (sizeclass == PR_ZONE_NUMCLASSES)
+	{
+		z = (przonestr_t *) malloc (size);
+		if (!z)
+			Sys_Error ("PR_AllocZoneString: failed to allocate %" SDL_PRIu64 " bytes", (uint64_t)size);
+		z->sizeclass = -1;
+		arena->numlarge++;
+		return z;
+	}
+
+	if (arena->freelist[sizeclass])
+	{
+		z = arena->freelist[sizeclass];
+		arena->freelist[sizeclass] = z->next;
+	}
+	else
+	{
+		size = (size_t)1 << (sizeclass + PR_ZONE_MINSHIFT);
+		if (arena->blockcursor + size > arena->blockend)
+		{
+			byte *block = (byte *) malloc (PR_ZONE_BLOCKSIZE);
+			if (!block)
+				Sys_Error ("PR_AllocZoneString: out of memory");
+			VEC_PUSH (arena->blocks, block);
+			arena->blockcursor = block;
+			arena->blockend = block + PR_ZONE_BLOCKSIZE;
+		}
+		z = (przonestr_t *) arena->blockcursor;
+		arena->blockcursor += size;
+	}
+	z->sizeclass = sizeclass;
+
+	return z;
+}
+
+/*
+=================
+PR_ZoneString
+
+Returns a zoned copy of s, which has to be released with PR_UnzoneString
+=================
+*/
+int PR_ZoneString (const char *s)
+{
+	prstrarena_t	*arena = qcvm->strarena;
+	przonestr_t		*z;
+	size_t			len;
+
+	qcvm->stringstats.zoned++;
+
+	if (!arena)
+	{
+		arena = qcvm->strarena = (prstrarena_t *) calloc (1, sizeof (*arena));
+		if (!arena)
+			Sys_Error ("PR_ZoneString: out of memory");
+	}
+
+	len = strlen (s) + 1;
+	z = PR_AllocZoneString (arena, len);
+	memcpy (z->str, s, len);
+	z->slot = PR_AllocStringSlot ();
+	PR_SetKnownString (z->slot, z->str);
+	PR_SetZonedBit (-1 - z->slot, true);
+
+	z->prev = NULL;
+	z->next = arena->live;
+	if (arena->live)
+		arena->live->prev = z;
+	arena->live = z;
+	arena->numstrings++;
+	arena->usedbytes += len;
+
+	return -1 - z->slot;
+}
+
+/*
+=================
+PR_UnzoneString
+
+Returns false if num wasn't a zoned string
+=================
+*/
+qboolean PR_UnzoneString (int num)
+{
+	prstrarena_t	*arena = qcvm->strarena;
+	przonestr_t		*z;
+
+	if (!arena || !PR_IsZonedString (num))
+		return false;
+
+	qcvm->stringstats.unzoned++;
+	z = PR_ZoneStringHeader (PR_GetString (num));
+
+	if (z->prev)
+		z->prev->next = z->next;
+	else
+		arena->live = z->next;
+	if (z->next)
+		z->next->prev = z->prev;
+	arena->numstrings--;
+	arena->usedbytes -= strlen (z->str) + 1;
+
+	PR_SetZonedBit (num, false);
+	PR_ClearEngineString (num);
+
+	if (z->sizeclass < 0)
+	{
+		arena->numlarge--;
+		free (z);
+	}
+	else
+	{
+		z->next = arena->freelist[z->sizeclass];
+		arena->freelist[z->sizeclass] = z;
+	}
+
+	return true;
+}
+
+/*
+=================
+PR_FreeStringArena
+
+Releases all the zoned strings at once
+=================
+*/
+static void PR_FreeStringArena (void)
+{
+	prstrarena_t	*arena = qcvm->strarena;
+	int				i;
+
+	if (!arena)
+		return;
+
+	while (arena->live)
+	{
+		przonestr_t *z = arena->live;
+		arena->live = z->next;
+		if (qcvm->knownstrings)
+			PR_ClearEngineString (-1 - z->slot);
+		if (z->sizeclass < 0)
+			free (z);
+	}
+	for (i = 0; i < (int) VEC_SIZE (arena->blocks); i++)
+		free (arena->blocks[i]);
+	VEC_FREE (arena->blocks);
+	free (arena);
+	qcvm->strarena = NULL;
+}
+
+/*
+=================
+PR_StringStats_f
+
+pr_stringstats [reset]
+=================
+*/
+static void PR_PrintStringStats (const char *name, qcvm_t *vm)
+{
+	prstringstats_t	*st = &vm->stringstats;
+	prstrarena_t	*arena = vm->strarena;
+	double			elapsed = q_max (Sys_DoubleTime () - st->starttime, 0.001);
+	size_t			reserved = 0, freebytes = 0;
+	int				i, freeslots = 0;
+	const char		**p;
+
+	for (p = vm->firstfreeknownstring; p; p = (const char **) *p)
+		freeslots++;
+
+	Con_Printf ("%s: %d known strings (%d free, %d allocated)\n", name, vm->numknownstrings - freeslots, freeslots, vm->maxknownstrings);
+	if (arena)
+	{
+		reserved = VEC_SIZE (arena->blocks) * PR_ZONE_BLOCKSIZE;
+		for (i = 0; i < PR_ZONE_NUMCLASSES; i++)
+		{
+			przonestr_t *z;
+			for (z = arena->freelist[i]; z; z = z->next)
+				freebytes += (size_t)1 << (i + PR_ZONE_MINSHIFT);
+		}
+		Con_Printf ("  zoned: %d strings, %" SDL_PRIu64 " bytes (%d large)\n", arena->numstrings, (uint64_t)arena->usedbytes, arena->numlarge);
+		Con_Printf ("  arena: %" SDL_PRIu64 "K in %d blocks, %" SDL_PRIu64 "K on free lists\n",
+			(uint64_t)reserved / 1024, (int) VEC_SIZE (arena->blocks), (uint64_t)freebytes / 1024);
+	}
+	Con_Printf ("  over %.1fs:\n", elapsed);
+	Con_Printf ("  %8d temp strings (%.0f/s, %d bytes avg)\n", st->tempstrings, st->tempstrings / elapsed,
+		st->tempstrings ? st->tempbytes / st->tempstrings : 0);
+	Con_Printf ("  %8d strzone (%.0f/s)\n", st->zoned, st->zoned / elapsed);
+	Con_Printf ("  %8d strunzone (%.0f/s)\n", st->unzoned, st->unzoned / elapsed);
+	Con_Printf ("  %8d engine string lookups (%.0f/s)\n", st->lookups, st->lookups / elapsed);
+}
+
+void PR_StringStats_f (void)
+{
+	qboolean reset = Cmd_Argc () >= 2 && !q_strcasecmp (Cmd_Argv (1), "reset");
+
+	if (reset)
+	{
+		memset (&sv.qcvm.stringstats, 0, sizeof (sv.qcvm.stringstats));
+		memset (&cl.qcvm.stringstats, 0, sizeof (cl.qcvm.stringstats));
+		sv.qcvm.stringstats.starttime = cl.qcvm.stringstats.starttime = Sys_DoubleTime ();
+		return;
+	}
+
+	if (sv.qcvm.progs)
+		PR_PrintStringStats ("server", &sv.qcvm);
+	if (cl.qcvm.progs)
+		PR_PrintStringStats ("client", &cl.qcvm);
+	if (!sv.qcvm.progs && !cl.qcvm.progs)
+		Con_Printf ("no progs loaded\n");
+}
+
 //===========================================================================
 
 void SaveData_Init (savedata_t *save)
@@ -20,6 +20,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 */
 
 #include "quakedef.h"
+#include <setjmp.h>
+
+cvar_t	pr_predecode = {"pr_predecode", "1", CVAR_NONE};
+cvar_t	pr_verify = {"pr_verify", "0", CVAR_NONE};
 
 static const char *pr_opnames[] =
 {
@@ -255,6 +259,577 @@ void PR_Profile_f (void)
 }
 
 
+/*
+============
+PR_FusionStats_f
+
+Lists how many statements were fused into superinstructions per function
+============
+*/
+typedef struct
+{
+	int		first;
+	int		total;
+	int		fused;
+	dfunction_t	*f;
+} prfusionstat_t;
+
+static int PR_CompareFusionStatStart (const void *pa, const void *pb)
+{
+	const prfusionstat_t *a = (const prfusionstat_t *) pa;
+	const prfusionstat_t *b = (const prfusionstat_t *) pb;
+	return a->first - b->first;
+}
+
+static int PR_CompareFusionStatCount (const void *pa, const void *pb)
+{
+	const prfusionstat_t *a = (const prfusionstat_t *) pa;
+	const prfusionstat_t *b = (const prfusionstat_t *) pb;
+	if (a->fused != b->fused)
+		return b->fused - a->fused;
+	return a->first - b->first;
+}
+
+void PR_FusionStats_f (void)
+{
+	static const char *const kindnames[OPX_NUMFUSED] =
+	{
+		"LOAD+IF",
+		"LOAD+IFNOT",
+		"ADDRESS+STOREP",
+		"ADDRESS+STOREP_V",
+		"MUL_F+ADD_F",
+		"STORE+CALL",
+		"STORE_V+CALL",
+	};
+	int				kinds[OPX_NUMFUSED];
+	prfusionstat_t	*stats;
+	int				i, j, count, end, maxlines, totalfused, fallback;
+
+	if (!sv.active)
+		return;
+
+	PR_SwitchQCVM(&sv.qcvm);
+
+	if (!qcvm->code)
+	{
+		Con_Printf ("No pre-decoded code available\n");
+		PR_SwitchQCVM(NULL);
+		return;
+	}
+
+	maxlines = Cmd_Argc () >= 2 ? Q_atoi (Cmd_Argv (1)) : 20;
+
+	stats = (prfusionstat_t *) malloc (qcvm->progs->numfunctions * sizeof (*stats));
+	count = 0;
+	for (i = 0; i < qcvm->progs->numfunctions; i++)
+	{
+		dfunction_t *f = &qcvm->functions[i];
+		if (f->first_statement <= 0)
+			continue;
+		stats[count].first = f->first_statement;
+		stats[count].f = f;
+		count++;
+	}
+
+	// function bodies are contiguous, so each one ends where the next one starts
+	qsort (stats, count, sizeof (*stats), PR_CompareFusionStatStart);
+	memset (kinds, 0, sizeof (kinds));
+	totalfused = fallback = 0;
+	for (i = 0; i < count; i++)
+	{
+		end = i + 1 < count ? stats[i + 1].first : qcvm->progs->numstatements;
+		stats[i].total = end - stats[i].first;
+		stats[i].fused = 0;
+		for (j = stats[i].first; j < end; j++)
+		{
+			int op = qcvm->code[j].op;
+			if (op >= OP_NUMOPS && op < OPX_FALLBACK)
+			{
+				kinds[op - OP_NUMOPS]++;
+				stats[i].fused += 2;
+			}
+		}
+		totalfused += stats[i].fused;
+		if (qcvm->code[stats[i].first].op == OPX_FALLBACK)
+			fallback++;
+	}
+
+	qsort (stats, count, sizeof (*stats), PR_CompareFusionStatCount);
+	Con_Printf ("fused  stmts  function\n");
+	for (i = 0; i < count && i < maxlines && stats[i].fused; i++)
+		Con_Printf ("%5i  %5i  %s\n", stats[i].fused, stats[i].total, PR_GetString (stats[i].f->s_name));
+
+	Con_Printf ("\n");
+	for (i = 0; i < OPX_NUMFUSED; i++)
+		Con_Printf ("%7i %s\n", kinds[i], kindnames[i]);
+	Con_Printf ("%i of %i statements fused (%.1f%%)\n", totalfused, qcvm->progs->numstatements,
+		100.0 * totalfused / q_max (qcvm->progs->numstatements, 1));
+	if (fallback)
+		Con_Printf ("%i functions run by the classic interpreter\n", fallback);
+
+	free (stats);
+
+	PR_SwitchQCVM(NULL);
+}
+
+
+/*
+==============================================================================
+
+HIERARCHICAL PROFILER
+
+Collects wall-clock time per call path (QC functions and builtins) in a call
+tree built at PR_EnterFunction/PR_LeaveFunction, so that inclusive/exclusive
+times, caller->callee edges and folded stacks can all be derived from it.
+==============================================================================
+*/
+
+#define PROF_MAX_FRAMES		(MAX_STACK_DEPTH * 2)	/* QC calls interleaved with builtins */
+
+typedef struct prprofnode_s
+{
+	int		func;			// index into qcvm->functions
+	int		parent;			// -1 for the root
+	int		child;			// first child, -1 if none
+	int		sibling;		// next child of the same parent, -1 if none
+	int		calls;
+	double	total;			// inclusive time
+	double	self;			// exclusive time
+} prprofnode_t;
+
+typedef struct prprofframe_s
+{
+	int		node;
+	double	start;
+	double	children;		// time spent in callees
+} prprofframe_t;
+
+typedef struct prprofiler_s
+{
+	prprofnode_t	*nodes;		// node 0 is the root
+	prprofframe_t	frames[PROF_MAX_FRAMES];
+	int				depth;
+	int				skipped;	// calls made while the frame stack was full
+	qboolean		active;
+	double			starttime;
+	double			elapsed;
+} prprofiler_t;
+
+/*
+============
+PR_ProfileChild
+
+Returns the child of the given node for func, creating it if needed
+============
+*/
+static int PR_ProfileChild (prprofiler_t *prof, int parent, int func)
+{
+	prprofnode_t	node;
+	int				i;
+
+	for (i = prof->nodes[parent].child; i != -1; i = prof->nodes[i].sibling)
+		if (prof->nodes[i].func == func)
+			return i;
+
+	memset (&node, 0, sizeof (node));
+	node.func = func;
+	node.parent = parent;
+	node.child = -1;
+	node.sibling = prof->nodes[parent].child;
+	VEC_PUSH (prof->nodes, node);
+
+	i = VEC_SIZE (prof->nodes) - 1;
+	prof->nodes[parent].child = i;
+	return i;
+}
+
+/*
+============
+PR_ProfileEnter
+============
+*/
+static void PR_ProfileEnter (dfunction_t *f)
+{
+	prprofiler_t	*prof = qcvm->profiler;
+	prprofframe_t	*frame;
+	int				parent;
+
+	if (!prof->active)
+		return;
+	if (prof->depth >= PROF_MAX_FRAMES)
+	{
+		prof->skipped++;
+		return;
+	}
+
+	parent = prof->depth ? prof->frames[prof->depth - 1].node : 0;
+	frame = &prof->frames[prof->depth++];
+	frame->node = PR_ProfileChild (prof, parent, f - qcvm->functions);
+	frame->children = 0.0;
+	frame->start = Sys_DoubleTime ();
+}
+
+/*
+============
+PR_ProfileLeave
+============
+*/
+static void PR_ProfileLeave (void)
+{
+	prprofiler_t	*prof = qcvm->profiler;
+	prprofframe_t	*frame;
+	prprofnode_t	*node;
+	double			elapsed;
+
+	if (prof->skipped)
+	{
+		prof->skipped--;
+		return;
+	}
+	if (!prof->active || !prof->depth)
+		return;
+
+	frame = &prof->frames[--prof->depth];
+	elapsed = Sys_DoubleTime () - frame->start;
+
+	node = &prof->nodes[frame->node];
+	node->calls++;
+	node->total += elapsed;
+	node->self += elapsed - frame->children;
+
+	if (prof->depth)
+		prof->frames[prof->depth - 1].children += elapsed;
+}
+
+/*
+============
+PR_ProfileBuiltin
+============
+*/
+static void PR_ProfileBuiltin (dfunction_t *f, builtin_t func)
+{
+	PR_ProfileEnter (f);
+	func ();
+	PR_ProfileLeave ();
+}
+
+/*
+============
+PR_FreeProfiler
+============
+*/
+void PR_FreeProfiler (qcvm_t *vm)
+{
+	if (!vm->profiler)
+		return;
+	VEC_FREE (vm->profiler->nodes);
+	free (vm->profiler);
+	vm->profiler = NULL;
+}
+
+/*
+============
+PR_ProfileReset
+============
+*/
+static void PR_ProfileReset (prprofiler_t *prof)
+{
+	prprofnode_t root;
+
+	memset (&root, 0, sizeof (root));
+	root.parent = -1;
+	root.child = -1;
+	root.sibling = -1;
+
+	VEC_CLEAR (prof->nodes);
+	VEC_PUSH (prof->nodes, root);
+	prof->depth = 0;
+	prof->skipped = 0;
+	prof->elapsed = 0.0;
+	prof->starttime = Sys_DoubleTime ();
+}
+
+typedef struct
+{
+	int		func;
+	int		callee;			// only used for edges
+	int		calls;
+	double	total;
+	double	self;
+} prprofstat_t;
+
+static int PR_CompareProfStatSelf (const void *pa, const void *pb)
+{
+	const prprofstat_t *a = (const prprofstat_t *) pa;
+	const prprofstat_t *b = (const prprofstat_t *) pb;
+	if (a->self != b->self)
+		return a->self < b->self ? 1 : -1;
+	return a->func - b->func;
+}
+
+static int PR_CompareProfStatTotal (const void *pa, const void *pb)
+{
+	const prprofstat_t *a = (const prprofstat_t *) pa;
+	const prprofstat_t *b = (const prprofstat_t *) pb;
+	if (a->total != b->total)
+		return a->total < b->total ? 1 : -1;
+	if (a->func != b->func)
+		return a->func - b->func;
+	return a->callee - b->callee;
+}
+
+static int PR_CompareProfStatEdge (const void *pa, const void *pb)
+{
+	const prprofstat_t *a = (const prprofstat_t *) pa;
+	const prprofstat_t *b = (const prprofstat_t *) pb;
+	if (a->func != b->func)
+		return a->func - b->func;
+	return a->callee - b->callee;
+}
+
+/*
+============
+PR_ProfileIsRecursive
+
+Returns true if func is already on the call path leading to the given node,
+in which case the node's inclusive time has already been accounted for
+============
+*/
+static qboolean PR_ProfileIsRecursive (prprofiler_t *prof, int node)
+{
+	int func = prof->nodes[node].func;
+	for (node = prof->nodes[node].parent; node > 0; node = prof->nodes[node].parent)
+		if (prof->nodes[node].func == func)
+			return true;
+	return false;
+}
+
+static const char *PR_ProfileFuncName (int func)
+{
+	dfunction_t *f = &qcvm->functions[func];
+	return f->first_statement < 0 ? va ("%s*", PR_GetString (f->s_name)) : PR_GetString (f->s_name);
+}
+
+/*
+============
+PR_ProfileReport
+
+Per-function call counts and inclusive/exclusive times (builtins are marked with *)
+============
+*/
+static void PR_ProfileReport (prprofiler_t *prof, int maxlines)
+{
+	prprofstat_t	*stats;
+	int				i, count;
+
+	stats = (prprofstat_t *) calloc (qcvm->progs->numfunctions, sizeof (*stats));
+	for (i = 0; i < qcvm->progs->numfunctions; i++)
+		stats[i].func = i;
+
+	for (i = 1; i < (int) VEC_SIZE (prof->nodes); i++)
+	{
+		prprofnode_t *node = &prof->nodes[i];
+		prprofstat_t *st = &stats[node->func];
+		st->calls += node->calls;
+		st->self += node->self;
+		if (!PR_ProfileIsRecursive (prof, i))
+			st->total += node->total;
+	}
+
+	qsort (stats, qcvm->progs->numfunctions, sizeof (*stats), PR_CompareProfStatSelf);
+
+	Con_Printf ("   calls    incl ms    self ms  function\n");
+	for (i = count = 0; i < qcvm->progs->numfunctions && count < maxlines; i++)
+	{
+		if (!stats[i].calls)
+			continue;
+		Con_Printf ("%8i %10.3f %10.3f  %s\n", stats[i].calls, stats[i].total * 1000.0, stats[i].self * 1000.0, PR_ProfileFuncName (stats[i].func));
+		count++;
+	}
+
+	free (stats);
+}
+
+/*
+============
+PR_ProfileEdges
+
+Caller->callee edges sorted by time spent in the callee
+============
+*/
+static void PR_ProfileEdges (prprofiler_t *prof, int maxlines)
+{
+	prprofstat_t	*edges;
+	int				i, j, count;
+
+	edges = (prprofstat_t *) calloc (VEC_SIZE (prof->nodes), sizeof (*edges));
+	for (i = 1, count = 0; i < (int) VEC_SIZE (prof->nodes); i++)
+	{
+		prprofnode_t *node = &prof->nodes[i];
+		if (node->parent <= 0)
+			continue;
+		edges[count].func = prof->nodes[node->parent].func;
+		edges[count].callee = node->func;
+		edges[count].calls = node->calls;
+		edges[count].total = PR_ProfileIsRecursive (prof, i) ? 0.0 : node->total;
+		count++;
+	}
+
+	// merge the edges coming from different call paths
+	qsort (edges, count, sizeof (*edges), PR_CompareProfStatEdge);
+	for (i = 0, j = -1; i < count; i++)
+	{
+		if (j >= 0 && edges[j].func == edges[i].func && edges[j].callee == edges[i].callee)
+		{
+			edges[j].calls += edges[i].calls;
+			edges[j].total += edges[i].total;
+		}
+		else
+			edges[++j] = edges[i];
+	}
+	count = j + 1;
+
+	qsort (edges, count, sizeof (*edges), PR_CompareProfStatTotal);
+
+	Con_Printf ("   calls    incl ms  caller -> callee\n");
+	for (i = 0; i < count && i < maxlines; i++)
+	{
+		Con_Printf ("%8i %10.3f  %s -> ", edges[i].calls, edges[i].total * 1000.0, PR_ProfileFuncName (edges[i].func));
+		Con_Printf ("%s\n", PR_ProfileFuncName (edges[i].callee));
+	}
+
+	free (edges);
+}
+
+/*
+============
+PR_ProfileDump
+
+Writes the call tree in the folded stack format used by flamegraph tools,
+one "caller;callee;... <exclusive microseconds>" line per call path
+============
+*/
+static void PR_ProfileDump (prprofiler_t *prof, const char *relname)
+{
+	char	name[MAX_OSPATH];
+	int		path[PROF_MAX_FRAMES];
+	int		i, j, len, lines;
+	FILE	*f;
+
+	q_snprintf (name, sizeof (name), "%s/%s", com_gamedir, relname);
+	f = Sys_fopen (name, "w");
+	if (!f)
+	{
+		Con_Printf ("ERROR: couldn't open file %s.\n", relname);
+		return;
+	}
+
+	for (i = 1, lines = 0; i < (int) VEC_SIZE (prof->nodes); i++)
+	{
+		long long usec = (long long) (prof->nodes[i].self * 1e6 + 0.5);
+		if (usec <= 0)
+			continue;
+
+		for (j = i, len = 0; j > 0 && len < PROF_MAX_FRAMES; j = prof->nodes[j].parent)
+			path[len++] = j;
+		while (len-- > 0)
+			fprintf (f, "%s%s", PR_ProfileFuncName (prof->nodes[path[len]].func), len ? ";" : "");
+		fprintf (f, " %lld\n", usec);
+		lines++;
+	}
+
+	fclose (f);
+	Con_Printf ("Wrote %i call paths to %s\n", lines, relname);
+}
+
+/*
+============
+PR_QCProfile_f
+
+qcprofile start|stop|clear|report [n]|edges [n]|dump [file]
+============
+*/
+void PR_QCProfile_f (void)
+{
+	prprofiler_t	*prof;
+	const char		*cmd = Cmd_Argv (1);
+	int				maxlines = Cmd_Argc () >= 3 ? Q_atoi (Cmd_Argv (2)) : 20;
+
+	if (Cmd_Argc () < 2)
+	{
+		Con_Printf ("usage: %s start|stop|clear|report [n]|edges [n]|dump [file]\n", Cmd_Argv (0));
+		return;
+	}
+
+	if (!sv.active)
+	{
+		Con_Printf ("No server running\n");
+		return;
+	}
+
+	PR_SwitchQCVM(&sv.qcvm);
+	prof = qcvm->profiler;
+
+	if (!q_strcasecmp (cmd, "start"))
+	{
+		if (!prof)
+			prof = qcvm->profiler = (prprofiler_t *) calloc (1, sizeof (prprofiler_t));
+		if (!prof->active)
+		{
+			PR_ProfileReset (prof);
+			prof->active = true;
+			Con_Printf ("QC profiling started\n");
+		}
+	}
+	else if (!prof)
+	{
+		Con_Printf ("QC profiling not started\n");
+	}
+	else if (!q_strcasecmp (cmd, "stop"))
+	{
+		if (prof->active)
+		{
+			prof->active = false;
+			prof->depth = 0;
+			prof->skipped = 0;
+			prof->elapsed = Sys_DoubleTime () - prof->starttime;
+			Con_Printf ("QC profiling stopped after %.1f seconds\n", prof->elapsed);
+		}
+	}
+	else if (!q_strcasecmp (cmd, "clear"))
+	{
+		qboolean active = prof->active;
+		PR_ProfileReset (prof);
+		prof->active = active;
+	}
+	else if (!q_strcasecmp (cmd, "report"))
+	{
+		PR_ProfileReport (prof, maxlines);
+	}
+	else if (!q_strcasecmp (cmd, "edges"))
+	{
+		PR_ProfileEdges (prof, maxlines);
+	}
+	else if (!q_strcasecmp (cmd, "dump"))
+	{
+		char relname[MAX_OSPATH];
+		q_strlcpy (relname, Cmd_Argc () >= 3 ? Cmd_Argv (2) : "qcprofile.txt", sizeof (relname));
+		COM_AddExtension (relname, ".txt", sizeof (relname));
+		PR_ProfileDump (prof, relname);
+	}
+	else
+	{
+		Con_Printf ("Unknown qcprofile command \"%s\"\n", cmd);
+	}
+
+	PR_SwitchQCVM(NULL);
+}
+
+
+static THREAD_LOCAL struct prisolatedvm_s *pr_isolatedvm;	// set while PR_ExecuteIsolated runs a call
+static void PR_AbortIsolated (void);
+
 /*
 ============
 PR_RunError
@@ -271,6 +846,9 @@ void PR_RunError (const char *error, ...)
 	q_vsnprintf (string, sizeof(string), error, argptr);
 	va_end (argptr);
 
+	if (pr_isolatedvm)
+		PR_AbortIsolated ();	// the normal run of the call reports it
+
 	PR_PrintStatement(qcvm->statements + qcvm->xstatement);
 	PR_StackTrace();
 
@@ -318,6 +896,9 @@ static int PR_EnterFunction (dfunction_t *f)
 		}
 	}
 
+	if (qcvm->profiler)
+		PR_ProfileEnter (f);
+
 	qcvm->xfunction = f;
 	return f->first_statement - 1;	// offset the s++
 }
@@ -334,6 +915,9 @@ static int PR_LeaveFunction (void)
 	if (qcvm->depth <= 0)
 		Host_Error("prog stack underflow");
 
+	if (qcvm->profiler)
+		PR_ProfileLeave ();
+
 	// Restore locals from the stack
 	c = qcvm->xfunction->locals;
 	qcvm->localstack_used -= c;
@@ -370,6 +954,8 @@ static void PR_CheckBuiltinExtension (dfunction_t *func)
 
 	if (GetBit (qcvm->warned_builtin[checked], builtin))
 		return;
+	if (pr_isolatedvm)
+		PR_AbortIsolated ();	// leave the warning to the normal run
 	SetBit (qcvm->warned_builtin[checked], builtin);
 
 	Con_DWarning (checked ?
@@ -383,39 +969,58 @@ static void PR_CheckBuiltinExtension (dfunction_t *func)
 
 /*
 ====================
-PR_ExecuteProgram
+PR_WatchField
 
-The interpretation main loop
+Lets the server entity index know when QC takes the address of a field it
+keeps track of (see SV_EdictChanged)
 ====================
 */
-#define OPA ((eval_t *)&qcvm->globals[(unsigned short)st->a])
-#define OPB ((eval_t *)&qcvm->globals[(unsigned short)st->b])
-#define OPC ((eval_t *)&qcvm->globals[(unsigned short)st->c])
-
-void PR_ExecuteProgram (func_t fnum)
+static inline void PR_WatchField (edict_t *ed, int ofs)
 {
-	eval_t		*ptr;
-	dstatement_t	*st;
-	dfunction_t	*f, *newf;
-	int profile, startprofile;
-	edict_t		*ed;
-	int		exitdepth;
+	if ((unsigned int)ofs < (unsigned int)qcvm->progs->entityfields && qcvm->fieldwatch[ofs])
+		SV_EdictChanged (ed);
+}
 
-	if (!fnum || fnum >= qcvm->progs->numfunctions)
-	{
-		if (pr_global_struct->self)
-			ED_Print (PROG_TO_EDICT(pr_global_struct->self));
-		Host_Error ("PR_ExecuteProgram: NULL function");
-	}
+static qcvm_t *pr_verifyvm;	// vm whose builtin calls go through PR_VerifyBuiltin
+static void PR_VerifyBuiltin (dfunction_t *f, builtin_t func);
 
-	f = &qcvm->functions[fnum];
+/*
+====================
+PR_CallBuiltin
 
-	qcvm->trace = false;
+Used by both interpreters
+====================
+*/
+static void PR_CallBuiltin (dfunction_t *f, builtin_t func)
+{
+	PR_CheckBuiltinExtension (f);
+	if (pr_verifyvm == qcvm)
+		PR_VerifyBuiltin (f, func);
+	else if (qcvm->profiler)
+		PR_ProfileBuiltin (f, func);
+	else
+		func ();
+}
 
-// make a stack frame
-	exitdepth = qcvm->depth;
+/*
+====================
+PR_ExecuteSwitch
+
+The classic interpretation main loop, decoding every statement as it goes.
+st points to the statement before the first one to execute.
+====================
+*/
+#define OPA ((eval_t *)&qcvm->globals[(unsigned short)st->a])
+#define OPB ((eval_t *)&qcvm->globals[(unsigned short)st->b])
+#define OPC ((eval_t *)&qcvm->globals[(unsigned short)st->c])
+
+static void PR_ExecuteSwitch (dstatement_t *st, int exitdepth)
+{
+	eval_t		*ptr;
+	dfunction_t	*newf;
+	int profile, startprofile;
+	edict_t		*ed;
 
-	st = &qcvm->statements[PR_EnterFunction(f)];
 	startprofile = profile = 0;
 
     while (1)
@@ -592,6 +1197,7 @@ void PR_ExecuteProgram (func_t fnum)
 			PR_RunError("assignment to world entity");
 		}
 		OPC->_int = (byte *)((int *)&ed->v + OPB->_int) - (byte *)qcvm->edicts;
+		PR_WatchField (ed, OPB->_int);
 		break;
 
 	case OP_LOAD_F:
@@ -652,8 +1258,7 @@ void PR_ExecuteProgram (func_t fnum)
 			int i = -newf->first_statement;
 			if (i >= qcvm->numbuiltins)
 				PR_RunError("Bad builtin call number %d", i);
-			PR_CheckBuiltinExtension (newf);
-			qcvm->builtins[i]();
+			PR_CallBuiltin (newf, qcvm->builtins[i]);
 			break;
 		}
 		// Normal function
@@ -692,3 +1297,2044 @@ void PR_ExecuteProgram (func_t fnum)
 #undef OPA
 #undef OPB
 #undef OPC
+
+/*
+====================
+PR_ExecuteCode
+
+Interpretation loop for the pre-decoded statements built by PR_TranslateProgram.
+Operands are already resolved to global addresses and, when the compiler supports
+computed gotos, each handler jumps straight to the next one (direct threading).
+The runaway counter is only checked on branches and calls, since straight-line
+code can't loop by itself.
+
+If tracing gets enabled by a builtin, execution is handed over to PR_ExecuteSwitch.
+Calling it with a NULL statement links the code to the handlers instead.
+====================
+*/
+#if defined(__GNUC__) && !defined(PR_NO_COMPUTED_GOTO)
+	#define PR_DIRECT_THREADED	1
+#else
+	#define PR_DIRECT_THREADED	0
+#endif
+
+#if PR_DIRECT_THREADED
+	#define PR_CASE(op)			lbl_##op
+	#define PR_DEFAULT			lbl_bad
+	#define PR_NEXT()			do { ++profile; goto *(++st)->handler; } while (0)
+#else
+	#define PR_CASE(op)			case op
+	#define PR_DEFAULT			default
+	#define PR_NEXT()			do { ++profile; ++st; goto dispatch; } while (0)
+#endif
+
+#define OPA (st->a)
+#define OPB (st->b)
+#define OPC (st->c)
+
+#define PR_CHECK_RUNAWAY()								\
+	do {												\
+		if (profile > 0x1000000)						\
+		{												\
+			qcvm->xstatement = st - qcvm->code;			\
+			PR_RunError("runaway loop error");			\
+		}												\
+	} while (0)
+
+static void PR_ExecuteCode (prinstr_t *st, int exitdepth)
+{
+	eval_t		*ptr;
+	dfunction_t	*newf;
+	int profile, startprofile;
+	edict_t		*ed;
+	prinstr_t	*code;
+
+#if PR_DIRECT_THREADED
+	static const void *const handlers[OPX_NUMOPS] =
+	{
+		[OP_DONE]		= &&lbl_OP_DONE,
+		[OP_MUL_F]		= &&lbl_OP_MUL_F,
+		[OP_MUL_V]		= &&lbl_OP_MUL_V,
+		[OP_MUL_FV]		= &&lbl_OP_MUL_FV,
+		[OP_MUL_VF]		= &&lbl_OP_MUL_VF,
+		[OP_DIV_F]		= &&lbl_OP_DIV_F,
+		[OP_ADD_F]		= &&lbl_OP_ADD_F,
+		[OP_ADD_V]		= &&lbl_OP_ADD_V,
+		[OP_SUB_F]		= &&lbl_OP_SUB_F,
+		[OP_SUB_V]		= &&lbl_OP_SUB_V,
+		[OP_EQ_F]		= &&lbl_OP_EQ_F,
+		[OP_EQ_V]		= &&lbl_OP_EQ_V,
+		[OP_EQ_S]		= &&lbl_OP_EQ_S,
+		[OP_EQ_E]		= &&lbl_OP_EQ_E,
+		[OP_EQ_FNC]		= &&lbl_OP_EQ_FNC,
+		[OP_NE_F]		= &&lbl_OP_NE_F,
+		[OP_NE_V]		= &&lbl_OP_NE_V,
+		[OP_NE_S]		= &&lbl_OP_NE_S,
+		[OP_NE_E]		= &&lbl_OP_NE_E,
+		[OP_NE_FNC]		= &&lbl_OP_NE_FNC,
+		[OP_LE]			= &&lbl_OP_LE,
+		[OP_GE]			= &&lbl_OP_GE,
+		[OP_LT]			= &&lbl_OP_LT,
+		[OP_GT]			= &&lbl_OP_GT,
+		[OP_LOAD_F]		= &&lbl_OP_LOAD_F,
+		[OP_LOAD_V]		= &&lbl_OP_LOAD_V,
+		[OP_LOAD_S]		= &&lbl_OP_LOAD_S,
+		[OP_LOAD_ENT]	= &&lbl_OP_LOAD_ENT,
+		[OP_LOAD_FLD]	= &&lbl_OP_LOAD_FLD,
+		[OP_LOAD_FNC]	= &&lbl_OP_LOAD_FNC,
+		[OP_ADDRESS]	= &&lbl_OP_ADDRESS,
+		[OP_STORE_F]	= &&lbl_OP_STORE_F,
+		[OP_STORE_V]	= &&lbl_OP_STORE_V,
+		[OP_STORE_S]	= &&lbl_OP_STORE_S,
+		[OP_STORE_ENT]	= &&lbl_OP_STORE_ENT,
+		[OP_STORE_FLD]	= &&lbl_OP_STORE_FLD,
+		[OP_STORE_FNC]	= &&lbl_OP_STORE_FNC,
+		[OP_STOREP_F]	= &&lbl_OP_STOREP_F,
+		[OP_STOREP_V]	= &&lbl_OP_STOREP_V,
+		[OP_STOREP_S]	= &&lbl_OP_STOREP_S,
+		[OP_STOREP_ENT]	= &&lbl_OP_STOREP_ENT,
+		[OP_STOREP_FLD]	= &&lbl_OP_STOREP_FLD,
+		[OP_STOREP_FNC]	= &&lbl_OP_STOREP_FNC,
+		[OP_RETURN]		= &&lbl_OP_RETURN,
+		[OP_NOT_F]		= &&lbl_OP_NOT_F,
+		[OP_NOT_V]		= &&lbl_OP_NOT_V,
+		[OP_NOT_S]		= &&lbl_OP_NOT_S,
+		[OP_NOT_ENT]	= &&lbl_OP_NOT_ENT,
+		[OP_NOT_FNC]	= &&lbl_OP_NOT_FNC,
+		[OP_IF]			= &&lbl_OP_IF,
+		[OP_IFNOT]		= &&lbl_OP_IFNOT,
+		[OP_CALL0]		= &&lbl_OP_CALL0,
+		[OP_CALL1]		= &&lbl_OP_CALL1,
+		[OP_CALL2]		= &&lbl_OP_CALL2,
+		[OP_CALL3]		= &&lbl_OP_CALL3,
+		[OP_CALL4]		= &&lbl_OP_CALL4,
+		[OP_CALL5]		= &&lbl_OP_CALL5,
+		[OP_CALL6]		= &&lbl_OP_CALL6,
+		[OP_CALL7]		= &&lbl_OP_CALL7,
+		[OP_CALL8]		= &&lbl_OP_CALL8,
+		[OP_STATE]		= &&lbl_OP_STATE,
+		[OP_GOTO]		= &&lbl_OP_GOTO,
+		[OP_AND]		= &&lbl_OP_AND,
+		[OP_OR]			= &&lbl_OP_OR,
+		[OP_BITAND]		= &&lbl_OP_BITAND,
+		[OP_BITOR]		= &&lbl_OP_BITOR,
+
+		[OPX_LOAD_IF]			= &&lbl_OPX_LOAD_IF,
+		[OPX_LOAD_IFNOT]		= &&lbl_OPX_LOAD_IFNOT,
+		[OPX_ADDRESS_STOREP]	= &&lbl_OPX_ADDRESS_STOREP,
+		[OPX_ADDRESS_STOREP_V]	= &&lbl_OPX_ADDRESS_STOREP_V,
+		[OPX_MUL_ADD_F]			= &&lbl_OPX_MUL_ADD_F,
+		[OPX_STORE_CALL]		= &&lbl_OPX_STORE_CALL,
+		[OPX_STORE_V_CALL]		= &&lbl_OPX_STORE_V_CALL,
+		[OPX_FALLBACK]			= &&lbl_OPX_FALLBACK,
+	};
+
+	if (!st)
+	{
+		int i;
+		for (i = 0; i < qcvm->progs->numstatements; i++)
+		{
+			prinstr_t *in = &qcvm->code[i];
+			if ((unsigned int)in->op < OPX_NUMOPS && handlers[in->op])
+				in->handler = handlers[in->op];
+			else
+				in->handler = &&lbl_bad;
+		}
+		return;
+	}
+#else
+	if (!st)
+		return;
+#endif
+
+	code = qcvm->code;
+	startprofile = profile = 0;
+
+	PR_NEXT ();
+
+#if !PR_DIRECT_THREADED
+dispatch:
+	switch (st->op)
+	{
+#endif
+	PR_CASE(OP_ADD_F):
+		OPC->_float = OPA->_float + OPB->_float;
+		PR_NEXT ();
+	PR_CASE(OP_ADD_V):
+		OPC->vector[0] = OPA->vector[0] + OPB->vector[0];
+		OPC->vector[1] = OPA->vector[1] + OPB->vector[1];
+		OPC->vector[2] = OPA->vector[2] + OPB->vector[2];
+		PR_NEXT ();
+
+	PR_CASE(OP_SUB_F):
+		OPC->_float = OPA->_float - OPB->_float;
+		PR_NEXT ();
+	PR_CASE(OP_SUB_V):
+		OPC->vector[0] = OPA->vector[0] - OPB->vector[0];
+		OPC->vector[1] = OPA->vector[1] - OPB->vector[1];
+		OPC->vector[2] = OPA->vector[2] - OPB->vector[2];
+		PR_NEXT ();
+
+	PR_CASE(OP_MUL_F):
+		OPC->_float = OPA->_float * OPB->_float;
+		PR_NEXT ();
+	PR_CASE(OP_MUL_V):
+		OPC->_float = OPA->vector[0] * OPB->vector[0] +
+			      OPA->vector[1] * OPB->vector[1] +
+			      OPA->vector[2] * OPB->vector[2];
+		PR_NEXT ();
+	PR_CASE(OP_MUL_FV):
+		OPC->vector[0] = OPA->_float * OPB->vector[0];
+		OPC->vector[1] = OPA->_float * OPB->vector[1];
+		OPC->vector[2] = OPA->_float * OPB->vector[2];
+		PR_NEXT ();
+	PR_CASE(OP_MUL_VF):
+		OPC->vector[0] = OPB->_float * OPA->vector[0];
+		OPC->vector[1] = OPB->_float * OPA->vector[1];
+		OPC->vector[2] = OPB->_float * OPA->vector[2];
+		PR_NEXT ();
+
+	PR_CASE(OP_DIV_F):
+		OPC->_float = OPA->_float / OPB->_float;
+		PR_NEXT ();
+
+	PR_CASE(OP_BITAND):
+		OPC->_float = (int)OPA->_float & (int)OPB->_float;
+		PR_NEXT ();
+
+	PR_CASE(OP_BITOR):
+		OPC->_float = (int)OPA->_float | (int)OPB->_float;
+		PR_NEXT ();
+
+	PR_CASE(OP_GE):
+		OPC->_float = OPA->_float >= OPB->_float;
+		PR_NEXT ();
+	PR_CASE(OP_LE):
+		OPC->_float = OPA->_float <= OPB->_float;
+		PR_NEXT ();
+	PR_CASE(OP_GT):
+		OPC->_float = OPA->_float > OPB->_float;
+		PR_NEXT ();
+	PR_CASE(OP_LT):
+		OPC->_float = OPA->_float < OPB->_float;
+		PR_NEXT ();
+	PR_CASE(OP_AND):
+		OPC->_float = OPA->_float && OPB->_float;
+		PR_NEXT ();
+	PR_CASE(OP_OR):
+		OPC->_float = OPA->_float || OPB->_float;
+		PR_NEXT ();
+
+	PR_CASE(OP_NOT_F):
+		OPC->_float = !OPA->_float;
+		PR_NEXT ();
+	PR_CASE(OP_NOT_V):
+		OPC->_float = !OPA->vector[0] && !OPA->vector[1] && !OPA->vector[2];
+		PR_NEXT ();
+	PR_CASE(OP_NOT_S):
+		OPC->_float = !OPA->string || !*PR_GetString(OPA->string);
+		PR_NEXT ();
+	PR_CASE(OP_NOT_FNC):
+		OPC->_float = !OPA->function;
+		PR_NEXT ();
+	PR_CASE(OP_NOT_ENT):
+		OPC->_float = (PROG_TO_EDICT(OPA->edict) == qcvm->edicts);
+		PR_NEXT ();
+
+	PR_CASE(OP_EQ_F):
+		OPC->_float = OPA->_float == OPB->_float;
+		PR_NEXT ();
+	PR_CASE(OP_EQ_V):
+		OPC->_float = (OPA->vector[0] == OPB->vector[0]) &&
+			      (OPA->vector[1] == OPB->vector[1]) &&
+			      (OPA->vector[2] == OPB->vector[2]);
+		PR_NEXT ();
+	PR_CASE(OP_EQ_S):
+		OPC->_float = !strcmp(PR_GetString(OPA->string), PR_GetString(OPB->string));
+		PR_NEXT ();
+	PR_CASE(OP_EQ_E):
+		OPC->_float = OPA->_int == OPB->_int;
+		PR_NEXT ();
+	PR_CASE(OP_EQ_FNC):
+		OPC->_float = OPA->function == OPB->function;
+		PR_NEXT ();
+
+	PR_CASE(OP_NE_F):
+		OPC->_float = OPA->_float != OPB->_float;
+		PR_NEXT ();
+	PR_CASE(OP_NE_V):
+		OPC->_float = (OPA->vector[0] != OPB->vector[0]) ||
+			      (OPA->vector[1] != OPB->vector[1]) ||
+			      (OPA->vector[2] != OPB->vector[2]);
+		PR_NEXT ();
+	PR_CASE(OP_NE_S):
+		OPC->_float = strcmp(PR_GetString(OPA->string), PR_GetString(OPB->string));
+		PR_NEXT ();
+	PR_CASE(OP_NE_E):
+		OPC->_float = OPA->_int != OPB->_int;
+		PR_NEXT ();
+	PR_CASE(OP_NE_FNC):
+		OPC->_float = OPA->function != OPB->function;
+		PR_NEXT ();
+
+	PR_CASE(OP_STORE_F):
+	PR_CASE(OP_STORE_ENT):
+	PR_CASE(OP_STORE_FLD):	// integers
+	PR_CASE(OP_STORE_S):
+	PR_CASE(OP_STORE_FNC):	// pointers
+		OPB->_int = OPA->_int;
+		PR_NEXT ();
+	PR_CASE(OP_STORE_V):
+		OPB->vector[0] = OPA->vector[0];
+		OPB->vector[1] = OPA->vector[1];
+		OPB->vector[2] = OPA->vector[2];
+		PR_NEXT ();
+
+	PR_CASE(OP_STOREP_F):
+	PR_CASE(OP_STOREP_ENT):
+	PR_CASE(OP_STOREP_FLD):	// integers
+	PR_CASE(OP_STOREP_S):
+	PR_CASE(OP_STOREP_FNC):	// pointers
+		ptr = (eval_t *)((byte *)qcvm->edicts + OPB->_int);
+		ptr->_int = OPA->_int;
+		PR_NEXT ();
+	PR_CASE(OP_STOREP_V):
+		ptr = (eval_t *)((byte *)qcvm->edicts + OPB->_int);
+		ptr->vector[0] = OPA->vector[0];
+		ptr->vector[1] = OPA->vector[1];
+		ptr->vector[2] = OPA->vector[2];
+		PR_NEXT ();
+
+	PR_CASE(OP_ADDRESS):
+		ed = PROG_TO_EDICT(OPA->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		if (ed == (edict_t *)qcvm->edicts && sv.state == ss_active)
+		{
+			qcvm->xstatement = st - code;
+			PR_RunError("assignment to world entity");
+		}
+		OPC->_int = (byte *)((int *)&ed->v + OPB->_int) - (byte *)qcvm->edicts;
+		PR_WatchField (ed, OPB->_int);
+		PR_NEXT ();
+
+	PR_CASE(OP_LOAD_F):
+	PR_CASE(OP_LOAD_FLD):
+	PR_CASE(OP_LOAD_ENT):
+	PR_CASE(OP_LOAD_S):
+	PR_CASE(OP_LOAD_FNC):
+		ed = PROG_TO_EDICT(OPA->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		OPC->_int = ((eval_t *)((int *)&ed->v + OPB->_int))->_int;
+		PR_NEXT ();
+
+	PR_CASE(OP_LOAD_V):
+		ed = PROG_TO_EDICT(OPA->edict);
+#ifdef PARANOID
+		NUM_FOR_EDICT(ed);	// Make sure it's in range
+#endif
+		ptr = (eval_t *)((int *)&ed->v + OPB->_int);
+		OPC->vector[0] = ptr->vector[0];
+		OPC->vector[1] = ptr->vector[1];
+		OPC->vector[2] = ptr->vector[2];
+		PR_NEXT ();
+
+	PR_CASE(OP_IFNOT):
+		PR_CHECK_RUNAWAY ();
+		if (!OPA->_int)
+			st = st->jump - 1;	/* -1 to offset the st++ */
+		PR_NEXT ();
+
+	PR_CASE(OP_IF):
+		PR_CHECK_RUNAWAY ();
+		if (OPA->_int)
+			st = st->jump - 1;	/* -1 to offset the st++ */
+		PR_NEXT ();
+
+	PR_CASE(OP_GOTO):
+		PR_CHECK_RUNAWAY ();
+		st = st->jump - 1;		/* -1 to offset the st++ */
+		PR_NEXT ();
+
+	PR_CASE(OP_CALL0):
+	PR_CASE(OP_CALL1):
+	PR_CASE(OP_CALL2):
+	PR_CASE(OP_CALL3):
+	PR_CASE(OP_CALL4):
+	PR_CASE(OP_CALL5):
+	PR_CASE(OP_CALL6):
+	PR_CASE(OP_CALL7):
+	PR_CASE(OP_CALL8):
+	do_call:
+		PR_CHECK_RUNAWAY ();
+		qcvm->xfunction->profile += profile - startprofile;
+		startprofile = profile;
+		qcvm->xstatement = st - code;
+		qcvm->argc = st->op - OP_CALL0;
+		if (!OPA->function)
+			PR_RunError("NULL function");
+		newf = &qcvm->functions[OPA->function];
+		if (newf->first_statement < 0)
+		{ // Built-in function
+			int i = -newf->first_statement;
+			if (i >= qcvm->numbuiltins)
+				PR_RunError("Bad builtin call number %d", i);
+			PR_CallBuiltin (newf, qcvm->builtins[i]);
+			if (qcvm->trace)
+			{ // continue in the classic interpreter so every statement gets printed
+				PR_ExecuteSwitch (qcvm->statements + (st - code), exitdepth);
+				return;
+			}
+			PR_NEXT ();
+		}
+		// Normal function
+		st = &code[PR_EnterFunction(newf)];
+		PR_NEXT ();
+
+	PR_CASE(OP_DONE):
+	PR_CASE(OP_RETURN):
+		qcvm->xfunction->profile += profile - startprofile;
+		startprofile = profile;
+		qcvm->xstatement = st - code;
+		qcvm->globals[OFS_RETURN] = OPA->vector[0];
+		qcvm->globals[OFS_RETURN + 1] = OPA->vector[1];
+		qcvm->globals[OFS_RETURN + 2] = OPA->vector[2];
+		st = &code[PR_LeaveFunction()];
+		if (qcvm->depth == exitdepth)
+		{ // Done
+			return;
+		}
+		PR_NEXT ();
+
+	PR_CASE(OP_STATE):
+		ed = PROG_TO_EDICT(pr_global_struct->self);
+		ed->v.nextthink = pr_global_struct->time + 0.1;
+		ed->v.frame = OPA->_float;
+		ed->v.think = OPB->function;
+		PR_NEXT ();
+
+	// superinstructions: st[0] is executed, then st[1] (left untouched by
+	// PR_FuseStatements, so branches into it still work) is executed inline
+	PR_CASE(OPX_LOAD_IF):
+		ed = PROG_TO_EDICT(OPA->edict);
+		OPC->_int = ((eval_t *)((int *)&ed->v + OPB->_int))->_int;
+		++profile;
+		++st;
+		PR_CHECK_RUNAWAY ();
+		if (OPA->_int)
+			st = st->jump - 1;
+		PR_NEXT ();
+
+	PR_CASE(OPX_LOAD_IFNOT):
+		ed = PROG_TO_EDICT(OPA->edict);
+		OPC->_int = ((eval_t *)((int *)&ed->v + OPB->_int))->_int;
+		++profile;
+		++st;
+		PR_CHECK_RUNAWAY ();
+		if (!OPA->_int)
+			st = st->jump - 1;
+		PR_NEXT ();
+
+	PR_CASE(OPX_ADDRESS_STOREP):
+	PR_CASE(OPX_ADDRESS_STOREP_V):
+		ed = PROG_TO_EDICT(OPA->edict);
+		if (ed == (edict_t *)qcvm->edicts && sv.state == ss_active)
+		{
+			qcvm->xstatement = st - code;
+			PR_RunError("assignment to world entity");
+		}
+		OPC->_int = (byte *)((int *)&ed->v + OPB->_int) - (byte *)qcvm->edicts;
+		PR_WatchField (ed, OPB->_int);
+		++profile;
+		PR_CHECK_RUNAWAY ();
+		if (st++->op == OPX_ADDRESS_STOREP)
+		{
+			ptr = (eval_t *)((byte *)qcvm->edicts + OPB->_int);
+			ptr->_int = OPA->_int;
+		}
+		else
+		{
+			ptr = (eval_t *)((byte *)qcvm->edicts + OPB->_int);
+			ptr->vector[0] = OPA->vector[0];
+			ptr->vector[1] = OPA->vector[1];
+			ptr->vector[2] = OPA->vector[2];
+		}
+		PR_NEXT ();
+
+	PR_CASE(OPX_MUL_ADD_F):
+		OPC->_float = OPA->_float * OPB->_float;
+		++profile;
+		++st;
+		PR_CHECK_RUNAWAY ();
+		OPC->_float = OPA->_float + OPB->_float;
+		PR_NEXT ();
+
+	PR_CASE(OPX_STORE_CALL):
+		OPB->_int = OPA->_int;
+		++profile;
+		++st;
+		goto do_call;
+
+	PR_CASE(OPX_STORE_V_CALL):
+		OPB->vector[0] = OPA->vector[0];
+		OPB->vector[1] = OPA->vector[1];
+		OPB->vector[2] = OPA->vector[2];
+		++profile;
+		++st;
+		goto do_call;
+
+	PR_CASE(OPX_FALLBACK):
+		qcvm->xfunction->profile += profile - startprofile;
+		PR_ExecuteSwitch (qcvm->statements + (st - code) - 1, exitdepth);
+		return;
+
+	PR_DEFAULT:
+		qcvm->xstatement = st - code;
+		PR_RunError("Bad opcode %i", st->op);
+#if !PR_DIRECT_THREADED
+	}
+#endif
+}
+
+#undef OPA
+#undef OPB
+#undef OPC
+#undef PR_CASE
+#undef PR_DEFAULT
+#undef PR_NEXT
+#undef PR_CHECK_RUNAWAY
+
+/*
+====================
+PR_FuseStatements
+
+Replaces common statement pairs in the pre-decoded code with superinstructions.
+Only the first statement of a pair is changed; the second one keeps its own
+decoding so that branches landing on it behave as before, and is never used
+as the start of another pair so its original opcode is preserved.
+====================
+*/
+static qboolean PR_IsIntLoad (int op)
+{
+	return op == OP_LOAD_F || op == OP_LOAD_ENT || op == OP_LOAD_FLD || op == OP_LOAD_S || op == OP_LOAD_FNC;
+}
+
+static qboolean PR_IsIntStore (int op)
+{
+	return op == OP_STORE_F || op == OP_STORE_ENT || op == OP_STORE_FLD || op == OP_STORE_S || op == OP_STORE_FNC;
+}
+
+static qboolean PR_IsIntStoreP (int op)
+{
+	return op == OP_STOREP_F || op == OP_STOREP_ENT || op == OP_STOREP_FLD || op == OP_STOREP_S || op == OP_STOREP_FNC;
+}
+
+static void PR_FuseStatements (void)
+{
+	int			i, op;
+	dstatement_t	*st;
+
+	for (i = 0; i < qcvm->progs->numstatements - 1; i++)
+	{
+		st = &qcvm->statements[i];
+		if (qcvm->code[i].op == OPX_FALLBACK || qcvm->code[i + 1].op == OPX_FALLBACK)
+			continue;
+
+		op = -1;
+		if (PR_IsIntLoad (st[0].op) && (st[1].op == OP_IF || st[1].op == OP_IFNOT) && st[1].a == st[0].c)
+			op = st[1].op == OP_IF ? OPX_LOAD_IF : OPX_LOAD_IFNOT;
+		else if (st[0].op == OP_ADDRESS && st[1].b == st[0].c && PR_IsIntStoreP (st[1].op))
+			op = OPX_ADDRESS_STOREP;
+		else if (st[0].op == OP_ADDRESS && st[1].b == st[0].c && st[1].op == OP_STOREP_V)
+			op = OPX_ADDRESS_STOREP_V;
+		else if (st[0].op == OP_MUL_F && st[1].op == OP_ADD_F && (st[1].a == st[0].c || st[1].b == st[0].c))
+			op = OPX_MUL_ADD_F;
+		else if (st[1].op >= OP_CALL0 && st[1].op <= OP_CALL8 &&
+				(unsigned short)st[0].b >= OFS_PARM0 && (unsigned short)st[0].b < RESERVED_OFS)
+		{
+			if (PR_IsIntStore (st[0].op))
+				op = OPX_STORE_CALL;
+			else if (st[0].op == OP_STORE_V)
+				op = OPX_STORE_V_CALL;
+		}
+
+		if (op < 0)
+			continue;
+
+		qcvm->code[i].op = op;
+		i++; // the second statement can't start another pair
+	}
+}
+
+static int PR_CompareInts (const void *pa, const void *pb)
+{
+	return *(const int *)pa - *(const int *)pb;
+}
+
+/*
+====================
+PR_TranslateProgram
+
+Builds the pre-decoded form of the statements used by PR_ExecuteCode.
+Called once from PR_LoadProgs, after the lumps have been byte-swapped.
+Functions containing statements that can't be translated (unknown opcodes,
+branches out of range) are left to the classic interpreter.
+====================
+*/
+void PR_TranslateProgram (void)
+{
+	int			i, j, target, count, end, fallback;
+	int			numstatements = qcvm->progs->numstatements;
+	int			*starts;
+	byte		*bad;
+	dstatement_t	*st;
+	prinstr_t	*in;
+
+	qcvm->code = (prinstr_t *) Hunk_AllocName (numstatements * sizeof (prinstr_t), "prcode");
+	bad = (byte *) calloc (numstatements, 1);
+	if (!bad)
+		Sys_Error ("PR_TranslateProgram: out of memory");
+
+	for (i = 0; i < numstatements; i++)
+	{
+		st = &qcvm->statements[i];
+		in = &qcvm->code[i];
+
+		in->op = st->op;
+		in->a = (eval_t *)&qcvm->globals[(unsigned short)st->a];
+		in->b = (eval_t *)&qcvm->globals[(unsigned short)st->b];
+		in->c = (eval_t *)&qcvm->globals[(unsigned short)st->c];
+
+		if (st->op >= OP_NUMOPS)
+		{
+			bad[i] = true;
+			continue;
+		}
+
+		switch (st->op)
+		{
+		case OP_IF:
+		case OP_IFNOT:
+			target = i + st->b;
+			break;
+		case OP_GOTO:
+			target = i + st->a;
+			break;
+		default:
+			continue;
+		}
+
+		if (target < 0 || target >= numstatements)
+			bad[i] = true;
+		else
+			in->jump = &qcvm->code[target];
+	}
+
+	// function bodies are contiguous, so each one ends where the next one starts
+	starts = (int *) malloc ((qcvm->progs->numfunctions + 1) * sizeof (int));
+	if (!starts)
+		Sys_Error ("PR_TranslateProgram: out of memory");
+	for (i = count = 0; i < qcvm->progs->numfunctions; i++)
+		if (qcvm->functions[i].first_statement > 0 && qcvm->functions[i].first_statement < numstatements)
+			starts[count++] = qcvm->functions[i].first_statement;
+	qsort (starts, count, sizeof (int), PR_CompareInts);
+	starts[count] = numstatements;
+
+	fallback = 0;
+	for (i = 0; i < count; i++)
+	{
+		if (starts[i] == starts[i + 1])
+			continue;
+		for (j = starts[i]; j < starts[i + 1] && !bad[j]; j++)
+			;
+		if (j == starts[i + 1])
+			continue;
+		Con_DWarning ("PR_TranslateProgram: statement %d can't be translated, using classic interpreter for its function\n", j);
+		for (j = starts[i], end = starts[i + 1]; j < end; j++)
+			bad[j] = true;
+		fallback++;
+	}
+
+	for (i = 0; i < numstatements; i++)
+	{
+		if (bad[i])
+		{
+			qcvm->code[i].op = OPX_FALLBACK;
+			qcvm->code[i].jump = NULL;
+		}
+	}
+
+	free (starts);
+	free (bad);
+
+	PR_FuseStatements ();
+	PR_ExecuteCode (NULL, 0);
+}
+
+/*
+===============================================================================
+
+ISOLATED CALLS
+
+Lets think functions run ahead of time on the trace workers (see
+SV_RunThinksAhead). A function qualifies if it only reads and writes fields of
+self, writes nothing but its own locals and the parm/return globals, and only
+calls functions that qualify too or builtins that just compute a value from
+their arguments.
+
+Such a call runs in the classic interpreter, against private copies of the
+globals and of self. Its results are used if self and every global it reads
+before writing it are still the same when the call is due, since running it
+then would do exactly the same; otherwise the call runs again the normal way.
+The parm and return globals only carry values from a call into the function
+it calls and back, so nothing reads what a think function leaves in them:
+they're taken from the early run rather than compared.
+
+===============================================================================
+*/
+
+#define PRLIVE_ALWAYS		1
+#define PRLIVE_RETURN(k)	(2 << (k))	// only if word k of the return value is used
+
+typedef struct
+{
+	int		ofs;
+	int		mask;		// PRLIVE_* bits
+} prlive_t;
+
+typedef struct
+{
+	int		ofs;
+	int		value;		// function the global has to hold, or -1 for a field offset
+	int		size;		// field words used through it
+} prisocheck_t;
+
+typedef struct prisolatedvm_s
+{
+	qcvm_t		vm;
+	float		*globals;
+	dfunction_t	*functions;		// the interpreter adds to their profile counts
+	byte		*fieldwatch;	// all zero, the caller compares the fields afterwards
+	int			generation;		// of the globals copy, 0 after an aborted call
+	jmp_buf		abort;
+} prisolatedvm_t;
+
+typedef struct prisolation_s
+{
+	char			(*reasons)[64];	// per function, empty if it can be isolated
+	prlive_t		**exposed;		// VEC per function, globals read before they're written
+	uint32_t		*writes;		// per function, parm/return globals it may write
+	prisocheck_t	*checks;		// VEC, global values the analysis relies on
+	float			*globals;		// as of PR_BeginIsolatedCalls
+	int				generation;
+	prisolatedvm_t	**vms;			// VEC, one per thread slot
+} prisolation_t;
+
+typedef struct
+{
+	const char	*name;
+	int			retsize;
+} prpurebuiltin_t;
+
+static const prpurebuiltin_t pr_purebuiltins[] =
+{
+	{"vlen", 1}, {"vectoyaw", 1}, {"vectoangles", 3}, {"normalize", 3}, {"fabs", 1}, {"floor", 1}, {"ceil", 1}, {"rint", 1},
+	{"sin", 1}, {"cos", 1}, {"sqrt", 1}, {"pow", 1}, {"min", 1}, {"max", 1}, {"bound", 1}, {"bitshift", 1},
+};
+
+/*
+====================
+PR_PureBuiltin
+
+Returns how many return words builtin f writes if it only computes a value
+from its arguments, 0 otherwise.  Goes by the engine's name for the builtin
+number rather than the one in the progs, since that's what gets called.
+====================
+*/
+static int PR_PureBuiltin (dfunction_t *f)
+{
+	int i, j, num = -f->first_statement;
+
+	if (num <= 0 || num >= qcvm->numbuiltins)
+		return 0;
+
+	for (i = 0; i < pr_numbuiltindefs; i++)
+	{
+		builtindef_t *def = &pr_builtindefs[i];
+		if (def->number != num || qcvm->builtins[num] != (qcvm == &sv.qcvm ? def->ssqcfunc : def->csqcfunc))
+			continue;
+		for (j = 0; j < (int) countof (pr_purebuiltins); j++)
+			if (!strcmp (def->name, pr_purebuiltins[j].name))
+				return pr_purebuiltins[j].retsize;
+	}
+
+	return 0;
+}
+
+typedef struct
+{
+	int		a, asize;		// read
+	int		b, bsize;		// read
+	int		def, defsize;	// written
+} propers_t;
+
+/*
+====================
+PR_Operands
+
+Which globals a statement reads and writes.  Calls, returns and OP_STATE also
+touch globals that aren't operands.
+====================
+*/
+static void PR_Operands (dstatement_t *st, propers_t *o)
+{
+	o->a = (unsigned short)st->a;
+	o->b = (unsigned short)st->b;
+	o->def = (unsigned short)st->c;
+	o->asize = o->bsize = o->defsize = 0;
+
+	switch (st->op)
+	{
+	case OP_DONE:
+	case OP_RETURN:
+		o->asize = 3;
+		break;
+
+	case OP_MUL_V:
+	case OP_EQ_V:
+	case OP_NE_V:
+		o->asize = o->bsize = 3;
+		o->defsize = 1;
+		break;
+	case OP_ADD_V:
+	case OP_SUB_V:
+		o->asize = o->bsize = o->defsize = 3;
+		break;
+	case OP_MUL_FV:
+		o->asize = 1;
+		o->bsize = o->defsize = 3;
+		break;
+	case OP_MUL_VF:
+		o->asize = o->defsize = 3;
+		o->bsize = 1;
+		break;
+
+	case OP_NOT_V:
+		o->asize = 3;
+		o->defsize = 1;
+		break;
+	case OP_NOT_F:
+	case OP_NOT_S:
+	case OP_NOT_FNC:
+	case OP_NOT_ENT:
+		o->asize = o->defsize = 1;
+		break;
+
+	case OP_LOAD_V:
+		o->asize = o->bsize = 1;
+		o->defsize = 3;
+		break;
+
+	case OP_STORE_V:
+		o->asize = o->defsize = 3;
+		o->def = o->b;
+		break;
+	case OP_STORE_F:
+	case OP_STORE_ENT:
+	case OP_STORE_FLD:
+	case OP_STORE_S:
+	case OP_STORE_FNC:
+		o->asize = o->defsize = 1;
+		o->def = o->b;
+		break;
+
+	case OP_STOREP_V:
+		o->asize = 3;
+		o->bsize = 1;
+		break;
+	case OP_STOREP_F:
+	case OP_STOREP_ENT:
+	case OP_STOREP_FLD:
+	case OP_STOREP_S:
+	case OP_STOREP_FNC:
+	case OP_STATE:
+		o->asize = o->bsize = 1;
+		break;
+
+	case OP_IF:
+	case OP_IFNOT:
+	case OP_CALL0: case OP_CALL1: case OP_CALL2: case OP_CALL3: case OP_CALL4:
+	case OP_CALL5: case OP_CALL6: case OP_CALL7: case OP_CALL8:
+		o->asize = 1;
+		break;
+
+	case OP_GOTO:
+		break;
+
+	default:	// arithmetic, comparisons, loads and OP_ADDRESS
+		o->asize = o->bsize = o->defsize = 1;
+		break;
+	}
+}
+
+static qboolean PR_IsLocal (dfunction_t *f, int ofs)
+{
+	return ofs >= f->parm_start && ofs < f->parm_start + f->locals;
+}
+
+/*
+====================
+PR_StatementConflict
+
+Describes why statement num of f (which ends at end) can't be isolated, or
+returns false
+====================
+*/
+static qboolean PR_StatementConflict (dfunction_t *f, int num, int end, int *callee, char *reason, size_t reasonsize)
+{
+	dstatement_t	*st = &qcvm->statements[num];
+	int				numglobals = qcvm->progs->numglobals;
+	int				selfofs = offsetof (globalvars_t, self) / 4;
+	int				i, target;
+	propers_t		o, p;
+
+	*callee = 0;
+	if (st->op >= OP_NUMOPS)
+	{
+		q_snprintf (reason, reasonsize, "unknown opcode %d", st->op);
+		return true;
+	}
+
+	PR_Operands (st, &o);
+	if (o.a + o.asize > numglobals || o.b + o.bsize > numglobals || o.def + o.defsize > numglobals)
+	{
+		q_snprintf (reason, reasonsize, "operand out of range");
+		return true;
+	}
+	if (o.defsize && o.def + o.defsize > RESERVED_OFS && !(PR_IsLocal (f, o.def) && PR_IsLocal (f, o.def + o.defsize - 1)))
+	{
+		q_snprintf (reason, reasonsize, "writes global %s", PR_GlobalStringNoContents (o.def));
+		return true;
+	}
+
+	switch (st->op)
+	{
+	case OP_IF:
+	case OP_IFNOT:
+	case OP_GOTO:
+		target = num + (st->op == OP_GOTO ? st->a : st->b);
+		if (target < f->first_statement || target >= end)
+		{
+			q_snprintf (reason, reasonsize, "jumps out of the function");
+			return true;
+		}
+		break;
+
+	// a temp string can change while its number stays the same
+	case OP_EQ_S:
+	case OP_NE_S:
+	case OP_NOT_S:
+		q_snprintf (reason, reasonsize, "compares strings");
+		return true;
+
+	case OP_LOAD_F:
+	case OP_LOAD_V:
+	case OP_LOAD_S:
+	case OP_LOAD_ENT:
+	case OP_LOAD_FLD:
+	case OP_LOAD_FNC:
+	case OP_ADDRESS:
+		if (o.a != selfofs)
+		{
+			q_snprintf (reason, reasonsize, "%s .%s of another entity", st->op == OP_ADDRESS ? "writes" : "reads",
+				PR_GlobalStringNoContents (o.b));
+			return true;
+		}
+		if (o.b < RESERVED_OFS || PR_IsLocal (f, o.b))
+		{
+			q_snprintf (reason, reasonsize, "computed field");
+			return true;
+		}
+		break;
+
+	case OP_STOREP_F:
+	case OP_STOREP_V:
+	case OP_STOREP_ENT:
+	case OP_STOREP_FLD:
+	case OP_STOREP_S:
+	case OP_STOREP_FNC:
+		// the pointer has to be a local that only ever holds field addresses
+		// of self (PR_ComputeExposed checks it isn't read before it's set)
+		if (!PR_IsLocal (f, o.b))
+		{
+			q_snprintf (reason, reasonsize, "stores through global %s", PR_GlobalStringNoContents (o.b));
+			return true;
+		}
+		for (i = f->first_statement; i < end; i++)
+		{
+			PR_Operands (&qcvm->statements[i], &p);
+			if (o.b >= p.def && o.b < p.def + p.defsize && qcvm->statements[i].op != OP_ADDRESS)
+			{
+				q_snprintf (reason, reasonsize, "stores through a pointer it didn't take");
+				return true;
+			}
+		}
+		break;
+
+	case OP_CALL0: case OP_CALL1: case OP_CALL2: case OP_CALL3: case OP_CALL4:
+	case OP_CALL5: case OP_CALL6: case OP_CALL7: case OP_CALL8:
+		*callee = G_INT (o.a);
+		if (o.a < RESERVED_OFS || PR_IsLocal (f, o.a) || *callee <= 0 || *callee >= qcvm->progs->numfunctions)
+		{
+			*callee = 0;
+			q_snprintf (reason, reasonsize, "indirect call");
+			return true;
+		}
+		break;
+	}
+
+	// the last statement can't go on into the next function
+	if (num == end - 1 && st->op != OP_RETURN && st->op != OP_DONE && st->op != OP_GOTO)
+	{
+		q_snprintf (reason, reasonsize, "runs past its end");
+		return true;
+	}
+
+	return false;
+}
+
+static int PR_DomainIndex (const int *dom, int count, int ofs)
+{
+	int lo = 0, hi = count;
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (dom[mid] < ofs)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static int PR_CompareLive (const void *pa, const void *pb)
+{
+	return ((const prlive_t *)pa)->ofs - ((const prlive_t *)pb)->ofs;
+}
+
+/*
+====================
+PR_ParmForLocal
+
+The parm global a parameter local of f gets copied from on entry, or ofs
+itself if it isn't one
+====================
+*/
+static int PR_ParmForLocal (dfunction_t *f, int ofs)
+{
+	int i, j, o = f->parm_start;
+
+	for (i = 0; i < f->numparms; i++)
+		for (j = 0; j < f->parm_size[i]; j++, o++)
+			if (o == ofs)
+				return OFS_PARM0 + i * 3 + j;
+
+	return ofs;
+}
+
+/*
+====================
+PR_ComputeExposed
+
+Backward liveness over the globals function fnum touches, which gives the ones
+it reads before writing them (along with the return words they matter for),
+and the parm/return globals it may write.  Returns false if one of the locals
+it stores through could be read before it's set.
+====================
+*/
+static qboolean PR_ComputeExposed (prisolation_t *iso, int fnum, int end, prlive_t **exposed, uint32_t *writes)
+{
+	dfunction_t		*f = &qcvm->functions[fnum];
+	dfunction_t		*cf;
+	dstatement_t	*st;
+	const prlive_t	*e;
+	propers_t		o;
+	int				first = f->first_statement, n = end - first;
+	int				i, j, k, d, count, callee, retsize, mask, changed;
+	int				*dom = NULL;
+	byte			*live, *out, *in;
+	qboolean		ok = true;
+
+	*writes = 0;
+	VEC_CLEAR (*exposed);
+
+	// every global the statements (and the functions they call) touch
+	for (i = 0; i < RESERVED_OFS; i++)
+		VEC_PUSH (dom, i);
+	for (i = first; i < end; i++)
+	{
+		st = &qcvm->statements[i];
+		PR_Operands (st, &o);
+		for (j = 0; j < o.asize; j++)
+			VEC_PUSH (dom, o.a + j);
+		for (j = 0; j < o.bsize; j++)
+			VEC_PUSH (dom, o.b + j);
+		for (j = 0; j < o.defsize; j++)
+		{
+			VEC_PUSH (dom, o.def + j);
+			if (o.def + j < RESERVED_OFS)
+				*writes |= 1u << (o.def + j);
+		}
+
+		if (st->op == OP_RETURN || st->op == OP_DONE)
+			*writes |= 7u << OFS_RETURN;
+		else if (st->op == OP_STATE)
+		{
+			VEC_PUSH (dom, offsetof (globalvars_t, self) / 4);
+			VEC_PUSH (dom, offsetof (globalvars_t, time) / 4);
+		}
+		else if (st->op >= OP_CALL0 && st->op <= OP_CALL8)
+		{
+			callee = G_INT (o.a);
+			cf = &qcvm->functions[callee];
+			if (cf->first_statement < 0)
+				*writes |= ((1u << PR_PureBuiltin (cf)) - 1) << OFS_RETURN;
+			else
+			{
+				*writes |= iso->writes[callee];
+				for (j = 0; j < (int) VEC_SIZE (iso->exposed[callee]); j++)
+					VEC_PUSH (dom, iso->exposed[callee][j].ofs);
+			}
+		}
+	}
+
+	qsort (dom, VEC_SIZE (dom), sizeof (int), PR_CompareInts);
+	for (i = count = 0; i < (int) VEC_SIZE (dom); i++)
+		if (!count || dom[i] != dom[count - 1])
+			dom[count++] = dom[i];
+
+	// live-in masks for each statement, then two scratch rows
+	live = (byte *) calloc ((size_t)(n + 2) * count, 1);
+	if (!live)
+		Sys_Error ("PR_ComputeExposed: out of memory");
+	out = live + (size_t)n * count;
+	in = out + count;
+
+#define DOM(ofs) PR_DomainIndex (dom, count, (ofs))
+
+	do
+	{
+		changed = 0;
+		for (i = n - 1; i >= 0; i--)
+		{
+			st = &qcvm->statements[first + i];
+			PR_Operands (st, &o);
+
+			memset (out, 0, count);
+			if (st->op != OP_RETURN && st->op != OP_DONE && st->op != OP_GOTO)
+				for (d = 0; d < count; d++)
+					out[d] |= live[(size_t)(i + 1) * count + d];
+			if (st->op == OP_IF || st->op == OP_IFNOT || st->op == OP_GOTO)
+			{
+				j = i + (st->op == OP_GOTO ? st->a : st->b);
+				for (d = 0; d < count; d++)
+					out[d] |= live[(size_t)j * count + d];
+			}
+
+			memcpy (in, out, count);
+			switch (st->op)
+			{
+			case OP_DONE:
+			case OP_RETURN:
+				// only the caller knows whether the return value is used
+				memset (in, 0, count);
+				for (k = 0; k < 3; k++)
+					in[DOM (o.a + k)] |= PRLIVE_RETURN (k);
+				break;
+
+			case OP_CALL0: case OP_CALL1: case OP_CALL2: case OP_CALL3: case OP_CALL4:
+			case OP_CALL5: case OP_CALL6: case OP_CALL7: case OP_CALL8:
+				callee = G_INT (o.a);
+				cf = &qcvm->functions[callee];
+				retsize = cf->first_statement < 0 ? PR_PureBuiltin (cf) : 3;
+				for (k = 0; k < retsize; k++)
+					in[DOM (OFS_RETURN + k)] = 0;
+				if (cf->first_statement < 0)
+				{
+					for (j = 0; j < (st->op - OP_CALL0) * 3; j++)
+						in[DOM (OFS_PARM0 + j)] |= PRLIVE_ALWAYS;
+				}
+				else
+				{
+					for (j = 0; j < (int) VEC_SIZE (iso->exposed[callee]); j++)
+					{
+						e = &iso->exposed[callee][j];
+						mask = e->mask & PRLIVE_ALWAYS;
+						for (k = 0; k < 3; k++)
+							if (e->mask & PRLIVE_RETURN (k))
+								mask |= out[DOM (OFS_RETURN + k)];
+						in[DOM (e->ofs)] |= mask;
+					}
+				}
+				in[DOM (o.a)] |= PRLIVE_ALWAYS;
+				break;
+
+			default:
+				for (j = 0; j < o.defsize; j++)
+					in[DOM (o.def + j)] = 0;
+				for (j = 0; j < o.asize; j++)
+					in[DOM (o.a + j)] |= PRLIVE_ALWAYS;
+				for (j = 0; j < o.bsize; j++)
+					in[DOM (o.b + j)] |= PRLIVE_ALWAYS;
+				if (st->op == OP_STATE)
+				{
+					in[DOM (offsetof (globalvars_t, self) / 4)] |= PRLIVE_ALWAYS;
+					in[DOM (offsetof (globalvars_t, time) / 4)] |= PRLIVE_ALWAYS;
+				}
+				break;
+			}
+
+			if (memcmp (in, live + (size_t)i * count, count))
+			{
+				memcpy (live + (size_t)i * count, in, count);
+				changed = 1;
+			}
+		}
+	} while (changed);
+
+	// a pointer read before it's set could point anywhere
+	for (i = first; i < end; i++)
+	{
+		st = &qcvm->statements[i];
+		if (st->op >= OP_STOREP_F && st->op <= OP_STOREP_FNC && live[DOM ((unsigned short)st->b)])
+			ok = false;
+	}
+
+	// parameters are read from the parm globals on entry
+	for (d = 0; d < count; d++)
+	{
+		prlive_t l;
+		if (!live[d])
+			continue;
+		l.ofs = PR_ParmForLocal (f, dom[d]);
+		l.mask = live[d];
+		VEC_PUSH (*exposed, l);
+	}
+	count = VEC_SIZE (*exposed);
+	qsort (*exposed, count, sizeof (prlive_t), PR_CompareLive);
+	for (i = j = 0; i < count; i++)
+	{
+		if (j && (*exposed)[j - 1].ofs == (*exposed)[i].ofs)
+			(*exposed)[j - 1].mask |= (*exposed)[i].mask;
+		else
+			(*exposed)[j++] = (*exposed)[i];
+	}
+	if (*exposed)
+		VEC_HEADER (*exposed).size = j;
+
+#undef DOM
+
+	free (live);
+	VEC_FREE (dom);
+	return ok;
+}
+
+/*
+====================
+PR_AddIsolationChecks
+
+Records the globals f's statements were analyzed with (call targets and
+field offsets), for PR_BeginIsolatedCalls to make sure they still hold them
+====================
+*/
+static void PR_AddIsolationChecks (prisolation_t *iso, dfunction_t *f, int end)
+{
+	dstatement_t	*st;
+	prisocheck_t	check;
+	int				i, j;
+
+	for (i = f->first_statement; i < end; i++)
+	{
+		st = &qcvm->statements[i];
+		check.ofs = (unsigned short)st->b;
+		check.value = -1;
+		check.size = 1;
+
+		switch (st->op)
+		{
+		case OP_CALL0: case OP_CALL1: case OP_CALL2: case OP_CALL3: case OP_CALL4:
+		case OP_CALL5: case OP_CALL6: case OP_CALL7: case OP_CALL8:
+			check.ofs = (unsigned short)st->a;
+			check.value = G_INT (check.ofs);
+			break;
+
+		case OP_LOAD_V:
+			check.size = 3;
+			break;
+
+		case OP_LOAD_F:
+		case OP_LOAD_S:
+		case OP_LOAD_ENT:
+		case OP_LOAD_FLD:
+		case OP_LOAD_FNC:
+			break;
+
+		case OP_ADDRESS:
+			// as wide as the widest store through it
+			for (j = f->first_statement; j < end; j++)
+				if (qcvm->statements[j].op == OP_STOREP_V && qcvm->statements[j].b == st->c)
+					check.size = 3;
+			break;
+
+		default:
+			continue;
+		}
+
+		VEC_PUSH (iso->checks, check);
+	}
+}
+
+/*
+====================
+PR_AnalyzeIsolation
+
+Finds the functions that can be isolated, with a reason for every other one
+====================
+*/
+static prisolation_t *PR_AnalyzeIsolation (void)
+{
+	int				numfunctions = qcvm->progs->numfunctions;
+	int				timeofs = offsetof (globalvars_t, time) / 4;
+	int				selfofs = offsetof (globalvars_t, self) / 4;
+	int				otherofs = offsetof (globalvars_t, other) / 4;
+	int				i, j, k, callee, changed, numstarts;
+	int				*starts, *ends, **callees;
+	uint32_t		writes;
+	prlive_t		*exposed = NULL, *swap;
+	prisolation_t	*iso;
+	dfunction_t		*f;
+	char			(*reasons)[64];
+
+	iso = (prisolation_t *) calloc (1, sizeof (*iso));
+	starts = (int *) malloc ((numfunctions + 1) * sizeof (int));
+	ends = (int *) calloc (numfunctions, sizeof (int));
+	callees = (int **) calloc (numfunctions, sizeof (int *));
+	if (!iso || !starts || !ends || !callees)
+		Sys_Error ("PR_AnalyzeIsolation: out of memory");
+	iso->reasons = (char (*)[64]) calloc (numfunctions, sizeof (*iso->reasons));
+	iso->exposed = (prlive_t **) calloc (numfunctions, sizeof (*iso->exposed));
+	iso->writes = (uint32_t *) calloc (numfunctions, sizeof (*iso->writes));
+	if (!iso->reasons || !iso->exposed || !iso->writes)
+		Sys_Error ("PR_AnalyzeIsolation: out of memory");
+	reasons = iso->reasons;
+
+	// function bodies are contiguous, so each one ends where the next one starts
+	for (i = j = 0; i < numfunctions; i++)
+		if (qcvm->functions[i].first_statement > 0)
+			starts[j++] = qcvm->functions[i].first_statement;
+	numstarts = j;
+	qsort (starts, numstarts, sizeof (int), PR_CompareInts);
+	starts[numstarts] = qcvm->progs->numstatements;
+
+	for (i = 0; i < numfunctions; i++)
+	{
+		f = &qcvm->functions[i];
+
+		if (!i)
+		{
+			q_snprintf (reasons[i], sizeof (reasons[i]), "null function");
+			continue;
+		}
+		if (f->first_statement < 0)
+		{
+			if (!PR_PureBuiltin (f))
+				q_snprintf (reasons[i], sizeof (reasons[i]), "builtin %s", PR_GetString (f->s_name));
+			continue;
+		}
+		if (f->first_statement == 0 || f->first_statement >= qcvm->progs->numstatements || f->numparms > MAX_PARMS)
+		{
+			q_snprintf (reasons[i], sizeof (reasons[i]), "bad function");
+			continue;
+		}
+
+		// find where this function ends
+		{
+			int lo = 0, hi = numstarts;
+			while (lo < hi)
+			{
+				int mid = (lo + hi) / 2;
+				if (starts[mid] <= f->first_statement)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			ends[i] = starts[lo];
+		}
+
+		for (j = f->first_statement; j < ends[i]; j++)
+		{
+			if (PR_StatementConflict (f, j, ends[i], &callee, reasons[i], sizeof (reasons[i])))
+				break;
+			if (callee && callee != i)
+				VEC_PUSH (callees[i], callee);
+		}
+	}
+
+	// anything calling a function that can't be isolated can't be either, and
+	// what a function reads depends on what the ones it calls read
+	do
+	{
+		changed = 0;
+		for (i = 1; i < numfunctions; i++)
+		{
+			if (reasons[i][0] || qcvm->functions[i].first_statement < 0)
+				continue;
+
+			for (j = 0; j < (int) VEC_SIZE (callees[i]); j++)
+			{
+				callee = callees[i][j];
+				if (reasons[callee][0])
+				{
+					q_snprintf (reasons[i], sizeof (reasons[i]), "calls %s", PR_GetString (qcvm->functions[callee].s_name));
+					break;
+				}
+			}
+			if (reasons[i][0])
+			{
+				changed++;
+				continue;
+			}
+
+			if (!PR_ComputeExposed (iso, i, ends[i], &exposed, &writes))
+			{
+				q_snprintf (reasons[i], sizeof (reasons[i]), "stores through a pointer it didn't take");
+				changed++;
+				continue;
+			}
+			if (writes != iso->writes[i] || VEC_SIZE (exposed) != VEC_SIZE (iso->exposed[i]) ||
+				(VEC_SIZE (exposed) && memcmp (exposed, iso->exposed[i], VEC_SIZE (exposed) * sizeof (*exposed))))
+			{
+				swap = iso->exposed[i];
+				iso->exposed[i] = exposed;
+				exposed = swap;
+				iso->writes[i] = writes;
+				changed++;
+			}
+		}
+	} while (changed);
+
+	for (i = 1; i < numfunctions; i++)
+	{
+		f = &qcvm->functions[i];
+		if (reasons[i][0] || f->first_statement < 0)
+		{
+			VEC_FREE (iso->exposed[i]);
+			continue;
+		}
+
+		// from here on only the globals a top-level call has to find unchanged
+		// are needed: time, self and other get set up for the call
+		for (j = k = 0; j < (int) VEC_SIZE (iso->exposed[i]); j++)
+		{
+			prlive_t *e = &iso->exposed[i][j];
+			if (!(e->mask & PRLIVE_ALWAYS) || e->ofs == timeofs || e->ofs == selfofs || e->ofs == otherofs)
+				continue;
+			iso->exposed[i][k++] = *e;
+		}
+		if (iso->exposed[i])
+			VEC_HEADER (iso->exposed[i]).size = k;
+
+		PR_AddIsolationChecks (iso, f, ends[i]);
+	}
+
+	for (i = 0; i < numfunctions; i++)
+		VEC_FREE (callees[i]);
+	VEC_FREE (exposed);
+	free (callees);
+	free (ends);
+	free (starts);
+
+	return iso;
+}
+
+static prisolation_t *PR_GetIsolation (void)
+{
+	if (!qcvm->isolation)
+		qcvm->isolation = PR_AnalyzeIsolation ();
+	return qcvm->isolation;
+}
+
+/*
+====================
+PR_IsolationReason
+
+Why function fnum can't be isolated, or an empty string if it can
+====================
+*/
+const char *PR_IsolationReason (func_t fnum)
+{
+	return PR_GetIsolation ()->reasons[fnum];
+}
+
+/*
+====================
+PR_FreeIsolation
+====================
+*/
+void PR_FreeIsolation (qcvm_t *vm)
+{
+	prisolation_t	*iso = vm->isolation;
+	int				i;
+
+	if (!iso)
+		return;
+
+	for (i = 0; i < vm->progs->numfunctions; i++)
+		VEC_FREE (iso->exposed[i]);
+	for (i = 0; i < (int) VEC_SIZE (iso->vms); i++)
+	{
+		free (iso->vms[i]->globals);
+		free (iso->vms[i]->functions);
+		free (iso->vms[i]->fieldwatch);
+		free (iso->vms[i]);
+	}
+	VEC_FREE (iso->vms);
+	VEC_FREE (iso->checks);
+	free (iso->globals);
+	free (iso->writes);
+	free (iso->exposed);
+	free (iso->reasons);
+	free (iso);
+	vm->isolation = NULL;
+}
+
+/*
+====================
+PR_BeginIsolatedCalls
+
+Takes the copy of the globals the next PR_ExecuteIsolated calls start from,
+and makes room for slots 0 .. numslots-1.  Returns false if isolated calls
+can't be used right now.
+====================
+*/
+qboolean PR_BeginIsolatedCalls (int numslots)
+{
+	prisolation_t	*iso;
+	prisolatedvm_t	*ivm;
+	prisocheck_t	*check;
+	int				i, value;
+	int				numglobals = qcvm->progs->numglobals;
+	int				numfunctions = qcvm->progs->numfunctions;
+
+	// those need to see every call
+	if (qcvm->profiler || pr_verify.value)
+		return false;
+
+	iso = PR_GetIsolation ();
+	for (i = 0; i < (int) VEC_SIZE (iso->checks); i++)
+	{
+		check = &iso->checks[i];
+		value = G_INT (check->ofs);
+		if (check->value >= 0 ? value != check->value : value < 0 || value + check->size > qcvm->progs->entityfields)
+			return false;
+	}
+
+	if (!iso->globals)
+	{
+		iso->globals = (float *) malloc (numglobals * sizeof (float));
+		if (!iso->globals)
+			Sys_Error ("PR_BeginIsolatedCalls: out of memory");
+	}
+	memcpy (iso->globals, qcvm->globals, numglobals * sizeof (float));
+	iso->generation++;
+
+	while ((int) VEC_SIZE (iso->vms) < numslots)
+	{
+		ivm = (prisolatedvm_t *) calloc (1, sizeof (*ivm));
+		if (!ivm)
+			Sys_Error ("PR_BeginIsolatedCalls: out of memory");
+		ivm->globals = (float *) malloc (numglobals * sizeof (float));
+		ivm->functions = (dfunction_t *) malloc (numfunctions * sizeof (dfunction_t));
+		ivm->fieldwatch = (byte *) calloc (qcvm->progs->entityfields, 1);
+		if (!ivm->globals || !ivm->functions || !ivm->fieldwatch)
+			Sys_Error ("PR_BeginIsolatedCalls: out of memory");
+		memcpy (ivm->functions, qcvm->functions, numfunctions * sizeof (dfunction_t));
+		VEC_PUSH (iso->vms, ivm);
+	}
+
+	return true;
+}
+
+static void PR_AbortIsolated (void)
+{
+	longjmp (pr_isolatedvm->abort, 1);
+}
+
+/*
+====================
+PR_ExecuteIsolated
+
+Runs isolated function fnum as the think function of ent, the way SV_RunThink
+would at the given time, but with the globals as of PR_BeginIsolatedCalls and
+copy (edict_size bytes) standing in for ent.  Fills in the parm/return globals
+it leaves behind.  Returns false if the call ran into an error or would have
+printed a warning, which the normal run should do instead.
+
+Can be called from any thread, each with its own slot, while the server VM
+is active and nothing changes it.
+====================
+*/
+qboolean PR_ExecuteIsolated (int slot, func_t fnum, edict_t *ent, edict_t *copy, float time, int *reserved)
+{
+	prisolation_t	*iso = qcvm->isolation;
+	prisolatedvm_t	*ivm = iso->vms[slot];
+	qcvm_t			*shared = qcvm;
+	globalvars_t	*oldglobals = pr_global_struct;
+	globalvars_t	*globals = (globalvars_t *) ivm->globals;
+	qboolean		ok;
+	int				s;
+
+	if (ivm->generation != iso->generation)
+	{
+		// the stacks start out empty, no need to copy them
+		memcpy (&ivm->vm, shared, offsetof (qcvm_t, stack));
+		memcpy (&ivm->vm.time, &shared->time, sizeof (qcvm_t) - offsetof (qcvm_t, time));
+		memcpy (ivm->globals, iso->globals, shared->progs->numglobals * sizeof (float));
+		ivm->vm.globals = ivm->globals;
+		ivm->vm.functions = ivm->functions;
+		ivm->vm.fieldwatch = ivm->fieldwatch;
+		ivm->vm.code = NULL;
+		ivm->vm.tracebatch = NULL;
+		ivm->vm.profiler = NULL;
+		ivm->vm.depth = 0;
+		ivm->vm.localstack_used = 0;
+		ivm->generation = iso->generation;
+	}
+	else // a finished call leaves its locals as they were
+		memcpy (ivm->globals, iso->globals, RESERVED_OFS * sizeof (float));
+
+	memcpy (copy, ent, shared->edict_size);
+	copy->v.nextthink = 0;
+	ivm->vm.edicts = (edict_t *)((byte *)copy - ((byte *)ent - (byte *)shared->edicts));
+	ivm->vm.trace = false;
+
+	globals->time = time;
+	globals->self = EDICT_TO_PROG (ent);
+	globals->other = EDICT_TO_PROG (shared->edicts);
+
+	qcvm = &ivm->vm;
+	pr_global_struct = globals;
+	pr_isolatedvm = ivm;
+
+	if (setjmp (ivm->abort))
+	{
+		ivm->generation = 0;	// the locals weren't restored
+		ok = false;
+	}
+	else
+	{
+		s = PR_EnterFunction (&qcvm->functions[fnum]);
+		PR_ExecuteSwitch (&qcvm->statements[s], 0);
+		ok = true;
+	}
+
+	pr_isolatedvm = NULL;
+	pr_global_struct = oldglobals;
+	qcvm = shared;
+
+	memcpy (reserved, ivm->globals, RESERVED_OFS * sizeof (int));
+	return ok;
+}
+
+/*
+====================
+PR_CommitIsolated
+
+Checks that every global the call to fnum read before writing it still holds
+what PR_ExecuteIsolated found, and if so applies the parm/return globals it
+left behind.  The caller checks self and sets up time, self and other.
+====================
+*/
+qboolean PR_CommitIsolated (func_t fnum, const int *reserved)
+{
+	prisolation_t	*iso = qcvm->isolation;
+	const prlive_t	*exposed = iso->exposed[fnum];
+	const int		*before = (const int *) iso->globals;
+	int				*globals = (int *) qcvm->globals;
+	uint32_t		writes = iso->writes[fnum];
+	int				i;
+
+	for (i = 0; i < (int) VEC_SIZE (exposed); i++)
+		if (globals[exposed[i].ofs] != before[exposed[i].ofs])
+			return false;
+
+	for (i = 0; i < RESERVED_OFS; i++)
+		if (writes & (1u << i))
+			globals[i] = reserved[i];
+
+	return true;
+}
+
+/*
+===============================================================================
+
+VERIFICATION
+
+With pr_verify 1, each top-level call is run by both interpreters and the
+resulting globals and entity fields are compared; pr_verify 2 also stops with
+a Host_Error when they differ.
+
+Builtins can have effects outside the VM, so they only really run during the
+pre-decoded pass. Each call's builtin, arguments and the globals and fields it
+changed (anything it ran in turn included) are logged, and the classic pass
+gets the same changes applied instead of calling it again, after checking
+that it makes the same call. Every builtin call costs a copy and a comparison
+of the whole VM state, so this is slow.
+
+===============================================================================
+*/
+
+typedef struct prvmstate_s
+{
+	int			*globals;
+	int			*fields;
+	int			num_edicts;
+} prvmstate_t;
+
+typedef struct prbuiltinlog_s
+{
+	dfunction_t	*func;
+	int			argc;
+	int			parms[MAX_PARMS * 3];
+	int			firstwrite, numwrites;
+} prbuiltinlog_t;
+
+typedef struct prvmwrite_s
+{
+	int			edict;		// -1 for a global
+	int			ofs;
+	int			value;
+} prvmwrite_t;
+
+static prvmstate_t		pr_verify_before, pr_verify_after, pr_verify_call;
+static prbuiltinlog_t	*pr_verify_calls;		// VEC, logged by the pre-decoded pass
+static prvmwrite_t		*pr_verify_writes;		// VEC
+static qboolean			pr_verify_replaying;
+static int				pr_verify_replayed;		// calls the classic pass has made so far
+static qboolean			pr_verify_diverged;
+static dfunction_t		*pr_verify_func;
+static int				pr_verify_checked, pr_verify_failed, pr_verify_builtins;
+
+static void PR_SaveVMState (prvmstate_t *state)
+{
+	int i, numfields = qcvm->progs->entityfields;
+
+	state->globals = (int *) realloc (state->globals, qcvm->progs->numglobals * sizeof (int));
+	state->fields = (int *) realloc (state->fields, qcvm->num_edicts * numfields * sizeof (int));
+	if (!state->globals || !state->fields)
+		Sys_Error ("PR_SaveVMState: out of memory");
+
+	memcpy (state->globals, qcvm->globals, qcvm->progs->numglobals * sizeof (int));
+	for (i = 0; i < qcvm->num_edicts; i++)
+		memcpy (state->fields + i * numfields, &EDICT_NUM (i)->v, numfields * sizeof (int));
+	state->num_edicts = qcvm->num_edicts;
+}
+
+static void PR_RestoreVMState (const prvmstate_t *state)
+{
+	int i, numfields = qcvm->progs->entityfields;
+
+	memcpy (qcvm->globals, state->globals, qcvm->progs->numglobals * sizeof (int));
+	for (i = 0; i < state->num_edicts; i++)
+		memcpy (&EDICT_NUM (i)->v, state->fields + i * numfields, numfields * sizeof (int));
+}
+
+static void PR_FreeVMState (prvmstate_t *state)
+{
+	free (state->globals);
+	free (state->fields);
+	memset (state, 0, sizeof (*state));
+}
+
+static const char *PR_FieldNameAtOfs (int ofs)
+{
+	int i;
+
+	for (i = 0; i < qcvm->progs->numfielddefs; i++)
+	{
+		ddef_t *def = &qcvm->fielddefs[i];
+		int size = (def->type & ~DEF_SAVEGLOBAL) == ev_vector ? 3 : 1;
+		if (ofs >= def->ofs && ofs < def->ofs + size && *PR_GetString (def->s_name))
+			return PR_GetString (def->s_name);
+	}
+
+	return "?";
+}
+
+/*
+====================
+PR_LogVMWrites
+
+Logs every global and field that differs from the saved state; edicts that
+didn't exist yet are logged whole
+====================
+*/
+static void PR_LogVMWrites (const prvmstate_t *state)
+{
+	int			i, j, numfields = qcvm->progs->entityfields;
+	const int	*g = (const int *) qcvm->globals;
+	prvmwrite_t	w;
+
+	w.edict = -1;
+	for (i = 0; i < qcvm->progs->numglobals; i++)
+	{
+		if (g[i] == state->globals[i])
+			continue;
+		w.ofs = i;
+		w.value = g[i];
+		VEC_PUSH (pr_verify_writes, w);
+	}
+
+	for (i = 0; i < qcvm->num_edicts; i++)
+	{
+		const int *v = (const int *) &EDICT_NUM (i)->v;
+		const int *saved = i < state->num_edicts ? state->fields + i * numfields : NULL;
+		for (j = 0; j < numfields; j++)
+		{
+			if (saved && v[j] == saved[j])
+				continue;
+			w.edict = i;
+			w.ofs = j;
+			w.value = v[j];
+			VEC_PUSH (pr_verify_writes, w);
+		}
+	}
+}
+
+/*
+====================
+PR_VerifyBuiltin
+
+Runs and logs a builtin call during the pre-decoded pass, replays it during
+the classic one
+====================
+*/
+static void PR_VerifyBuiltin (dfunction_t *f, builtin_t func)
+{
+	prbuiltinlog_t	call;
+	prvmwrite_t		*w;
+	int				i;
+
+	if (!pr_verify_replaying)
+	{
+		PR_SaveVMState (&pr_verify_call);
+		call.func = f;
+		call.argc = qcvm->argc;
+		memcpy (call.parms, &qcvm->globals[OFS_PARM0], sizeof (call.parms));
+
+		// whatever the builtin runs in turn is part of its effects
+		pr_verifyvm = NULL;
+		if (qcvm->profiler)
+			PR_ProfileBuiltin (f, func);
+		else
+			func ();
+		pr_verifyvm = qcvm;
+
+		call.firstwrite = VEC_SIZE (pr_verify_writes);
+		PR_LogVMWrites (&pr_verify_call);
+		call.numwrites = VEC_SIZE (pr_verify_writes) - call.firstwrite;
+		VEC_PUSH (pr_verify_calls, call);
+		return;
+	}
+
+	if (pr_verify_diverged)
+		return;
+
+	if (pr_verify_replayed == (int) VEC_SIZE (pr_verify_calls))
+	{
+		Con_Printf ("pr_verify: %s: classic interpreter makes an extra call to %s\n",
+			PR_GetString (pr_verify_func->s_name), PR_GetString (f->s_name));
+		pr_verify_diverged = true;
+		return;
+	}
+
+	call = pr_verify_calls[pr_verify_replayed];
+	if (call.func != f || call.argc != qcvm->argc ||
+		memcmp (call.parms, &qcvm->globals[OFS_PARM0], call.argc * 3 * sizeof (int)))
+	{
+		Con_Printf ("pr_verify: %s: builtin call %d is %s, %s in the pre-decoded run (or different arguments)\n",
+			PR_GetString (pr_verify_func->s_name), pr_verify_replayed + 1,
+			PR_GetString (f->s_name), PR_GetString (call.func->s_name));
+		pr_verify_diverged = true;
+		return;
+	}
+	pr_verify_replayed++;
+
+	for (i = 0, w = pr_verify_writes + call.firstwrite; i < call.numwrites; i++, w++)
+	{
+		if (w->edict < 0)
+			((int *) qcvm->globals)[w->ofs] = w->value;
+		else if (w->edict < qcvm->num_edicts)
+			((int *) &EDICT_NUM (w->edict)->v)[w->ofs] = w->value;
+	}
+}
+
+/*
+====================
+PR_CompareVMState
+
+Prints the first few differences between the saved state and the current one
+====================
+*/
+static qboolean PR_CompareVMState (const prvmstate_t *state, dfunction_t *f)
+{
+	int i, j, numfields = qcvm->progs->entityfields, diffs = 0;
+	const int *g = (const int *) qcvm->globals;
+
+	for (i = 0; i < qcvm->progs->numglobals; i++)
+	{
+		if (g[i] == state->globals[i])
+			continue;
+		if (diffs++ < 4)
+			Con_Printf ("pr_verify: %s: global %s differs (%08x predecoded, %08x classic)\n",
+				PR_GetString (f->s_name), PR_GlobalStringNoContents (i), state->globals[i], g[i]);
+	}
+
+	for (i = 0; i < state->num_edicts; i++)
+	{
+		const int *v = (const int *) &EDICT_NUM (i)->v;
+		const int *saved = state->fields + i * numfields;
+		for (j = 0; j < numfields; j++)
+		{
+			if (v[j] == saved[j])
+				continue;
+			if (diffs++ < 4)
+				Con_Printf ("pr_verify: %s: entity %d field .%s differs (%08x predecoded, %08x classic)\n",
+					PR_GetString (f->s_name), i, PR_FieldNameAtOfs (j), saved[j], v[j]);
+		}
+	}
+
+	return !diffs;
+}
+
+/*
+====================
+PR_ExecuteVerified
+====================
+*/
+static void PR_ExecuteVerified (dfunction_t *f)
+{
+	qboolean	match;
+
+	pr_verify_func = f;
+	VEC_CLEAR (pr_verify_calls);
+	VEC_CLEAR (pr_verify_writes);
+
+	PR_SaveVMState (&pr_verify_before);
+	pr_verify_replaying = false;
+	pr_verifyvm = qcvm;
+	PR_ExecuteCode (&qcvm->code[PR_EnterFunction (f)], 0);
+
+	PR_SaveVMState (&pr_verify_after);
+	PR_RestoreVMState (&pr_verify_before);
+	pr_verify_replaying = true;
+	pr_verify_replayed = 0;
+	pr_verify_diverged = false;
+	PR_ExecuteSwitch (&qcvm->statements[PR_EnterFunction (f)], 0);
+	pr_verifyvm = NULL;
+
+	if (!pr_verify_diverged && pr_verify_replayed != (int) VEC_SIZE (pr_verify_calls))
+	{
+		Con_Printf ("pr_verify: %s: %d builtin calls in the pre-decoded run, %d in the classic one\n",
+			PR_GetString (f->s_name), (int) VEC_SIZE (pr_verify_calls), pr_verify_replayed);
+		pr_verify_diverged = true;
+	}
+	pr_verify_builtins += pr_verify_replayed;
+
+	match = PR_CompareVMState (&pr_verify_after, f) && !pr_verify_diverged;
+	if (match)
+	{
+		pr_verify_checked++;
+		return;
+	}
+	pr_verify_failed++;
+
+	// the classic pass is the reference, unless it stopped following the
+	// builtin calls that actually happened
+	if (pr_verify_diverged)
+		PR_RestoreVMState (&pr_verify_after);
+
+	if (pr_verify.value >= 2)
+		Host_Error ("pr_verify: %s gives different results in the two interpreters", PR_GetString (f->s_name));
+}
+
+/*
+====================
+PR_Verify_f
+
+Called when pr_verify changes, reports the results when it's turned off
+====================
+*/
+void PR_Verify_f (cvar_t *var)
+{
+	if (var->value)
+	{
+		pr_verify_checked = pr_verify_failed = pr_verify_builtins = 0;
+		return;
+	}
+
+	if (pr_verify_checked || pr_verify_failed)
+		Con_Printf ("pr_verify: %d calls checked, %d mismatched, %d builtin calls replayed\n",
+			pr_verify_checked, pr_verify_failed, pr_verify_builtins);
+
+	PR_FreeVMState (&pr_verify_before);
+	PR_FreeVMState (&pr_verify_after);
+	PR_FreeVMState (&pr_verify_call);
+	VEC_FREE (pr_verify_calls);
+	VEC_FREE (pr_verify_writes);
+}
+
+/*
+====================
+PR_ExecuteProgram
+====================
+*/
+void PR_ExecuteProgram (func_t fnum)
+{
+	dfunction_t	*f;
+	int		exitdepth;
+	int		s;
+
+	if (!fnum || fnum >= qcvm->progs->numfunctions)
+	{
+		if (pr_global_struct->self)
+			ED_Print (PROG_TO_EDICT(pr_global_struct->self));
+		Host_Error ("PR_ExecuteProgram: NULL function");
+	}
+
+	f = &qcvm->functions[fnum];
+
+	qcvm->trace = false;
+
+// make a stack frame
+	exitdepth = qcvm->depth;
+	if (!exitdepth && qcvm->profiler)
+		qcvm->profiler->depth = qcvm->profiler->skipped = 0;	// in case a previous call was aborted
+	if (!exitdepth && pr_verifyvm == qcvm)
+		pr_verifyvm = NULL;	// a verified call was aborted
+
+	if (!exitdepth && pr_verify.value && qcvm->code && pr_predecode.value)
+	{
+		PR_ExecuteVerified (f);
+		return;
+	}
+
+	s = PR_EnterFunction(f);
+	if (qcvm->code && pr_predecode.value)
+		PR_ExecuteCode (&qcvm->code[s], exitdepth);
+	else
+		PR_ExecuteSwitch (&qcvm->statements[s], exitdepth);
+}
@@ -50,9 +50,16 @@ typedef struct edict_s
 	qboolean	free;			/* don't modify directly, use ED_AddToFreeList/ED_RemoveFromFreeList */
 	link_t		freechain;
 	link_t		area;			/* linked to a division node or leaf */
+	int		areanode;		/* index of the area node holding the link, valid while area.prev is set */
+	int		areaslot;		/* position in that node's packed box list */
 
-	int		num_leafs;
+	int		num_leafs;		/* MAX_ENT_LEAFS when the edict touches more leafs than that, see leafbits */
 	int		leafnums[MAX_ENT_LEAFS];
+	byte		*leafbits;		/* VEC, PVS-style leaf bits for leafstart*8 onwards, used when num_leafs overflows */
+	int		leafstart;		/* first byte of the world leaf bitset held in leafbits */
+	int		leafgen;		/* world the leafs were found in, see SV_FindTouchedLeafs */
+	float		leafslack;		/* how far the bounds below can move without crossing a node plane */
+	vec3_t		leafmins, leafmaxs;
 
 	entity_state_t	baseline;
 	unsigned char	alpha;			/* johnfitz -- hack to support alpha since it's not part of entvars_t */
@@ -85,6 +92,45 @@ typedef struct
 	dfunction_t	*f;
 } prstack_t;
 
+#define PR_MAX_TEMPSTRINGS	1024	// number of temp strings that stay valid at the same time
+
+typedef struct prstringstats_s
+{
+	double			starttime;
+	int				lookups;		// PR_SetEngineString calls that weren't temp strings
+	int				tempstrings;
+	int				tempbytes;
+	int				zoned;			// PF_strzone and ED_RezoneString requests
+	int				unzoned;
+} prstringstats_t;
+
+#define OP_NUMOPS			(OP_BITOR + 1)
+
+/* engine-internal superinstructions, only found in qcvm->code */
+enum
+{
+	OPX_LOAD_IF = OP_NUMOPS,	/* LOAD_F/ENT/FLD/S/FNC + IF */
+	OPX_LOAD_IFNOT,				/* LOAD_F/ENT/FLD/S/FNC + IFNOT */
+	OPX_ADDRESS_STOREP,			/* ADDRESS + STOREP_F/ENT/FLD/S/FNC */
+	OPX_ADDRESS_STOREP_V,		/* ADDRESS + STOREP_V */
+	OPX_MUL_ADD_F,				/* MUL_F + ADD_F */
+	OPX_STORE_CALL,				/* STORE_F/ENT/FLD/S/FNC into a parm + CALLn */
+	OPX_STORE_V_CALL,			/* STORE_V into a parm + CALLn */
+	OPX_FALLBACK,				/* not translated, handed over to the classic interpreter */
+
+	OPX_NUMOPS
+};
+#define OPX_NUMFUSED		(OPX_FALLBACK - OP_NUMOPS)
+
+/* pre-decoded statement, built once at load time by PR_TranslateProgram */
+typedef struct prinstr_s
+{
+	const void			*handler;	/* dispatch target (direct-threaded builds only) */
+	int					op;
+	eval_t				*a, *b, *c;	/* operands resolved to global addresses */
+	struct prinstr_s	*jump;		/* branch target for IF/IFNOT/GOTO */
+} prinstr_t;
+
 typedef struct prhashtable_s
 {
 	int			capacity;
@@ -109,6 +155,8 @@ struct pr_extfuncs_s
 	QCEXTFUNCS_CS
 #undef QCEXTFUNC
 };
+extern	cvar_t	pr_predecode;		//if 0, the classic switch interpreter is used instead of the pre-decoded code
+extern	cvar_t	pr_verify;			//if 1, top-level calls are run by both interpreters and their results compared, 2 makes a mismatch an error
 extern	cvar_t	pr_checkextension;	//if 0, extensions are disabled (unless they'd be fatal, but they're still spammy)
 	
 struct pr_extglobals_s
@@ -205,6 +253,12 @@ typedef struct qcvm_s
 	dprograms_t		*progs;
 	dfunction_t		*functions;
 	dstatement_t	*statements;
+	prinstr_t		*code;		/* pre-decoded statements, indexed like statements (NULL if unavailable) */
+	struct tracejob_s	*tracebatch;	/* VEC, traces queued by tracebatch_add */
+	qboolean		tracebatchdone;	/* tracebatch holds results rather than requests */
+	struct prprofiler_s	*profiler;	/* hierarchical profiler state, only allocated while profiling */
+	struct prisolation_s	*isolation;	/* which functions can run ahead on the trace workers, see PR_BeginIsolatedCalls */
+	byte			*fieldwatch;	/* per field offset: taking its address with OP_ADDRESS calls SV_EdictChanged */
 	float			*globals;	/* same as pr_global_struct */
 	ddef_t			*fielddefs;	//yay reflection.
 
@@ -243,11 +297,20 @@ typedef struct qcvm_s
 	unsigned char	*knownzone;
 	size_t			knownzonesize;
 
+	int				*knownstringhash;	// open addressing, slot+1 keyed by pointer (0 = empty)
+	int				knownstringhashsize;
+	struct prstrarena_s	*strarena;		// storage and intern table for zoned strings
+	int				tempstringslots[PR_MAX_TEMPSTRINGS];	// slot+1 (0 = not reserved yet)
+	int				tempstringnext;
+	prstringstats_t	stringstats;
+
 	ddef_t			*globaldefs;
 
 	prhashtable_t	ht_fields;
 	prhashtable_t	ht_functions;
 	prhashtable_t	ht_globals;
+	int				*fieldatofs;	// first fielddef at each field offset, -1 if none
+	int				*globalatofs;	// first globaldef at each global offset, -1 if none
 
 	//originally defined in pr_exec, but moved into the switchable qcvm struct
 #define	MAX_STACK_DEPTH		1024 /*was 64*/	/* was 32 */
@@ -307,6 +370,7 @@ void PR_PopQCVM(qcvm_t *oldvm);
 void PR_Init (void);
 
 void PR_ExecuteProgram (func_t fnum);
+void PR_TranslateProgram (void);
 void PR_ClearProgs(qcvm_t *vm);
 qboolean PR_LoadProgs (const char *filename, qboolean fatal);
 void PR_EnableExtensions (void);
@@ -319,8 +383,21 @@ const char *PR_GetString (int num);
 int PR_SetEngineString (const char *s);
 void PR_ClearEngineString (int num);
 int PR_AllocString (int bufferlength, char **ptr);
+int PR_SetTempString (const char *s);
+int PR_ZoneString (const char *s);
+qboolean PR_UnzoneString (int num);
+void PR_StringStats_f (void);
 
 void PR_Profile_f (void);
+void PR_FusionStats_f (void);
+void PR_Verify_f (cvar_t *var);
+const char *PR_IsolationReason (func_t fnum);
+qboolean PR_BeginIsolatedCalls (int numslots);
+qboolean PR_ExecuteIsolated (int slot, func_t fnum, edict_t *ent, edict_t *copy, float time, int *reserved);
+qboolean PR_CommitIsolated (func_t fnum, const int *reserved);
+void PR_FreeIsolation (qcvm_t *vm);
+void PR_QCProfile_f (void);
+void PR_FreeProfiler (qcvm_t *vm);
 
 edict_t *ED_Alloc (void);
 void ED_Free (edict_t *ed);
@@ -336,6 +413,7 @@ void ED_WriteGlobals (savedata_t *save);
 const char *ED_ParseGlobals (const char *data);
 
 void ED_LoadFromFile (const char *data);
+void ED_SpawnProfile_f (void);
 
 /*
 #define EDICT_NUM(n)		((edict_t *)(sv.edicts+ (n)*pr_edict_size))
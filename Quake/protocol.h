@@ -64,11 +64,19 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define U_MODEL2		(1<<18) // 1 byte, this is .modelindex & 0xFF00 (second byte)
 #define U_LERPFINISH	(1<<19) // 1 byte, 0.0-1.0 maps to 0-255, not sent if exactly 0.1, this is ent->v.nextthink - sv.time, used for lerping
 #define U_SCALE			(1<<20) // 1 byte, for PROTOCOL_RMQ PRFL_EDICTSCALE
-#define U_UNUSED21		(1<<21)
+#define U_SNAPFLAGS		(1<<21) // 1 byte, SNAP_* flags, svc_deltaentities only
 #define U_UNUSED22		(1<<22)
 #define U_EXTEND2		(1<<23) // another byte to follow, future expansion
 //johnfitz
 
+// svc_deltaentities
+#define SNAPSHOT_BACKUP	32		// snapshots kept on both ends, must be a power of two
+#define SNAPSHOT_MASK	(SNAPSHOT_BACKUP-1)
+#define SNAP_REMOVE		0x8000	// set in the entity number of a removal
+
+#define SNAP_STEP		(1<<0)	// replaces U_STEP
+#define SNAP_LERPFINISH	(1<<1)	// lerpfinish is valid, replaces U_LERPFINISH being present
+
 //johnfitz -- PROTOCOL_NEHAHRA transparency
 #define U_TRANS			(1<<15)
 //johnfitz
@@ -224,6 +232,10 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define svc_backtolobby		55
 #define svc_localsound		56
 
+// not sent unless the client asks for it with a "deltaents" command
+#define svc_deltaentities	57	// [long] sequence [byte] delta from, 0 = baselines
+								// then [short] entity number and fast update bits, until 0
+
 //
 // client to server
 //
@@ -232,6 +244,7 @@ Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
 #define	clc_disconnect	2
 #define	clc_move		3		// [usercmd_t]
 #define	clc_stringcmd	4		// [string] message
+#define	clc_ackentities	5		// [long] last svc_deltaentities sequence received, 0 = none
 
 //
 // temp entity events
@@ -267,6 +280,21 @@ typedef struct
 	int		effects;
 } entity_state_t;
 
+// an entity as of one svc_deltaentities snapshot
+typedef struct
+{
+	unsigned short	num;
+	unsigned char	flags;		// SNAP_STEP, SNAP_LERPFINISH
+	unsigned char	lerpfinish;
+	entity_state_t	state;
+} snapentity_t;
+
+typedef struct
+{
+	int				sequence;	// 0 = empty
+	snapentity_t	*ents;		// VEC
+} entsnapshot_t;
+
 typedef struct
 {
 	vec3_t	viewangles;
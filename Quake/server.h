@@ -32,6 +32,9 @@ typedef struct
 	struct client_s	*clients;		// [maxclients]
 	int			serverflags;		// episode completion information
 	qboolean	changelevel_issued;	// cleared when at SV_SpawnServer
+	FILE		*recordfile;		// sv_record, NULL if not recording
+	qboolean	replaying;			// sv_replay is feeding recorded client input
+	qboolean	replayingame;		// key_dest was key_game in the frame being replayed
 } server_static_t;
 
 //=============================================================================
@@ -130,6 +133,8 @@ typedef struct client_s
 	sizebuf_t		message;			// can be added to at any time,
 										// copied and clear once per frame
 	byte			msgbuf[MAX_MSGLEN];
+	sizebuf_t		datagram;			// unreliable message being built,
+	byte			datagrambuf[MAX_DATAGRAM];	// sent at the end of the frame
 	edict_t			*edict;				// EDICT_NUM(clientnum+1)
 	char			name[32];			// for printing to other people
 	int				colors;
@@ -146,6 +151,15 @@ typedef struct client_s
 	int				oldstats_i[MAX_CL_STATS];		//previous values of stats. if these differ from the current values, reflag resendstats.
 	float			oldstats_f[MAX_CL_STATS];		//previous values of stats. if these differ from the current values, reflag resendstats.
 	char			*oldstats_s[MAX_CL_STATS];
+
+	int				traces;				// SV_Move calls made by its physics last frame
+	int				tracetotal, traceframes, tracemax;	// for sv_clienttraces
+
+// svc_deltaentities, if the client asked for it
+	qboolean		deltaents;
+	int				snapsequence;		// last snapshot sent
+	int				snapacked;			// last snapshot the client has, 0 = none
+	entsnapshot_t	snapshots[SNAPSHOT_BACKUP];
 } client_t;
 
 
@@ -260,6 +274,18 @@ void SV_LocalSound (client_t *client, const char *sample); // for 2021 rerelease
 void SV_DropClient (qboolean crash);
 
 void SV_SendClientMessages (void);
+void SV_NetBench_f (void);
+
+typedef struct
+{
+	int		clients;	// visible entity lists built
+	int		pvshits;	// fat PVS found in the cache
+	int		shared;		// visible entities reused from another client
+	double	time;		// spent writing the entity updates
+} netstats_t;
+
+extern netstats_t sv_netstats;
+// accumulated until host_speeds reports them
 void SV_ClearDatagram (void);
 void SV_ReserveSignonSpace (int numbytes);
 
@@ -276,6 +302,8 @@ void SV_ClientPrintf (const char *fmt, ...) FUNC_PRINTF(1,2);
 void SV_BroadcastPrintf (const char *fmt, ...) FUNC_PRINTF(1,2);
 
 void SV_Physics (void);
+void SV_ThinkStats_f (void);
+void SV_ClientTraces_f (void);
 
 qboolean SV_CheckBottom (edict_t *ent);
 qboolean SV_movestep (edict_t *ent, vec3_t move, qboolean relink);
@@ -289,4 +317,19 @@ void SV_RunClients (void);
 void SV_SaveSpawnparms (void);
 void SV_SpawnServer (const char *server);
 
+void SV_Record_f (void);
+void SV_StopRecord_f (void);
+void SV_Replay_f (void);
+void SV_RecordSpawn (const char *server);
+void SV_RecordFrame (void);
+void SV_RecordDrop (qboolean crash);
+void SV_StopRecording (void);
+void SV_StopReplay (void);
+void SV_ReplayEndFrame (void);
+qboolean SV_PhysicsActive (void);
+int SV_GetClientMessage (void);
+
+void SV_RunBots (double frametime);
+void SV_FreeNetScratch (void);
+
 #endif	/* QUAKE_SERVER_H */
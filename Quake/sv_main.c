@@ -34,6 +34,17 @@ int		sv_protocol = PROTOCOL_RMQ; //johnfitz
 extern cvar_t nomonsters;
 
 static cvar_t sv_netsort = {"sv_netsort", "1", CVAR_NONE};
+static cvar_t sv_deltaents = {"sv_deltaents", "1", CVAR_NONE};
+static cvar_t sv_pvscache = {"sv_pvscache", "1", CVAR_NONE};
+static cvar_t sv_parallelsend = {"sv_parallelsend", "1", CVAR_NONE};
+static cvar_t sv_botmove = {"sv_botmove", "2", CVAR_NONE};	// 0 = stand still, 1 = run in circles, 2 = wander
+
+extern cvar_t host_speeds;
+
+static void SV_DeltaEnts_f (void);
+static void SV_SendBench_f (void);
+static void SV_Bots_f (void);
+static void SV_BotStats_f (void);
 
 //============================================================================
 
@@ -147,6 +158,9 @@ void SV_Init (void)
 	extern	cvar_t	sv_gravity;
 	extern	cvar_t	sv_nostep;
 	extern	cvar_t	sv_freezenonclients;
+	extern	cvar_t	sv_pushgather;
+	extern	cvar_t	sv_clientprefetch;
+	extern	cvar_t	sv_parallelthinks;
 	extern	cvar_t	sv_friction;
 	extern	cvar_t	sv_edgefriction;
 	extern	cvar_t	sv_stopspeed;
@@ -174,15 +188,41 @@ void SV_Init (void)
 	Cvar_RegisterVariable (&sv_aim);
 	Cvar_RegisterVariable (&sv_nostep);
 	Cvar_RegisterVariable (&sv_freezenonclients);
+	Cvar_RegisterVariable (&sv_pushgather);
+	Cvar_RegisterVariable (&sv_clientprefetch);
+	Cvar_RegisterVariable (&sv_parallelthinks);
 	Cvar_RegisterVariable (&pr_checkextension);
 	Cvar_RegisterVariable (&sv_altnoclip); //johnfitz
 	Cvar_RegisterVariable (&sv_gameplayfix_random);
 	Cvar_RegisterVariable (&sv_netsort);
+	Cvar_RegisterVariable (&sv_deltaents);
+	Cvar_RegisterVariable (&sv_pvscache);
+	Cvar_RegisterVariable (&sv_parallelsend);
+	Cvar_RegisterVariable (&sv_botmove);
+	Cvar_RegisterVariable (&sv_findindex);
+	Cvar_RegisterVariable (&sv_areasplit);
+	Cvar_RegisterVariable (&sv_tracecache);
+	Cvar_RegisterVariable (&sv_leafcache);
+	Cvar_RegisterVariable (&sv_triggerindex);
+	Cvar_RegisterVariable (&sv_traceworkers);
 	Cvar_RegisterVariable (&sv_autoload);
 	Cvar_RegisterVariable (&sv_autosave);
 	Cvar_RegisterVariable (&sv_autosave_interval);
 
 	Cmd_AddCommand ("sv_protocol", &SV_Protocol_f); //johnfitz
+	Cmd_AddCommand ("sv_thinkstats", &SV_ThinkStats_f);
+	Cmd_AddCommand ("sv_clienttraces", &SV_ClientTraces_f);
+	Cmd_AddCommand ("sv_netbench", &SV_NetBench_f);
+	Cmd_AddCommand ("sv_sendbench", &SV_SendBench_f);
+	Cmd_AddCommand ("sv_areastats", &SV_AreaStats_f);
+	Cmd_AddCommand ("sv_tracebench", &SV_TraceBench_f);
+	Cmd_AddCommand ("sv_hullbench", &SV_HullBench_f);
+	Cmd_AddCommand ("sv_record", &SV_Record_f);
+	Cmd_AddCommand ("sv_stoprecord", &SV_StopRecord_f);
+	Cmd_AddCommand ("sv_replay", &SV_Replay_f);
+	Cmd_AddCommand ("sv_bots", &SV_Bots_f);
+	Cmd_AddCommand ("sv_botstats", &SV_BotStats_f);
+	Cmd_AddCommand_ClientCommand ("deltaents", &SV_DeltaEnts_f);
 
 	for (i=0 ; i<MAX_MODELS ; i++)
 		sprintf (localmodels[i], "*%i", i);
@@ -458,6 +498,12 @@ void SV_SendServerinfo (client_t *client)
 
 	client->sendsignon = PRESPAWN_FLUSH;
 	client->spawned = false;		// need prespawn, spawn, etc
+
+// entity numbers start over, the client asks for deltas again if it wants them
+	client->deltaents = false;
+	client->snapacked = 0;
+	for (i = 0; i < SNAPSHOT_BACKUP; i++)
+		client->snapshots[i].sequence = 0;
 }
 
 /*
@@ -490,6 +536,8 @@ void SV_ConnectClient (int clientnum)
 
 	if (sv.loadgame)
 		memcpy (spawn_parms, client->spawn_parms, sizeof(spawn_parms));
+	for (i = 0; i < SNAPSHOT_BACKUP; i++)
+		VEC_FREE (client->snapshots[i].ents);
 	memset (client, 0, sizeof(*client));
 	client->netconnection = netconnection;
 
@@ -500,6 +548,8 @@ void SV_ConnectClient (int clientnum)
 	client->message.data = client->msgbuf;
 	client->message.maxsize = sizeof(client->msgbuf);
 	client->message.allowoverflow = true;		// we can catch it
+	client->datagram.data = client->datagrambuf;
+	client->datagram.maxsize = sizeof(client->datagrambuf);
 
 	if (sv.loadgame)
 		memcpy (client->spawn_parms, spawn_parms, sizeof(spawn_parms));
@@ -515,6 +565,9 @@ void SV_ConnectClient (int clientnum)
 }
 
 
+static void SV_RecordConnect (int clientnum);
+static void SV_ReplayConnects (void);
+
 /*
 ===================
 SV_CheckForNewClients
@@ -526,6 +579,12 @@ void SV_CheckForNewClients (void)
 	struct qsocket_s	*ret;
 	int				i;
 
+	if (svs.replaying)
+	{
+		SV_ReplayConnects ();
+		return;
+	}
+
 //
 // check for new connections
 //
@@ -546,6 +605,7 @@ void SV_CheckForNewClients (void)
 
 		svs.clients[i].netconnection = ret;
 		SV_ConnectClient (i);
+		SV_RecordConnect (i);
 
 		net_activeconnections++;
 	}
@@ -652,7 +712,18 @@ SV_EdictInPVS
 */
 qboolean SV_EdictInPVS (edict_t *test, byte *pvs)
 {
-	int i;
+	int i, bytes;
+
+	// too many leafs for the list, test the bitset against the pvs instead
+	bytes = VEC_SIZE (test->leafbits);
+	if (bytes)
+	{
+		for (i = 0 ; i < bytes ; i++)
+			if (pvs[test->leafstart + i] & test->leafbits[i])
+				return true;
+		return false;
+	}
+
 	for (i = 0 ; i < test->num_leafs ; i++)
 		if (pvs[test->leafnums[i] >> 3] & (1 << (test->leafnums[i] & 7)))
 			return true;
@@ -681,1203 +752,3335 @@ qboolean SV_VisibleToClient (edict_t *client, edict_t *test, qmodel_t *worldmode
 
 #define MAX_NET_EDICTS 65536
 
-static uint16_t		net_edicts[MAX_NET_EDICTS];
-static byte			net_edict_dists[MAX_NET_EDICTS];
-static int			net_edict_bins[256];
-static uint16_t		net_edicts_sorted[MAX_NET_EDICTS];
+// scratch space for building one client's entity updates
+typedef struct
+{
+	uint16_t	edicts[MAX_NET_EDICTS];
+	byte		dists[MAX_NET_EDICTS];
+	int			bins[256];
+	uint16_t	sorted[MAX_NET_EDICTS];
+	int			baseindex[MAX_EDICTS];	// index+1 in the base snapshot, negated once seen, zeroed after use
+} netscratch_t;
+
+// one for the main thread and each trace worker, allocated on first use
+static netscratch_t	*net_scratch[1 + MAX_TRACE_WORKERS];
 
 /*
 =============
-SV_WriteEntitiesToClient
+SV_NetScratch
 
+Returns the scratch space of the calling thread
 =============
 */
-void SV_WriteEntitiesToClient (edict_t	*clent, sizebuf_t *msg)
+static netscratch_t *SV_NetScratch (void)
 {
-	int		e, i, j, numents;
-	int		bits;
-	byte	*pvs;
-	vec3_t	org, forward, right, up;
-	float	miss, dist, size;
-	eval_t	*val;
-	edict_t	*ent;
-
-// find the client's PVS
-	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
-	pvs = SV_FatPVS (org, sv.worldmodel);
-
-// find the client's orientation
-	AngleVectors (clent->v.v_angle, forward, right, up);
+	netscratch_t	**ns = &net_scratch[sv_traceworkernum];
 
-// reset sorting bins
-	memset (net_edict_bins, 0, sizeof (net_edict_bins));
-
-// add clent
-	if (sv_netsort.value)
+	if (!*ns)
 	{
-		net_edicts[0] = NUM_FOR_EDICT (clent);
-		net_edict_dists[0] = 0;
-		net_edict_bins[0] = 1;
+		*ns = (netscratch_t *) calloc (1, sizeof (netscratch_t));
+		if (!*ns)
+			Sys_Error ("SV_NetScratch: out of memory");
 	}
-	else
-		net_edicts_sorted[0] = NUM_FOR_EDICT (clent);
-	numents = 1;
-
-// add all other entities that touch the pvs
-	ent = NEXT_EDICT(qcvm->edicts);
-	for (e=1 ; e<qcvm->num_edicts ; e++, ent = NEXT_EDICT(ent))
-	{
-		if (ent != clent)	// clent already added before the loop
-		{
-			// ignore ents without visible models
-			if (!ent->v.modelindex || !PR_GetString(ent->v.model)[0])
-				continue;
-
-			//johnfitz -- don't send model>255 entities if protocol is 15
-			if (sv.protocol == PROTOCOL_NETQUAKE && (int)ent->v.modelindex & 0xFF00)
-				continue;
-
-			// ignore if not touching a PV leaf
-			for (i=0 ; i < ent->num_leafs ; i++)
-				if (pvs[ent->leafnums[i] >> 3] & (1 << (ent->leafnums[i]&7) ))
-					break;
-			
-			// ericw -- added ent->num_leafs < MAX_ENT_LEAFS condition.
-			//
-			// if ent->num_leafs == MAX_ENT_LEAFS, the ent is visible from too many leafs
-			// for us to say whether it's in the PVS, so don't try to vis cull it.
-			// this commonly happens with rotators, because they often have huge bboxes
-			// spanning the entire map, or really tall lifts, etc.
-			if (i == ent->num_leafs && ent->num_leafs < MAX_ENT_LEAFS)
-				continue;		// not visible
-
-			if (sv_netsort.value)
-			{
-				// compute ent bbox size and distance from org to the closest point in ent's bbox
-				dist = size = 0.f;
-				for (i=0 ; i<3 ; i++)
-				{
-					float delta = CLAMP (ent->v.absmin[i], org[i], ent->v.absmax[i]) - org[i];
-					dist += delta * delta;
-					delta = ent->v.absmax[i] - ent->v.absmin[i];
-					size += delta * delta;
-				}
-				size = q_max (1.f, size);
 
-				// use scaled square root of (distance/size) as sort key
-				dist = 8.f * sqrt (sqrt (dist/size));
-				net_edict_dists[numents] = (int) q_min (dist, 255.f);
-				net_edicts[numents] = e;
+	return *ns;
+}
 
-				// compute max distance along forward axis
-				dist = 0.f;
-				for (i=0 ; i<3 ; i++)
-					dist += ((forward[i] < 0.f ? ent->v.absmin[i] : ent->v.absmax[i]) - org[i]) * forward[i];
-				if (dist < 0.f)
-					net_edict_dists[numents] |= 128; // deprioritize entities behind the client
+/*
+=============
+SV_FreeNetScratch
 
-				net_edict_bins[net_edict_dists[numents]]++;
-			}
-			else
-				net_edicts_sorted[numents] = e;
+Called once the trace workers are stopped
+=============
+*/
+void SV_FreeNetScratch (void)
+{
+	int		i;
 
-			if (++numents == MAX_NET_EDICTS)
-				break;
-		}
-		else
-			continue;
+	for (i = 0; i < countof (net_scratch); i++)
+	{
+		free (net_scratch[i]);
+		net_scratch[i] = NULL;
 	}
+}
 
-	if (sv_netsort.value)
-	{
-		// compute bin offsets
-		e = 0;
-		for (i=0 ; i<countof(net_edict_bins) ; i++)
-		{
-			int tmp = net_edict_bins[i];
-			net_edict_bins[i] = e;
-			e += tmp;
-		}
+/*
+===============================================================================
 
-		// generate sorted list
-		for (e=0 ; e<numents ; e++)
-			net_edicts_sorted[net_edict_bins[net_edict_dists[e]]++] = net_edicts[e];
-	}
+NET ENTITY LIST
 
-// send entities (closest first)
-	for (j=0 ; j<numents ; j++)
-	{
-		e = net_edicts_sorted[j];
-		ent = EDICT_NUM (e);
+SV_WriteEntitiesToClient only needs a handful of things from each edict to
+decide whether to send it, but looking them up directly touches every edict
+once per client. They're gathered into compact arrays once per frame instead,
+in SV_BuildNetEdicts, and the per-client scans only go through those.
 
-		// johnfitz -- max size for protocol 15 is 18 bytes, not 16 as originally
-		// assumed here.  And, for protocol 85 the max size is actually 24 bytes.
-		// For float coords and angles the limit is 40.
-		// FIXME: Use tighter limit according to protocol flags and send bits.
-		if (msg->cursize + 40 > msg->maxsize)
-		{
-			//johnfitz -- less spammy overflow message
-			if (!dev_overflows.packetsize || dev_overflows.packetsize + CONSOLE_RESPAM_TIME < realtime )
-			{
-				Con_Printf ("Packet overflow!\n");
-				dev_overflows.packetsize = realtime;
-			}
-			goto stats;
-			//johnfitz
-		}
+===============================================================================
+*/
 
-// send an update
-		bits = 0;
+typedef struct
+{
+	int			count;
+	int			num_edicts;		// qcvm->num_edicts when built
+	int			frame;			// bumped every time it's built
+	uint16_t	*nums;			// VEC, edicts with a model that can be sent
+	float		*bounds;		// VEC, absmin and absmax for each
+	int			*leafofs;		// VEC, first leaf for each, plus one extra at the end
+	int			*leafs;			// VEC
+	byte		*leafbits;		// VEC, leafs are in the edict's leafbits instead
+} svnetedicts_t;
+
+static svnetedicts_t	sv_netedicts;
 
-		for (i=0 ; i<3 ; i++)
-		{
-			miss = ent->v.origin[i] - ent->baseline.origin[i];
-			if ( miss < -0.1 || miss > 0.1 )
-				bits |= U_ORIGIN1<<i;
-		}
+/*
+=============
+SV_CanSendEdict
 
-		if ( ent->v.angles[0] != ent->baseline.angles[0] )
-			bits |= U_ANGLE1;
+Has a model that the current protocol can send
+=============
+*/
+static qboolean SV_CanSendEdict (edict_t *ent)
+{
+	// ignore ents without visible models
+	if (!ent->v.modelindex || !PR_GetString(ent->v.model)[0])
+		return false;
 
-		if ( ent->v.angles[1] != ent->baseline.angles[1] )
-			bits |= U_ANGLE2;
+	//johnfitz -- don't send model>255 entities if protocol is 15
+	if (sv.protocol == PROTOCOL_NETQUAKE && (int)ent->v.modelindex & 0xFF00)
+		return false;
 
-		if ( ent->v.angles[2] != ent->baseline.angles[2] )
-			bits |= U_ANGLE3;
+	return true;
+}
 
-		if (ent->v.movetype == MOVETYPE_STEP)
-			bits |= U_STEP;	// don't mess up the step animation
+/*
+=============
+SV_UpdateEdictAlpha
 
-		if (ent->baseline.colormap != ent->v.colormap)
-			bits |= U_COLORMAP;
+Looks up the alpha and scale fields, done here instead of for every client
+that gets sent the edict
+=============
+*/
+static void SV_UpdateEdictAlpha (edict_t *ent)
+{
+	eval_t	*val;
 
-		if (ent->baseline.skin != ent->v.skin)
-			bits |= U_SKIN;
+	//johnfitz -- alpha
+	val = GetEdictFieldValueByName(ent, "alpha");
+	if (val)
+		ent->alpha = ENTALPHA_ENCODE(val->_float);
+	//johnfitz
 
-		if (ent->baseline.frame != ent->v.frame)
-			bits |= U_FRAME;
+	val = GetEdictFieldValueByName(ent, "scale");
+	if (val)
+		ent->scale = ENTSCALE_ENCODE(val->_float);
+	else
+		ent->scale = ENTSCALE_DEFAULT;
+}
 
-		if ((ent->baseline.effects ^ (int)ent->v.effects) & qcvm->effects_mask)
-			bits |= U_EFFECTS;
+/*
+=============
+SV_BuildNetEdicts
 
-		if (ent->baseline.modelindex != ent->v.modelindex)
-			bits |= U_MODEL;
+Called once per frame, before the client messages are built
+=============
+*/
+static void SV_BuildNetEdicts (void)
+{
+	svnetedicts_t	*ne = &sv_netedicts;
+	edict_t			*ent;
+	int				e;
 
-		//johnfitz -- alpha
-		// TODO: find a cleaner place to put this code
-		val = GetEdictFieldValueByName(ent, "alpha");
-		if (val)
-			ent->alpha = ENTALPHA_ENCODE(val->_float);
+	VEC_CLEAR (ne->nums);
+	VEC_CLEAR (ne->bounds);
+	VEC_CLEAR (ne->leafofs);
+	VEC_CLEAR (ne->leafs);
+	VEC_CLEAR (ne->leafbits);
 
-		//don't send invisible entities unless they have effects
-		if (ent->alpha == ENTALPHA_ZERO && !((int)ent->v.effects & qcvm->effects_mask))
+	ent = NEXT_EDICT(qcvm->edicts);
+	for (e=1 ; e<qcvm->num_edicts ; e++, ent = NEXT_EDICT(ent))
+	{
+		if (!SV_CanSendEdict (ent))
+		{
+			if (e <= svs.maxclients)	// always sent to their own client
+				SV_UpdateEdictAlpha (ent);
 			continue;
-		//johnfitz
+		}
 
-		val = GetEdictFieldValueByName(ent, "scale");
-		if (val)
-			ent->scale = ENTSCALE_ENCODE(val->_float);
+		SV_UpdateEdictAlpha (ent);
+		VEC_PUSH (ne->nums, e);
+		Vec_Append ((void **)&ne->bounds, sizeof (float), ent->v.absmin, 3);
+		Vec_Append ((void **)&ne->bounds, sizeof (float), ent->v.absmax, 3);
+		VEC_PUSH (ne->leafofs, VEC_SIZE (ne->leafs));
+		if (VEC_SIZE (ent->leafbits))
+			VEC_PUSH (ne->leafbits, 1);
 		else
-			ent->scale = ENTSCALE_DEFAULT;
-
-		//johnfitz -- PROTOCOL_FITZQUAKE
-		if (sv.protocol != PROTOCOL_NETQUAKE)
 		{
-
-			if (ent->baseline.alpha != ent->alpha) bits |= U_ALPHA;
-			if (ent->baseline.scale != ent->scale) bits |= U_SCALE;
-			if (bits & U_FRAME && (int)ent->v.frame & 0xFF00) bits |= U_FRAME2;
-			if (bits & U_MODEL && (int)ent->v.modelindex & 0xFF00) bits |= U_MODEL2;
-			if (ent->sendinterval) bits |= U_LERPFINISH;
-			if (bits >= 65536) bits |= U_EXTEND1;
-			if (bits >= 16777216) bits |= U_EXTEND2;
+			Vec_Append ((void **)&ne->leafs, sizeof (int), ent->leafnums, ent->num_leafs);
+			VEC_PUSH (ne->leafbits, 0);
 		}
-		//johnfitz
-
-		if (e >= 256)
-			bits |= U_LONGENTITY;
+	}
+	VEC_PUSH (ne->leafofs, VEC_SIZE (ne->leafs));
 
-		if (bits >= 256)
-			bits |= U_MOREBITS;
+	ne->count = VEC_SIZE (ne->nums);
+	ne->num_edicts = qcvm->num_edicts;
+	ne->frame++;
+}
 
-	//
-	// write the message
-	//
-		MSG_WriteByte (msg, bits | U_SIGNAL);
+/*
+=============
+SV_AddNetEdict
 
-		if (bits & U_MOREBITS)
-			MSG_WriteByte (msg, bits>>8);
+Adds an edict that touches the pvs to the list of edicts to send
+=============
+*/
+static int SV_AddNetEdict (netscratch_t *ns, int e, const float *absmin, const float *absmax, const vec3_t org, const vec3_t forward, int numents)
+{
+	float	dist, size;
+	int		i;
 
-		//johnfitz -- PROTOCOL_FITZQUAKE
-		if (bits & U_EXTEND1)
-			MSG_WriteByte(msg, bits>>16);
-		if (bits & U_EXTEND2)
-			MSG_WriteByte(msg, bits>>24);
-		//johnfitz
+	if (sv_netsort.value)
+	{
+		// compute ent bbox size and distance from org to the closest point in ent's bbox
+		dist = size = 0.f;
+		for (i=0 ; i<3 ; i++)
+		{
+			float delta = CLAMP (absmin[i], org[i], absmax[i]) - org[i];
+			dist += delta * delta;
+			delta = absmax[i] - absmin[i];
+			size += delta * delta;
+		}
+		size = q_max (1.f, size);
 
-		if (bits & U_LONGENTITY)
-			MSG_WriteShort (msg,e);
-		else
-			MSG_WriteByte (msg,e);
+		// use scaled square root of (distance/size) as sort key
+		dist = 8.f * sqrt (sqrt (dist/size));
+		ns->dists[numents] = (int) q_min (dist, 255.f);
+		ns->edicts[numents] = e;
 
-		if (bits & U_MODEL)
-			MSG_WriteByte (msg,	ent->v.modelindex);
-		if (bits & U_FRAME)
-			MSG_WriteByte (msg, ent->v.frame);
-		if (bits & U_COLORMAP)
-			MSG_WriteByte (msg, ent->v.colormap);
-		if (bits & U_SKIN)
-			MSG_WriteByte (msg, ent->v.skin);
-		if (bits & U_EFFECTS)
-			MSG_WriteByte (msg, (int)ent->v.effects & qcvm->effects_mask);
-		if (bits & U_ORIGIN1)
-			MSG_WriteCoord (msg, ent->v.origin[0], sv.protocolflags);
-		if (bits & U_ANGLE1)
-			MSG_WriteAngle(msg, ent->v.angles[0], sv.protocolflags);
-		if (bits & U_ORIGIN2)
-			MSG_WriteCoord (msg, ent->v.origin[1], sv.protocolflags);
-		if (bits & U_ANGLE2)
-			MSG_WriteAngle(msg, ent->v.angles[1], sv.protocolflags);
-		if (bits & U_ORIGIN3)
-			MSG_WriteCoord (msg, ent->v.origin[2], sv.protocolflags);
-		if (bits & U_ANGLE3)
-			MSG_WriteAngle(msg, ent->v.angles[2], sv.protocolflags);
+		// compute max distance along forward axis
+		dist = 0.f;
+		for (i=0 ; i<3 ; i++)
+			dist += ((forward[i] < 0.f ? absmin[i] : absmax[i]) - org[i]) * forward[i];
+		if (dist < 0.f)
+			ns->dists[numents] |= 128; // deprioritize entities behind the client
 
-		//johnfitz -- PROTOCOL_FITZQUAKE
-		if (bits & U_ALPHA)
-			MSG_WriteByte(msg, ent->alpha);
-		if (bits & U_SCALE)
-			MSG_WriteByte(msg, ent->scale);
-		if (bits & U_FRAME2)
-			MSG_WriteByte(msg, (int)ent->v.frame >> 8);
-		if (bits & U_MODEL2)
-			MSG_WriteByte(msg, (int)ent->v.modelindex >> 8);
-		if (bits & U_LERPFINISH)
-			MSG_WriteByte(msg, (byte)(Q_rint((ent->v.nextthink-qcvm->time)*255)));
-		//johnfitz
+		ns->bins[ns->dists[numents]]++;
 	}
+	else
+		ns->sorted[numents] = e;
 
-	//johnfitz -- devstats
-stats:
-	if (msg->cursize > 1024 && dev_peakstats.packetsize <= 1024)
-		Con_DWarning ("%i byte packet exceeds standard limit of 1024 (max = %d).\n", msg->cursize, msg->maxsize);
-	dev_stats.packetsize = msg->cursize;
-	dev_peakstats.packetsize = q_max(msg->cursize, dev_peakstats.packetsize);
-	//johnfitz
+	return numents + 1;
 }
 
 /*
 =============
-SV_CleanupEnts
+SV_GatherNetEdictsSlow
 
+The original scan over all the edicts, used when the net edict list isn't
+up to date, and by sv_netbench for comparison
 =============
 */
-void SV_CleanupEnts (void)
+static int SV_GatherNetEdictsSlow (netscratch_t *ns, edict_t *clent, byte *pvs, const vec3_t org, const vec3_t forward, int numents)
 {
-	int		e;
 	edict_t	*ent;
+	int		e;
 
 	ent = NEXT_EDICT(qcvm->edicts);
 	for (e=1 ; e<qcvm->num_edicts ; e++, ent = NEXT_EDICT(ent))
 	{
-		ent->v.effects = (int)ent->v.effects & ~EF_MUZZLEFLASH;
+		if (ent == clent)	// clent already added before the loop
+			continue;
+
+		if (!SV_CanSendEdict (ent))
+			continue;
+
+		// ignore if not touching a PV leaf
+		if (!SV_EdictInPVS (ent, pvs))
+			continue;		// not visible
+
+		SV_UpdateEdictAlpha (ent);
+		numents = SV_AddNetEdict (ns, e, ent->v.absmin, ent->v.absmax, org, forward, numents);
+		if (numents == MAX_NET_EDICTS)
+			break;
 	}
+
+	return numents;
 }
 
 /*
-==================
-SV_WriteClientdataToMessage
+=============
+SV_NetEdictListValid
 
-==================
+False if edicts were added since the net edict list was built
+=============
 */
-void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg)
+static qboolean SV_NetEdictListValid (void)
 {
-	int		bits;
-	int		i;
-	edict_t	*other;
-	int		items;
-	eval_t	*val;
+	return sv_netedicts.num_edicts == qcvm->num_edicts && sv_netedicts.leafofs;
+}
 
-//
-// send a damage message
-//
-	if (ent->v.dmg_take || ent->v.dmg_save)
-	{
-		other = PROG_TO_EDICT(ent->v.dmg_inflictor);
-		MSG_WriteByte (msg, svc_damage);
-		MSG_WriteByte (msg, ent->v.dmg_save);
-		MSG_WriteByte (msg, ent->v.dmg_take);
-		for (i=0 ; i<3 ; i++)
-			MSG_WriteCoord (msg, other->v.origin[i] + 0.5*(other->v.mins[i] + other->v.maxs[i]), sv.protocolflags );
+/*
+=============
+SV_NetEdictInPVS
 
-		ent->v.dmg_take = 0;
-		ent->v.dmg_save = 0;
-	}
+Takes an index in the net edict list
+=============
+*/
+static qboolean SV_NetEdictInPVS (int i, byte *pvs)
+{
+	svnetedicts_t	*ne = &sv_netedicts;
+	int				j;
 
-//
-// send the current viewpos offset from the view entity
-//
-	SV_SetIdealPitch ();		// how much to look up / down ideally
+	if (ne->leafbits[i])
+		return SV_EdictInPVS (EDICT_NUM (ne->nums[i]), pvs);
 
-// a fixangle might get lost in a dropped packet.  Oh well.
-	if ( ent->v.fixangle )
-	{
-		MSG_WriteByte (msg, svc_setangle);
-		for (i=0 ; i < 3 ; i++)
-			MSG_WriteAngle (msg, ent->v.angles[i], sv.protocolflags );
-		ent->v.fixangle = 0;
-	}
-
-	bits = 0;
-
-	if (ent->v.view_ofs[2] != DEFAULT_VIEWHEIGHT)
-		bits |= SU_VIEWHEIGHT;
+	for (j = ne->leafofs[i]; j < ne->leafofs[i+1]; j++)
+		if (pvs[ne->leafs[j] >> 3] & (1 << (ne->leafs[j]&7)))
+			return true;
+	return false;
+}
 
-	if (ent->v.idealpitch)
-		bits |= SU_IDEALPITCH;
+/*
+=============
+SV_GatherNetEdicts
+=============
+*/
+static int SV_GatherNetEdicts (netscratch_t *ns, edict_t *clent, byte *pvs, const vec3_t org, const vec3_t forward, int numents)
+{
+	svnetedicts_t	*ne = &sv_netedicts;
+	int				i, clentnum = NUM_FOR_EDICT (clent);
 
-// stuff the sigil bits into the high bits of items for sbar, or else
-// mix in items2
-	val = GetEdictFieldValueByName(ent, "items2");
+	if (!SV_NetEdictListValid ())
+		return SV_GatherNetEdictsSlow (ns, clent, pvs, org, forward, numents);
 
-	if (val)
-		items = (int)ent->v.items | ((int)val->_float << 23);
-	else
-		items = (int)ent->v.items | ((int)pr_global_struct->serverflags << 28);
+	for (i = 0; i < ne->count; i++)
+	{
+		int e = ne->nums[i];
+		if (e == clentnum)	// clent already added before the loop
+			continue;
 
-	bits |= SU_ITEMS;
+		if (!SV_NetEdictInPVS (i, pvs))
+			continue;		// not visible
 
-	if ( (int)ent->v.flags & FL_ONGROUND)
-		bits |= SU_ONGROUND;
+		numents = SV_AddNetEdict (ns, e, &ne->bounds[i*6], &ne->bounds[i*6+3], org, forward, numents);
+		if (numents == MAX_NET_EDICTS)
+			break;
+	}
 
-	if ( ent->v.waterlevel >= 2)
-		bits |= SU_INWATER;
+	return numents;
+}
 
-	for (i=0 ; i<3 ; i++)
-	{
-		if (ent->v.punchangle[i])
-			bits |= (SU_PUNCH1<<i);
-		if (ent->v.velocity[i])
-			bits |= (SU_VELOCITY1<<i);
-	}
+/*
+===============================================================================
 
-	if (ent->v.weaponframe)
-		bits |= SU_WEAPONFRAME;
+SHARED PVS
 
-	if (ent->v.armorvalue)
-		bits |= SU_ARMOR;
+A fat PVS only depends on which leafs are within 8 units of the view origin,
+so it's cached under that list of leafs.  Clients standing in the same spot
+share it, along with the net edicts that touch it for the frame, and only
+the distance sorting is left to do for each of them.
 
-//	if (ent->v.weapon)
-	  bits |= SU_WEAPON;
+===============================================================================
+*/
 
-	//johnfitz -- PROTOCOL_FITZQUAKE
-	if (sv.protocol != PROTOCOL_NETQUAKE)
-	{
-		if (bits & SU_WEAPON && SV_ModelIndex(PR_GetString(ent->v.weaponmodel)) & 0xFF00) bits |= SU_WEAPON2;
-		if ((int)ent->v.armorvalue & 0xFF00) bits |= SU_ARMOR2;
-		if ((int)ent->v.currentammo & 0xFF00) bits |= SU_AMMO2;
-		if ((int)ent->v.ammo_shells & 0xFF00) bits |= SU_SHELLS2;
-		if ((int)ent->v.ammo_nails & 0xFF00) bits |= SU_NAILS2;
-		if ((int)ent->v.ammo_rockets & 0xFF00) bits |= SU_ROCKETS2;
-		if ((int)ent->v.ammo_cells & 0xFF00) bits |= SU_CELLS2;
-		if (bits & SU_WEAPONFRAME && (int)ent->v.weaponframe & 0xFF00) bits |= SU_WEAPONFRAME2;
-		if (bits & SU_WEAPON && ent->alpha != ENTALPHA_DEFAULT) bits |= SU_WEAPONALPHA; //for now, weaponalpha = client entity alpha
-		if (bits >= 65536) bits |= SU_EXTEND1;
-		if (bits >= 16777216) bits |= SU_EXTEND2;
-	}
-	//johnfitz
+#define MAX_PVS_CACHE	64		// enough for sv_sendbench too
+#define MAX_FAT_LEAFS	8
 
-// send the data
+typedef struct
+{
+	int		numleafs;				// 0 = unused
+	int		leafs[MAX_FAT_LEAFS];	// in the order SV_AddToFatPVS visits them
+	byte	*pvs;
+	int		frame;					// sv_netedicts.frame the list was gathered for
+	int		*list;					// VEC, indices in the net edict list
+	int		lastused;
+} pvscache_t;
 
-	MSG_WriteByte (msg, svc_clientdata);
-	MSG_WriteShort (msg, bits);
+static pvscache_t	pvscache[MAX_PVS_CACHE];
+static int			pvscache_time;
+static int			pvscache_passtime;	// pvscache_time when the clients' updates began
 
-	//johnfitz -- PROTOCOL_FITZQUAKE
-	if (bits & SU_EXTEND1) MSG_WriteByte(msg, bits>>16);
-	if (bits & SU_EXTEND2) MSG_WriteByte(msg, bits>>24);
-	//johnfitz
+netstats_t			sv_netstats;
 
-	if (bits & SU_VIEWHEIGHT)
-		MSG_WriteChar (msg, ent->v.view_ofs[2]);
+/*
+=============
+SV_ClearPVSCache
 
-	if (bits & SU_IDEALPITCH)
-		MSG_WriteChar (msg, ent->v.idealpitch);
+The leafs are only good for the map they came from
+=============
+*/
+static void SV_ClearPVSCache (void)
+{
+	int i;
 
-	for (i=0 ; i<3 ; i++)
+	for (i = 0; i < MAX_PVS_CACHE; i++)
 	{
-		if (bits & (SU_PUNCH1<<i))
-			MSG_WriteChar (msg, ent->v.punchangle[i]);
-		if (bits & (SU_VELOCITY1<<i))
-			MSG_WriteChar (msg, ent->v.velocity[i]/16);
+		pvscache[i].numleafs = 0;
+		pvscache[i].frame = 0;
+		pvscache[i].lastused = 0;
 	}
+	pvscache_time = 0;
+	pvscache_passtime = 0;
+}
 
-// [always sent]	if (bits & SU_ITEMS)
-	MSG_WriteLong (msg, items);
-
-	if (bits & SU_WEAPONFRAME)
-		MSG_WriteByte (msg, ent->v.weaponframe);
-	if (bits & SU_ARMOR)
-		MSG_WriteByte (msg, ent->v.armorvalue);
-	if (bits & SU_WEAPON)
-		MSG_WriteByte (msg, SV_ModelIndex(PR_GetString(ent->v.weaponmodel)));
+/*
+=============
+SV_FatLeafs
 
-	MSG_WriteShort (msg, ent->v.health);
-	MSG_WriteByte (msg, ent->v.currentammo);
-	MSG_WriteByte (msg, ent->v.ammo_shells);
-	MSG_WriteByte (msg, ent->v.ammo_nails);
-	MSG_WriteByte (msg, ent->v.ammo_rockets);
-	MSG_WriteByte (msg, ent->v.ammo_cells);
+Lists the leafs SV_AddToFatPVS would add, returns how many there are even
+if that's more than MAX_FAT_LEAFS
+=============
+*/
+static int SV_FatLeafs (vec3_t org, mnode_t *node, int *leafs, int numleafs)
+{
+	mplane_t	*plane;
+	float		d;
 
-	if (standard_quake)
-	{
-		MSG_WriteByte (msg, ent->v.weapon);
-	}
-	else
+	while (1)
 	{
-		for(i=0;i<32;i++)
+		if (node->contents < 0)
 		{
-			if ( ((int)ent->v.weapon) & (1<<i) )
+			if (node->contents != CONTENTS_SOLID)
 			{
-				MSG_WriteByte (msg, i);
-				break;
+				if (numleafs < MAX_FAT_LEAFS)
+					leafs[numleafs] = (mleaf_t *)node - sv.worldmodel->leafs;
+				numleafs++;
 			}
+			return numleafs;
+		}
+
+		plane = node->plane;
+		d = DotProduct (org, plane->normal) - plane->dist;
+		if (d > 8)
+			node = node->children[0];
+		else if (d < -8)
+			node = node->children[1];
+		else
+		{	// go down both
+			numleafs = SV_FatLeafs (org, node->children[0], leafs, numleafs);
+			node = node->children[1];
 		}
 	}
+}
 
-	//johnfitz -- PROTOCOL_FITZQUAKE
-	if (bits & SU_WEAPON2)
-		MSG_WriteByte (msg, SV_ModelIndex(PR_GetString(ent->v.weaponmodel)) >> 8);
-	if (bits & SU_ARMOR2)
-		MSG_WriteByte (msg, (int)ent->v.armorvalue >> 8);
-	if (bits & SU_AMMO2)
-		MSG_WriteByte (msg, (int)ent->v.currentammo >> 8);
-	if (bits & SU_SHELLS2)
-		MSG_WriteByte (msg, (int)ent->v.ammo_shells >> 8);
-	if (bits & SU_NAILS2)
-		MSG_WriteByte (msg, (int)ent->v.ammo_nails >> 8);
-	if (bits & SU_ROCKETS2)
-		MSG_WriteByte (msg, (int)ent->v.ammo_rockets >> 8);
-	if (bits & SU_CELLS2)
-		MSG_WriteByte (msg, (int)ent->v.ammo_cells >> 8);
-	if (bits & SU_WEAPONFRAME2)
-		MSG_WriteByte (msg, (int)ent->v.weaponframe >> 8);
-	if (bits & SU_WEAPONALPHA)
-		MSG_WriteByte (msg, ent->alpha); //for now, weaponalpha = client entity alpha
-	//johnfitz
+/*
+=============
+SV_CachedFatPVS
 
-	// Hack: Alkaline 1.1 uses bit flags to store the active weapon,
-	// but we only send the stat as a byte, which can lead to truncation.
-	// If we detect this, re-send the stat separately (as a 32-bit int).
-	if ((byte)ent->v.weapon != (int)ent->v.weapon && msg->cursize + 6 <= msg->maxsize)
+Returns NULL if the view origin touches too many leafs to cache, or if every
+entry is already in use by another client this frame
+=============
+*/
+static pvscache_t *SV_CachedFatPVS (vec3_t org)
+{
+	int			leafs[MAX_FAT_LEAFS];
+	int			i, j, numleafs, bytes;
+	pvscache_t	*c, *oldest;
+	byte		*pvs;
+
+	numleafs = SV_FatLeafs (org, sv.worldmodel->nodes, leafs, 0);
+	if (!numleafs || numleafs > MAX_FAT_LEAFS)
+		return NULL;
+
+	pvscache_time++;
+	oldest = pvscache;
+	for (i = 0, c = pvscache; i < MAX_PVS_CACHE; i++, c++)
 	{
-		MSG_WriteByte (msg, svc_updatestat);
-		MSG_WriteByte (msg, STAT_ACTIVEWEAPON);
-		MSG_WriteLong (msg, (int)ent->v.weapon);
+		if (c->numleafs == numleafs && !memcmp (c->leafs, leafs, numleafs * sizeof (leafs[0])))
+		{
+			c->lastused = pvscache_time;
+			sv_netstats.pvshits++;
+			return c;
+		}
+		if (c->lastused < oldest->lastused)
+			oldest = c;
+	}
+
+	if (oldest->lastused > pvscache_passtime)
+		return NULL;
+
+	c = oldest;
+	bytes = (sv.worldmodel->numleafs+7)>>3;
+	c->pvs = (byte *) realloc (c->pvs, bytes);
+	if (!c->pvs)
+		Sys_Error ("SV_CachedFatPVS: realloc() failed on %d bytes", bytes);
+	memset (c->pvs, 0, bytes);
+	for (i = 0; i < numleafs; i++)
+	{
+		pvs = Mod_LeafPVS (&sv.worldmodel->leafs[leafs[i]], sv.worldmodel);
+		for (j = 0; j < bytes; j++)
+			c->pvs[j] |= pvs[j];
 	}
+
+	c->numleafs = numleafs;
+	memcpy (c->leafs, leafs, numleafs * sizeof (leafs[0]));
+	c->frame = 0;
+	c->lastused = pvscache_time;
+
+	return c;
 }
 
 /*
-=======================
-SV_SendClientDatagram
-=======================
+=============
+SV_BuildCachedNetEdicts
+
+Lists the net edicts that touch a cached PVS, once per frame
+=============
 */
-qboolean SV_SendClientDatagram (client_t *client)
+static void SV_BuildCachedNetEdicts (int index, void *data)
 {
-	byte		buf[MAX_DATAGRAM];
-	sizebuf_t	msg;
+	svnetedicts_t	*ne = &sv_netedicts;
+	pvscache_t		*c = ((pvscache_t **) data)[index];
+	int				i;
 
-	msg.data = buf;
-	msg.maxsize = sizeof(buf);
-	msg.cursize = 0;
+	VEC_CLEAR (c->list);
+	for (i = 0; i < ne->count; i++)
+		if (SV_NetEdictInPVS (i, c->pvs))
+			VEC_PUSH (c->list, i);
+}
 
-	//johnfitz -- if client is nonlocal, use smaller max size so packets aren't fragmented
-	if (Q_strcmp(NET_QSocketGetAddressString(client->netconnection), "LOCAL") != 0)
-		msg.maxsize = DATAGRAM_MTU;
-	//johnfitz
+/*
+=============
+SV_GatherCachedNetEdicts
 
-	MSG_WriteByte (&msg, svc_time);
-	MSG_WriteFloat (&msg, qcvm->time);
+Same as SV_GatherNetEdicts, with the PVS tests already done by
+SV_BuildCachedNetEdicts
+=============
+*/
+static int SV_GatherCachedNetEdicts (netscratch_t *ns, pvscache_t *c, edict_t *clent, const vec3_t org, const vec3_t forward, int numents)
+{
+	svnetedicts_t	*ne = &sv_netedicts;
+	int				i, j, count, clentnum = NUM_FOR_EDICT (clent);
 
-// add the client specific data to the datagram
-	SV_WriteClientdataToMessage (client->edict, &msg);
+	for (j = 0, count = VEC_SIZE (c->list); j < count; j++)
+	{
+		i = c->list[j];
+		if (ne->nums[i] == clentnum)	// clent already added before the loop
+			continue;
 
-	SV_WriteEntitiesToClient (client->edict, &msg);
+		numents = SV_AddNetEdict (ns, ne->nums[i], &ne->bounds[i*6], &ne->bounds[i*6+3], org, forward, numents);
+		if (numents == MAX_NET_EDICTS)
+			break;
+	}
 
-// copy the server datagram if there is space
-	if (msg.cursize + sv.datagram.cursize < msg.maxsize)
-		SZ_Write (&msg, sv.datagram.data, sv.datagram.cursize);
+	return numents;
+}
 
-// send the datagram
-	if (NET_SendUnreliableMessage (client->netconnection, &msg) == -1)
+/*
+=============
+SV_NetBench_f
+
+Times the per-client entity scans with and without the net edict list
+
+sv_netbench [iterations]
+=============
+*/
+void SV_NetBench_f (void)
+{
+	netscratch_t	*ns;
+	byte		*pvs;
+	vec3_t		org, forward, right, up;
+	edict_t		*clent;
+	double		t0, t1, t2;
+	int			i, iterations, numents[2];
+	size_t		edictbytes, listbytes;
+
+	if (!sv.active)
+		return;
+
+	iterations = Cmd_Argc () >= 2 ? q_max (Q_atoi (Cmd_Argv (1)), 1) : 100;
+
+	PR_SwitchQCVM(&sv.qcvm);
+	ns = SV_NetScratch ();
+
+	clent = svs.clients[0].edict;
+	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
+	AngleVectors (clent->v.v_angle, forward, right, up);
+
+	t0 = Sys_DoubleTime ();
+	for (i = 0; i < iterations; i++)
 	{
-		SV_DropClient (true);// if the message couldn't send, kick off
-		return false;
+		memset (ns->bins, 0, sizeof (ns->bins));
+		pvs = SV_FatPVS (org, sv.worldmodel);
+		numents[0] = SV_GatherNetEdictsSlow (ns, clent, pvs, org, forward, 1);
 	}
+	t1 = Sys_DoubleTime ();
+	for (i = 0; i < iterations; i++)
+	{
+		memset (ns->bins, 0, sizeof (ns->bins));
+		SV_BuildNetEdicts ();
+		pvs = SV_FatPVS (org, sv.worldmodel);
+		numents[1] = SV_GatherNetEdicts (ns, clent, pvs, org, forward, 1);
+	}
+	t2 = Sys_DoubleTime ();
 
-	return true;
+	edictbytes = (size_t) qcvm->num_edicts * qcvm->edict_size;
+	listbytes = sv_netedicts.count * (sizeof (uint16_t) + 6 * sizeof (float) + sizeof (int) + 1) + VEC_SIZE (sv_netedicts.leafs) * sizeof (int);
+
+	Con_Printf ("%d edicts (%" SDL_PRIu64 "K), %d sendable (%" SDL_PRIu64 "K), %d visible from client 1\n",
+		qcvm->num_edicts, (uint64_t) edictbytes / 1024, sv_netedicts.count, (uint64_t) listbytes / 1024, numents[1] - 1);
+	Con_Printf ("edict scan:      %7.3f ms per client\n", (t1 - t0) * 1000.0 / iterations);
+	Con_Printf ("build + list:    %7.3f ms for the first client\n", (t2 - t1) * 1000.0 / iterations);
+	if (numents[0] != numents[1])
+		Con_Printf ("WARNING: scans disagree (%d vs %d)\n", numents[0], numents[1]);
+
+	PR_SwitchQCVM(NULL);
 }
 
 /*
-=======================
-SV_WriteStats
+=============
+SV_SortNetEdicts
 
-TODO: group multiple stats in a single stuffcmd, the client already supports this
-=======================
+Fills ns->sorted with the client and the edicts it can see,
+closest first, and returns how many there are.  cache is the client's entry
+from SV_PrepareSendJobs, without one this has to run on the main thread.
+=============
 */
-void SV_WriteStats (client_t *client)
+static int SV_SortNetEdicts (netscratch_t *ns, edict_t *clent, pvscache_t *cache)
 {
-	int			statsi[MAX_CL_STATS];
-	float		statsf[MAX_CL_STATS];
-	const char	*statss[MAX_CL_STATS];
-	int			i;
+	int			e, i, numents;
+	byte		*pvs;
+	vec3_t		org, forward, right, up;
 
-	SV_CalcStats (client, statsi, statsf, statss);
+// find the client's PVS
+	VectorAdd (clent->v.origin, clent->v.view_ofs, org);
+	if (cache)
+		pvs = cache->pvs;
+	else
+		pvs = SV_FatPVS (org, sv.worldmodel);
 
-	for (i = 0; i < MAX_CL_STATS; i++)
-	{
-		//small cleanup
-		if (!statsi[i])
-			statsi[i] =	statsf[i];
-		else
-			statsf[i] =	0;//statsi[i];
+// find the client's orientation
+	AngleVectors (clent->v.v_angle, forward, right, up);
 
-		if (i >= STAT_NONCLIENT && (statsi[i] != client->oldstats_i[i] || statsf[i] != client->oldstats_f[i]))
-		{
+// reset sorting bins
+	memset (ns->bins, 0, sizeof (ns->bins));
+
+// add clent
+	if (sv_netsort.value)
+	{
+		ns->edicts[0] = NUM_FOR_EDICT (clent);
+		ns->dists[0] = 0;
+		ns->bins[0] = 1;
+	}
+	else
+		ns->sorted[0] = NUM_FOR_EDICT (clent);
+	numents = 1;
+
+// add all other entities that touch the pvs
+	if (cache)
+		numents = SV_GatherCachedNetEdicts (ns, cache, clent, org, forward, numents);
+	else
+		numents = SV_GatherNetEdicts (ns, clent, pvs, org, forward, numents);
+
+	if (sv_netsort.value)
+	{
+		// compute bin offsets
+		e = 0;
+		for (i=0 ; i<countof(ns->bins) ; i++)
+		{
+			int tmp = ns->bins[i];
+			ns->bins[i] = e;
+			e += tmp;
+		}
+
+		// generate sorted list
+		for (e=0 ; e<numents ; e++)
+			ns->sorted[ns->bins[ns->dists[e]]++] = ns->edicts[e];
+	}
+
+	return numents;
+}
+
+/*
+=============
+SV_GetEntityState
+
+Fills in what gets sent for an entity.  Returns false if it's invisible
+and shouldn't be sent at all.
+=============
+*/
+static qboolean SV_GetEntityState (edict_t *ent, snapentity_t *s)
+{
+	//johnfitz -- don't send invisible entities unless they have effects
+	if (ent->alpha == ENTALPHA_ZERO && !((int)ent->v.effects & qcvm->effects_mask))
+		return false;
+
+	s->num = NUM_FOR_EDICT (ent);
+	s->flags = 0;
+	s->lerpfinish = 0;
+	if (ent->v.movetype == MOVETYPE_STEP)
+		s->flags |= SNAP_STEP;
+	if (ent->sendinterval)
+	{
+		s->flags |= SNAP_LERPFINISH;
+		s->lerpfinish = (byte)(Q_rint((ent->v.nextthink-qcvm->time)*255));
+	}
+
+	VectorCopy (ent->v.origin, s->state.origin);
+	VectorCopy (ent->v.angles, s->state.angles);
+	s->state.modelindex = (int)ent->v.modelindex;
+	s->state.frame = (int)ent->v.frame;
+	s->state.colormap = (int)ent->v.colormap;
+	s->state.skin = (int)ent->v.skin;
+	s->state.alpha = ent->alpha;
+	s->state.scale = ent->scale;
+	s->state.effects = (int)ent->v.effects & qcvm->effects_mask;
+
+	return true;
+}
+
+/*
+=============
+SV_WriteEntityFields
+
+Writes the fields selected by bits, which follow the bits and entity number
+=============
+*/
+static void SV_WriteEntityFields (sizebuf_t *msg, int bits, const snapentity_t *s)
+{
+	if (bits & U_MODEL)
+		MSG_WriteByte (msg,	s->state.modelindex);
+	if (bits & U_FRAME)
+		MSG_WriteByte (msg, s->state.frame);
+	if (bits & U_COLORMAP)
+		MSG_WriteByte (msg, s->state.colormap);
+	if (bits & U_SKIN)
+		MSG_WriteByte (msg, s->state.skin);
+	if (bits & U_EFFECTS)
+		MSG_WriteByte (msg, s->state.effects);
+	if (bits & U_ORIGIN1)
+		MSG_WriteCoord (msg, s->state.origin[0], sv.protocolflags);
+	if (bits & U_ANGLE1)
+		MSG_WriteAngle(msg, s->state.angles[0], sv.protocolflags);
+	if (bits & U_ORIGIN2)
+		MSG_WriteCoord (msg, s->state.origin[1], sv.protocolflags);
+	if (bits & U_ANGLE2)
+		MSG_WriteAngle(msg, s->state.angles[1], sv.protocolflags);
+	if (bits & U_ORIGIN3)
+		MSG_WriteCoord (msg, s->state.origin[2], sv.protocolflags);
+	if (bits & U_ANGLE3)
+		MSG_WriteAngle(msg, s->state.angles[2], sv.protocolflags);
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (bits & U_ALPHA)
+		MSG_WriteByte(msg, s->state.alpha);
+	if (bits & U_SCALE)
+		MSG_WriteByte(msg, s->state.scale);
+	if (bits & U_FRAME2)
+		MSG_WriteByte(msg, s->state.frame >> 8);
+	if (bits & U_MODEL2)
+		MSG_WriteByte(msg, s->state.modelindex >> 8);
+	if (bits & U_LERPFINISH)
+		MSG_WriteByte(msg, s->lerpfinish);
+	//johnfitz
+
+	if (bits & U_SNAPFLAGS)
+		MSG_WriteByte (msg, s->flags);
+}
+
+/*
+=============
+SV_UpdatePacketStats
+=============
+*/
+static void SV_UpdatePacketStats (sizebuf_t *msg)
+{
+	//johnfitz -- devstats
+	if (msg->cursize > 1024 && dev_peakstats.packetsize <= 1024)
+		Con_DWarning ("%i byte packet exceeds standard limit of 1024 (max = %d).\n", msg->cursize, msg->maxsize);
+	dev_stats.packetsize = msg->cursize;
+	dev_peakstats.packetsize = q_max(msg->cursize, dev_peakstats.packetsize);
+	//johnfitz
+}
+
+/*
+=============
+SV_PacketOverflow
+=============
+*/
+static void SV_PacketOverflow (void)
+{
+	//johnfitz -- less spammy overflow message
+	if (!dev_overflows.packetsize || dev_overflows.packetsize + CONSOLE_RESPAM_TIME < realtime )
+	{
+		Con_Printf ("Packet overflow!\n");
+		dev_overflows.packetsize = realtime;
+	}
+	//johnfitz
+}
+
+/*
+=============
+SV_WriteEntitiesToClient
+
+Sets msg->overflowed if not everything fit, SV_SendClientDatagram reports it
+=============
+*/
+static void SV_WriteEntitiesToClient (netscratch_t *ns, edict_t *clent, pvscache_t *cache, sizebuf_t *msg)
+{
+	int		e, i, j, numents;
+	int		bits;
+	float	miss;
+	edict_t	*ent;
+	snapentity_t	s;
+
+	numents = SV_SortNetEdicts (ns, clent, cache);
+
+// send entities (closest first)
+	for (j=0 ; j<numents ; j++)
+	{
+		e = ns->sorted[j];
+		ent = EDICT_NUM (e);
+
+		// johnfitz -- max size for protocol 15 is 18 bytes, not 16 as originally
+		// assumed here.  And, for protocol 85 the max size is actually 24 bytes.
+		// For float coords and angles the limit is 40.
+		// FIXME: Use tighter limit according to protocol flags and send bits.
+		if (msg->cursize + 40 > msg->maxsize)
+		{
+			msg->overflowed = true;
+			break;
+		}
+
+		if (!SV_GetEntityState (ent, &s))
+			continue;
+
+// send an update
+		bits = 0;
+
+		for (i=0 ; i<3 ; i++)
+		{
+			miss = ent->v.origin[i] - ent->baseline.origin[i];
+			if ( miss < -0.1 || miss > 0.1 )
+				bits |= U_ORIGIN1<<i;
+		}
+
+		if ( ent->v.angles[0] != ent->baseline.angles[0] )
+			bits |= U_ANGLE1;
+
+		if ( ent->v.angles[1] != ent->baseline.angles[1] )
+			bits |= U_ANGLE2;
+
+		if ( ent->v.angles[2] != ent->baseline.angles[2] )
+			bits |= U_ANGLE3;
+
+		if (ent->v.movetype == MOVETYPE_STEP)
+			bits |= U_STEP;	// don't mess up the step animation
+
+		if (ent->baseline.colormap != ent->v.colormap)
+			bits |= U_COLORMAP;
+
+		if (ent->baseline.skin != ent->v.skin)
+			bits |= U_SKIN;
+
+		if (ent->baseline.frame != ent->v.frame)
+			bits |= U_FRAME;
+
+		if ((ent->baseline.effects ^ (int)ent->v.effects) & qcvm->effects_mask)
+			bits |= U_EFFECTS;
+
+		if (ent->baseline.modelindex != ent->v.modelindex)
+			bits |= U_MODEL;
+
+		//johnfitz -- PROTOCOL_FITZQUAKE
+		if (sv.protocol != PROTOCOL_NETQUAKE)
+		{
+
+			if (ent->baseline.alpha != ent->alpha) bits |= U_ALPHA;
+			if (ent->baseline.scale != ent->scale) bits |= U_SCALE;
+			if (bits & U_FRAME && (int)ent->v.frame & 0xFF00) bits |= U_FRAME2;
+			if (bits & U_MODEL && (int)ent->v.modelindex & 0xFF00) bits |= U_MODEL2;
+			if (ent->sendinterval) bits |= U_LERPFINISH;
+			if (bits >= 65536) bits |= U_EXTEND1;
+			if (bits >= 16777216) bits |= U_EXTEND2;
+		}
+		//johnfitz
+
+		if (e >= 256)
+			bits |= U_LONGENTITY;
+
+		if (bits >= 256)
+			bits |= U_MOREBITS;
+
+	//
+	// write the message
+	//
+		MSG_WriteByte (msg, bits | U_SIGNAL);
+
+		if (bits & U_MOREBITS)
+			MSG_WriteByte (msg, bits>>8);
+
+		//johnfitz -- PROTOCOL_FITZQUAKE
+		if (bits & U_EXTEND1)
+			MSG_WriteByte(msg, bits>>16);
+		if (bits & U_EXTEND2)
+			MSG_WriteByte(msg, bits>>24);
+		//johnfitz
+
+		if (bits & U_LONGENTITY)
+			MSG_WriteShort (msg,e);
+		else
+			MSG_WriteByte (msg,e);
+
+		SV_WriteEntityFields (msg, bits, &s);
+	}
+}
+
+/*
+===============================================================================
+
+DELTA ENTITIES
+
+Clients that send "deltaents" get svc_deltaentities instead of fast updates.
+Every snapshot sent is kept, and the next one only carries what changed
+since the last snapshot the client acknowledged with clc_ackentities, plus
+removals.  Without a usable ack it's sent against the baselines, which costs
+the same as the fast updates.
+
+What's kept is what the client will have after parsing the message, not
+what the edicts hold: an entity that didn't fit stays as the client last saw
+it, and so do origin components within the send threshold.
+
+===============================================================================
+*/
+
+// largest entity in a svc_deltaentities message: number, 4 bytes of bits,
+// 5 byte fields, 6 float coords and angles, 6 more bytes of extensions
+#define MAX_DELTA_ENTITY_SIZE	41
+
+/*
+=============
+SV_DeltaEntityBits
+=============
+*/
+static int SV_DeltaEntityBits (const snapentity_t *from, const snapentity_t *to)
+{
+	int		i, bits;
+	float	miss;
+
+	bits = 0;
+
+	for (i=0 ; i<3 ; i++)
+	{
+		miss = to->state.origin[i] - from->state.origin[i];
+		if ( miss < -0.1 || miss > 0.1 )
+			bits |= U_ORIGIN1<<i;
+	}
+
+	if (to->state.angles[0] != from->state.angles[0])
+		bits |= U_ANGLE1;
+	if (to->state.angles[1] != from->state.angles[1])
+		bits |= U_ANGLE2;
+	if (to->state.angles[2] != from->state.angles[2])
+		bits |= U_ANGLE3;
+
+	if (to->state.modelindex != from->state.modelindex)
+	{
+		bits |= U_MODEL;
+		if (to->state.modelindex & 0xFF00)
+			bits |= U_MODEL2;
+	}
+	if (to->state.frame != from->state.frame)
+	{
+		bits |= U_FRAME;
+		if (to->state.frame & 0xFF00)
+			bits |= U_FRAME2;
+	}
+	if (to->state.colormap != from->state.colormap)
+		bits |= U_COLORMAP;
+	if (to->state.skin != from->state.skin)
+		bits |= U_SKIN;
+	if (to->state.effects != from->state.effects)
+		bits |= U_EFFECTS;
+	if (to->state.alpha != from->state.alpha)
+		bits |= U_ALPHA;
+	if (to->state.scale != from->state.scale)
+		bits |= U_SCALE;
+	if (to->lerpfinish != from->lerpfinish)
+		bits |= U_LERPFINISH;
+	if (to->flags != from->flags)
+		bits |= U_SNAPFLAGS;
+
+	if (bits >= 65536)
+		bits |= U_EXTEND1;
+	if (bits >= 16777216)
+		bits |= U_EXTEND2;
+	if (bits >= 256)
+		bits |= U_MOREBITS;
+
+	return bits;
+}
+
+/*
+=============
+SV_WriteDeltaEntitiesToClient
+
+Same as SV_WriteEntitiesToClient for clients that asked for deltas
+=============
+*/
+static void SV_WriteDeltaEntitiesToClient (netscratch_t *ns, client_t *client, pvscache_t *cache, sizebuf_t *msg)
+{
+	entsnapshot_t	*from, *to;
+	snapentity_t	s, base, *old;
+	edict_t			*ent;
+	int				i, j, e, bits, numents, count, seq;
+
+	if (msg->cursize + 8 > msg->maxsize)
+	{
+		msg->overflowed = true;
+		return;
+	}
+
+	numents = SV_SortNetEdicts (ns, client->edict, cache);
+
+	seq = ++client->snapsequence;
+	from = &client->snapshots[client->snapacked & SNAPSHOT_MASK];
+	if (client->snapacked <= 0 || from->sequence != client->snapacked || seq - from->sequence >= SNAPSHOT_BACKUP)
+		from = NULL;
+	to = &client->snapshots[seq & SNAPSHOT_MASK];
+	to->sequence = 0;
+	VEC_CLEAR (to->ents);
+
+	count = from ? VEC_SIZE (from->ents) : 0;
+	for (i = 0; i < count; i++)
+		ns->baseindex[from->ents[i].num] = i + 1;
+
+	MSG_WriteByte (msg, svc_deltaentities);
+	MSG_WriteLong (msg, seq);
+	MSG_WriteByte (msg, from ? seq - from->sequence : 0);
+
+// send changes (closest first)
+	for (j=0 ; j<numents ; j++)
+	{
+		e = ns->sorted[j];
+		ent = EDICT_NUM (e);
+
+		if (!SV_GetEntityState (ent, &s))
+			continue;
+
+		if (ns->baseindex[e] > 0)
+		{
+			old = &from->ents[ns->baseindex[e] - 1];
+			ns->baseindex[e] = -ns->baseindex[e];
+			bits = SV_DeltaEntityBits (old, &s);
+			if (!bits)
+			{
+				VEC_PUSH (to->ents, *old);
+				continue;
+			}
+		}
+		else
+		{
+			// new to the client, always sent even if it matches the baseline
+			old = &base;
+			old->num = e;
+			old->flags = 0;
+			old->lerpfinish = 0;
+			old->state = ent->baseline;
+			bits = SV_DeltaEntityBits (old, &s);
+		}
+
+		// leave room for the terminator
+		if (msg->cursize + MAX_DELTA_ENTITY_SIZE + 2 > msg->maxsize)
+		{
+			msg->overflowed = true;
+			if (old != &base)
+				VEC_PUSH (to->ents, *old);
+			continue;
+		}
+
+		MSG_WriteShort (msg, e);
+		MSG_WriteByte (msg, bits & 255);
+		if (bits & U_MOREBITS)
+			MSG_WriteByte (msg, bits>>8);
+		if (bits & U_EXTEND1)
+			MSG_WriteByte (msg, bits>>16);
+		if (bits & U_EXTEND2)
+			MSG_WriteByte (msg, bits>>24);
+		SV_WriteEntityFields (msg, bits, &s);
+
+		// the client keeps its old origin components if they weren't sent
+		for (i=0 ; i<3 ; i++)
+			if (!(bits & (U_ORIGIN1<<i)))
+				s.state.origin[i] = old->state.origin[i];
+		VEC_PUSH (to->ents, s);
+	}
+
+// send removals for what the client has but can't see anymore
+	for (i = 0; i < count; i++)
+	{
+		old = &from->ents[i];
+		if (ns->baseindex[old->num] > 0)
+		{
+			if (msg->cursize + 2 + 2 > msg->maxsize)
+				VEC_PUSH (to->ents, *old);
+			else
+				MSG_WriteShort (msg, old->num | SNAP_REMOVE);
+		}
+		ns->baseindex[old->num] = 0;
+	}
+
+	MSG_WriteShort (msg, 0);
+	to->sequence = seq;
+}
+
+/*
+=============
+SV_DeltaEnts_f
+
+Sent by clients that can parse svc_deltaentities
+=============
+*/
+static void SV_DeltaEnts_f (void)
+{
+	if (cmd_source == src_command)
+		return;
+
+	host_client->deltaents = sv.protocol != PROTOCOL_NETQUAKE;
+	host_client->snapacked = 0;
+}
+
+/*
+=============
+SV_CleanupEnts
+
+=============
+*/
+void SV_CleanupEnts (void)
+{
+	int		e;
+	edict_t	*ent;
+
+	ent = NEXT_EDICT(qcvm->edicts);
+	for (e=1 ; e<qcvm->num_edicts ; e++, ent = NEXT_EDICT(ent))
+	{
+		ent->v.effects = (int)ent->v.effects & ~EF_MUZZLEFLASH;
+	}
+}
+
+/*
+==================
+SV_WriteClientdataToMessage
+
+==================
+*/
+void SV_WriteClientdataToMessage (edict_t *ent, sizebuf_t *msg)
+{
+	int		bits;
+	int		i;
+	edict_t	*other;
+	int		items;
+	eval_t	*val;
+
+//
+// send a damage message
+//
+	if (ent->v.dmg_take || ent->v.dmg_save)
+	{
+		other = PROG_TO_EDICT(ent->v.dmg_inflictor);
+		MSG_WriteByte (msg, svc_damage);
+		MSG_WriteByte (msg, ent->v.dmg_save);
+		MSG_WriteByte (msg, ent->v.dmg_take);
+		for (i=0 ; i<3 ; i++)
+			MSG_WriteCoord (msg, other->v.origin[i] + 0.5*(other->v.mins[i] + other->v.maxs[i]), sv.protocolflags );
+
+		ent->v.dmg_take = 0;
+		ent->v.dmg_save = 0;
+	}
+
+//
+// send the current viewpos offset from the view entity
+//
+	SV_SetIdealPitch ();		// how much to look up / down ideally
+
+// a fixangle might get lost in a dropped packet.  Oh well.
+	if ( ent->v.fixangle )
+	{
+		MSG_WriteByte (msg, svc_setangle);
+		for (i=0 ; i < 3 ; i++)
+			MSG_WriteAngle (msg, ent->v.angles[i], sv.protocolflags );
+		ent->v.fixangle = 0;
+	}
+
+	bits = 0;
+
+	if (ent->v.view_ofs[2] != DEFAULT_VIEWHEIGHT)
+		bits |= SU_VIEWHEIGHT;
+
+	if (ent->v.idealpitch)
+		bits |= SU_IDEALPITCH;
+
+// stuff the sigil bits into the high bits of items for sbar, or else
+// mix in items2
+	val = GetEdictFieldValueByName(ent, "items2");
+
+	if (val)
+		items = (int)ent->v.items | ((int)val->_float << 23);
+	else
+		items = (int)ent->v.items | ((int)pr_global_struct->serverflags << 28);
+
+	bits |= SU_ITEMS;
+
+	if ( (int)ent->v.flags & FL_ONGROUND)
+		bits |= SU_ONGROUND;
+
+	if ( ent->v.waterlevel >= 2)
+		bits |= SU_INWATER;
+
+	for (i=0 ; i<3 ; i++)
+	{
+		if (ent->v.punchangle[i])
+			bits |= (SU_PUNCH1<<i);
+		if (ent->v.velocity[i])
+			bits |= (SU_VELOCITY1<<i);
+	}
+
+	if (ent->v.weaponframe)
+		bits |= SU_WEAPONFRAME;
+
+	if (ent->v.armorvalue)
+		bits |= SU_ARMOR;
+
+//	if (ent->v.weapon)
+	  bits |= SU_WEAPON;
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (sv.protocol != PROTOCOL_NETQUAKE)
+	{
+		if (bits & SU_WEAPON && SV_ModelIndex(PR_GetString(ent->v.weaponmodel)) & 0xFF00) bits |= SU_WEAPON2;
+		if ((int)ent->v.armorvalue & 0xFF00) bits |= SU_ARMOR2;
+		if ((int)ent->v.currentammo & 0xFF00) bits |= SU_AMMO2;
+		if ((int)ent->v.ammo_shells & 0xFF00) bits |= SU_SHELLS2;
+		if ((int)ent->v.ammo_nails & 0xFF00) bits |= SU_NAILS2;
+		if ((int)ent->v.ammo_rockets & 0xFF00) bits |= SU_ROCKETS2;
+		if ((int)ent->v.ammo_cells & 0xFF00) bits |= SU_CELLS2;
+		if (bits & SU_WEAPONFRAME && (int)ent->v.weaponframe & 0xFF00) bits |= SU_WEAPONFRAME2;
+		if (bits & SU_WEAPON && ent->alpha != ENTALPHA_DEFAULT) bits |= SU_WEAPONALPHA; //for now, weaponalpha = client entity alpha
+		if (bits >= 65536) bits |= SU_EXTEND1;
+		if (bits >= 16777216) bits |= SU_EXTEND2;
+	}
+	//johnfitz
+
+// send the data
+
+	MSG_WriteByte (msg, svc_clientdata);
+	MSG_WriteShort (msg, bits);
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (bits & SU_EXTEND1) MSG_WriteByte(msg, bits>>16);
+	if (bits & SU_EXTEND2) MSG_WriteByte(msg, bits>>24);
+	//johnfitz
+
+	if (bits & SU_VIEWHEIGHT)
+		MSG_WriteChar (msg, ent->v.view_ofs[2]);
+
+	if (bits & SU_IDEALPITCH)
+		MSG_WriteChar (msg, ent->v.idealpitch);
+
+	for (i=0 ; i<3 ; i++)
+	{
+		if (bits & (SU_PUNCH1<<i))
+			MSG_WriteChar (msg, ent->v.punchangle[i]);
+		if (bits & (SU_VELOCITY1<<i))
+			MSG_WriteChar (msg, ent->v.velocity[i]/16);
+	}
+
+// [always sent]	if (bits & SU_ITEMS)
+	MSG_WriteLong (msg, items);
+
+	if (bits & SU_WEAPONFRAME)
+		MSG_WriteByte (msg, ent->v.weaponframe);
+	if (bits & SU_ARMOR)
+		MSG_WriteByte (msg, ent->v.armorvalue);
+	if (bits & SU_WEAPON)
+		MSG_WriteByte (msg, SV_ModelIndex(PR_GetString(ent->v.weaponmodel)));
+
+	MSG_WriteShort (msg, ent->v.health);
+	MSG_WriteByte (msg, ent->v.currentammo);
+	MSG_WriteByte (msg, ent->v.ammo_shells);
+	MSG_WriteByte (msg, ent->v.ammo_nails);
+	MSG_WriteByte (msg, ent->v.ammo_rockets);
+	MSG_WriteByte (msg, ent->v.ammo_cells);
+
+	if (standard_quake)
+	{
+		MSG_WriteByte (msg, ent->v.weapon);
+	}
+	else
+	{
+		for(i=0;i<32;i++)
+		{
+			if ( ((int)ent->v.weapon) & (1<<i) )
+			{
+				MSG_WriteByte (msg, i);
+				break;
+			}
+		}
+	}
+
+	//johnfitz -- PROTOCOL_FITZQUAKE
+	if (bits & SU_WEAPON2)
+		MSG_WriteByte (msg, SV_ModelIndex(PR_GetString(ent->v.weaponmodel)) >> 8);
+	if (bits & SU_ARMOR2)
+		MSG_WriteByte (msg, (int)ent->v.armorvalue >> 8);
+	if (bits & SU_AMMO2)
+		MSG_WriteByte (msg, (int)ent->v.currentammo >> 8);
+	if (bits & SU_SHELLS2)
+		MSG_WriteByte (msg, (int)ent->v.ammo_shells >> 8);
+	if (bits & SU_NAILS2)
+		MSG_WriteByte (msg, (int)ent->v.ammo_nails >> 8);
+	if (bits & SU_ROCKETS2)
+		MSG_WriteByte (msg, (int)ent->v.ammo_rockets >> 8);
+	if (bits & SU_CELLS2)
+		MSG_WriteByte (msg, (int)ent->v.ammo_cells >> 8);
+	if (bits & SU_WEAPONFRAME2)
+		MSG_WriteByte (msg, (int)ent->v.weaponframe >> 8);
+	if (bits & SU_WEAPONALPHA)
+		MSG_WriteByte (msg, ent->alpha); //for now, weaponalpha = client entity alpha
+	//johnfitz
+
+	// Hack: Alkaline 1.1 uses bit flags to store the active weapon,
+	// but we only send the stat as a byte, which can lead to truncation.
+	// If we detect this, re-send the stat separately (as a 32-bit int).
+	if ((byte)ent->v.weapon != (int)ent->v.weapon && msg->cursize + 6 <= msg->maxsize)
+	{
+		MSG_WriteByte (msg, svc_updatestat);
+		MSG_WriteByte (msg, STAT_ACTIVEWEAPON);
+		MSG_WriteLong (msg, (int)ent->v.weapon);
+	}
+}
+
+/*
+===============================================================================
+
+CLIENT DATAGRAMS
+
+Every spawned client's datagram is built in its own buffer before any of them
+are sent.  The client data is written on the main thread, then the entity
+updates for all the clients at once, on the trace workers if sv_parallelsend
+is set: they only read the edicts and the net edict list, which don't change
+until the messages are out, and write to the client's own buffer and
+snapshots.  Clients without a cached PVS are left for the main thread, since
+SV_FatPVS and the vis decompression aren't thread safe.
+
+===============================================================================
+*/
+
+typedef struct
+{
+	client_t	*client;		// NULL for sv_sendbench viewpoints
+	edict_t		*clent;
+	sizebuf_t	*msg;
+	pvscache_t	*cache;			// NULL = has to be written on the main thread
+} sendjob_t;
+
+/*
+=============
+SV_PrepareSendJobs
+
+Finds the cached PVS of each job, and lists the net edicts touching the ones
+that weren't used yet this frame
+=============
+*/
+static void SV_PrepareSendJobs (sendjob_t *jobs, int count, qboolean parallel)
+{
+	pvscache_t	*build[MAX_PVS_CACHE];
+	sendjob_t	*job;
+	vec3_t		org;
+	int			i, numbuild;
+
+	pvscache_passtime = pvscache_time;
+	numbuild = 0;
+
+	for (i = 0, job = jobs; i < count; i++, job++)
+	{
+		sv_netstats.clients++;
+
+		job->cache = NULL;
+		if (!sv_pvscache.value || !SV_NetEdictListValid ())
+			continue;
+
+		VectorAdd (job->clent->v.origin, job->clent->v.view_ofs, org);
+		job->cache = SV_CachedFatPVS (org);
+		if (!job->cache)
+			continue;
+
+		if (job->cache->frame == sv_netedicts.frame)
+			sv_netstats.shared++;
+		else
+		{
+			job->cache->frame = sv_netedicts.frame;
+			build[numbuild++] = job->cache;
+		}
+	}
+
+	if (parallel)
+		SV_ParallelJobs (SV_BuildCachedNetEdicts, build, numbuild);
+	else
+	{
+		for (i = 0; i < numbuild; i++)
+			SV_BuildCachedNetEdicts (i, build);
+	}
+}
+
+/*
+=============
+SV_WriteClientEntities
+=============
+*/
+static void SV_WriteClientEntities (sendjob_t *job)
+{
+	netscratch_t	*ns = SV_NetScratch ();
+
+	if (job->client && job->client->deltaents && sv_deltaents.value)
+		SV_WriteDeltaEntitiesToClient (ns, job->client, job->cache, job->msg);
+	else
+		SV_WriteEntitiesToClient (ns, job->clent, job->cache, job->msg);
+}
+
+/*
+=============
+SV_ParallelSendJob
+
+Runs on the trace workers
+=============
+*/
+static void SV_ParallelSendJob (int index, void *data)
+{
+	sendjob_t *job = (sendjob_t *) data + index;
+
+	if (job->cache)
+		SV_WriteClientEntities (job);
+}
+
+/*
+=============
+SV_RunSendJobs
+
+Appends the entity updates to the message of each job
+=============
+*/
+static void SV_RunSendJobs (sendjob_t *jobs, int count, qboolean parallel)
+{
+	double	start;
+	int		i;
+
+	start = host_speeds.value ? Sys_DoubleTime () : 0.0;
+
+	SV_PrepareSendJobs (jobs, count, parallel);
+
+	if (parallel)
+		SV_ParallelJobs (SV_ParallelSendJob, jobs, count);
+	for (i = 0; i < count; i++)
+		if (!parallel || !jobs[i].cache)
+			SV_WriteClientEntities (&jobs[i]);
+
+	if (host_speeds.value)
+		sv_netstats.time += Sys_DoubleTime () - start;
+}
+
+/*
+=======================
+SV_BeginClientDatagram
+
+Starts the datagram with what has to be written on the main thread
+=======================
+*/
+static void SV_BeginClientDatagram (client_t *client)
+{
+	sizebuf_t	*msg = &client->datagram;
+
+	SZ_Clear (msg);
+	msg->overflowed = false;
+	msg->maxsize = sizeof(client->datagrambuf);
+
+	//johnfitz -- if client is nonlocal, use smaller max size so packets aren't fragmented
+	if (Q_strcmp(NET_QSocketGetAddressString(client->netconnection), "LOCAL") != 0)
+		msg->maxsize = DATAGRAM_MTU;
+	//johnfitz
+
+	MSG_WriteByte (msg, svc_time);
+	MSG_WriteFloat (msg, qcvm->time);
+
+// add the client specific data to the datagram
+	SV_WriteClientdataToMessage (client->edict, msg);
+}
+
+/*
+=======================
+SV_SendClientDatagram
+
+Sends the datagram once the entity updates are in
+=======================
+*/
+qboolean SV_SendClientDatagram (client_t *client)
+{
+	sizebuf_t	*msg = &client->datagram;
+
+	SV_UpdatePacketStats (msg);
+	if (msg->overflowed)
+	{
+		SV_PacketOverflow ();
+		msg->overflowed = false;
+	}
+
+// copy the server datagram if there is space
+	if (msg->cursize + sv.datagram.cursize < msg->maxsize)
+		SZ_Write (msg, sv.datagram.data, sv.datagram.cursize);
+
+// send the datagram
+	if (NET_SendUnreliableMessage (client->netconnection, msg) == -1)
+	{
+		SV_DropClient (true);// if the message couldn't send, kick off
+		return false;
+	}
+
+	return true;
+}
+
+/*
+=============
+SV_SendBench_f
+
+Times the entity updates for a number of viewpoints spread over the sendable
+edicts, standing in for local clients, built one after the other and then in
+parallel, and checks that both give the same messages
+
+sv_sendbench [viewpoints] [iterations]
+=============
+*/
+static void SV_SendBench_f (void)
+{
+	sendjob_t	*jobs;
+	sizebuf_t	*msgs;
+	byte		*bufs;
+	netstats_t	stats;
+	double		t[2];
+	int			i, p, count, iterations, bytes, mismatches;
+
+	if (!sv.active)
+		return;
+
+	count = Cmd_Argc () >= 2 ? CLAMP (1, Q_atoi (Cmd_Argv (1)), MAX_PVS_CACHE) : 32;
+	iterations = Cmd_Argc () >= 3 ? q_max (Q_atoi (Cmd_Argv (2)), 1) : 100;
+
+	PR_SwitchQCVM(&sv.qcvm);
+	stats = sv_netstats;
+
+	SV_BuildNetEdicts ();
+	if (!sv_netedicts.count)
+	{
+		Con_Printf ("no sendable edicts\n");
+		PR_SwitchQCVM(NULL);
+		return;
+	}
+
+	jobs = (sendjob_t *) calloc (count, sizeof (*jobs));
+	msgs = (sizebuf_t *) calloc (count * 2, sizeof (*msgs));
+	bufs = (byte *) malloc ((size_t) count * 2 * MAX_DATAGRAM);
+	if (!jobs || !msgs || !bufs)
+		Sys_Error ("SV_SendBench_f: out of memory");
+
+	for (i = 0; i < count * 2; i++)
+	{
+		msgs[i].data = bufs + (size_t) i * MAX_DATAGRAM;
+		msgs[i].maxsize = MAX_DATAGRAM;
+	}
+
+	for (p = 0; p < 2; p++)
+	{
+		t[p] = Sys_DoubleTime ();
+		for (i = 0; i < iterations; i++)
+		{
+			int j;
+			SV_BuildNetEdicts ();	// new lists, like a new frame
+			for (j = 0; j < count; j++)
+			{
+				jobs[j].clent = EDICT_NUM (sv_netedicts.nums[j * sv_netedicts.count / count]);
+				jobs[j].msg = &msgs[p * count + j];
+				SZ_Clear (jobs[j].msg);
+				jobs[j].msg->overflowed = false;
+			}
+			SV_RunSendJobs (jobs, count, p == 1);
+		}
+		t[p] = Sys_DoubleTime () - t[p];
+	}
+
+	bytes = mismatches = 0;
+	for (i = 0; i < count; i++)
+	{
+		bytes += msgs[i].cursize;
+		if (msgs[i].cursize != msgs[count + i].cursize || memcmp (msgs[i].data, msgs[count + i].data, msgs[i].cursize))
+			mismatches++;
+	}
+
+	Con_Printf ("%d viewpoints, %d bytes of entity updates per frame\n", count, bytes);
+	Con_Printf ("serial:   %7.3f ms per frame\n", t[0] * 1000.0 / iterations);
+	Con_Printf ("parallel: %7.3f ms per frame (%.2fx)\n", t[1] * 1000.0 / iterations, t[0] / q_max (t[1], 1e-9));
+	if (mismatches)
+		Con_Printf ("WARNING: %d messages differ\n", mismatches);
+
+	free (bufs);
+	free (msgs);
+	free (jobs);
+
+	sv_netstats = stats;
+	PR_SwitchQCVM(NULL);
+}
+
+/*
+=======================
+SV_WriteStats
+
+TODO: group multiple stats in a single stuffcmd, the client already supports this
+=======================
+*/
+void SV_WriteStats (client_t *client)
+{
+	int			statsi[MAX_CL_STATS];
+	float		statsf[MAX_CL_STATS];
+	const char	*statss[MAX_CL_STATS];
+	int			i;
+
+	SV_CalcStats (client, statsi, statsf, statss);
+
+	for (i = 0; i < MAX_CL_STATS; i++)
+	{
+		//small cleanup
+		if (!statsi[i])
+			statsi[i] =	statsf[i];
+		else
+			statsf[i] =	0;//statsi[i];
+
+		if (i >= STAT_NONCLIENT && (statsi[i] != client->oldstats_i[i] || statsf[i] != client->oldstats_f[i]))
+		{
 			client->oldstats_i[i] = statsi[i];
 			client->oldstats_f[i] = statsf[i];
 
-			if ((double)statsi[i] != statsf[i] && statsf[i])
-			{	//didn't round nicely, so send as a float
-				MSG_WriteByte (&client->message, svc_stufftext);
-				MSG_WriteString (&client->message, va ("//st %i %g\n", i, statsf[i]));
-			}
-			else
-			{
-				if (i < MAX_CL_BASE_STATS)
-				{
-					MSG_WriteByte (&client->message, svc_updatestat);
-					MSG_WriteByte (&client->message, i);
-					MSG_WriteLong (&client->message, statsi[i]);
-				}
-				else
-				{
-					MSG_WriteByte (&client->message, svc_stufftext);
-					MSG_WriteString (&client->message, va ("//st %i %i\n", i, statsi[i]));
-				}
-			}
-		}
+			if ((double)statsi[i] != statsf[i] && statsf[i])
+			{	//didn't round nicely, so send as a float
+				MSG_WriteByte (&client->message, svc_stufftext);
+				MSG_WriteString (&client->message, va ("//st %i %g\n", i, statsf[i]));
+			}
+			else
+			{
+				if (i < MAX_CL_BASE_STATS)
+				{
+					MSG_WriteByte (&client->message, svc_updatestat);
+					MSG_WriteByte (&client->message, i);
+					MSG_WriteLong (&client->message, statsi[i]);
+				}
+				else
+				{
+					MSG_WriteByte (&client->message, svc_stufftext);
+					MSG_WriteString (&client->message, va ("//st %i %i\n", i, statsi[i]));
+				}
+			}
+		}
+
+		if (statss[i] || client->oldstats_s[i])
+		{
+			const char *os = client->oldstats_s[i];
+			const char *ns = statss[i];
+			if (!ns)	ns="";
+			if (!os)	os="";
+			if (strcmp(os,ns))
+			{
+				free(client->oldstats_s[i]);
+				client->oldstats_s[i] = strdup(ns);
+
+				MSG_WriteByte (&client->message, svc_stufftext);
+				MSG_WriteString (&client->message, va ("//sts %i \"%s\"\n", i, ns));
+			}
+		}
+	}
+}
+
+/*
+=======================
+SV_WriteUnderwaterOverride
+=======================
+*/
+void SV_WriteUnderwaterOverride (client_t *client)
+{
+	if (!client->edict->sendforcewater)
+		return;
+	client->edict->sendforcewater = false;
+	MSG_WriteByte (&client->message, svc_stufftext);
+	MSG_WriteString (&client->message, va ("//v_water %i\n", client->edict->forcewater));
+}
+
+
+/*
+=======================
+SV_UpdateToReliableMessages
+=======================
+*/
+void SV_UpdateToReliableMessages (void)
+{
+	int			i, j;
+	client_t *client;
+
+// check for changes to be sent over the reliable streams
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	{
+		if (host_client->old_frags != host_client->edict->v.frags)
+		{
+			for (j=0, client = svs.clients ; j<svs.maxclients ; j++, client++)
+			{
+				if (!client->active)
+					continue;
+				MSG_WriteByte (&client->message, svc_updatefrags);
+				MSG_WriteByte (&client->message, i);
+				MSG_WriteShort (&client->message, host_client->edict->v.frags);
+			}
+
+			host_client->old_frags = host_client->edict->v.frags;
+		}
+	}
+
+	for (j=0, client = svs.clients ; j<svs.maxclients ; j++, client++)
+	{
+		if (!client->active)
+			continue;
+		SV_WriteStats (client);
+		SV_WriteUnderwaterOverride (client);
+		SZ_Write (&client->message, sv.reliable_datagram.data, sv.reliable_datagram.cursize);
+	}
+
+	SZ_Clear (&sv.reliable_datagram);
+}
+
+
+/*
+=======================
+SV_SendNop
+
+Send a nop message without trashing or sending the accumulated client
+message buffer
+=======================
+*/
+void SV_SendNop (client_t *client)
+{
+	sizebuf_t	msg;
+	byte		buf[4];
+
+	msg.data = buf;
+	msg.maxsize = sizeof(buf);
+	msg.cursize = 0;
+
+	MSG_WriteChar (&msg, svc_nop);
+
+	if (NET_SendUnreliableMessage (client->netconnection, &msg) == -1)
+		SV_DropClient (true);	// if the message couldn't send, kick off
+	client->last_message = realtime;
+}
+
+/*
+=======================
+SV_SendClientMessages
+=======================
+*/
+void SV_SendClientMessages (void)
+{
+	sendjob_t	jobs[MAX_SCOREBOARD];
+	int			i, numjobs;
+
+// update frags, names, etc
+	SV_UpdateToReliableMessages ();
+
+	SV_BuildNetEdicts ();
+
+// build the datagrams
+	numjobs = 0;
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	{
+		if (!host_client->active || !host_client->spawned)
+			continue;
+
+		SV_BeginClientDatagram (host_client);
+		jobs[numjobs].client = host_client;
+		jobs[numjobs].clent = host_client->edict;
+		jobs[numjobs].msg = &host_client->datagram;
+		numjobs++;
+	}
+	SV_RunSendJobs (jobs, numjobs, sv_parallelsend.value && numjobs > 1);
+
+// send individual updates
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	{
+		if (!host_client->active)
+			continue;
+
+		if (host_client->spawned)
+		{
+			if (!SV_SendClientDatagram (host_client))
+				continue;
+		}
+		else
+		{
+		// the player isn't totally in the game yet
+		// send small keepalive messages if too much time has passed
+		// send a full message when the next signon stage has been requested
+		// some other message data (name changes, etc) may accumulate
+		// between signon stages
+			if (!host_client->sendsignon)
+			{
+				if (realtime - host_client->last_message > 5)
+					SV_SendNop (host_client);
+				continue;	// don't send out non-signon messages
+			}
+			if (host_client->sendsignon == PRESPAWN_SIGNONBUFS)
+			{
+				qboolean local = SV_IsLocalClient (host_client);
+				while (host_client->signonidx < sv.num_signon_buffers)
+				{
+					sizebuf_t *signon = sv.signon_buffers[host_client->signonidx];
+					if (host_client->message.cursize + signon->cursize > host_client->message.maxsize)
+						break;
+					SZ_Write (&host_client->message, signon->data, signon->cursize);
+					host_client->signonidx++;
+					// only send multiple buffers at once when playing locally,
+					// otherwise we send one signon at a time to avoid overflowing
+					// the datagram buffer for clients using a lower limit (e.g. 32000 in QS)
+					if (!local)
+						break;
+				}
+				if (host_client->signonidx == sv.num_signon_buffers)
+					host_client->sendsignon = PRESPAWN_SIGNONMSG;
+			}
+			if (host_client->sendsignon == PRESPAWN_SIGNONMSG)
+			{
+				if (host_client->message.cursize + 2 < host_client->message.maxsize)
+				{
+					MSG_WriteByte (&host_client->message, svc_signonnum);
+					MSG_WriteByte (&host_client->message, 2);
+					host_client->sendsignon = PRESPAWN_FLUSH;
+				}
+			}
+		}
+
+		// check for an overflowed message.  Should only happen
+		// on a very fucked up connection that backs up a lot, then
+		// changes level
+		if (host_client->message.overflowed)
+		{
+			SV_DropClient (true);
+			host_client->message.overflowed = false;
+			continue;
+		}
+
+		if (host_client->message.cursize || host_client->dropasap)
+		{
+			if (!NET_CanSendMessage (host_client->netconnection))
+			{
+//				I_Printf ("can't write\n");
+				continue;
+			}
+
+			if (host_client->dropasap)
+				SV_DropClient (false);	// went to another level
+			else
+			{
+				if (NET_SendMessage (host_client->netconnection
+				, &host_client->message) == -1)
+					SV_DropClient (true);	// if the message couldn't send, kick off
+				SZ_Clear (&host_client->message);
+				host_client->last_message = realtime;
+				if (host_client->sendsignon == PRESPAWN_FLUSH)
+					host_client->sendsignon = PRESPAWN_DONE;
+			}
+		}
+	}
+
+
+// clear muzzle flashes
+	SV_CleanupEnts ();
+}
+
+
+/*
+==============================================================================
+
+SERVER SPAWNING
+
+==============================================================================
+*/
+
+#define SIGNON_SIZE		31500 // QS has a MAX_DATAGRAM of 32000, try to play nice
+
+/*
+================
+SV_AddSignonBuffer
+================
+*/
+static void SV_AddSignonBuffer (void)
+{
+	sizebuf_t *sb;
+	if (sv.num_signon_buffers >= MAX_SIGNON_BUFFERS)
+		Host_Error ("SV_AddSignonBuffer overflow\n");
+
+	sb = (sizebuf_t *) Hunk_AllocName (sizeof (sizebuf_t) + SIGNON_SIZE, "signon");
+	sb->data = (byte *)(sb + 1);
+	sb->maxsize = SIGNON_SIZE;
+	sv.signon_buffers[sv.num_signon_buffers++] = sb;
+	sv.signon = sb;
+}
+
+/*
+================
+SV_ReserveSignonSpace
+================
+*/
+void SV_ReserveSignonSpace (int numbytes)
+{
+	if (sv.signon->cursize + numbytes > sv.signon->maxsize)
+		SV_AddSignonBuffer ();
+}
+
+/*
+================
+SV_ModelIndex
+
+================
+*/
+int SV_ModelIndex (const char *name)
+{
+	int		i;
+
+	if (!name || !name[0])
+		return 0;
+
+	for (i=0 ; i<MAX_MODELS && sv.model_precache[i] ; i++)
+		if (!strcmp(sv.model_precache[i], name))
+			return i;
+	if (i==MAX_MODELS || !sv.model_precache[i])
+		Sys_Error ("SV_ModelIndex: model %s not precached", name);
+	return i;
+}
+
+/*
+================
+SV_CreateBaseline
+================
+*/
+void SV_CreateBaseline (void)
+{
+	int			i;
+	edict_t		*svent;
+	int			entnum;
+	int			bits; //johnfitz -- PROTOCOL_FITZQUAKE
+
+	for (entnum = 0; entnum < qcvm->num_edicts ; entnum++)
+	{
+	// get the current server version
+		svent = EDICT_NUM(entnum);
+		if (svent->free)
+			continue;
+		if (entnum > svs.maxclients && !svent->v.modelindex)
+			continue;
+
+	//
+	// create entity baseline
+	//
+		VectorCopy (svent->v.origin, svent->baseline.origin);
+		VectorCopy (svent->v.angles, svent->baseline.angles);
+		svent->baseline.frame = svent->v.frame;
+		svent->baseline.skin = svent->v.skin;
+		if (entnum > 0 && entnum <= svs.maxclients)
+		{
+			svent->baseline.colormap = entnum;
+			svent->baseline.modelindex = SV_ModelIndex("progs/player.mdl");
+			svent->baseline.alpha = ENTALPHA_DEFAULT; //johnfitz -- alpha support
+			svent->baseline.scale = ENTSCALE_DEFAULT;
+		}
+		else
+		{
+			svent->baseline.colormap = 0;
+			svent->baseline.modelindex = SV_ModelIndex(PR_GetString(svent->v.model));
+			svent->baseline.alpha = svent->alpha; //johnfitz -- alpha support
+			svent->baseline.scale = ENTSCALE_DEFAULT;
+			if (sv.protocol == PROTOCOL_RMQ)
+			{
+				eval_t* val;
+				val = GetEdictFieldValueByName(svent, "scale");
+				if (val)
+					svent->baseline.scale = ENTSCALE_ENCODE(val->_float);
+			}
+		}
+
+		//johnfitz -- PROTOCOL_FITZQUAKE
+		bits = 0;
+		if (sv.protocol == PROTOCOL_NETQUAKE) //still want to send baseline in PROTOCOL_NETQUAKE, so reset these values
+		{
+			if (svent->baseline.modelindex & 0xFF00)
+				svent->baseline.modelindex = 0;
+			if (svent->baseline.frame & 0xFF00)
+				svent->baseline.frame = 0;
+			svent->baseline.alpha = ENTALPHA_DEFAULT;
+			svent->baseline.scale = ENTSCALE_DEFAULT;
+		}
+		else //decide which extra data needs to be sent
+		{
+			if (svent->baseline.modelindex & 0xFF00)
+				bits |= B_LARGEMODEL;
+			if (svent->baseline.frame & 0xFF00)
+				bits |= B_LARGEFRAME;
+			if (svent->baseline.alpha != ENTALPHA_DEFAULT)
+				bits |= B_ALPHA;
+			if (svent->baseline.scale != ENTSCALE_DEFAULT)
+				bits |= B_SCALE;
+		}
+		//johnfitz
+
+	//
+	// add to the message
+	//
+		SV_ReserveSignonSpace (35);
+
+		//johnfitz -- PROTOCOL_FITZQUAKE
+		if (bits)
+			MSG_WriteByte (sv.signon, svc_spawnbaseline2);
+		else
+			MSG_WriteByte (sv.signon, svc_spawnbaseline);
+		//johnfitz
+
+		MSG_WriteShort (sv.signon,entnum);
+
+		//johnfitz -- PROTOCOL_FITZQUAKE
+		if (bits)
+			MSG_WriteByte (sv.signon, bits);
+
+		if (bits & B_LARGEMODEL)
+			MSG_WriteShort (sv.signon, svent->baseline.modelindex);
+		else
+			MSG_WriteByte (sv.signon, svent->baseline.modelindex);
+
+		if (bits & B_LARGEFRAME)
+			MSG_WriteShort (sv.signon, svent->baseline.frame);
+		else
+			MSG_WriteByte (sv.signon, svent->baseline.frame);
+		//johnfitz
+
+		MSG_WriteByte (sv.signon, svent->baseline.colormap);
+		MSG_WriteByte (sv.signon, svent->baseline.skin);
+		for (i=0 ; i<3 ; i++)
+		{
+			MSG_WriteCoord(sv.signon, svent->baseline.origin[i], sv.protocolflags);
+			MSG_WriteAngle(sv.signon, svent->baseline.angles[i], sv.protocolflags);
+		}
+
+		//johnfitz -- PROTOCOL_FITZQUAKE
+		if (bits & B_ALPHA)
+			MSG_WriteByte (sv.signon, svent->baseline.alpha);
+		//johnfitz
+
+		if (bits & B_SCALE)
+			MSG_WriteByte (sv.signon, svent->baseline.scale);
+	}
+}
+
+
+/*
+================
+SV_SendReconnect
+
+Tell all the clients that the server is changing levels
+================
+*/
+void SV_SendReconnect (void)
+{
+	byte	data[128];
+	sizebuf_t	msg;
+
+	msg.data = data;
+	msg.cursize = 0;
+	msg.maxsize = sizeof(data);
+
+	MSG_WriteChar (&msg, svc_stufftext);
+	MSG_WriteString (&msg, "reconnect\n");
+	NET_SendToAll (&msg, 5.0);
+
+	if (!isDedicated)
+		Cmd_ExecuteString ("reconnect\n", src_command);
+}
+
+
+/*
+================
+SV_SaveSpawnparms
+
+Grabs the current state of each client for saving across the
+transition to another level
+================
+*/
+void SV_SaveSpawnparms (void)
+{
+	int		i, j;
+
+	svs.serverflags = pr_global_struct->serverflags;
+
+	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	{
+		if (!host_client->active)
+			continue;
+
+	// call the progs to get default spawn parms for the new client
+		pr_global_struct->self = EDICT_TO_PROG(host_client->edict);
+		PR_ExecuteProgram (pr_global_struct->SetChangeParms);
+		for (j=0 ; j<NUM_SPAWN_PARMS ; j++)
+			host_client->spawn_parms[j] = (&pr_global_struct->parm1)[j];
+	}
+}
+
+
+/*
+================
+SV_SpawnServer
+
+This is called at the start of each level
+================
+*/
+extern float		scr_centertime_off;
+void SV_SpawnServer (const char *server)
+{
+	static char	dummy[8] = { 0,0,0,0,0,0,0,0 };
+	edict_t		*ent;
+	int			i, signonsize;
+	qcvm_t		*vm = qcvm;
+
+	// let's not have any servers with no name
+	if (hostname.string[0] == 0)
+		Cvar_Set ("hostname", "UNNAMED");
+	scr_centertime_off = 0;
+
+	Con_DPrintf ("SpawnServer: %s\n",server);
+	svs.changelevel_issued = false;		// now safe to issue another
+
+	PR_SwitchQCVM(NULL);
+
+//
+// tell all connected clients that we are going to a new level
+//
+	if (sv.active)
+	{
+		SV_SendReconnect ();
+	}
+
+//
+// make cvars consistant
+//
+	if (coop.value)
+		Cvar_Set ("deathmatch", "0");
+	current_skill = (int)(skill.value + 0.5);
+	if (current_skill < 0)
+		current_skill = 0;
+	if (current_skill > 3)
+		current_skill = 3;
+
+	Cvar_SetValue ("skill", (float)current_skill);
+
+	SV_RecordSpawn (server);
+
+//
+// set up the new server
+//
+	//memset (&sv, 0, sizeof(sv));
+	Host_ClearMemory ();
+
+	q_strlcpy (sv.name, server, sizeof(sv.name));
+
+	sv.protocol = sv_protocol; // johnfitz
+	
+	if (sv.protocol == PROTOCOL_RMQ)
+	{
+		// set up the protocol flags used by this server
+		// (note - these could be cvar-ised so that server admins could choose the protocol features used by their servers)
+		sv.protocolflags = PRFL_INT32COORD | PRFL_SHORTANGLE;
+	}
+	else sv.protocolflags = 0;
+
+	PR_SwitchQCVM(vm);
+// load progs to get entity field count
+	PR_LoadProgs ("progs.dat", true);
+
+// allocate server memory
+	/* Host_ClearMemory() called above already cleared the whole sv structure */
+	qcvm->max_edicts = CLAMP (MIN_EDICTS,(int)max_edicts.value,MAX_EDICTS); //johnfitz -- max_edicts cvar
+	qcvm->edicts = (edict_t *) malloc (qcvm->max_edicts*qcvm->edict_size); // ericw -- sv.edicts switched to use malloc()
+	ClearLink (&qcvm->free_edicts);
+
+	sv.datagram.maxsize = sizeof(sv.datagram_buf);
+	sv.datagram.cursize = 0;
+	sv.datagram.data = sv.datagram_buf;
+
+	sv.reliable_datagram.maxsize = sizeof(sv.reliable_datagram_buf);
+	sv.reliable_datagram.cursize = 0;
+	sv.reliable_datagram.data = sv.reliable_datagram_buf;
+
+	SV_AddSignonBuffer ();
+
+// leave slots at start for clients only
+	qcvm->num_edicts = svs.maxclients+1;
+	memset(qcvm->edicts, 0, qcvm->num_edicts*qcvm->edict_size); // ericw -- sv.edicts switched to use malloc()
+	for (i=0 ; i<svs.maxclients ; i++)
+	{
+		ent = EDICT_NUM(i+1);
+		svs.clients[i].edict = ent;
+	}
+
+	sv.state = ss_loading;
+	sv.paused = false;
+	sv.nomonsters = (nomonsters.value != 0.f);
+
+	qcvm->time = 1.0;
+
+	q_strlcpy (sv.name, server, sizeof(sv.name));
+	q_snprintf (sv.modelname, sizeof(sv.modelname), "maps/%s.bsp", server);
+	sv.worldmodel = Mod_ForName (sv.modelname, false);
+	if (!sv.worldmodel)
+	{
+		Con_Printf ("Couldn't spawn server %s\n", sv.modelname);
+		sv.active = false;
+		return;
+	}
+	sv.models[1] = sv.worldmodel;
+
+//
+// clear world interaction links
+//
+	SV_ClearWorld ();
+	SV_ClearPVSCache ();
+
+	sv.sound_precache[0] = dummy;
+	sv.model_precache[0] = dummy;
+	sv.model_precache[1] = sv.modelname;
+	for (i=1 ; i<sv.worldmodel->numsubmodels ; i++)
+	{
+		sv.model_precache[1+i] = localmodels[i];
+		sv.models[i+1] = Mod_ForName (localmodels[i], false);
+	}
+
+//
+// load the rest of the entities
+//
+	ent = EDICT_NUM(0);
+	memset (&ent->v, 0, qcvm->progs->entityfields * 4);
+	ent->v.model = PR_SetEngineString(sv.worldmodel->name);
+	ent->v.modelindex = 1;		// world model
+	ent->v.solid = SOLID_BSP;
+	ent->v.movetype = MOVETYPE_PUSH;
+
+	if (coop.value)
+		pr_global_struct->coop = coop.value;
+	else
+		pr_global_struct->deathmatch = deathmatch.value;
+
+	pr_global_struct->mapname = PR_SetEngineString(sv.name);
+
+// serverflags are for cross level information (sigils)
+	pr_global_struct->serverflags = svs.serverflags;
+
+	ED_LoadFromFile (sv.worldmodel->entities);
+
+	sv.active = true;
+
+// all setup is completed, any further precache statements are errors
+	sv.state = ss_active;
+
+// run two frames to allow everything to settle
+	host_frametime = 0.1;
+	SV_Physics ();
+	SV_Physics ();
+
+// create a baseline for more efficient communications
+	SV_CreateBaseline ();
+
+	//johnfitz -- warn if signon buffer larger than standard server can handle
+	for (i = 0, signonsize = 0; i < sv.num_signon_buffers; i++)
+		signonsize += sv.signon_buffers[i]->cursize;
+	if (signonsize > 64000-2)
+		Con_DWarning ("%i byte signon buffer exceeds QS limit of 63998.\n", signonsize);
+	else if (signonsize > 8000-2) //max size that will fit into 8000-sized client->message buffer with 2 extra bytes on the end
+		Con_DWarning ("%i byte signon buffer exceeds standard limit of 7998.\n", signonsize);
+	//johnfitz
+
+// send serverinfo to all connected clients
+	for (i=0,host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+		if (host_client->active)
+			SV_SendServerinfo (host_client);
+
+	Con_DPrintf ("Server spawned.\n");
+}
+
+
+/*
+===============================================================================
+
+SESSION RECORDING
+
+sv_record arms a recording that starts with the next new game. From then on
+the server logs every message it reads from a client together with the frame
+time and a fresh random seed for each frame, plus the connects and drops that
+don't come from those messages. sv_replay (or -replay <name> on the command
+line, which implies a dedicated server) spawns the same map, feeds the logged
+messages back in place of the network and runs the frames back to back
+without sending anything, then prints frame time percentiles.
+
+Only client input is logged: a replay needs the same game data and server
+cvars as the recording, and the same C library, since QC randomness comes
+from rand().
+===============================================================================
+*/
+
+#define REPLAY_VERSION	1
+
+enum
+{
+	rpl_frame,
+	rpl_connect,
+	rpl_message,
+	rpl_drop,
+};
+
+typedef struct
+{
+	double		frametime;
+	int			seed;
+	qboolean	ingame;
+	int			firstevent;
+} rplframe_t;
+
+typedef struct
+{
+	int			type;
+	int			client;
+	int			ret;		// NET_GetMessage result, or crash flag for drops
+	int			ofs, len;	// message bytes in the file
+} rplevent_t;
+
+static struct
+{
+	char		armed[MAX_OSPATH];	// file to record to on the next new game
+	char		name[MAX_OSPATH];	// file being recorded
+	int			frames;
+
+	// playback
+	byte		*data;
+	int			size, pos;
+	int			seed;
+	rplframe_t	*framelist;
+	rplevent_t	*events;
+	int			firstevent, lastevent;	// events of the current frame
+	int			cursor[MAX_SCOREBOARD];	// next message to look at per client
+} sv_replay;
+
+static void SV_RecordByte (int c)
+{
+	byte	b = (byte) c;
+
+	fwrite (&b, 1, 1, svs.recordfile);
+}
+
+static void SV_RecordLong (int l)
+{
+	l = LittleLong (l);
+	fwrite (&l, 4, 1, svs.recordfile);
+}
+
+static void SV_RecordFloat (float f)
+{
+	f = LittleFloat (f);
+	fwrite (&f, 4, 1, svs.recordfile);
+}
+
+// doubles go out bit for bit so frame times replay exactly
+static void SV_RecordDouble (double d)
+{
+	uint64_t	bits;
+
+	memcpy (&bits, &d, sizeof (bits));
+	SV_RecordLong ((int) (uint32_t) bits);
+	SV_RecordLong ((int) (uint32_t) (bits >> 32));
+}
+
+static qboolean SV_ReplayRead (void *out, int len)
+{
+	if (len < 0 || sv_replay.size - sv_replay.pos < len)
+		return false;
+	memcpy (out, sv_replay.data + sv_replay.pos, len);
+	sv_replay.pos += len;
+	return true;
+}
+
+static int SV_ReplayByte (void)
+{
+	byte	b;
+
+	return SV_ReplayRead (&b, 1) ? b : -1;
+}
+
+static int SV_ReplayLong (void)
+{
+	int		l = 0;
+
+	SV_ReplayRead (&l, 4);
+	return LittleLong (l);
+}
+
+static float SV_ReplayFloat (void)
+{
+	float	f = 0.f;
+
+	SV_ReplayRead (&f, 4);
+	return LittleFloat (f);
+}
+
+static double SV_ReplayDouble (void)
+{
+	uint64_t	bits;
+	double		d;
+
+	bits = (uint32_t) SV_ReplayLong ();
+	bits |= (uint64_t) (uint32_t) SV_ReplayLong () << 32;
+	memcpy (&d, &bits, sizeof (d));
+	return d;
+}
+
+/*
+==================
+SV_StopRecording
+==================
+*/
+void SV_StopRecording (void)
+{
+	if (!svs.recordfile)
+		return;
+
+	fclose (svs.recordfile);
+	svs.recordfile = NULL;
+	Con_Printf ("Recorded %d server frames to %s\n", sv_replay.frames, sv_replay.name);
+}
 
-		if (statss[i] || client->oldstats_s[i])
-		{
-			const char *os = client->oldstats_s[i];
-			const char *ns = statss[i];
-			if (!ns)	ns="";
-			if (!os)	os="";
-			if (strcmp(os,ns))
-			{
-				free(client->oldstats_s[i]);
-				client->oldstats_s[i] = strdup(ns);
+/*
+==================
+SV_RecordSpawn
 
-				MSG_WriteByte (&client->message, svc_stufftext);
-				MSG_WriteString (&client->message, va ("//sts %i \"%s\"\n", i, ns));
-			}
+Called by SV_SpawnServer once the spawn cvars are settled, before anything
+can use rand(). Starts an armed recording, ends one on a level change and
+reseeds for a replay.
+==================
+*/
+void SV_RecordSpawn (const char *server)
+{
+	char	mapname[MAX_QPATH];
+	int		i;
+
+	if (svs.replaying)
+	{
+		srand (sv_replay.seed);
+		return;
+	}
+
+	if (svs.recordfile)
+	{
+		Con_Printf ("Level changed, ");
+		SV_StopRecording ();
+	}
+
+	if (!sv_replay.armed[0])
+		return;
+
+	// clients carried over from the last level can't be reconnected on replay
+	for (i = 0; i < svs.maxclients; i++)
+	{
+		if (svs.clients[i].active)
+		{
+			Con_Printf ("sv_record: clients already connected, waiting for a new game\n");
+			return;
 		}
 	}
+
+	svs.recordfile = Sys_fopen (sv_replay.armed, "wb");
+	if (!svs.recordfile)
+	{
+		Con_Printf ("ERROR: couldn't create %s\n", sv_replay.armed);
+		sv_replay.armed[0] = 0;
+		return;
+	}
+	q_strlcpy (sv_replay.name, sv_replay.armed, sizeof (sv_replay.name));
+	sv_replay.armed[0] = 0;
+	sv_replay.frames = 0;
+
+	sv_replay.seed = rand ();
+	srand (sv_replay.seed);
+
+	memset (mapname, 0, sizeof (mapname));
+	q_strlcpy (mapname, server, sizeof (mapname));
+	fwrite ("SVRP", 4, 1, svs.recordfile);
+	SV_RecordLong (REPLAY_VERSION);
+	fwrite (mapname, sizeof (mapname), 1, svs.recordfile);
+	SV_RecordFloat (skill.value);
+	SV_RecordFloat (coop.value);
+	SV_RecordFloat (deathmatch.value);
+	SV_RecordFloat (teamplay.value);
+	SV_RecordFloat (nomonsters.value);
+	SV_RecordLong (svs.maxclients);
+	SV_RecordLong (svs.serverflags);
+	SV_RecordLong ((int) max_edicts.value);
+	SV_RecordLong (sv_replay.seed);
+
+	Con_Printf ("Recording server session to %s\n", sv_replay.name);
 }
 
 /*
-=======================
-SV_WriteUnderwaterOverride
-=======================
+==================
+SV_RecordFrame
+
+Starts a frame in the recording with its time and a new random seed, so
+whatever the local client does with rand() between frames doesn't matter
+==================
 */
-void SV_WriteUnderwaterOverride (client_t *client)
+void SV_RecordFrame (void)
 {
-	if (!client->edict->sendforcewater)
+	int		seed;
+
+	if (!svs.recordfile)
 		return;
-	client->edict->sendforcewater = false;
-	MSG_WriteByte (&client->message, svc_stufftext);
-	MSG_WriteString (&client->message, va ("//v_water %i\n", client->edict->forcewater));
+
+	seed = rand ();
+	srand (seed);
+
+	SV_RecordByte (rpl_frame);
+	SV_RecordDouble (host_frametime);
+	SV_RecordLong (seed);
+	SV_RecordByte (key_dest == key_game);
+	sv_replay.frames++;
 }
 
+/*
+==================
+SV_RecordDrop
+
+Logs host_client being dropped. Drops that come out of reading its messages
+are logged too, but the replay has already repeated those by the time it
+gets to them.
+==================
+*/
+void SV_RecordDrop (qboolean crash)
+{
+	if (!svs.recordfile)
+		return;
+
+	SV_RecordByte (rpl_drop);
+	SV_RecordByte (host_client - svs.clients);
+	SV_RecordByte (crash != false);
+}
 
 /*
-=======================
-SV_UpdateToReliableMessages
-=======================
+==================
+SV_PhysicsActive
+
+Whether clients think and the world runs this frame: never while paused, and
+in single player only while the game has focus (as recorded when replaying)
+==================
 */
-void SV_UpdateToReliableMessages (void)
+qboolean SV_PhysicsActive (void)
 {
-	int			i, j;
-	client_t *client;
+	if (sv.paused)
+		return false;
+	if (svs.maxclients > 1)
+		return true;
+	if (svs.replaying)
+		return svs.replayingame;
+	return key_dest == key_game;
+}
 
-// check for changes to be sent over the reliable streams
-	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+/*
+==================
+SV_GetClientMessage
+
+NET_GetMessage for host_client, logged when recording and taken from the
+recording when replaying
+==================
+*/
+int SV_GetClientMessage (void)
+{
+	rplevent_t	*ev;
+	int			ret, num;
+
+	num = host_client - svs.clients;
+
+	if (svs.replaying)
 	{
-		if (host_client->old_frags != host_client->edict->v.frags)
+		while (sv_replay.cursor[num] < sv_replay.lastevent)
 		{
-			for (j=0, client = svs.clients ; j<svs.maxclients ; j++, client++)
-			{
-				if (!client->active)
-					continue;
-				MSG_WriteByte (&client->message, svc_updatefrags);
-				MSG_WriteByte (&client->message, i);
-				MSG_WriteShort (&client->message, host_client->edict->v.frags);
-			}
-
-			host_client->old_frags = host_client->edict->v.frags;
+			ev = &sv_replay.events[sv_replay.cursor[num]++];
+			if (ev->type != rpl_message || ev->client != num)
+				continue;
+			SZ_Clear (&net_message);
+			SZ_Write (&net_message, sv_replay.data + ev->ofs, ev->len);
+			return ev->ret;
 		}
+		return 0;
 	}
 
-	for (j=0, client = svs.clients ; j<svs.maxclients ; j++, client++)
+	ret = NET_GetMessage (host_client->netconnection);
+	if (ret && svs.recordfile)
 	{
-		if (!client->active)
-			continue;
-		SV_WriteStats (client);
-		SV_WriteUnderwaterOverride (client);
-		SZ_Write (&client->message, sv.reliable_datagram.data, sv.reliable_datagram.cursize);
+		SV_RecordByte (rpl_message);
+		SV_RecordByte (num);
+		SV_RecordLong (ret);
+		SV_RecordLong (net_message.cursize);
+		fwrite (net_message.data, net_message.cursize, 1, svs.recordfile);
 	}
 
-	SZ_Clear (&sv.reliable_datagram);
+	return ret;
 }
 
-
 /*
-=======================
-SV_SendNop
-
-Send a nop message without trashing or sending the accumulated client
-message buffer
-=======================
+==================
+SV_RecordConnect
+==================
 */
-void SV_SendNop (client_t *client)
+static void SV_RecordConnect (int clientnum)
 {
-	sizebuf_t	msg;
-	byte		buf[4];
+	if (!svs.recordfile)
+		return;
 
-	msg.data = buf;
-	msg.maxsize = sizeof(buf);
-	msg.cursize = 0;
+	SV_RecordByte (rpl_connect);
+	SV_RecordByte (clientnum);
+}
 
-	MSG_WriteChar (&msg, svc_nop);
+/*
+==================
+SV_ReplayConnects
 
-	if (NET_SendUnreliableMessage (client->netconnection, &msg) == -1)
-		SV_DropClient (true);	// if the message couldn't send, kick off
-	client->last_message = realtime;
+Connects the clients that connected in the current replay frame. They get
+no net connection, everything they would have sent comes from the recording.
+==================
+*/
+static void SV_ReplayConnects (void)
+{
+	rplevent_t	*ev;
+	int			i;
+
+	for (i = sv_replay.firstevent; i < sv_replay.lastevent; i++)
+	{
+		ev = &sv_replay.events[i];
+		if (ev->type != rpl_connect || svs.clients[ev->client].active)
+			continue;
+		svs.clients[ev->client].netconnection = NULL;
+		SV_ConnectClient (ev->client);
+		net_activeconnections++;
+	}
 }
 
 /*
-=======================
-SV_SendClientMessages
-=======================
+==================
+SV_ReplayEndFrame
+
+Applies the current frame's drops in place of sending anything, then throws
+away what would have been sent
+==================
 */
-void SV_SendClientMessages (void)
+void SV_ReplayEndFrame (void)
 {
+	rplevent_t	*ev;
 	int			i;
 
-// update frags, names, etc
-	SV_UpdateToReliableMessages ();
-
-// build individual updates
-	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	for (i = sv_replay.firstevent; i < sv_replay.lastevent; i++)
 	{
-		if (!host_client->active)
+		ev = &sv_replay.events[i];
+		if (ev->type != rpl_drop || !svs.clients[ev->client].active)
 			continue;
+		host_client = &svs.clients[ev->client];
+		SV_DropClient (ev->ret);
+	}
 
-		if (host_client->spawned)
-		{
-			if (!SV_SendClientDatagram (host_client))
-				continue;
-		}
-		else
-		{
-		// the player isn't totally in the game yet
-		// send small keepalive messages if too much time has passed
-		// send a full message when the next signon stage has been requested
-		// some other message data (name changes, etc) may accumulate
-		// between signon stages
-			if (!host_client->sendsignon)
-			{
-				if (realtime - host_client->last_message > 5)
-					SV_SendNop (host_client);
-				continue;	// don't send out non-signon messages
-			}
-			if (host_client->sendsignon == PRESPAWN_SIGNONBUFS)
-			{
-				qboolean local = SV_IsLocalClient (host_client);
-				while (host_client->signonidx < sv.num_signon_buffers)
-				{
-					sizebuf_t *signon = sv.signon_buffers[host_client->signonidx];
-					if (host_client->message.cursize + signon->cursize > host_client->message.maxsize)
-						break;
-					SZ_Write (&host_client->message, signon->data, signon->cursize);
-					host_client->signonidx++;
-					// only send multiple buffers at once when playing locally,
-					// otherwise we send one signon at a time to avoid overflowing
-					// the datagram buffer for clients using a lower limit (e.g. 32000 in QS)
-					if (!local)
-						break;
-				}
-				if (host_client->signonidx == sv.num_signon_buffers)
-					host_client->sendsignon = PRESPAWN_SIGNONMSG;
-			}
-			if (host_client->sendsignon == PRESPAWN_SIGNONMSG)
-			{
-				if (host_client->message.cursize + 2 < host_client->message.maxsize)
-				{
-					MSG_WriteByte (&host_client->message, svc_signonnum);
-					MSG_WriteByte (&host_client->message, 2);
-					host_client->sendsignon = PRESPAWN_FLUSH;
-				}
-			}
-		}
+	for (i = 0, host_client = svs.clients; i < svs.maxclients; i++, host_client++)
+		SZ_Clear (&host_client->message);
+	SZ_Clear (&sv.reliable_datagram);
+}
 
-		// check for an overflowed message.  Should only happen
-		// on a very fucked up connection that backs up a lot, then
-		// changes level
-		if (host_client->message.overflowed)
-		{
-			SV_DropClient (true);
-			host_client->message.overflowed = false;
-			continue;
-		}
+/*
+==================
+SV_ReplayParse
 
-		if (host_client->message.cursize || host_client->dropasap)
-		{
-			if (!NET_CanSendMessage (host_client->netconnection))
-			{
-//				I_Printf ("can't write\n");
-				continue;
-			}
+Splits the loaded recording into frames and events. A truncated recording
+ends at its last complete record.
+==================
+*/
+static qboolean SV_ReplayParse (void)
+{
+	static const int	sizes[] = {13, 1, 9, 2};	// after the type byte
+	rplframe_t	frame;
+	rplevent_t	ev;
+	int			type;
 
-			if (host_client->dropasap)
-				SV_DropClient (false);	// went to another level
-			else
-			{
-				if (NET_SendMessage (host_client->netconnection
-				, &host_client->message) == -1)
-					SV_DropClient (true);	// if the message couldn't send, kick off
-				SZ_Clear (&host_client->message);
-				host_client->last_message = realtime;
-				if (host_client->sendsignon == PRESPAWN_FLUSH)
-					host_client->sendsignon = PRESPAWN_DONE;
-			}
+	while ((type = SV_ReplayByte ()) != -1)
+	{
+		if (type >= (int) countof (sizes))
+		{
+			Con_Printf ("Bad record type %d at offset %d\n", type, sv_replay.pos - 1);
+			return false;
+		}
+		if (sv_replay.size - sv_replay.pos < sizes[type])
+			break;
+
+		if (type == rpl_frame)
+		{
+			frame.frametime = SV_ReplayDouble ();
+			frame.seed = SV_ReplayLong ();
+			frame.ingame = SV_ReplayByte () != 0;
+			frame.firstevent = VEC_SIZE (sv_replay.events);
+			VEC_PUSH (sv_replay.framelist, frame);
+			continue;
+		}
+
+		memset (&ev, 0, sizeof (ev));
+		ev.type = type;
+		ev.client = SV_ReplayByte ();
+		if (ev.client >= svs.maxclients)
+		{
+			Con_Printf ("Bad client %d at offset %d\n", ev.client, sv_replay.pos - 1);
+			return false;
+		}
+		if (type == rpl_drop)
+			ev.ret = SV_ReplayByte ();
+		else if (type == rpl_message)
+		{
+			ev.ret = SV_ReplayLong ();
+			ev.len = SV_ReplayLong ();
+			ev.ofs = sv_replay.pos;
+			if (ev.len < 0 || ev.len > net_message.maxsize || sv_replay.size - sv_replay.pos < ev.len)
+				break;
+			sv_replay.pos += ev.len;
 		}
+		VEC_PUSH (sv_replay.events, ev);
 	}
 
+	if (type != -1)
+		Con_Printf ("Recording is truncated after frame %d\n", (int) VEC_SIZE (sv_replay.framelist));
 
-// clear muzzle flashes
-	SV_CleanupEnts ();
+	return VEC_SIZE (sv_replay.framelist) != 0;
 }
 
+static int SV_CompareDoubles (const void *a, const void *b)
+{
+	double	x = *(const double *) a;
+	double	y = *(const double *) b;
 
-/*
-==============================================================================
-
-SERVER SPAWNING
+	return (x > y) - (x < y);
+}
 
-==============================================================================
+/*
+==================
+SV_StopReplay
+==================
 */
-
-#define SIGNON_SIZE		31500 // QS has a MAX_DATAGRAM of 32000, try to play nice
+void SV_StopReplay (void)
+{
+	svs.replaying = false;
+	free (sv_replay.data);
+	sv_replay.data = NULL;
+	VEC_FREE (sv_replay.framelist);
+	VEC_FREE (sv_replay.events);
+}
 
 /*
-================
-SV_AddSignonBuffer
-================
+==================
+SV_Record_f
+
+sv_record <name>
+==================
 */
-static void SV_AddSignonBuffer (void)
+void SV_Record_f (void)
 {
-	sizebuf_t *sb;
-	if (sv.num_signon_buffers >= MAX_SIGNON_BUFFERS)
-		Host_Error ("SV_AddSignonBuffer overflow\n");
+	char	relname[MAX_OSPATH];
 
-	sb = (sizebuf_t *) Hunk_AllocName (sizeof (sizebuf_t) + SIGNON_SIZE, "signon");
-	sb->data = (byte *)(sb + 1);
-	sb->maxsize = SIGNON_SIZE;
-	sv.signon_buffers[sv.num_signon_buffers++] = sb;
-	sv.signon = sb;
+	if (Cmd_Argc () != 2)
+	{
+		Con_Printf ("sv_record <name> : record the next game's client input\n");
+		return;
+	}
+
+	if (svs.recordfile)
+	{
+		Con_Printf ("Already recording to %s\n", sv_replay.name);
+		return;
+	}
+
+	if (svs.replaying)
+		return;
+
+	q_strlcpy (relname, Cmd_Argv (1), sizeof (relname));
+	COM_AddExtension (relname, ".rpl", sizeof (relname));
+	q_snprintf (sv_replay.armed, sizeof (sv_replay.armed), "%s/%s", com_gamedir, relname);
+
+	Con_Printf ("Recording will start with the next map\n");
 }
 
 /*
-================
-SV_ReserveSignonSpace
-================
+==================
+SV_StopRecord_f
+==================
 */
-void SV_ReserveSignonSpace (int numbytes)
+void SV_StopRecord_f (void)
 {
-	if (sv.signon->cursize + numbytes > sv.signon->maxsize)
-		SV_AddSignonBuffer ();
+	if (sv_replay.armed[0])
+	{
+		sv_replay.armed[0] = 0;
+		Con_Printf ("Recording cancelled\n");
+	}
+	else if (svs.recordfile)
+		SV_StopRecording ();
+	else
+		Con_Printf ("Not recording\n");
 }
 
 /*
-================
-SV_ModelIndex
+==================
+SV_Replay_f
 
-================
+sv_replay <name>
+
+Replays a recording as fast as possible and prints frame times
+==================
 */
-int SV_ModelIndex (const char *name)
+void SV_Replay_f (void)
 {
-	int		i;
+	char		relname[MAX_OSPATH];
+	char		mapname[MAX_QPATH];
+	rplframe_t	*frame;
+	double		*times, t, total, oldframetime;
+	float		cvars[5];
+	int			i, j, count, maxclients, serverflags, edicts;
+
+	if (Cmd_Argc () != 2)
+	{
+		Con_Printf ("sv_replay <name> : replay a recorded game and time its frames\n");
+		return;
+	}
 
-	if (!name || !name[0])
-		return 0;
+	if (svs.replaying || cmd_source != src_command)
+		return;
 
-	for (i=0 ; i<MAX_MODELS && sv.model_precache[i] ; i++)
-		if (!strcmp(sv.model_precache[i], name))
-			return i;
-	if (i==MAX_MODELS || !sv.model_precache[i])
-		Sys_Error ("SV_ModelIndex: model %s not precached", name);
-	return i;
+	if (svs.recordfile || sv_replay.armed[0])
+	{
+		Con_Printf ("Can't replay while recording\n");
+		return;
+	}
+
+	q_strlcpy (relname, Cmd_Argv (1), sizeof (relname));
+	COM_AddExtension (relname, ".rpl", sizeof (relname));
+
+	CL_Disconnect ();
+	Host_ShutdownServer (false);
+
+	sv_replay.data = COM_LoadMallocFile (relname, NULL);
+	if (!sv_replay.data)
+	{
+		Con_Printf ("ERROR: couldn't open %s\n", relname);
+		return;
+	}
+	sv_replay.size = (int) com_filesize;
+	sv_replay.pos = 0;
+
+	if (!SV_ReplayRead (mapname, 4) || memcmp (mapname, "SVRP", 4) != 0 || SV_ReplayLong () != REPLAY_VERSION)
+	{
+		Con_Printf ("%s is not a server recording\n", relname);
+		SV_StopReplay ();
+		return;
+	}
+	SV_ReplayRead (mapname, sizeof (mapname));
+	mapname[sizeof (mapname) - 1] = 0;
+	for (i = 0; i < 5; i++)
+		cvars[i] = SV_ReplayFloat ();
+	maxclients = SV_ReplayLong ();
+	serverflags = SV_ReplayLong ();
+	edicts = SV_ReplayLong ();
+	sv_replay.seed = SV_ReplayLong ();
+
+	if (maxclients < 1 || maxclients > svs.maxclientslimit)
+	{
+		Con_Printf ("%s needs %d client slots, only %d available\n", relname, maxclients, svs.maxclientslimit);
+		SV_StopReplay ();
+		return;
+	}
+
+	svs.maxclients = maxclients;
+	if (!SV_ReplayParse ())
+	{
+		Con_Printf ("%s has no frames\n", relname);
+		SV_StopReplay ();
+		return;
+	}
+
+	Cvar_SetValue ("skill", cvars[0]);
+	Cvar_SetValue ("coop", cvars[1]);
+	Cvar_SetValue ("deathmatch", cvars[2]);
+	Cvar_SetValue ("teamplay", cvars[3]);
+	Cvar_SetValue ("nomonsters", cvars[4]);
+	Cvar_SetValue ("max_edicts", edicts);
+	svs.serverflags = serverflags;
+
+	svs.replaying = true;
+	PR_SwitchQCVM(&sv.qcvm);
+	SV_SpawnServer (mapname);
+	PR_SwitchQCVM(NULL);
+	if (!sv.active)
+	{
+		SV_StopReplay ();
+		return;
+	}
+
+	count = VEC_SIZE (sv_replay.framelist);
+	times = (double *) malloc (count * sizeof (double));
+	if (!times)
+		Sys_Error ("SV_Replay_f: out of memory");
+
+	Con_Printf ("Replaying %d frames of %s\n", count, mapname);
+
+	oldframetime = host_frametime;
+	total = 0.0;
+	for (i = 0; i < count && sv.active; i++)
+	{
+		frame = &sv_replay.framelist[i];
+		sv_replay.firstevent = frame->firstevent;
+		sv_replay.lastevent = i + 1 < count ? frame[1].firstevent : (int) VEC_SIZE (sv_replay.events);
+		for (j = 0; j < svs.maxclients; j++)
+			sv_replay.cursor[j] = sv_replay.firstevent;
+
+		host_frametime = frame->frametime;
+		svs.replayingame = frame->ingame;
+		srand (frame->seed);
+
+		t = Sys_DoubleTime ();
+		PR_SwitchQCVM(&sv.qcvm);
+		Host_ServerFrame ();
+		PR_SwitchQCVM(NULL);
+		times[i] = Sys_DoubleTime () - t;
+		total += times[i];
+	}
+	host_frametime = oldframetime;
+	count = i;
+
+	qsort (times, count, sizeof (double), SV_CompareDoubles);
+	Con_Printf ("%d frames in %.3f s, %.3f ms per frame\n", count, total, total * 1000.0 / count);
+	Con_Printf ("p50 %7.3f ms  p90 %7.3f ms  p99 %7.3f ms  max %7.3f ms\n",
+		times[count / 2] * 1000.0,
+		times[count * 9 / 10] * 1000.0,
+		times[count * 99 / 100] * 1000.0,
+		times[count - 1] * 1000.0);
+	free (times);
+
+	Host_ShutdownServer (false);
 }
 
+
 /*
-================
-SV_CreateBaseline
-================
+===============================================================================
+
+BOTS
+
+A load generator for benchmarking the server, dedicated or not.  sv_bots
+connects fake clients over the loopback driver, which the server takes for
+any other remote client.  Once per server frame they read everything sent to
+them, go through the signon like a real client would, and send a move, set
+by sv_botmove.  The wandering ones use their own random numbers so that runs
+can be repeated and rand() is left to the game.
+
+They don't parse what they get: the signon steps wait for the server to have
+sent all of the previous stage, which is found from their client_t instead.
+
+sv_botstats reports the server frame times and traffic since the bots were
+last added or the stats printed.
+
+===============================================================================
 */
-void SV_CreateBaseline (void)
+
+typedef struct
 {
-	int			i;
-	edict_t		*svent;
-	int			entnum;
-	int			bits; //johnfitz -- PROTOCOL_FITZQUAKE
+	struct qsocket_s	*sock;		// client end, NULL = unused
+	char		name[16];			// also the address of the server end
+	qboolean	accepted;			// picked up by the server
+	int			signon;				// like cls.signon
+	unsigned int	seed;
+	float		yaw;
+	int			forwardmove, sidemove, buttons;
+	double		nextchange;			// for wandering
+} svbot_t;
+
+static svbot_t	sv_bots[MAX_SCOREBOARD];
+
+static struct
+{
+	double		start;				// realtime when the stats were reset
+	double		*frametimes;		// VEC
+	double		bytes;
+	int			messages;
+	int			dropped;			// loop_droppedDatagrams at the start
+} sv_botstats;
 
-	for (entnum = 0; entnum < qcvm->num_edicts ; entnum++)
-	{
-	// get the current server version
-		svent = EDICT_NUM(entnum);
-		if (svent->free)
-			continue;
-		if (entnum > svs.maxclients && !svent->v.modelindex)
-			continue;
+/*
+==================
+SV_ResetBotStats
+==================
+*/
+static void SV_ResetBotStats (void)
+{
+	VEC_CLEAR (sv_botstats.frametimes);
+	sv_botstats.start = realtime;
+	sv_botstats.bytes = 0.0;
+	sv_botstats.messages = 0;
+	sv_botstats.dropped = loop_droppedDatagrams;
+}
 
-	//
-	// create entity baseline
-	//
-		VectorCopy (svent->v.origin, svent->baseline.origin);
-		VectorCopy (svent->v.angles, svent->baseline.angles);
-		svent->baseline.frame = svent->v.frame;
-		svent->baseline.skin = svent->v.skin;
-		if (entnum > 0 && entnum <= svs.maxclients)
-		{
-			svent->baseline.colormap = entnum;
-			svent->baseline.modelindex = SV_ModelIndex("progs/player.mdl");
-			svent->baseline.alpha = ENTALPHA_DEFAULT; //johnfitz -- alpha support
-			svent->baseline.scale = ENTSCALE_DEFAULT;
-		}
-		else
-		{
-			svent->baseline.colormap = 0;
-			svent->baseline.modelindex = SV_ModelIndex(PR_GetString(svent->v.model));
-			svent->baseline.alpha = svent->alpha; //johnfitz -- alpha support
-			svent->baseline.scale = ENTSCALE_DEFAULT;
-			if (sv.protocol == PROTOCOL_RMQ)
-			{
-				eval_t* val;
-				val = GetEdictFieldValueByName(svent, "scale");
-				if (val)
-					svent->baseline.scale = ENTSCALE_ENCODE(val->_float);
-			}
-		}
+/*
+==================
+SV_BotRandom
+==================
+*/
+static int SV_BotRandom (svbot_t *bot)
+{
+	bot->seed = bot->seed * 1103515245 + 12345;
+	return (bot->seed >> 16) & 0x7fff;
+}
 
-		//johnfitz -- PROTOCOL_FITZQUAKE
-		bits = 0;
-		if (sv.protocol == PROTOCOL_NETQUAKE) //still want to send baseline in PROTOCOL_NETQUAKE, so reset these values
-		{
-			if (svent->baseline.modelindex & 0xFF00)
-				svent->baseline.modelindex = 0;
-			if (svent->baseline.frame & 0xFF00)
-				svent->baseline.frame = 0;
-			svent->baseline.alpha = ENTALPHA_DEFAULT;
-			svent->baseline.scale = ENTSCALE_DEFAULT;
-		}
-		else //decide which extra data needs to be sent
-		{
-			if (svent->baseline.modelindex & 0xFF00)
-				bits |= B_LARGEMODEL;
-			if (svent->baseline.frame & 0xFF00)
-				bits |= B_LARGEFRAME;
-			if (svent->baseline.alpha != ENTALPHA_DEFAULT)
-				bits |= B_ALPHA;
-			if (svent->baseline.scale != ENTSCALE_DEFAULT)
-				bits |= B_SCALE;
-		}
-		//johnfitz
+/*
+==================
+SV_BotClient
 
-	//
-	// add to the message
-	//
-		SV_ReserveSignonSpace (35);
+Returns NULL until the server has picked up the connection
+==================
+*/
+static client_t *SV_BotClient (svbot_t *bot)
+{
+	client_t	*client;
+	int			i;
 
-		//johnfitz -- PROTOCOL_FITZQUAKE
-		if (bits)
-			MSG_WriteByte (sv.signon, svc_spawnbaseline2);
-		else
-			MSG_WriteByte (sv.signon, svc_spawnbaseline);
-		//johnfitz
+	for (i = 0, client = svs.clients; i < svs.maxclients; i++, client++)
+	{
+		if (client->active && client->netconnection &&
+			!strcmp (NET_QSocketGetAddressString (client->netconnection), bot->name))
+			return client;
+	}
 
-		MSG_WriteShort (sv.signon,entnum);
+	return NULL;
+}
 
-		//johnfitz -- PROTOCOL_FITZQUAKE
-		if (bits)
-			MSG_WriteByte (sv.signon, bits);
+/*
+==================
+SV_AddBot
+==================
+*/
+static qboolean SV_AddBot (svbot_t *bot)
+{
+	int		num = bot - sv_bots;
 
-		if (bits & B_LARGEMODEL)
-			MSG_WriteShort (sv.signon, svent->baseline.modelindex);
-		else
-			MSG_WriteByte (sv.signon, svent->baseline.modelindex);
+	memset (bot, 0, sizeof (*bot));
+	q_snprintf (bot->name, sizeof (bot->name), "bot%d", num + 1);
+	bot->sock = NET_ConnectBot (bot->name);
+	if (!bot->sock)
+		return false;
 
-		if (bits & B_LARGEFRAME)
-			MSG_WriteShort (sv.signon, svent->baseline.frame);
-		else
-			MSG_WriteByte (sv.signon, svent->baseline.frame);
-		//johnfitz
+	bot->seed = num + 1;
+	bot->yaw = num * 360.f / MAX_SCOREBOARD;
 
-		MSG_WriteByte (sv.signon, svent->baseline.colormap);
-		MSG_WriteByte (sv.signon, svent->baseline.skin);
-		for (i=0 ; i<3 ; i++)
-		{
-			MSG_WriteCoord(sv.signon, svent->baseline.origin[i], sv.protocolflags);
-			MSG_WriteAngle(sv.signon, svent->baseline.angles[i], sv.protocolflags);
-		}
+	return true;
+}
 
-		//johnfitz -- PROTOCOL_FITZQUAKE
-		if (bits & B_ALPHA)
-			MSG_WriteByte (sv.signon, svent->baseline.alpha);
-		//johnfitz
+/*
+==================
+SV_RemoveBot
+==================
+*/
+static void SV_RemoveBot (svbot_t *bot)
+{
+	client_t	*client, *save;
 
-		if (bits & B_SCALE)
-			MSG_WriteByte (sv.signon, svent->baseline.scale);
+	client = SV_BotClient (bot);
+	if (client)
+	{
+		save = host_client;
+		host_client = client;
+		SV_DropClient (false);
+		host_client = save;
 	}
-}
 
+	NET_CloseBot (bot->sock);
+	memset (bot, 0, sizeof (*bot));
+}
 
 /*
-================
-SV_SendReconnect
+==================
+SV_BotSignon
 
-Tell all the clients that the server is changing levels
-================
+Sends the reply to a signon stage once the server has sent all of it
+==================
 */
-void SV_SendReconnect (void)
+static void SV_BotSignon (svbot_t *bot, client_t *client)
 {
-	byte	data[128];
+	byte		buf[128];
 	sizebuf_t	msg;
 
-	msg.data = data;
+	if (client->sendsignon != PRESPAWN_DONE || !NET_CanSendMessage (bot->sock))
+		return;
+
+	msg.data = buf;
+	msg.maxsize = sizeof (buf);
 	msg.cursize = 0;
-	msg.maxsize = sizeof(data);
 
-	MSG_WriteChar (&msg, svc_stufftext);
-	MSG_WriteString (&msg, "reconnect\n");
-	NET_SendToAll (&msg, 5.0);
+	switch (bot->signon)
+	{
+	case 0:
+		MSG_WriteByte (&msg, clc_stringcmd);
+		MSG_WriteString (&msg, "prespawn");
+		break;
 
-	if (!isDedicated)
-		Cmd_ExecuteString ("reconnect\n", src_command);
-}
+	case 1:
+		MSG_WriteByte (&msg, clc_stringcmd);
+		MSG_WriteString (&msg, va ("name \"%s\"\n", bot->name));
+		MSG_WriteByte (&msg, clc_stringcmd);
+		MSG_WriteString (&msg, va ("color %i %i\n", (int)(bot - sv_bots) % 14, (int)(bot - sv_bots) % 14));
+		MSG_WriteByte (&msg, clc_stringcmd);
+		MSG_WriteString (&msg, "spawn");
+		break;
+
+	case 2:
+		MSG_WriteByte (&msg, clc_stringcmd);
+		MSG_WriteString (&msg, "begin");
+		break;
+
+	default:
+		return;
+	}
 
+	if (NET_SendMessage (bot->sock, &msg) == 1)
+		bot->signon++;
+}
 
 /*
-================
-SV_SaveSpawnparms
+==================
+SV_BotMove
 
-Grabs the current state of each client for saving across the
-transition to another level
-================
+Returns false if the connection is gone
+==================
 */
-void SV_SaveSpawnparms (void)
+static qboolean SV_BotMove (svbot_t *bot)
 {
-	int		i, j;
-
-	svs.serverflags = pr_global_struct->serverflags;
+	byte		buf[32];
+	sizebuf_t	msg;
+	vec3_t		angles;
+	int			i;
 
-	for (i=0, host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
+	switch ((int) sv_botmove.value)
 	{
-		if (!host_client->active)
-			continue;
+	case 1:	// run in circles
+		bot->yaw = anglemod (bot->yaw + 90.f * host_frametime);
+		bot->forwardmove = 400;
+		bot->sidemove = 0;
+		bot->buttons = 0;
+		break;
 
-	// call the progs to get default spawn parms for the new client
-		pr_global_struct->self = EDICT_TO_PROG(host_client->edict);
-		PR_ExecuteProgram (pr_global_struct->SetChangeParms);
-		for (j=0 ; j<NUM_SPAWN_PARMS ; j++)
-			host_client->spawn_parms[j] = (&pr_global_struct->parm1)[j];
+	case 2:	// wander, jumping and firing now and then
+		if (qcvm->time >= bot->nextchange)
+		{
+			bot->yaw = SV_BotRandom (bot) * 360.f / 0x8000;
+			bot->forwardmove = (SV_BotRandom (bot) % 3 - 1) * 400;
+			bot->sidemove = (SV_BotRandom (bot) % 3 - 1) * 350;
+			bot->buttons = SV_BotRandom (bot) & 3;
+			bot->nextchange = qcvm->time + 0.5 + (SV_BotRandom (bot) & 1023) / 1024.0 * 1.5;
+		}
+		break;
+
+	default:
+		bot->forwardmove = bot->sidemove = bot->buttons = 0;
+		break;
 	}
-}
 
+	angles[0] = 0.f;
+	angles[1] = bot->yaw;
+	angles[2] = 0.f;
 
-/*
-================
-SV_SpawnServer
+	msg.data = buf;
+	msg.maxsize = sizeof (buf);
+	msg.cursize = 0;
 
-This is called at the start of each level
-================
+	MSG_WriteByte (&msg, clc_move);
+	MSG_WriteFloat (&msg, qcvm->time);	// no ping to speak of
+	for (i = 0; i < 3; i++)
+		if (sv.protocol == PROTOCOL_NETQUAKE)
+			MSG_WriteAngle (&msg, angles[i], sv.protocolflags);
+		else
+			MSG_WriteAngle16 (&msg, angles[i], sv.protocolflags);
+	MSG_WriteShort (&msg, bot->forwardmove);
+	MSG_WriteShort (&msg, bot->sidemove);
+	MSG_WriteShort (&msg, 0);
+	MSG_WriteByte (&msg, bot->buttons);
+	MSG_WriteByte (&msg, 0);
+
+	return NET_SendUnreliableMessage (bot->sock, &msg) != -1;
+}
+
+/*
+==================
+SV_RunBot
+==================
 */
-extern float		scr_centertime_off;
-void SV_SpawnServer (const char *server)
+static void SV_RunBot (svbot_t *bot)
 {
-	static char	dummy[8] = { 0,0,0,0,0,0,0,0 };
-	edict_t		*ent;
-	int			i, signonsize;
-	qcvm_t		*vm = qcvm;
-
-	// let's not have any servers with no name
-	if (hostname.string[0] == 0)
-		Cvar_Set ("hostname", "UNNAMED");
-	scr_centertime_off = 0;
-
-	Con_DPrintf ("SpawnServer: %s\n",server);
-	svs.changelevel_issued = false;		// now safe to issue another
+	client_t	*client;
 
-	PR_SwitchQCVM(NULL);
+// read everything the server sent
+	while (NET_GetMessage (bot->sock) > 0)
+	{
+		sv_botstats.bytes += net_message.cursize;
+		sv_botstats.messages++;
+	}
 
-//
-// tell all connected clients that we are going to a new level
-//
-	if (sv.active)
+	client = SV_BotClient (bot);
+	if (!client)
 	{
-		SV_SendReconnect ();
+		if (bot->accepted)
+			SV_RemoveBot (bot);	// dropped by the server
+		return;
 	}
+	bot->accepted = true;
 
-//
-// make cvars consistant
-//
-	if (coop.value)
-		Cvar_Set ("deathmatch", "0");
-	current_skill = (int)(skill.value + 0.5);
-	if (current_skill < 0)
-		current_skill = 0;
-	if (current_skill > 3)
-		current_skill = 3;
+	if (!client->spawned)
+	{
+		if (bot->signon == SIGNONS)
+			bot->signon = 0;	// new level
+		SV_BotSignon (bot, client);
+		return;
+	}
+	// "begin" went through, so losing spawned from now on means a level change
+	bot->signon = SIGNONS;
 
-	Cvar_SetValue ("skill", (float)current_skill);
+	if (!SV_BotMove (bot))
+		SV_RemoveBot (bot);
+}
 
-//
-// set up the new server
-//
-	//memset (&sv, 0, sizeof(sv));
-	Host_ClearMemory ();
+/*
+==================
+SV_RunBots
 
-	q_strlcpy (sv.name, server, sizeof(sv.name));
+Called at the end of every server frame, which took frametime seconds
+==================
+*/
+void SV_RunBots (double frametime)
+{
+	int		i;
+	qboolean	any = false;
 
-	sv.protocol = sv_protocol; // johnfitz
-	
-	if (sv.protocol == PROTOCOL_RMQ)
+	for (i = 0; i < MAX_SCOREBOARD; i++)
 	{
-		// set up the protocol flags used by this server
-		// (note - these could be cvar-ised so that server admins could choose the protocol features used by their servers)
-		sv.protocolflags = PRFL_INT32COORD | PRFL_SHORTANGLE;
+		if (!sv_bots[i].sock)
+			continue;
+		SV_RunBot (&sv_bots[i]);
+		any = true;
 	}
-	else sv.protocolflags = 0;
-
-	PR_SwitchQCVM(vm);
-// load progs to get entity field count
-	PR_LoadProgs ("progs.dat", true);
 
-// allocate server memory
-	/* Host_ClearMemory() called above already cleared the whole sv structure */
-	qcvm->max_edicts = CLAMP (MIN_EDICTS,(int)max_edicts.value,MAX_EDICTS); //johnfitz -- max_edicts cvar
-	qcvm->edicts = (edict_t *) malloc (qcvm->max_edicts*qcvm->edict_size); // ericw -- sv.edicts switched to use malloc()
-	ClearLink (&qcvm->free_edicts);
-
-	sv.datagram.maxsize = sizeof(sv.datagram_buf);
-	sv.datagram.cursize = 0;
-	sv.datagram.data = sv.datagram_buf;
+	if (any)
+		VEC_PUSH (sv_botstats.frametimes, frametime);
+}
 
-	sv.reliable_datagram.maxsize = sizeof(sv.reliable_datagram_buf);
-	sv.reliable_datagram.cursize = 0;
-	sv.reliable_datagram.data = sv.reliable_datagram_buf;
+/*
+==================
+SV_Bots_f
 
-	SV_AddSignonBuffer ();
+sv_bots [count]
+==================
+*/
+static void SV_Bots_f (void)
+{
+	int		i, count, wanted, pending;
 
-// leave slots at start for clients only
-	qcvm->num_edicts = svs.maxclients+1;
-	memset(qcvm->edicts, 0, qcvm->num_edicts*qcvm->edict_size); // ericw -- sv.edicts switched to use malloc()
-	for (i=0 ; i<svs.maxclients ; i++)
+	for (i = count = pending = 0; i < MAX_SCOREBOARD; i++)
 	{
-		ent = EDICT_NUM(i+1);
-		svs.clients[i].edict = ent;
+		if (!sv_bots[i].sock)
+			continue;
+		count++;
+		if (!SV_BotClient (&sv_bots[i]))
+			pending++;
 	}
 
-	sv.state = ss_loading;
-	sv.paused = false;
-	sv.nomonsters = (nomonsters.value != 0.f);
-
-	qcvm->time = 1.0;
-
-	q_strlcpy (sv.name, server, sizeof(sv.name));
-	q_snprintf (sv.modelname, sizeof(sv.modelname), "maps/%s.bsp", server);
-	sv.worldmodel = Mod_ForName (sv.modelname, false);
-	if (!sv.worldmodel)
+	if (Cmd_Argc () < 2)
 	{
-		Con_Printf ("Couldn't spawn server %s\n", sv.modelname);
-		sv.active = false;
+		Con_Printf ("%d bots\n", count);
 		return;
 	}
-	sv.models[1] = sv.worldmodel;
-
-//
-// clear world interaction links
-//
-	SV_ClearWorld ();
 
-	sv.sound_precache[0] = dummy;
-	sv.model_precache[0] = dummy;
-	sv.model_precache[1] = sv.modelname;
-	for (i=1 ; i<sv.worldmodel->numsubmodels ; i++)
+	if (!sv.active)
 	{
-		sv.model_precache[1+i] = localmodels[i];
-		sv.models[i+1] = Mod_ForName (localmodels[i], false);
+		Con_Printf ("No server running\n");
+		return;
 	}
 
-//
-// load the rest of the entities
-//
-	ent = EDICT_NUM(0);
-	memset (&ent->v, 0, qcvm->progs->entityfields * 4);
-	ent->v.model = PR_SetEngineString(sv.worldmodel->name);
-	ent->v.modelindex = 1;		// world model
-	ent->v.solid = SOLID_BSP;
-	ent->v.movetype = MOVETYPE_PUSH;
-
-	if (coop.value)
-		pr_global_struct->coop = coop.value;
-	else
-		pr_global_struct->deathmatch = deathmatch.value;
-
-	pr_global_struct->mapname = PR_SetEngineString(sv.name);
-
-// serverflags are for cross level information (sigils)
-	pr_global_struct->serverflags = svs.serverflags;
+	wanted = CLAMP (0, Q_atoi (Cmd_Argv (1)), MAX_SCOREBOARD);
 
-	ED_LoadFromFile (sv.worldmodel->entities);
+	for (i = MAX_SCOREBOARD - 1; i >= 0 && count > wanted; i--)
+	{
+		if (!sv_bots[i].sock)
+			continue;
+		SV_RemoveBot (&sv_bots[i]);
+		count--;
+	}
 
-	sv.active = true;
+	for (i = 0; i < MAX_SCOREBOARD && count < wanted; i++)
+	{
+		if (sv_bots[i].sock)
+			continue;
+		if (net_activeconnections + pending >= svs.maxclients || !SV_AddBot (&sv_bots[i]))
+		{
+			Con_Printf ("Server is full, %d bots\n", count);
+			break;
+		}
+		count++;
+		pending++;
+	}
 
-// all setup is completed, any further precache statements are errors
-	sv.state = ss_active;
+	SV_ResetBotStats ();
+}
 
-// run two frames to allow everything to settle
-	host_frametime = 0.1;
-	SV_Physics ();
-	SV_Physics ();
+/*
+==================
+SV_BotStats_f
 
-// create a baseline for more efficient communications
-	SV_CreateBaseline ();
+Prints the server frame times and bot traffic since the last reset
+==================
+*/
+static void SV_BotStats_f (void)
+{
+	double	*times, total, elapsed;
+	int		i, count, numbots;
 
-	//johnfitz -- warn if signon buffer larger than standard server can handle
-	for (i = 0, signonsize = 0; i < sv.num_signon_buffers; i++)
-		signonsize += sv.signon_buffers[i]->cursize;
-	if (signonsize > 64000-2)
-		Con_DWarning ("%i byte signon buffer exceeds QS limit of 63998.\n", signonsize);
-	else if (signonsize > 8000-2) //max size that will fit into 8000-sized client->message buffer with 2 extra bytes on the end
-		Con_DWarning ("%i byte signon buffer exceeds standard limit of 7998.\n", signonsize);
-	//johnfitz
+	for (i = numbots = 0; i < MAX_SCOREBOARD; i++)
+		if (sv_bots[i].sock)
+			numbots++;
 
-// send serverinfo to all connected clients
-	for (i=0,host_client = svs.clients ; i<svs.maxclients ; i++, host_client++)
-		if (host_client->active)
-			SV_SendServerinfo (host_client);
+	count = VEC_SIZE (sv_botstats.frametimes);
+	elapsed = realtime - sv_botstats.start;
+	if (!numbots || !count || elapsed <= 0.0)
+	{
+		Con_Printf ("No bot frames to report\n");
+		return;
+	}
 
-	Con_DPrintf ("Server spawned.\n");
+	times = sv_botstats.frametimes;
+	for (i = 0, total = 0.0; i < count; i++)
+		total += times[i];
+	qsort (times, count, sizeof (double), SV_CompareDoubles);
+
+	Con_Printf ("%d bots, %d server frames in %.1f s\n", numbots, count, elapsed);
+	Con_Printf ("frame   avg %7.3f ms  p50 %7.3f ms  p99 %7.3f ms  max %7.3f ms\n",
+		total * 1000.0 / count,
+		times[count / 2] * 1000.0,
+		times[count * 99 / 100] * 1000.0,
+		times[count - 1] * 1000.0);
+	Con_Printf ("per bot %7.0f bytes/s  %5.1f messages/s\n",
+		sv_botstats.bytes / numbots / elapsed, sv_botstats.messages / (double) numbots / elapsed);
+	Con_Printf ("dropped %d messages\n", loop_droppedDatagrams - sv_botstats.dropped);
+
+	SV_ResetBotStats ();
 }
-
@@ -212,6 +212,7 @@ qboolean SV_movestep (edict_t *ent, vec3_t move, qboolean relink)
 		ent->v.flags = (int)ent->v.flags & ~FL_PARTIALGROUND;
 	}
 	ent->v.groundentity = EDICT_TO_PROG(trace.ent);
+	SV_GroundChanged (ent);
 
 // the move is ok
 	if (relink)
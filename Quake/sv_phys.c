@@ -47,6 +47,9 @@ cvar_t	sv_gravity = {"sv_gravity","800",CVAR_NOTIFY|CVAR_SERVERINFO};
 cvar_t	sv_maxvelocity = {"sv_maxvelocity","2000",CVAR_NONE};
 cvar_t	sv_nostep = {"sv_nostep","0",CVAR_NONE};
 cvar_t	sv_freezenonclients = {"sv_freezenonclients","0",CVAR_NONE};
+cvar_t	sv_pushgather = {"sv_pushgather","1",CVAR_NONE};
+cvar_t	sv_clientprefetch = {"sv_clientprefetch","1",CVAR_NONE};
+cvar_t	sv_parallelthinks = {"sv_parallelthinks","0",CVAR_NONE};
 
 
 #define	MOVE_EPSILON	0.01
@@ -110,6 +113,179 @@ void SV_CheckVelocity (edict_t *ent)
 	}
 }
 
+/*
+===============================================================================
+
+THINKS AHEAD
+
+With sv_parallelthinks, the think functions that can be isolated (see
+PR_ExecuteIsolated) and are due this frame all run on the trace workers right
+after StartFrame, each on a copy of its edict.  When SV_RunThink gets to the
+edict, the early run is used if nothing it depends on has changed since, and
+the think runs normally otherwise, so the results are the same either way.
+
+===============================================================================
+*/
+
+typedef struct
+{
+	edict_t		*ent;
+	int			num;
+	float		thinktime;
+	qboolean	done;						// false if the early run gave up
+	int			reserved[RESERVED_OFS];		// parm/return globals it left
+	size_t		ofs;						// of its copy and snapshot in sv_thinkbuf
+} thinkjob_t;
+
+static thinkjob_t	*sv_thinkjobs;			// VEC
+static byte			*sv_thinkbuf;			// per job, the edict copy followed by the fields it started from
+static size_t		sv_thinkbufsize;
+static int			*sv_thinkjobof;			// per edict, job index + 1
+static int			sv_thinkjobofsize;
+static int			sv_thinksahead, sv_thinksused;	// since the last sv_thinkstats
+
+static void SV_ThinkAheadJob (int index, void *data)
+{
+	thinkjob_t *job = (thinkjob_t *) data + index;
+	job->done = PR_ExecuteIsolated (sv_traceworkernum, job->ent->v.think, job->ent, (edict_t *)(sv_thinkbuf + job->ofs), job->thinktime, job->reserved);
+}
+
+/*
+=============
+SV_ClearThinksAhead
+
+Forgets the early runs SV_RunThink didn't get to
+=============
+*/
+static void SV_ClearThinksAhead (void)
+{
+	int i;
+
+	for (i = 0; i < (int) VEC_SIZE (sv_thinkjobs); i++)
+		sv_thinkjobof[sv_thinkjobs[i].num] = 0;
+	VEC_CLEAR (sv_thinkjobs);
+}
+
+/*
+=============
+SV_RunThinksAhead
+=============
+*/
+static void SV_RunThinksAhead (void)
+{
+	thinkjob_t	job;
+	edict_t		*ent;
+	size_t		stride;
+	int			i, count;
+
+	SV_ClearThinksAhead ();
+	if (!sv_parallelthinks.value || sv_freezenonclients.value || !PR_BeginIsolatedCalls (1 + MAX_TRACE_WORKERS))
+		return;
+
+	memset (&job, 0, sizeof (job));
+	ent = EDICT_NUM (svs.maxclients);
+	for (i = svs.maxclients + 1; i < qcvm->num_edicts; i++)
+	{
+		ent = NEXT_EDICT (ent);
+		// pushers run their thinks themselves
+		if (ent->free || ent->v.movetype == MOVETYPE_PUSH)
+			continue;
+		if (ent->v.nextthink <= 0 || ent->v.nextthink > qcvm->time + host_frametime)
+			continue;
+		if (ent->v.think <= 0 || ent->v.think >= qcvm->progs->numfunctions || *PR_IsolationReason (ent->v.think))
+			continue;
+		job.ent = ent;
+		job.num = i;
+		job.thinktime = q_max (ent->v.nextthink, qcvm->time);
+		VEC_PUSH (sv_thinkjobs, job);
+	}
+
+	// not worth it for a single think
+	count = VEC_SIZE (sv_thinkjobs);
+	if (count < 2)
+	{
+		VEC_CLEAR (sv_thinkjobs);
+		return;
+	}
+
+	stride = (qcvm->edict_size + qcvm->progs->entityfields * 4 + 15) & ~15;
+	if (sv_thinkbufsize < stride * count)
+	{
+		free (sv_thinkbuf);
+		sv_thinkbufsize = stride * count * 2;
+		sv_thinkbuf = (byte *) malloc (sv_thinkbufsize);
+		if (!sv_thinkbuf)
+			Sys_Error ("SV_RunThinksAhead: out of memory");
+	}
+	if (sv_thinkjobofsize < qcvm->max_edicts)
+	{
+		free (sv_thinkjobof);
+		sv_thinkjobofsize = qcvm->max_edicts;
+		sv_thinkjobof = (int *) calloc (sv_thinkjobofsize, sizeof (int));
+		if (!sv_thinkjobof)
+			Sys_Error ("SV_RunThinksAhead: out of memory");
+	}
+
+	for (i = 0; i < count; i++)
+	{
+		thinkjob_t *j = &sv_thinkjobs[i];
+		j->ofs = stride * i;
+		memcpy (sv_thinkbuf + j->ofs + qcvm->edict_size, &j->ent->v, qcvm->progs->entityfields * 4);
+		sv_thinkjobof[j->num] = i + 1;
+	}
+
+	SV_ParallelJobs (SV_ThinkAheadJob, sv_thinkjobs, count);
+	sv_thinksahead += count;
+}
+
+/*
+=============
+SV_UseThinkAhead
+
+Applies the early run of ent's think if there is one and it's still valid,
+otherwise returns false
+=============
+*/
+static qboolean SV_UseThinkAhead (edict_t *ent, float thinktime)
+{
+	int			num = NUM_FOR_EDICT (ent);
+	int			i, size = qcvm->progs->entityfields * 4;
+	thinkjob_t	*job;
+	edict_t		*copy;
+
+	if (num >= sv_thinkjobofsize || !sv_thinkjobof[num])
+		return false;
+	job = &sv_thinkjobs[sv_thinkjobof[num] - 1];
+	sv_thinkjobof[num] = 0;	// any other think this frame runs normally
+	copy = (edict_t *)(sv_thinkbuf + job->ofs);
+
+	if (!job->done || job->thinktime != thinktime || memcmp (&ent->v, sv_thinkbuf + job->ofs + qcvm->edict_size, size))
+		return false;
+	if (!PR_CommitIsolated (ent->v.think, job->reserved))
+		return false;
+
+	ent->oldthinktime = thinktime;
+	ent->oldframe = ent->v.frame;
+
+	// what SV_EdictChanged would have been told about while it ran
+	for (i = 0; i < qcvm->progs->entityfields; i++)
+	{
+		if (qcvm->fieldwatch[i] && ((int *)&ent->v)[i] != ((int *)&copy->v)[i])
+		{
+			SV_EdictChanged (ent);
+			break;
+		}
+	}
+	memcpy (&ent->v, &copy->v, size);
+
+	pr_global_struct->time = thinktime;
+	pr_global_struct->self = EDICT_TO_PROG(ent);
+	pr_global_struct->other = EDICT_TO_PROG(qcvm->edicts);
+	sv_thinksused++;
+
+	return true;
+}
+
 /*
 =============
 SV_RunThink
@@ -133,6 +309,9 @@ qboolean SV_RunThink (edict_t *ent)
 								// it is possible to start that way
 								// by a trigger with a local time.
 
+	if (VEC_SIZE (sv_thinkjobs) && SV_UseThinkAhead (ent, thinktime))
+		return true;
+
 	ent->oldthinktime = thinktime;
 	ent->oldframe = ent->v.frame; //johnfitz
 
@@ -145,6 +324,81 @@ qboolean SV_RunThink (edict_t *ent)
 	return !ent->free;
 }
 
+typedef struct
+{
+	int		func;
+	int		count;
+} thinkstat_t;
+
+static int SV_CompareThinkStats (const void *pa, const void *pb)
+{
+	const thinkstat_t *a = (const thinkstat_t *) pa;
+	const thinkstat_t *b = (const thinkstat_t *) pb;
+	if (a->count != b->count)
+		return b->count - a->count;
+	return a->func - b->func;
+}
+
+/*
+=============
+SV_ThinkStats_f
+
+Shows which of the scheduled think functions can be run ahead (see
+SV_RunThinksAhead) and why the others can't, and how many early runs got used
+
+sv_thinkstats [lines]
+=============
+*/
+void SV_ThinkStats_f (void)
+{
+	thinkstat_t	*stats;
+	edict_t		*ent;
+	int			i, count, total, isolated, maxlines;
+
+	if (!sv.active)
+		return;
+
+	PR_SwitchQCVM(&sv.qcvm);
+
+	maxlines = Cmd_Argc () >= 2 ? Q_atoi (Cmd_Argv (1)) : 20;
+	stats = (thinkstat_t *) calloc (qcvm->progs->numfunctions, sizeof (*stats));
+	if (!stats)
+		Sys_Error ("SV_ThinkStats_f: out of memory");
+
+	for (i = 0; i < qcvm->progs->numfunctions; i++)
+		stats[i].func = i;
+	total = 0;
+	ent = NEXT_EDICT(qcvm->edicts);
+	for (i = 1; i < qcvm->num_edicts; i++, ent = NEXT_EDICT(ent))
+	{
+		if (ent->free || ent->v.nextthink <= 0 || ent->v.think <= 0 || ent->v.think >= qcvm->progs->numfunctions)
+			continue;
+		stats[ent->v.think].count++;
+		total++;
+	}
+
+	qsort (stats, qcvm->progs->numfunctions, sizeof (*stats), SV_CompareThinkStats);
+	Con_Printf ("count  think function\n");
+	for (i = count = isolated = 0; i < qcvm->progs->numfunctions && stats[i].count; i++)
+	{
+		const char *reason = PR_IsolationReason (stats[i].func);
+		if (!*reason)
+			isolated += stats[i].count;
+		if (count++ < maxlines)
+			Con_Printf ("%5i  %s%s%s\n", stats[i].count, PR_GetString (qcvm->functions[stats[i].func].s_name),
+				*reason ? ": " : "", reason);
+	}
+	Con_Printf ("%i of %i scheduled thinks (%.1f%%) can run ahead\n", isolated, total, 100.0 * isolated / q_max (total, 1));
+	if (sv_thinksahead)
+		Con_Printf ("%i thinks run ahead since the last sv_thinkstats, %i (%.1f%%) used\n",
+			sv_thinksahead, sv_thinksused, 100.0 * sv_thinksused / sv_thinksahead);
+	sv_thinksahead = sv_thinksused = 0;
+
+	free (stats);
+
+	PR_SwitchQCVM(NULL);
+}
+
 /*
 ==================
 SV_Impact
@@ -287,6 +541,7 @@ int SV_FlyMove (edict_t *ent, float time, trace_t *steptrace)
 			{
 				ent->v.flags =	(int)ent->v.flags | FL_ONGROUND;
 				ent->v.groundentity = EDICT_TO_PROG(trace.ent);
+				SV_GroundChanged (ent);
 			}
 		}
 		if (!trace.plane.normal[2])
@@ -370,18 +625,19 @@ SV_AddGravity
 
 ============
 */
-void SV_AddGravity (edict_t *ent)
+static float SV_EntityGravity (edict_t *ent)
 {
-	float	ent_gravity;
 	eval_t	*val;
 
 	val = GetEdictFieldValueByName(ent, "gravity");
 	if (val && val->_float)
-		ent_gravity = val->_float;
-	else
-		ent_gravity = 1.0;
+		return val->_float;
+	return 1.0;
+}
 
-	ent->v.velocity[2] -= ent_gravity * sv_gravity.value * host_frametime;
+void SV_AddGravity (edict_t *ent)
+{
+	ent->v.velocity[2] -= SV_EntityGravity (ent) * sv_gravity.value * host_frametime;
 }
 
 
@@ -425,9 +681,243 @@ trace_t SV_PushEntity (edict_t *ent, vec3_t push)
 }
 
 
+/*
+===============================================================================
+
+PUSHER CANDIDATES
+
+With sv_pushgather, SV_PushMove only looks at the edicts the area tree finds
+around the pusher's sweep, the ones that may be standing on it (SV_RiderEdicts)
+and the ones that were linked or flagged after those were gathered
+(SV_ChangeLog).  Anything a scan of all the edicts would move is in one of
+those sets, so it gets the same tests in the same order.
+
+SV_Physics gathers the lists of all the moving pushers at once, spread over
+the trace workers, before anything has moved.  They stay usable because every
+change made afterwards is on the change log.  The pushes themselves link edicts
+and run QC, so they still happen one at a time in edict order.
+===============================================================================
+*/
+
+#define MAX_PUSHLOG		1024	// changes to catch up on before gathering again is cheaper
+
+typedef struct
+{
+	edict_t		*pusher;
+	vec3_t		mins, maxs;		// box the list was gathered for
+	edict_t		**list;			// VEC, unsorted, may hold repeats
+	int			logpos;			// change log size at the time
+	qboolean	valid;
+} pushgather_t;
+
+typedef struct
+{
+	edict_t		*ent;
+	vec3_t		from;
+} pushmoved_t;
+
+static pushgather_t	*sv_pushgathers;		// VEC, slots are kept from frame to frame
+static int			sv_numpushgathers;		// in use this frame, in edict order
+static int			sv_nextpushgather;
+static edict_t		**sv_pushcandidates;	// VEC
+static pushmoved_t	*sv_pushmoved;			// VEC
+
+/*
+============
+SV_GatherPushList
+
+Fills list with the edicts in the box and those that might ride on pusher.
+Also called on the trace workers.
+============
+*/
+static int SV_GatherPushList (edict_t *pusher, const vec3_t mins, const vec3_t maxs, edict_t ***list)
+{
+	int		count, riders;
+
+	VEC_CLEAR (*list);
+	Vec_Grow ((void **) list, sizeof (edict_t *), qcvm->num_edicts * 2);
+	count = SV_AreaEdicts (mins, maxs, *list, qcvm->num_edicts);
+	riders = SV_RiderEdicts (pusher, *list + count);
+	if (riders < 0)
+		return -1;
+	count += riders;
+	VEC_HEADER (*list).size = count;
+
+	return count;
+}
+
+static void SV_GatherPushJob (int index, void *data)
+{
+	pushgather_t *g = (pushgather_t *) data + index;
+
+	g->valid = SV_GatherPushList (g->pusher, g->mins, g->maxs, &g->list) >= 0;
+}
+
+/*
+============
+SV_GatherPushers
+
+Gathers the candidates of every pusher that will move this frame
+============
+*/
+static void SV_GatherPushers (void)
+{
+	pushgather_t	*g;
+	edict_t			*ent;
+	int				i, j, count, logpos;
+	const int		*log;
+
+	sv_numpushgathers = sv_nextpushgather = 0;
+	if (!sv_pushgather.value || sv_freezenonclients.value)
+		return;
+
+	logpos = SV_ChangeLog (&log);
+	count = 0;
+	ent = EDICT_NUM (svs.maxclients);
+	for (i = svs.maxclients + 1; i < qcvm->num_edicts; i++)
+	{
+		ent = NEXT_EDICT (ent);
+		if (ent->free || ent->v.movetype != MOVETYPE_PUSH)
+			continue;
+		if (!ent->v.velocity[0] && !ent->v.velocity[1] && !ent->v.velocity[2])
+			continue;
+		if (count == (int) VEC_SIZE (sv_pushgathers))
+		{
+			pushgather_t blank;
+			memset (&blank, 0, sizeof (blank));
+			VEC_PUSH (sv_pushgathers, blank);
+		}
+		g = &sv_pushgathers[count++];
+		g->pusher = ent;
+		// covers any movetime up to a whole frame
+		for (j = 0; j < 3; j++)
+		{
+			float move = ent->v.velocity[j] * host_frametime;
+			g->mins[j] = q_min (ent->v.absmin[j], ent->v.absmin[j] + move);
+			g->maxs[j] = q_max (ent->v.absmax[j], ent->v.absmax[j] + move);
+		}
+		g->logpos = logpos;
+	}
+
+	// with a single pusher there's nothing to gain over gathering in place
+	if (count > 1)
+	{
+		SV_ParallelJobs (SV_GatherPushJob, sv_pushgathers, count);
+		sv_numpushgathers = count;
+	}
+}
+
+static int SV_ComparePushCandidates (const void *a, const void *b)
+{
+	const edict_t *ea = *(const edict_t *const *)a;
+	const edict_t *eb = *(const edict_t *const *)b;
+	return (ea > eb) - (ea < eb);
+}
+
+/*
+============
+SV_SortPushCandidates
+
+Sorts sv_pushcandidates from first on into edict order and drops the repeats
+============
+*/
+static int SV_SortPushCandidates (int first)
+{
+	edict_t	**list = sv_pushcandidates;
+	int		i, count, total = VEC_SIZE (sv_pushcandidates);
+
+	if (total - first < 2)
+		return total;
+
+	qsort (list + first, total - first, sizeof (*list), SV_ComparePushCandidates);
+	count = first + 1;
+	for (i = first + 1; i < total; i++)
+		if (list[i] != list[count - 1])
+			list[count++] = list[i];
+	VEC_HEADER (list).size = count;
+
+	return count;
+}
+
+/*
+============
+SV_PushCandidates
+
+Fills sv_pushcandidates for a pusher about to sweep through mins/maxs, using
+the list SV_GatherPushers made for it if there is one.  Returns the count, or
+-1 if the edicts have to be scanned.
+============
+*/
+static int SV_PushCandidates (edict_t *pusher, const vec3_t mins, const vec3_t maxs)
+{
+	pushgather_t	*g = NULL;
+	const int		*log;
+	int				i, count, logsize;
+
+	logsize = SV_ChangeLog (&log);
+
+	while (sv_nextpushgather < sv_numpushgathers && sv_pushgathers[sv_nextpushgather].pusher < pusher)
+		sv_nextpushgather++;
+	if (sv_nextpushgather < sv_numpushgathers && sv_pushgathers[sv_nextpushgather].pusher == pusher)
+	{
+		g = &sv_pushgathers[sv_nextpushgather++];
+		if (!g->valid || logsize - g->logpos > MAX_PUSHLOG)
+			g = NULL;
+		for (i = 0; g && i < 3; i++)
+			if (!(mins[i] >= g->mins[i] && maxs[i] <= g->maxs[i]))
+				g = NULL;
+	}
+
+	if (!g)
+	{
+		if (SV_GatherPushList (pusher, mins, maxs, &sv_pushcandidates) < 0)
+			return -1;
+		return SV_SortPushCandidates (0);
+	}
+
+	// whatever changed since then could have moved into the box or onto the pusher
+	count = VEC_SIZE (g->list);
+	VEC_CLEAR (sv_pushcandidates);
+	Vec_Grow ((void **) &sv_pushcandidates, sizeof (edict_t *), count + logsize - g->logpos);
+	memcpy (sv_pushcandidates, g->list, count * sizeof (edict_t *));
+	for (i = g->logpos; i < logsize; i++)
+		if (log[i] < qcvm->num_edicts)
+			sv_pushcandidates[count++] = EDICT_NUM (log[i]);
+	VEC_HEADER (sv_pushcandidates).size = count;
+
+	return SV_SortPushCandidates (0);
+}
+
+/*
+============
+SV_AddPushCandidates
+
+Adds the edicts after check that changed since logpos (touch functions may
+have moved them into the way), keeping the list in order from index first
+============
+*/
+static int SV_AddPushCandidates (int first, edict_t *check, int logpos)
+{
+	const int	*log;
+	int			i, logsize, num;
+
+	logsize = SV_ChangeLog (&log);
+	num = NUM_FOR_EDICT (check);
+	for (i = logpos; i < logsize; i++)
+		if (log[i] > num && log[i] < qcvm->num_edicts)
+			VEC_PUSH (sv_pushcandidates, EDICT_NUM (log[i]));
+
+	return SV_SortPushCandidates (first);
+}
+
 /*
 ============
 SV_PushMove
+
+With sv_pushgather the edicts to check come from the lists above instead of a
+scan of all of them.  After each push, the edicts that touch functions linked
+or changed are merged into the rest of the list, as a scan would still reach
+the ones with higher numbers.
 ============
 */
 void SV_PushMove (edict_t *pusher, float movetime)
@@ -435,11 +925,12 @@ void SV_PushMove (edict_t *pusher, float movetime)
 	int			i, e;
 	edict_t		*check, *block;
 	vec3_t		mins, maxs, move;
+	vec3_t		boxmins, boxmaxs;
 	vec3_t		entorig, pushorig;
-	int			num_moved;
-	edict_t		**moved_edict; //johnfitz -- dynamically allocate
-	vec3_t		*moved_from; //johnfitz -- dynamically allocate
-	int			mark; //johnfitz
+	pushmoved_t	moved;
+	int			numcandidates;
+	int			logpos;
+	const int	*log;
 
 	if (!pusher->v.velocity[0] && !pusher->v.velocity[1] && !pusher->v.velocity[2])
 	{
@@ -452,6 +943,8 @@ void SV_PushMove (edict_t *pusher, float movetime)
 		move[i] = pusher->v.velocity[i] * movetime;
 		mins[i] = pusher->v.absmin[i] + move[i];
 		maxs[i] = pusher->v.absmax[i] + move[i];
+		boxmins[i] = q_min (pusher->v.absmin[i], mins[i]);
+		boxmaxs[i] = q_max (pusher->v.absmax[i], maxs[i]);
 	}
 
 	VectorCopy (pusher->v.origin, pushorig);
@@ -462,17 +955,29 @@ void SV_PushMove (edict_t *pusher, float movetime)
 	pusher->v.ltime += movetime;
 	SV_LinkEdict (pusher, false);
 
-	//johnfitz -- dynamically allocate
-	mark = Hunk_LowMark ();
-	moved_edict = (edict_t **) Hunk_Alloc (qcvm->num_edicts*sizeof(edict_t *));
-	moved_from = (vec3_t *) Hunk_Alloc (qcvm->num_edicts*sizeof(vec3_t));
-	//johnfitz
+	numcandidates = -1;
+	if (sv_pushgather.value && qcvm == &sv.qcvm)
+		numcandidates = SV_PushCandidates (pusher, boxmins, boxmaxs);
+	logpos = SV_ChangeLog (&log);
+
+	VEC_CLEAR (sv_pushmoved);
 
 // see if any solid entities are inside the final position
-	num_moved = 0;
-	check = NEXT_EDICT(qcvm->edicts);
-	for (e=1 ; e<qcvm->num_edicts ; e++, check = NEXT_EDICT(check))
+	for (e=0 ; ; e++)
 	{
+		if (numcandidates >= 0)
+		{
+			if (e == numcandidates)
+				break;
+			check = sv_pushcandidates[e];
+		}
+		else
+		{
+			if (e+1 >= qcvm->num_edicts)
+				break;
+			check = EDICT_NUM(e+1);
+		}
+
 		if (check->free)
 			continue;
 		if (check->v.movetype == MOVETYPE_PUSH
@@ -502,15 +1007,20 @@ void SV_PushMove (edict_t *pusher, float movetime)
 			check->v.flags = (int)check->v.flags & ~FL_ONGROUND;
 
 		VectorCopy (check->v.origin, entorig);
-		VectorCopy (check->v.origin, moved_from[num_moved]);
-		moved_edict[num_moved] = check;
-		num_moved++;
+		moved.ent = check;
+		VectorCopy (check->v.origin, moved.from);
+		VEC_PUSH (sv_pushmoved, moved);
 
 		// try moving the contacted entity
 		pusher->v.solid = SOLID_NOT;
 		SV_PushEntity (check, move);
 		pusher->v.solid = SOLID_BSP;
 
+	// the push links check, anything more came from touch functions
+		if (numcandidates >= 0 && SV_ChangeLog (&log) > logpos + 1)
+			numcandidates = SV_AddPushCandidates (e + 1, check, logpos);
+		logpos = SV_ChangeLog (&log);
+
 	// if it is still inside the pusher, block
 		block = SV_TestEntityPosition (check);
 		if (block)
@@ -541,18 +1051,14 @@ void SV_PushMove (edict_t *pusher, float movetime)
 			}
 
 		// move back any entities we already moved
-			for (i=0 ; i<num_moved ; i++)
+			for (i=0 ; i<(int) VEC_SIZE (sv_pushmoved) ; i++)
 			{
-				VectorCopy (moved_from[i], moved_edict[i]->v.origin);
-				SV_LinkEdict (moved_edict[i], false);
+				VectorCopy (sv_pushmoved[i].from, sv_pushmoved[i].ent->v.origin);
+				SV_LinkEdict (sv_pushmoved[i].ent, false);
 			}
-			Hunk_FreeToLowMark (mark); //johnfitz
 			return;
 		}
 	}
-
-	Hunk_FreeToLowMark (mark); //johnfitz
-
 }
 
 /*
@@ -869,6 +1375,7 @@ void SV_WalkMove (edict_t *ent)
 		{
 			ent->v.flags =	(int)ent->v.flags | FL_ONGROUND;
 			ent->v.groundentity = EDICT_TO_PROG(downtrace.ent);
+			SV_GroundChanged (ent);
 		}
 	}
 	else
@@ -1102,6 +1609,7 @@ void SV_Physics_Toss (edict_t *ent)
 		{
 			ent->v.flags = (int)ent->v.flags | FL_ONGROUND;
 			ent->v.groundentity = EDICT_TO_PROG(trace.ent);
+			SV_GroundChanged (ent);
 			VectorCopy (vec3_origin, ent->v.velocity);
 			VectorCopy (vec3_origin, ent->v.avelocity);
 		}
@@ -1163,6 +1671,111 @@ void SV_Physics_Step (edict_t *ent)
 
 //============================================================================
 
+/*
+================
+SV_PrefetchClientMoves
+
+Collects the first two traces every walking client is about to make (the
+SV_CheckStuck test and the first slide of SV_WalkMove), as they will be if
+PlayerPreThink leaves the player alone, and has their world part done in one
+batch on the trace workers. Whatever was guessed right is found in the hull
+trace cache when the client moves, anything else is traced as usual.
+================
+*/
+static void SV_PrefetchClientMoves (void)
+{
+	tracejob_t	jobs[MAX_SCOREBOARD * 2];
+	tracejob_t	*job;
+	edict_t		*ent;
+	vec3_t		vel;
+	float		time;
+	int			i, j, count;
+
+	if (!sv_clientprefetch.value)
+		return;
+
+	time = host_frametime;
+	count = 0;
+	for (i = 1; i <= svs.maxclients; i++)
+	{
+		ent = EDICT_NUM(i);
+		if (!svs.clients[i-1].active || ent->free || ent->v.movetype != MOVETYPE_WALK)
+			continue;
+
+		// SV_CheckStuck
+		job = &jobs[count++];
+		VectorCopy (ent->v.origin, job->start);
+		VectorCopy (ent->v.origin, job->end);
+		VectorCopy (ent->v.mins, job->mins);
+		VectorCopy (ent->v.maxs, job->maxs);
+
+		// SV_CheckVelocity, gravity and the first SV_FlyMove step
+		for (j = 0; j < 3; j++)
+		{
+			if (IS_NAN (ent->v.velocity[j]) || IS_NAN (ent->v.origin[j]))
+				break;
+			vel[j] = CLAMP (-sv_maxvelocity.value, ent->v.velocity[j], sv_maxvelocity.value);
+		}
+		if (j < 3)
+			continue;
+		if (ent->v.waterlevel <= 1 && !((int)ent->v.flags & FL_WATERJUMP))
+			vel[2] -= SV_EntityGravity (ent) * sv_gravity.value * host_frametime;
+		if (!vel[0] && !vel[1] && !vel[2])
+			continue;
+
+		job = &jobs[count];
+		*job = jobs[count - 1];
+		count++;
+		for (j = 0; j < 3; j++)
+			job->end[j] = ent->v.origin[j] + time * vel[j];
+	}
+
+	SV_PrefetchWorldMoves (jobs, count);
+}
+
+/*
+================
+SV_CountClientTraces
+
+================
+*/
+static void SV_CountClientTraces (client_t *client, int traces)
+{
+	if (!client->active)
+		return;
+	client->traces = traces;
+	client->tracetotal += traces;
+	client->traceframes++;
+	client->tracemax = q_max (client->tracemax, traces);
+}
+
+/*
+=============
+SV_ClientTraces_f
+
+Shows how many SV_Move calls each client's physics made per frame since the
+last time it was asked
+=============
+*/
+void SV_ClientTraces_f (void)
+{
+	client_t	*client;
+	int			i;
+
+	if (!sv.active)
+		return;
+
+	Con_Printf ("client            last   avg   max\n");
+	for (i = 0, client = svs.clients; i < svs.maxclients; i++, client++)
+	{
+		if (!client->active)
+			continue;
+		Con_Printf ("%-16.16s %5i %5.1f %5i\n", client->name, client->traces,
+			client->traceframes ? (double) client->tracetotal / client->traceframes : 0.0, client->tracemax);
+		client->tracetotal = client->traceframes = client->tracemax = 0;
+	}
+}
+
 /*
 ================
 SV_Physics
@@ -1174,6 +1787,9 @@ void SV_Physics (void)
 	int	i;
 	int	entity_cap; // For sv_freezenonclients 
 	edict_t	*ent;
+	unsigned int	traces;
+
+	SV_FlushEntityIndex ();
 
 // let the progs know that a new frame has started
 	pr_global_struct->self = EDICT_TO_PROG(qcvm->edicts);
@@ -1183,6 +1799,10 @@ void SV_Physics (void)
 
 //SV_CheckAllEnts ();
 
+	SV_PrefetchClientMoves ();
+	SV_GatherPushers ();
+	SV_RunThinksAhead ();
+
 //
 // treat each object in turn
 //
@@ -1205,7 +1825,11 @@ void SV_Physics (void)
 		}
 
 		if (i > 0 && i <= svs.maxclients)
+		{
+			traces = sv_movecount;
 			SV_Physics_Client (ent, i);
+			SV_CountClientTraces (&svs.clients[i-1], sv_movecount - traces);
+		}
 		else if (ent->v.movetype == MOVETYPE_PUSH)
 			SV_Physics_Pusher (ent);
 		else if (ent->v.movetype == MOVETYPE_NONE)
@@ -1236,6 +1860,8 @@ void SV_Physics (void)
 	//johnfitz
 	}
 
+	SV_ClearThinksAhead ();
+
 	if (pr_global_struct->force_retouch)
 		pr_global_struct->force_retouch--;
 
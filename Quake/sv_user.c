@@ -488,7 +488,7 @@ qboolean SV_ReadClientMessage (void)
 	do
 	{
 nextmsg:
-		ret = NET_GetMessage (host_client->netconnection);
+		ret = SV_GetClientMessage ();
 		if (ret == -1)
 		{
 			Sys_Printf ("SV_ReadClientMessage: NET_GetMessage failed\n");
@@ -602,6 +602,10 @@ nextmsg:
 			case clc_move:
 				SV_ReadClientMove (&host_client->cmd);
 				break;
+
+			case clc_ackentities:
+				host_client->snapacked = MSG_ReadLong ();
+				break;
 			}
 		}
 	} while (ret == 1);
@@ -640,7 +644,7 @@ void SV_RunClients (void)
 		}
 
 // always pause in single player if in console or menus
-		if (!sv.paused && (svs.maxclients > 1 || key_dest == key_game) )
+		if (SV_PhysicsActive ())
 			SV_ClientThink ();
 	}
 }
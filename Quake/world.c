@@ -46,6 +46,14 @@ typedef struct
 
 
 int SV_HullPointContents (hull_t *hull, int num, vec3_t p);
+static void SV_ClearEntityIndex (void);
+static void SV_ClearLeafCache (void);
+static void SV_ClearTriggerIndex (void);
+static void SV_FileTrigger (edict_t *ent);
+static void SV_UnfileTrigger (edict_t *ent);
+static void SV_RankAreaNodes (void);
+static qboolean SV_IndexedTriggerEdicts (edict_t *ent, edict_t **list, int *listcount, const int listspace);
+static void SV_IndexEdict (edict_t *ent);
 
 /*
 ===============================================================================
@@ -57,8 +65,7 @@ HULL BOXES
 
 
 static	hull_t		box_hull;
-static	mclipnode_t	box_clipnodes[6]; //johnfitz -- was dclipnode_t
-static	mplane_t	box_planes[6];
+static	mhullnode_t	box_nodes[6];	// only the flattened nodes, nothing else walks the box hull
 
 /*
 ===================
@@ -73,25 +80,24 @@ void SV_InitBoxHull (void)
 	int		i;
 	int		side;
 
-	box_hull.clipnodes = box_clipnodes;
-	box_hull.planes = box_planes;
+	box_hull.nodes = box_nodes;
 	box_hull.firstclipnode = 0;
 	box_hull.lastclipnode = 5;
 
 	for (i=0 ; i<6 ; i++)
 	{
-		box_clipnodes[i].planenum = i;
+		box_nodes[i].planenum = i;
 
 		side = i&1;
 
-		box_clipnodes[i].children[side] = CONTENTS_EMPTY;
+		box_nodes[i].children[side] = CONTENTS_EMPTY;
 		if (i != 5)
-			box_clipnodes[i].children[side^1] = i + 1;
+			box_nodes[i].children[side^1] = i + 1;
 		else
-			box_clipnodes[i].children[side^1] = CONTENTS_SOLID;
+			box_nodes[i].children[side^1] = CONTENTS_SOLID;
 
-		box_planes[i].type = i>>1;
-		box_planes[i].normal[i>>1] = 1;
+		box_nodes[i].type = i>>1;
+		box_nodes[i].normal[i>>1] = 1;
 	}
 
 }
@@ -107,12 +113,12 @@ BSP trees instead of being compared directly.
 */
 hull_t	*SV_HullForBox (vec3_t mins, vec3_t maxs)
 {
-	box_planes[0].dist = maxs[0];
-	box_planes[1].dist = mins[0];
-	box_planes[2].dist = maxs[1];
-	box_planes[3].dist = mins[1];
-	box_planes[4].dist = maxs[2];
-	box_planes[5].dist = mins[2];
+	box_nodes[0].dist = maxs[0];
+	box_nodes[1].dist = mins[0];
+	box_nodes[2].dist = maxs[1];
+	box_nodes[3].dist = mins[1];
+	box_nodes[4].dist = maxs[2];
+	box_nodes[5].dist = mins[2];
 
 	return &box_hull;
 }
@@ -178,11 +184,186 @@ hull_t *SV_HullForEntity (edict_t *ent, vec3_t mins, vec3_t maxs, vec3_t offset)
 /*
 ===============================================================================
 
+HULL QUERY CACHE
+
+Brush hulls never change during a map, so a hull trace or point contents query
+is a pure function of its inputs.  Monsters repeat the same queries a lot
+(SV_CheckBottom corners and movestep traces while standing or blocked), and
+the results are remembered in small direct-mapped tables.  Keys are the exact
+endpoints, so a hit returns exactly what the hull walk would have.  Box hulls
+are rebuilt for every query and are never cached, and neither are queries
+made by the client VM, whose models can change without SV_ClearWorld.
+
+===============================================================================
+*/
+
+cvar_t	sv_tracecache = {"sv_tracecache", "1", CVAR_NONE};
+
+#define	TRACECACHE_SIZE		2048	// must be a power of two
+#define	POINTCACHE_SIZE		1024	// must be a power of two
+
+typedef struct tracekey_s
+{
+	hull_t		*hull;
+	vec3_t		start, end;		// in hull space
+	vec3_t		worldend;		// the untouched trace keeps this as its endpos
+} tracekey_t;
+
+typedef struct tracecache_s
+{
+	tracekey_t	key;
+	int			generation;
+	trace_t		trace;
+} tracecache_t;
+
+typedef struct pointcache_s
+{
+	vec3_t		p;
+	int			generation;
+	int			contents;
+} pointcache_t;
+
+static	tracecache_t	sv_tracecache_entries[TRACECACHE_SIZE];
+static	pointcache_t	sv_pointcache_entries[POINTCACHE_SIZE];
+static	int				sv_tracecache_generation = 1;
+static	qboolean		sv_tracebatch_active;		// set while trace workers share the world
+
+typedef struct tracecachestats_s
+{
+	uint64_t	traces, tracehits;
+	uint64_t	points, pointhits;
+	uint64_t	prefetches;
+} tracecachestats_t;
+
+static	tracecachestats_t	sv_tracecachestats;
+
+/*
+===============
+SV_ClearTraceCache
+
+Called from SV_ClearWorld, since hull pointers are only valid for one map
+===============
+*/
+static void SV_ClearTraceCache (void)
+{
+	sv_tracecache_generation++;
+	memset (&sv_tracecachestats, 0, sizeof (sv_tracecachestats));
+}
+
+/*
+===============
+SV_TraceCacheEntry
+
+Fills in the key for a hull check and returns the slot it goes in
+===============
+*/
+static tracecache_t *SV_TraceCacheEntry (tracekey_t *key, hull_t *hull, const vec3_t start, const vec3_t end, const vec3_t worldend)
+{
+	memset (key, 0, sizeof (*key));
+	key->hull = hull;
+	VectorCopy (start, key->start);
+	VectorCopy (end, key->end);
+	VectorCopy (worldend, key->worldend);
+
+	return &sv_tracecache_entries[COM_HashBlock (key, sizeof (*key)) & (TRACECACHE_SIZE - 1)];
+}
+
+/*
+===============
+SV_CachedHullCheck
+
+SV_RecursiveHullCheck from the head node of the hull, going through the cache
+===============
+*/
+static void SV_CachedHullCheck (hull_t *hull, vec3_t start, vec3_t end, trace_t *trace)
+{
+	tracekey_t		key;
+	tracecache_t	*entry;
+
+	if (hull == &box_hull || !sv_tracecache.value || qcvm != &sv.qcvm || sv_tracebatch_active)
+	{
+		SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start, end, trace);
+		return;
+	}
+
+	sv_tracecachestats.traces++;
+	entry = SV_TraceCacheEntry (&key, hull, start, end, trace->endpos);
+	if (entry->generation == sv_tracecache_generation && !memcmp (&entry->key, &key, sizeof (key)))
+	{
+		sv_tracecachestats.tracehits++;
+		*trace = entry->trace;
+		return;
+	}
+
+	SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start, end, trace);
+
+	entry->key = key;
+	entry->generation = sv_tracecache_generation;
+	entry->trace = *trace;
+}
+
+/*
+===============
+SV_CachedPointContents
+
+World hull 0 contents at a point, going through the cache
+===============
+*/
+static int SV_CachedPointContents (vec3_t p)
+{
+	pointcache_t	*entry;
+
+	if (!sv_tracecache.value || qcvm != &sv.qcvm || sv_tracebatch_active)
+		return SV_HullPointContents (&sv.worldmodel->hulls[0], 0, p);
+
+	sv_tracecachestats.points++;
+	entry = &sv_pointcache_entries[COM_HashBlock (p, sizeof (vec3_t)) & (POINTCACHE_SIZE - 1)];
+	if (entry->generation == sv_tracecache_generation && !memcmp (entry->p, p, sizeof (vec3_t)))
+	{
+		sv_tracecachestats.pointhits++;
+		return entry->contents;
+	}
+
+	VectorCopy (p, entry->p);
+	entry->generation = sv_tracecache_generation;
+	entry->contents = SV_HullPointContents (&sv.worldmodel->hulls[0], 0, p);
+	return entry->contents;
+}
+
+/*
+===============
+SV_PrintTraceCacheStats
+
+===============
+*/
+static void SV_PrintTraceCacheStats (void)
+{
+	Con_Printf ("hull trace cache: %" SDL_PRIu64 " lookups, %.1f%% hits, %" SDL_PRIu64 " prefetched\n", sv_tracecachestats.traces,
+		sv_tracecachestats.traces ? 100.0 * sv_tracecachestats.tracehits / sv_tracecachestats.traces : 0.0,
+		sv_tracecachestats.prefetches);
+	Con_Printf ("point contents cache: %" SDL_PRIu64 " lookups, %.1f%% hits\n", sv_tracecachestats.points,
+		sv_tracecachestats.points ? 100.0 * sv_tracecachestats.pointhits / sv_tracecachestats.points : 0.0);
+}
+
+/*
+===============================================================================
+
 ENTITY AREA CHECKING
 
 ===============================================================================
 */
 
+// packed copy of the boxes on one area node list, in the same order as the
+// links, so the broadphase can test several edicts at once
+typedef struct areaboxes_s
+{
+	int		count;		// slots in use, including dead ones
+	int		dead;
+	int		capacity;	// always a multiple of 4
+	edict_t	**ents;		// NULL for a dead slot
+	float	*bounds;	// absmin[0..2] then absmax[0..2], capacity floats each
+} areaboxes_t;
+
 typedef struct areanode_s
 {
 	int		axis;		// -1 = leaf node
@@ -190,350 +371,2179 @@ typedef struct areanode_s
 	struct areanode_s	*children[2];
 	link_t	trigger_edicts;
 	link_t	solid_edicts;
+	link_t	nonsolid_edicts;	// SOLID_NOT, only looked at by SV_AreaEdicts
+	areaboxes_t	trigger_boxes;
+	areaboxes_t	solid_boxes;
+	areaboxes_t	nonsolid_boxes;
+	vec3_t	mins, maxs;
+	int		depth;
+	int		numlinks;	// edicts on the trigger and solid lists
+	int		nextsplit;	// don't try to split again until numlinks reaches this
+	int		rank;		// position in a depth-first walk, the order SV_AreaTriggerEdicts visits nodes in
 } areanode_t;
 
 // Note: changing this can affect droptofloor
 #define	AREA_DEPTH	4
 #define	AREA_NODES	(2<<AREA_DEPTH)
 
-static	areanode_t	sv_areanodes[AREA_NODES];
+// leaves holding more than sv_areasplit edicts are split further, up to
+// AREA_MAX_DEPTH, so that dense parts of large maps get a finer tree.
+// Off by default: a different tree changes the order edicts are found in,
+// and with it which of two equal traces wins and the touch order
+#define	AREA_MAX_DEPTH		16
+#define	AREA_MAX_NODES		4096
+#define	AREA_MIN_SIZE		64		// don't split nodes narrower than this
+
+#define	AREA_BATCH			64		// candidates gathered per broadphase pass
+
+cvar_t	sv_areasplit = {"sv_areasplit", "0", CVAR_NONE};
+
+static	areanode_t	sv_areanodes[AREA_MAX_NODES];
 static	int			sv_numareanodes;
 
+typedef struct areastats_s
+{
+	int			splits;
+	uint64_t	moves, movenodes, movelinks;
+	uint64_t	touches, touchnodes, touchlinks;
+	uint64_t	leafsearches, leafreuses, leafoverflows;
+	uint64_t	areaqueries, areaedicts;
+	double		starttime;
+} areastats_t;
+
+static	THREAD_LOCAL areastats_t	sv_areastats;	// trace workers keep their own counts
+
+THREAD_LOCAL unsigned int	sv_movecount;
+THREAD_LOCAL int			sv_traceworkernum;
+
 /*
 ===============
-SV_CreateAreaNode
+SV_AllocAreaNode
 
 ===============
 */
-areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
+static areanode_t *SV_AllocAreaNode (int depth, vec3_t mins, vec3_t maxs)
 {
 	areanode_t	*anode;
-	vec3_t		size;
-	vec3_t		mins1, maxs1, mins2, maxs2;
 
 	anode = &sv_areanodes[sv_numareanodes];
 	sv_numareanodes++;
 
 	ClearLink (&anode->trigger_edicts);
 	ClearLink (&anode->solid_edicts);
+	ClearLink (&anode->nonsolid_edicts);
+	// the box arrays are kept from map to map
+	anode->trigger_boxes.count = anode->trigger_boxes.dead = 0;
+	anode->solid_boxes.count = anode->solid_boxes.dead = 0;
+	anode->nonsolid_boxes.count = anode->nonsolid_boxes.dead = 0;
+	VectorCopy (mins, anode->mins);
+	VectorCopy (maxs, anode->maxs);
+	anode->depth = depth;
+	anode->numlinks = 0;
+	anode->nextsplit = 0;
+	anode->axis = -1;
+	anode->children[0] = anode->children[1] = NULL;
 
-	if (depth == AREA_DEPTH)
-	{
-		anode->axis = -1;
-		anode->children[0] = anode->children[1] = NULL;
-		return anode;
-	}
+	return anode;
+}
 
-	VectorSubtract (maxs, mins, size);
-	if (size[0] > size[1])
-		anode->axis = 0;
-	else
-		anode->axis = 1;
+/*
+===============
+SV_GrowAreaBoxes
 
-	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
-	VectorCopy (mins, mins1);
-	VectorCopy (mins, mins2);
-	VectorCopy (maxs, maxs1);
-	VectorCopy (maxs, maxs2);
+===============
+*/
+static void SV_GrowAreaBoxes (areaboxes_t *boxes)
+{
+	int			i, capacity = q_max (boxes->capacity * 2, 16);
+	edict_t		**ents;
+	float		*bounds;
 
-	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+	ents = (edict_t **) malloc (capacity * sizeof (*ents));
+	bounds = (float *) malloc (capacity * 6 * sizeof (*bounds));
+	if (!ents || !bounds)
+		Sys_Error ("SV_GrowAreaBoxes: out of memory");
 
-	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
-	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
+	if (boxes->count)
+	{
+		memcpy (ents, boxes->ents, boxes->count * sizeof (*ents));
+		for (i = 0; i < 6; i++)
+			memcpy (bounds + i * capacity, boxes->bounds + i * boxes->capacity, boxes->count * sizeof (*bounds));
+	}
 
-	return anode;
+	free (boxes->ents);
+	free (boxes->bounds);
+	boxes->ents = ents;
+	boxes->bounds = bounds;
+	boxes->capacity = capacity;
 }
 
 /*
 ===============
-SV_ClearWorld
+SV_CompactAreaBoxes
 
+Squeezes out the dead slots, keeping the order of the rest
 ===============
 */
-void SV_ClearWorld (void)
+static void SV_CompactAreaBoxes (areaboxes_t *boxes)
 {
-	SV_InitBoxHull ();
+	int		i, j, k;
 
-	memset (sv_areanodes, 0, sizeof(sv_areanodes));
-	sv_numareanodes = 0;
-	SV_CreateAreaNode (0, sv.worldmodel->mins, sv.worldmodel->maxs);
+	for (i = j = 0; i < boxes->count; i++)
+	{
+		if (!boxes->ents[i])
+			continue;
+		if (i != j)
+		{
+			boxes->ents[j] = boxes->ents[i];
+			for (k = 0; k < 6; k++)
+				boxes->bounds[k * boxes->capacity + j] = boxes->bounds[k * boxes->capacity + i];
+		}
+		boxes->ents[j]->areaslot = j;
+		j++;
+	}
+	boxes->count = j;
+	boxes->dead = 0;
 }
 
-
 /*
 ===============
-SV_UnlinkEdict
+SV_AddAreaBox
 
+Appends the edict's current absmin/absmax, matching InsertLinkBefore on the list head
 ===============
 */
-void SV_UnlinkEdict (edict_t *ent)
+static void SV_AddAreaBox (areaboxes_t *boxes, edict_t *ent)
 {
-	if (!ent->area.prev)
-		return;		// not linked in anywhere
-	RemoveLink (&ent->area);
-	ent->area.prev = ent->area.next = NULL;
-}
+	int		i, slot;
 
+	if (boxes->count == boxes->capacity)
+	{
+		if (boxes->dead * 2 >= boxes->count && boxes->count)
+			SV_CompactAreaBoxes (boxes);
+		else
+			SV_GrowAreaBoxes (boxes);
+	}
+
+	slot = boxes->count++;
+	boxes->ents[slot] = ent;
+	for (i = 0; i < 3; i++)
+	{
+		boxes->bounds[i * boxes->capacity + slot] = ent->v.absmin[i];
+		boxes->bounds[(i + 3) * boxes->capacity + slot] = ent->v.absmax[i];
+	}
+	ent->areaslot = slot;
+}
 
 /*
-====================
-SV_AreaTriggerEdicts
+===============
+SV_RemoveAreaBox
 
-Spike -- just builds a list of entities within the area, rather than walking
-them and risking the list getting corrupt.
-====================
+===============
 */
-static void
-SV_AreaTriggerEdicts ( edict_t *ent, areanode_t *node, edict_t **list, int *listcount, const int listspace )
+static void SV_RemoveAreaBox (areaboxes_t *boxes, int slot)
 {
-	link_t		*l, *next;
-	edict_t		*touch;
+	int		i;
 
-// touch linked edicts
-	for (l = node->trigger_edicts.next ; l != &node->trigger_edicts ; l = next)
+	boxes->ents[slot] = NULL;
+	for (i = 0; i < 3; i++)
 	{
-		next = l->next;
-		touch = EDICT_FROM_AREA(l);
-		if (touch == ent)
-			continue;
-		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
-			continue;
-		if (ent->v.absmin[0] > touch->v.absmax[0]
-		|| ent->v.absmin[1] > touch->v.absmax[1]
-		|| ent->v.absmin[2] > touch->v.absmax[2]
-		|| ent->v.absmax[0] < touch->v.absmin[0]
-		|| ent->v.absmax[1] < touch->v.absmin[1]
-		|| ent->v.absmax[2] < touch->v.absmin[2] )
-			continue;
-
-		if (*listcount == listspace)
-			return; // should never happen
+		boxes->bounds[i * boxes->capacity + slot] = FLT_MAX;
+		boxes->bounds[(i + 3) * boxes->capacity + slot] = -FLT_MAX;
+	}
+	boxes->dead++;
 
-		list[*listcount] = touch;
-		(*listcount)++;
+	while (boxes->count && !boxes->ents[boxes->count - 1])
+	{
+		boxes->count--;
+		boxes->dead--;
 	}
+	if (boxes->dead > 16 && boxes->dead * 2 > boxes->count)
+		SV_CompactAreaBoxes (boxes);
+}
 
-// recurse down both sides
-	if (node->axis == -1)
-		return;
+/*
+===============
+SV_AreaBoxesFor
 
-	if ( ent->v.absmax[node->axis] > node->dist )
-		SV_AreaTriggerEdicts ( ent, node->children[0], list, listcount, listspace );
-	if ( ent->v.absmin[node->axis] < node->dist )
-		SV_AreaTriggerEdicts ( ent, node->children[1], list, listcount, listspace );
+Returns the box list holding the edict
+===============
+*/
+static areaboxes_t *SV_AreaBoxesFor (edict_t *ent)
+{
+	areanode_t	*node = &sv_areanodes[ent->areanode];
+	areaboxes_t	*boxes = &node->trigger_boxes;
+
+	if (ent->areaslot < boxes->count && boxes->ents[ent->areaslot] == ent)
+		return boxes;
+	boxes = &node->nonsolid_boxes;
+	if (ent->areaslot < boxes->count && boxes->ents[ent->areaslot] == ent)
+		return boxes;
+	return &node->solid_boxes;
 }
 
 /*
-====================
-SV_TouchLinks
+===============
+SV_AreaBoxCandidates
 
-ericw -- copy the touching edicts to an array so we can avoid
-iteating the trigger_edicts linked list while calling PR_ExecuteProgram
-which could potentially corrupt the list while it's being iterated.
-Based on code from Spike.
-====================
+Collects up to AREA_BATCH edicts whose boxes overlap mins/maxs, starting from
+slot *pos and advancing it.  The rejection test is the same one the scalar
+code used on the edict fields, including its behaviour with NaNs.
+===============
 */
-void SV_TouchLinks (edict_t *ent)
+static int SV_AreaBoxCandidates (const areaboxes_t *boxes, int *pos, const vec3_t mins, const vec3_t maxs, edict_t **list)
 {
-	edict_t		**list;
-	edict_t		*touch;
-	int		old_self, old_other;
-	int		i, listcount;
+	const float	*b = boxes->bounds;
+	int			cap = boxes->capacity;
+	int			i = *pos, count = 0;
 
-	list = alloca (qcvm->num_edicts*sizeof(edict_t *));
+#ifdef USE_SSE2
+	if (use_simd)
+	{
+		__m128	mn0 = _mm_set1_ps (mins[0]), mn1 = _mm_set1_ps (mins[1]), mn2 = _mm_set1_ps (mins[2]);
+		__m128	mx0 = _mm_set1_ps (maxs[0]), mx1 = _mm_set1_ps (maxs[1]), mx2 = _mm_set1_ps (maxs[2]);
+		__m128	out;
+		int		mask, j;
 
-	listcount = 0;
-	SV_AreaTriggerEdicts (ent, sv_areanodes, list, &listcount, qcvm->num_edicts);
+		for (; i + 4 <= boxes->count && count <= AREA_BATCH - 4; i += 4)
+		{
+			out = _mm_or_ps (_mm_cmpgt_ps (mn0, _mm_loadu_ps (b + 3 * cap + i)), _mm_cmplt_ps (mx0, _mm_loadu_ps (b + 0 * cap + i)));
+			out = _mm_or_ps (out, _mm_cmpgt_ps (mn1, _mm_loadu_ps (b + 4 * cap + i)));
+			out = _mm_or_ps (out, _mm_cmplt_ps (mx1, _mm_loadu_ps (b + 1 * cap + i)));
+			out = _mm_or_ps (out, _mm_cmpgt_ps (mn2, _mm_loadu_ps (b + 5 * cap + i)));
+			out = _mm_or_ps (out, _mm_cmplt_ps (mx2, _mm_loadu_ps (b + 2 * cap + i)));
+			mask = ~_mm_movemask_ps (out) & 15;
+			for (j = 0; mask; j++, mask >>= 1)
+				if ((mask & 1) && boxes->ents[i + j])
+					list[count++] = boxes->ents[i + j];
+		}
+	}
+#endif
 
-	for (i = 0; i < listcount; i++)
+	for (; i < boxes->count && count < AREA_BATCH; i++)
 	{
-		touch = list[i];
-	// re-validate in case of PR_ExecuteProgram having side effects that make
-	// edicts later in the list no longer touch
-		if (touch == ent)
-			continue;
-		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
-			continue;
-		if (ent->v.absmin[0] > touch->v.absmax[0]
-		|| ent->v.absmin[1] > touch->v.absmax[1]
-		|| ent->v.absmin[2] > touch->v.absmax[2]
-		|| ent->v.absmax[0] < touch->v.absmin[0]
-		|| ent->v.absmax[1] < touch->v.absmin[1]
-		|| ent->v.absmax[2] < touch->v.absmin[2] )
+		if (mins[0] > b[3 * cap + i] || mins[1] > b[4 * cap + i] || mins[2] > b[5 * cap + i]
+		|| maxs[0] < b[0 * cap + i] || maxs[1] < b[1 * cap + i] || maxs[2] < b[2 * cap + i])
 			continue;
-		old_self = pr_global_struct->self;
-		old_other = pr_global_struct->other;
+		if (boxes->ents[i])
+			list[count++] = boxes->ents[i];
+	}
 
-		pr_global_struct->self = EDICT_TO_PROG(touch);
-		pr_global_struct->other = EDICT_TO_PROG(ent);
-		pr_global_struct->time = qcvm->time;
-		PR_ExecuteProgram (touch->v.touch);
+	*pos = i;
+	return count;
+}
+
+/*
+===============
+SV_CreateAreaNode
+
+===============
+*/
+areanode_t *SV_CreateAreaNode (int depth, vec3_t mins, vec3_t maxs)
+{
+	areanode_t	*anode;
+	vec3_t		size;
+	vec3_t		mins1, maxs1, mins2, maxs2;
+
+	anode = SV_AllocAreaNode (depth, mins, maxs);
+
+	if (depth == AREA_DEPTH)
+		return anode;
+
+	VectorSubtract (maxs, mins, size);
+	if (size[0] > size[1])
+		anode->axis = 0;
+	else
+		anode->axis = 1;
+
+	anode->dist = 0.5 * (maxs[anode->axis] + mins[anode->axis]);
+	VectorCopy (mins, mins1);
+	VectorCopy (mins, mins2);
+	VectorCopy (maxs, maxs1);
+	VectorCopy (maxs, maxs2);
+
+	maxs1[anode->axis] = mins2[anode->axis] = anode->dist;
+
+	anode->children[0] = SV_CreateAreaNode (depth+1, mins2, maxs2);
+	anode->children[1] = SV_CreateAreaNode (depth+1, mins1, maxs1);
+
+	return anode;
+}
+
+static int SV_CompareFloats (const void *a, const void *b)
+{
+	float fa = *(const float *)a, fb = *(const float *)b;
+	return (fa > fb) - (fa < fb);
+}
+
+/*
+===============
+SV_MoveAreaLinks
+
+Moves the edicts in list that lie entirely on one side of the node's plane
+down to the matching child, keeping their relative order
+===============
+*/
+static void SV_MoveAreaLinks (areanode_t *node, link_t *list, qboolean triggers)
+{
+	link_t		*l, *next;
+	edict_t		*ent;
+	areanode_t	*child;
+
+	for (l = list->next ; l != list ; l = next)
+	{
+		next = l->next;
+		ent = EDICT_FROM_AREA(l);
+		if (ent->v.absmin[node->axis] > node->dist)
+			child = node->children[0];
+		else if (ent->v.absmax[node->axis] < node->dist)
+			child = node->children[1];
+		else
+			continue;
+
+		RemoveLink (l);
+		InsertLinkBefore (l, triggers ? &child->trigger_edicts : &child->solid_edicts);
+		SV_RemoveAreaBox (triggers ? &node->trigger_boxes : &node->solid_boxes, ent->areaslot);
+		SV_AddAreaBox (triggers ? &child->trigger_boxes : &child->solid_boxes, ent);
+		ent->areanode = child - sv_areanodes;
+		child->numlinks++;
+		node->numlinks--;
+	}
+}
+
+/*
+===============
+SV_SplitAreaNode
+
+Turns a crowded leaf into a node, splitting at the median of the linked
+edicts along its longer horizontal axis
+===============
+*/
+static void SV_SplitAreaNode (areanode_t *node)
+{
+	link_t		*lists[2] = {&node->solid_edicts, &node->trigger_edicts};
+	link_t		*l;
+	edict_t		*ent;
+	float		*centers;
+	float		dist;
+	vec3_t		size, mins1, maxs1, mins2, maxs2;
+	int			axis, i, count, moved;
+
+	if (node->depth >= AREA_MAX_DEPTH || sv_numareanodes + 2 > AREA_MAX_NODES)
+		return;
+
+	VectorSubtract (node->maxs, node->mins, size);
+	axis = size[0] > size[1] ? 0 : 1;
+	if (size[axis] < AREA_MIN_SIZE * 2)
+		return;
+
+	centers = (float *) alloca (node->numlinks * sizeof (float));
+	for (i = count = 0; i < 2; i++)
+	{
+		for (l = lists[i]->next ; l != lists[i] && count < node->numlinks ; l = l->next)
+		{
+			ent = EDICT_FROM_AREA(l);
+			centers[count++] = 0.5f * (ent->v.absmin[axis] + ent->v.absmax[axis]);
+		}
+	}
+	qsort (centers, count, sizeof (float), SV_CompareFloats);
+	dist = centers[count / 2];
+	dist = q_max (dist, node->mins[axis] + AREA_MIN_SIZE);
+	dist = q_min (dist, node->maxs[axis] - AREA_MIN_SIZE);
+
+	// a split that leaves most of the edicts straddling the plane only adds cost
+	for (i = moved = 0; i < 2; i++)
+	{
+		for (l = lists[i]->next ; l != lists[i] ; l = l->next)
+		{
+			ent = EDICT_FROM_AREA(l);
+			if (ent->v.absmin[axis] > dist || ent->v.absmax[axis] < dist)
+				moved++;
+		}
+	}
+	if (moved * 2 < node->numlinks)
+	{
+		node->nextsplit = node->numlinks * 2;
+		return;
+	}
+
+	VectorCopy (node->mins, mins1);
+	VectorCopy (node->mins, mins2);
+	VectorCopy (node->maxs, maxs1);
+	VectorCopy (node->maxs, maxs2);
+	maxs1[axis] = mins2[axis] = dist;
+
+	node->axis = axis;
+	node->dist = dist;
+	node->children[0] = SV_AllocAreaNode (node->depth + 1, mins2, maxs2);
+	node->children[1] = SV_AllocAreaNode (node->depth + 1, mins1, maxs1);
+	SV_MoveAreaLinks (node, &node->solid_edicts, false);
+	SV_MoveAreaLinks (node, &node->trigger_edicts, true);
+	sv_areastats.splits++;
+	SV_RankAreaNodes ();
+
+	for (i = 0; i < 2; i++)
+		if (sv_areasplit.value > 0 && node->children[i]->numlinks > sv_areasplit.value)
+			SV_SplitAreaNode (node->children[i]);
+}
+
+/*
+===============
+SV_ClearWorld
+
+===============
+*/
+void SV_ClearWorld (void)
+{
+	SV_InitBoxHull ();
+
+	sv_numareanodes = 0;
+	SV_CreateAreaNode (0, sv.worldmodel->mins, sv.worldmodel->maxs);
+	memset (&sv_areastats, 0, sizeof (sv_areastats));
+	sv_areastats.starttime = Sys_DoubleTime ();
+
+	SV_ClearTraceCache ();
+	SV_ClearEntityIndex ();
+	SV_ClearLeafCache ();
+	SV_RankAreaNodes ();
+	SV_ClearTriggerIndex ();
+}
+
+/*
+===============
+SV_AreaStats_f
+
+===============
+*/
+void SV_AreaStats_f (void)
+{
+	areanode_t	*node, *longest;
+	int			i, leaves, maxdepth, nonempty, total, inleaves;
+	double		elapsed;
+
+	if (Cmd_Argc () >= 2 && !q_strcasecmp (Cmd_Argv (1), "reset"))
+	{
+		memset (&sv_areastats, 0, sizeof (sv_areastats));
+		memset (&sv_tracecachestats, 0, sizeof (sv_tracecachestats));
+		sv_areastats.starttime = Sys_DoubleTime ();
+		return;
+	}
+
+	if (!sv.active)
+	{
+		Con_Printf ("server is not running\n");
+		return;
+	}
+
+	leaves = maxdepth = nonempty = total = inleaves = 0;
+	longest = sv_areanodes;
+	for (i = 0; i < sv_numareanodes; i++)
+	{
+		node = &sv_areanodes[i];
+		if (node->axis == -1)
+		{
+			leaves++;
+			inleaves += node->numlinks;
+		}
+		if (node->numlinks)
+			nonempty++;
+		total += node->numlinks;
+		maxdepth = q_max (maxdepth, node->depth);
+		if (node->numlinks > longest->numlinks)
+			longest = node;
+	}
+
+	Con_Printf ("%i area nodes (%i leaves, depth %i), %i splits, sv_areasplit %g\n",
+		sv_numareanodes, leaves, maxdepth, sv_areastats.splits, sv_areasplit.value);
+	Con_Printf ("%i edicts linked, %i in leaves, %i on splitting planes\n", total, inleaves, total - inleaves);
+	Con_Printf ("average list %.1f, longest %i (depth %i, %s)\n",
+		nonempty ? (double) total / nonempty : 0.0, longest->numlinks, longest->depth,
+		longest->axis == -1 ? "leaf" : "node");
+
+	elapsed = Sys_DoubleTime () - sv_areastats.starttime;
+	Con_Printf ("%" SDL_PRIu64 " moves: %.1f nodes, %.1f edicts tested per move\n", sv_areastats.moves,
+		sv_areastats.moves ? (double) sv_areastats.movenodes / sv_areastats.moves : 0.0,
+		sv_areastats.moves ? (double) sv_areastats.movelinks / sv_areastats.moves : 0.0);
+	Con_Printf ("%" SDL_PRIu64 " trigger checks: %.1f nodes, %.1f edicts tested per check\n", sv_areastats.touches,
+		sv_areastats.touches ? (double) sv_areastats.touchnodes / sv_areastats.touches : 0.0,
+		sv_areastats.touches ? (double) sv_areastats.touchlinks / sv_areastats.touches : 0.0);
+	Con_Printf ("%" SDL_PRIu64 " pvs leaf searches, %" SDL_PRIu64 " reused (%.1f%%), %" SDL_PRIu64 " spilled to bitsets\n",
+		sv_areastats.leafsearches, sv_areastats.leafreuses,
+		sv_areastats.leafsearches + sv_areastats.leafreuses ?
+			100.0 * sv_areastats.leafreuses / (sv_areastats.leafsearches + sv_areastats.leafreuses) : 0.0,
+		sv_areastats.leafoverflows);
+	Con_Printf ("%" SDL_PRIu64 " box queries: %.1f edicts per query\n", sv_areastats.areaqueries,
+		sv_areastats.areaqueries ? (double) sv_areastats.areaedicts / sv_areastats.areaqueries : 0.0);
+	SV_PrintTraceCacheStats ();
+	Con_Printf ("(over the last %.1f seconds)\n", elapsed);
+}
+
+static float SV_BenchRandom (unsigned int *seed)
+{
+	*seed = *seed * 1103515245u + 12345u;
+	return ((*seed >> 8) & 0xffff) * (2.f / 65535.f) - 1.f;
+}
+
+/*
+===============
+SV_TraceBenchPass
+
+===============
+*/
+static void SV_TraceBenchPass (const char *name, int count)
+{
+	static vec3_t	hullmins[2] = {{0, 0, 0}, {-16, -16, -24}};
+	static vec3_t	hullmaxs[2] = {{0, 0, 0}, {16, 16, 32}};
+	unsigned int	seed = 1;
+	edict_t			*ent;
+	trace_t			trace;
+	vec3_t			start, end;
+	double			time;
+	int				i, j, hits;
+
+	SV_ClearTraceCache ();
+
+	time = Sys_DoubleTime ();
+	for (i = hits = 0; i < count; i++)
+	{
+		// start from an edict so that most traces begin in open space
+		ent = EDICT_NUM (1 + (int)((SV_BenchRandom (&seed) * 0.5f + 0.5f) * (qcvm->num_edicts - 2)));
+		for (j = 0; j < 3; j++)
+		{
+			start[j] = ent->v.origin[j];
+			end[j] = start[j] + SV_BenchRandom (&seed) * 1024.f;
+		}
+		trace = SV_Move (start, hullmins[i & 1], hullmaxs[i & 1], end, MOVE_NORMAL, NULL);
+		if (trace.ent && trace.ent != qcvm->edicts)
+			hits++;
+	}
+	time = Sys_DoubleTime () - time;
+
+	Con_Printf ("%-6s %i traces in %.3f s, %.0f traces/sec, %i hit edicts\n",
+		name, count, time, time > 0 ? count / time : 0.0, hits);
+}
+
+/*
+===============
+SV_TraceBench_f
+
+Fires the same set of random traces through the current map with the scalar
+and the SIMD broadphase, starting each pass with an empty hull query cache
+===============
+*/
+void SV_TraceBench_f (void)
+{
+	qboolean	oldsimd = use_simd;
+	areastats_t	oldstats = sv_areastats;
+	tracecachestats_t	oldcachestats = sv_tracecachestats;
+	int			count;
+
+	if (!sv.active || sv.qcvm.num_edicts < 2)
+	{
+		Con_Printf ("server is not running\n");
+		return;
+	}
+
+	count = Cmd_Argc () >= 2 ? Q_atoi (Cmd_Argv (1)) : 100000;
+	if (count <= 0)
+		return;
+
+	PR_SwitchQCVM (&sv.qcvm);
+
+	use_simd = false;
+	SV_TraceBenchPass ("scalar", count);
+#ifdef USE_SSE2
+	use_simd = SDL_HasSSE () && SDL_HasSSE2 ();
+	if (use_simd)
+		SV_TraceBenchPass ("sse2", count);
+#endif
+	use_simd = oldsimd;
+
+	PR_SwitchQCVM (NULL);
+
+	// keep the benchmark out of sv_areastats
+	sv_areastats = oldstats;
+	sv_tracecachestats = oldcachestats;
+}
+
+
+/*
+===============
+SV_UnlinkEdict
+
+===============
+*/
+void SV_UnlinkEdict (edict_t *ent)
+{
+	areanode_t	*node;
+	areaboxes_t	*boxes;
+
+	if (!ent->area.prev)
+		return;		// not linked in anywhere
+	SV_UnfileTrigger (ent);
+	node = &sv_areanodes[ent->areanode];
+	boxes = SV_AreaBoxesFor (ent);
+	if (boxes != &node->nonsolid_boxes)
+		node->numlinks--;
+	SV_RemoveAreaBox (boxes, ent->areaslot);
+	RemoveLink (&ent->area);
+	ent->area.prev = ent->area.next = NULL;
+}
+
+
+/*
+====================
+SV_AreaTriggerEdicts
+
+Spike -- just builds a list of entities within the area, rather than walking
+them and risking the list getting corrupt.
+====================
+*/
+static void
+SV_AreaTriggerEdicts ( edict_t *ent, areanode_t *node, edict_t **list, int *listcount, const int listspace )
+{
+	edict_t		*batch[AREA_BATCH];
+	edict_t		*touch;
+	int			pos, i, count;
+
+	sv_areastats.touchnodes++;
+	sv_areastats.touchlinks += node->trigger_boxes.count - node->trigger_boxes.dead;
+
+// touch linked edicts
+	for (pos = 0; pos < node->trigger_boxes.count; )
+	{
+		count = SV_AreaBoxCandidates (&node->trigger_boxes, &pos, ent->v.absmin, ent->v.absmax, batch);
+		for (i = 0; i < count; i++)
+		{
+			touch = batch[i];
+			if (touch == ent)
+				continue;
+			if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
+				continue;
+
+			if (*listcount == listspace)
+				return; // should never happen
+
+			list[*listcount] = touch;
+			(*listcount)++;
+		}
+	}
+
+// recurse down both sides
+	if (node->axis == -1)
+		return;
+
+	if ( ent->v.absmax[node->axis] > node->dist )
+		SV_AreaTriggerEdicts ( ent, node->children[0], list, listcount, listspace );
+	if ( ent->v.absmin[node->axis] < node->dist )
+		SV_AreaTriggerEdicts ( ent, node->children[1], list, listcount, listspace );
+}
+
+/*
+====================
+SV_TouchLinks
+
+ericw -- copy the touching edicts to an array so we can avoid
+iteating the trigger_edicts linked list while calling PR_ExecuteProgram
+which could potentially corrupt the list while it's being iterated.
+Based on code from Spike.
+====================
+*/
+void SV_TouchLinks (edict_t *ent)
+{
+	edict_t		**list;
+	edict_t		*touch;
+	int		old_self, old_other;
+	int		i, listcount;
+
+	list = alloca (qcvm->num_edicts*sizeof(edict_t *));
+
+	listcount = 0;
+	sv_areastats.touches++;
+	sv_touchstats.checks++;
+	if (!SV_IndexedTriggerEdicts (ent, list, &listcount, qcvm->num_edicts))
+		SV_AreaTriggerEdicts (ent, sv_areanodes, list, &listcount, qcvm->num_edicts);
+
+	for (i = 0; i < listcount; i++)
+	{
+		touch = list[i];
+	// re-validate in case of PR_ExecuteProgram having side effects that make
+	// edicts later in the list no longer touch
+		if (touch == ent)
+			continue;
+		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
+			continue;
+		if (ent->v.absmin[0] > touch->v.absmax[0]
+		|| ent->v.absmin[1] > touch->v.absmax[1]
+		|| ent->v.absmin[2] > touch->v.absmax[2]
+		|| ent->v.absmax[0] < touch->v.absmin[0]
+		|| ent->v.absmax[1] < touch->v.absmin[1]
+		|| ent->v.absmax[2] < touch->v.absmin[2] )
+			continue;
+		old_self = pr_global_struct->self;
+		old_other = pr_global_struct->other;
+
+		sv_touchstats.calls++;
+		pr_global_struct->self = EDICT_TO_PROG(touch);
+		pr_global_struct->other = EDICT_TO_PROG(ent);
+		pr_global_struct->time = qcvm->time;
+		PR_ExecuteProgram (touch->v.touch);
+
+		pr_global_struct->self = old_self;
+		pr_global_struct->other = old_other;
+	}
+}
+
+/*
+====================
+SV_AreaEdictsR
+
+====================
+*/
+static int SV_AreaEdictsR (areanode_t *node, const vec3_t mins, const vec3_t maxs, edict_t **list, int count, int maxcount)
+{
+	areaboxes_t	*lists[3] = {&node->solid_boxes, &node->trigger_boxes, &node->nonsolid_boxes};
+	edict_t		*batch[AREA_BATCH];
+	int			i, n, pos;
+
+	for (i = 0; i < 3; i++)
+	{
+		for (pos = 0; pos < lists[i]->count; )
+		{
+			n = SV_AreaBoxCandidates (lists[i], &pos, mins, maxs, batch);
+			n = q_min (n, maxcount - count);
+			memcpy (list + count, batch, n * sizeof (*batch));
+			count += n;
+		}
+	}
+
+	if (node->axis == -1)
+		return count;
+
+	if (maxs[node->axis] > node->dist)
+		count = SV_AreaEdictsR (node->children[0], mins, maxs, list, count, maxcount);
+	if (mins[node->axis] < node->dist)
+		count = SV_AreaEdictsR (node->children[1], mins, maxs, list, count, maxcount);
+
+	return count;
+}
+
+static int SV_CompareEdictPointers (const void *a, const void *b)
+{
+	const edict_t *ea = *(const edict_t *const *)a;
+	const edict_t *eb = *(const edict_t *const *)b;
+	return (ea > eb) - (ea < eb);
+}
+
+/*
+====================
+SV_AreaEdicts
+
+Gathers the linked edicts of any solid type whose boxes (as of their last link)
+overlap mins/maxs, in edict number order
+====================
+*/
+int SV_AreaEdicts (const vec3_t mins, const vec3_t maxs, edict_t **list, int maxcount)
+{
+	int		count;
+
+	count = SV_AreaEdictsR (sv_areanodes, mins, maxs, list, 0, maxcount);
+	qsort (list, count, sizeof (*list), SV_CompareEdictPointers);
+	sv_areastats.areaqueries++;
+	sv_areastats.areaedicts += count;
+
+	return count;
+}
+
+
+/*
+===============================================================================
+
+TRIGGER INDEX
+
+SV_TouchLinks runs for nearly every move, and walking the area tree to find the
+triggers it overlaps gets expensive once solid edicts have split the tree into
+hundreds of nodes. Linked triggers are also filed in a 2D grid of their own,
+which only holds triggers, and queries gather candidates from the cells the
+mover covers. The candidates are then put back into the order the area tree
+walk would have produced them in (node rank, then slot), so touch functions
+still run in the same order.
+
+Each edict also keeps the triggers its last check found. As long as its box
+hasn't changed and no trigger has been filed, unfiled or moved between area
+nodes since, the same list is used again without testing anything.
+===============================================================================
+*/
+
+cvar_t	sv_triggerindex = {"sv_triggerindex", "1", CVAR_NONE};
+
+touchstats_t	sv_touchstats;
+
+#define TRIGGRID_CELLSIZE		256
+#define TRIGGRID_BUCKETS		1024					// must be a power of two
+#define TRIGGRID_MAXCOORD		(1<<20)
+#define TRIGGRID_MAXCELLS		64						// bigger triggers go on the big list, bigger queries walk the area tree
+
+typedef struct
+{
+	int			maxents;
+	int			generation;			// bumped whenever the trigger order may have changed
+	int			querynum;
+	int			*buckets[TRIGGRID_BUCKETS];	// VEC each, edict numbers, one entry per covered cell
+	int			*big;				// VEC, triggers covering too many cells
+	int			*cells;				// 4 per edict, cell range it was filed in, [0] = INT_MIN if on the big list
+	byte		*filed;				// per edict
+	int			*stamp;				// per edict, last query that looked at it
+	int			**touched;			// per edict, VEC of the triggers the last check found
+	int			*touchgen;			// per edict, generation touched was found in
+	float		*touchbox;			// 6 per edict, absmin/absmax touched was found for
+	edict_t		**candidates;		// VEC, scratch space for queries
+} trigindex_t;
+
+static trigindex_t	sv_trigindex;
+
+/*
+===============
+SV_RankAreaNodes
+
+Numbers the area nodes in the order SV_AreaTriggerEdicts walks them
+===============
+*/
+static int SV_RankAreaNode (areanode_t *node, int rank)
+{
+	node->rank = rank++;
+	if (node->axis == -1)
+		return rank;
+	rank = SV_RankAreaNode (node->children[0], rank);
+	return SV_RankAreaNode (node->children[1], rank);
+}
+
+static void SV_RankAreaNodes (void)
+{
+	SV_RankAreaNode (sv_areanodes, 0);
+	sv_trigindex.generation++;
+}
+
+/*
+===============
+SV_TriggerCells
+
+Returns false if the box covers too many cells, or lies too far out
+===============
+*/
+static qboolean SV_TriggerCells (const float *mins, const float *maxs, int cells[4])
+{
+	int		i;
+
+	for (i = 0; i < 2; i++)
+	{
+		double lo = floor (mins[i] / TRIGGRID_CELLSIZE);
+		double hi = floor (maxs[i] / TRIGGRID_CELLSIZE);
+		if (!(lo > -TRIGGRID_MAXCOORD && hi < TRIGGRID_MAXCOORD && lo <= hi)) // also catches NaN
+			return false;
+		cells[i] = (int) lo;
+		cells[i + 2] = (int) hi;
+	}
+
+	return (double) (cells[2] - cells[0] + 1) * (cells[3] - cells[1] + 1) <= TRIGGRID_MAXCELLS;
+}
+
+static int SV_TriggerBucket (int cx, int cy)
+{
+	return (((unsigned int)cx * 73856093u) ^ ((unsigned int)cy * 19349663u)) & (TRIGGRID_BUCKETS - 1);
+}
+
+/*
+===============
+SV_RemoveTriggerNum
+
+Swaps the first occurrence of num out of the list
+===============
+*/
+static void SV_RemoveTriggerNum (int *list, int num)
+{
+	int		i, count = VEC_SIZE (list);
+
+	for (i = 0; i < count; i++)
+	{
+		if (list[i] == num)
+		{
+			list[i] = list[count - 1];
+			VEC_POP (list);
+			return;
+		}
+	}
+}
+
+/*
+===============
+SV_FileTrigger
+
+Called from SV_LinkEdict for edicts going on the trigger lists
+===============
+*/
+static void SV_FileTrigger (edict_t *ent)
+{
+	trigindex_t	*idx = &sv_trigindex;
+	int			num, x, y, *cells;
+
+	if (qcvm != &sv.qcvm || !idx->maxents)
+		return;
+	num = NUM_FOR_EDICT (ent);
+	if (num >= idx->maxents || idx->filed[num])
+		return;
+
+	cells = &idx->cells[num*4];
+	if (!SV_TriggerCells (ent->v.absmin, ent->v.absmax, cells))
+	{
+		cells[0] = INT_MIN;
+		VEC_PUSH (idx->big, num);
+	}
+	else
+	{
+		for (y = cells[1]; y <= cells[3]; y++)
+			for (x = cells[0]; x <= cells[2]; x++)
+				VEC_PUSH (idx->buckets[SV_TriggerBucket (x, y)], num);
+	}
+
+	idx->filed[num] = true;
+	idx->generation++;
+}
+
+/*
+===============
+SV_UnfileTrigger
+
+Called from SV_UnlinkEdict
+===============
+*/
+static void SV_UnfileTrigger (edict_t *ent)
+{
+	trigindex_t	*idx = &sv_trigindex;
+	int			num, x, y, *cells;
+
+	if (qcvm != &sv.qcvm || !idx->maxents)
+		return;
+	num = NUM_FOR_EDICT (ent);
+	if (num >= idx->maxents || !idx->filed[num])
+		return;
+
+	cells = &idx->cells[num*4];
+	if (cells[0] == INT_MIN)
+		SV_RemoveTriggerNum (idx->big, num);
+	else
+	{
+		for (y = cells[1]; y <= cells[3]; y++)
+			for (x = cells[0]; x <= cells[2]; x++)
+				SV_RemoveTriggerNum (idx->buckets[SV_TriggerBucket (x, y)], num);
+	}
+
+	idx->filed[num] = false;
+	idx->generation++;
+}
+
+/*
+===============
+SV_CompareTriggers
+
+Area tree order: the node walked first, then the earlier slot in its list
+===============
+*/
+static int SV_CompareTriggers (const void *a, const void *b)
+{
+	const edict_t	*ea = *(edict_t *const *)a;
+	const edict_t	*eb = *(edict_t *const *)b;
+	int				ra = sv_areanodes[ea->areanode].rank;
+	int				rb = sv_areanodes[eb->areanode].rank;
+
+	if (ra != rb)
+		return ra - rb;
+	return ea->areaslot - eb->areaslot;
+}
+
+/*
+===============
+SV_GatherTrigger
+
+Adds num to the candidates if its linked box overlaps ent's, using the same
+test as SV_AreaBoxCandidates
+===============
+*/
+static void SV_GatherTrigger (trigindex_t *idx, edict_t *ent, int num)
+{
+	edict_t		*touch;
+	areaboxes_t	*boxes;
+	const float	*b;
+	int			cap, slot;
+
+	if (idx->stamp[num] == idx->querynum)
+		return;
+	idx->stamp[num] = idx->querynum;
+
+	touch = EDICT_NUM (num);
+	if (touch == ent)
+		return;
+
+	sv_touchstats.tested++;
+	boxes = &sv_areanodes[touch->areanode].trigger_boxes;
+	cap = boxes->capacity;
+	slot = touch->areaslot;
+	b = boxes->bounds;
+	if (ent->v.absmin[0] > b[3*cap + slot] || ent->v.absmin[1] > b[4*cap + slot] || ent->v.absmin[2] > b[5*cap + slot] ||
+		ent->v.absmax[0] < b[0*cap + slot] || ent->v.absmax[1] < b[1*cap + slot] || ent->v.absmax[2] < b[2*cap + slot])
+		return;
+
+	VEC_PUSH (idx->candidates, touch);
+}
+
+/*
+===============
+SV_IndexedTriggerEdicts
+
+Same result as SV_AreaTriggerEdicts from the top node.  Returns false if the
+index can't answer the query, and the area tree has to be walked instead.
+===============
+*/
+static qboolean SV_IndexedTriggerEdicts (edict_t *ent, edict_t **list, int *listcount, const int listspace)
+{
+	trigindex_t	*idx = &sv_trigindex;
+	edict_t		*touch;
+	float		*box;
+	int			num, i, x, y, count, *touched, cells[4];
+
+	if (!sv_triggerindex.value || qcvm != &sv.qcvm || !idx->maxents)
+		return false;
+	num = NUM_FOR_EDICT (ent);
+	if (num >= idx->maxents)
+		return false;
+
+	box = &idx->touchbox[num*6];
+	if (idx->touchgen[num] != idx->generation ||
+		!VectorCompare (ent->v.absmin, box) || !VectorCompare (ent->v.absmax, box + 3))
+	{
+		if (!SV_TriggerCells (ent->v.absmin, ent->v.absmax, cells))
+			return false;
+
+		idx->querynum++;
+		VEC_CLEAR (idx->candidates);
+		for (i = 0; i < VEC_SIZE (idx->big); i++)
+			SV_GatherTrigger (idx, ent, idx->big[i]);
+		for (y = cells[1]; y <= cells[3]; y++)
+		{
+			for (x = cells[0]; x <= cells[2]; x++)
+			{
+				int *bucket = idx->buckets[SV_TriggerBucket (x, y)];
+				for (i = 0; i < VEC_SIZE (bucket); i++)
+					SV_GatherTrigger (idx, ent, bucket[i]);
+			}
+		}
+
+		count = VEC_SIZE (idx->candidates);
+		qsort (idx->candidates, count, sizeof (edict_t *), SV_CompareTriggers);
+
+		VEC_CLEAR (idx->touched[num]);
+		for (i = 0; i < count; i++)
+			VEC_PUSH (idx->touched[num], NUM_FOR_EDICT (idx->candidates[i]));
+		idx->touchgen[num] = idx->generation;
+		VectorCopy (ent->v.absmin, box);
+		VectorCopy (ent->v.absmax, box + 3);
+	}
+	else
+		sv_touchstats.reused++;
+
+	touched = idx->touched[num];
+	count = VEC_SIZE (touched);
+	for (i = 0; i < count && *listcount < listspace; i++)
+	{
+		touch = EDICT_NUM (touched[i]);
+		if (!touch->v.touch || touch->v.solid != SOLID_TRIGGER)
+			continue;
+		list[(*listcount)++] = touch;
+	}
+
+	return true;
+}
+
+/*
+===============
+SV_ClearTriggerIndex
+
+Called from SV_ClearWorld, after the edicts have been allocated
+===============
+*/
+static void SV_ClearTriggerIndex (void)
+{
+	trigindex_t	*idx = &sv_trigindex;
+	int			i;
+
+	for (i = 0; i < TRIGGRID_BUCKETS; i++)
+		VEC_CLEAR (idx->buckets[i]);
+	VEC_CLEAR (idx->big);
+
+	if (idx->maxents != qcvm->max_edicts)
+	{
+		for (i = 0; i < idx->maxents; i++)
+			VEC_FREE (idx->touched[i]);
+		free (idx->cells);
+		free (idx->filed);
+		free (idx->touched);
+		free (idx->touchbox);
+		idx->maxents = qcvm->max_edicts;
+		idx->cells = (int *) malloc (idx->maxents * 6 * sizeof (int));
+		idx->stamp = idx->cells + idx->maxents * 4;
+		idx->touchgen = idx->stamp + idx->maxents;
+		idx->filed = (byte *) malloc (idx->maxents);
+		idx->touched = (int **) calloc (idx->maxents, sizeof (int *));
+		idx->touchbox = (float *) malloc (idx->maxents * 6 * sizeof (float));
+		if (!idx->cells || !idx->filed || !idx->touched || !idx->touchbox)
+			Sys_Error ("SV_ClearTriggerIndex: out of memory");
+	}
+
+	for (i = 0; i < idx->maxents; i++)
+	{
+		idx->stamp[i] = 0;
+		idx->touchgen[i] = 0;
+		VEC_CLEAR (idx->touched[i]);
+	}
+	memset (idx->filed, 0, idx->maxents);
+	idx->querynum = 0;
+	idx->generation = 1;
+}
+
+/*
+===============================================================================
+
+PVS LEAFS
+
+SV_LinkEdict records which world leafs an edict's box touches, so that it can
+be culled against client PVSes. Finding them means walking the world BSP from
+the top, so the result is kept along with the bounds it was found for and the
+smallest distance between those bounds and any node plane the walk tested.
+Until the box has moved that far it can't have crossed one of those planes,
+and the previous leafs are reused.
+
+Edicts touching more than MAX_ENT_LEAFS leafs (rotators, tall lifts, huge
+triggers) keep them as a bitset over the range they span, instead of being
+sent to every client.
+===============================================================================
+*/
+
+cvar_t	sv_leafcache = {"sv_leafcache", "1", CVAR_NONE};
+
+#define	LEAFCACHE_EPSILON	(1.f/32.f)	// covers rounding in the plane distances
+
+static int	sv_leafgeneration;		// bumped by SV_ClearWorld, so that edicts don't reuse leafs from another map
+static int	*sv_touchedleafs;		// VEC, scratch space for SV_FindTouchedLeafs
+
+/*
+===============
+SV_ClearLeafCache
+
+Called from SV_ClearWorld
+===============
+*/
+static void SV_ClearLeafCache (void)
+{
+	if (++sv_leafgeneration == 0)
+		sv_leafgeneration = 1;
+}
+
+/*
+===============
+SV_LeafPlaneSlack
+
+How far any side of the box can move before BOX_ON_PLANE_SIDE gives
+something other than sides for this plane
+===============
+*/
+static float SV_LeafPlaneSlack (const vec3_t mins, const vec3_t maxs, const mplane_t *plane, int sides)
+{
+	float	lo, hi, scale;
+	int		i;
+
+	// lowest and highest distance of any point of the box from the plane
+	if (plane->type < 3)
+	{
+		lo = mins[plane->type] - plane->dist;
+		hi = maxs[plane->type] - plane->dist;
+		scale = 1.f;
+	}
+	else
+	{
+		lo = hi = -plane->dist;
+		scale = 0.f;
+		for (i = 0; i < 3; i++)
+		{
+			if (plane->normal[i] < 0)
+			{
+				lo += plane->normal[i] * maxs[i];
+				hi += plane->normal[i] * mins[i];
+			}
+			else
+			{
+				lo += plane->normal[i] * mins[i];
+				hi += plane->normal[i] * maxs[i];
+			}
+			scale += fabs (plane->normal[i]);
+		}
+	}
+
+	if (sides == 1)
+		return lo / scale;
+	if (sides == 2)
+		return -hi / scale;
+	return q_min (-lo, hi) / scale;
+}
+
+/*
+===============
+SV_WalkTouchedLeafs
+
+Appends the leafs to sv_touchedleafs in the same order as the old recursive
+search, and lowers ent->leafslack to the closest plane
+===============
+*/
+static void SV_WalkTouchedLeafs (edict_t *ent, mnode_t *node)
+{
+	float	slack;
+	int		sides;
+
+	while (1)
+	{
+		if (node->contents == CONTENTS_SOLID)
+			return;
+
+		if (node->contents < 0)
+		{
+			VEC_PUSH (sv_touchedleafs, (int) ((mleaf_t *)node - sv.worldmodel->leafs - 1));
+			return;
+		}
+
+		sides = BOX_ON_PLANE_SIDE (ent->v.absmin, ent->v.absmax, node->plane);
+		slack = SV_LeafPlaneSlack (ent->v.absmin, ent->v.absmax, node->plane, sides);
+		if (!(slack >= ent->leafslack)) // also catches NaN
+			ent->leafslack = slack;
+
+		if (sides == 3)
+		{
+			SV_WalkTouchedLeafs (ent, node->children[0]);
+			node = node->children[1];
+		}
+		else if (sides == 1)
+			node = node->children[0];
+		else if (sides == 2)
+			node = node->children[1];
+		else
+			return;		// NaN bounds
+	}
+}
+
+/*
+===============
+SV_LeafsStillValid
+
+===============
+*/
+static qboolean SV_LeafsStillValid (edict_t *ent)
+{
+	int		i;
+
+	if (ent->leafgen != sv_leafgeneration || !sv_leafcache.value)
+		return false;
+
+	if (VectorCompare (ent->v.absmin, ent->leafmins) && VectorCompare (ent->v.absmax, ent->leafmaxs))
+		return true;
+
+	for (i = 0; i < 3; i++)
+	{
+		if (!(fabs (ent->v.absmin[i] - ent->leafmins[i]) < ent->leafslack) ||
+			!(fabs (ent->v.absmax[i] - ent->leafmaxs[i]) < ent->leafslack))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+===============
+SV_FindTouchedLeafs
+
+Fills in leafnums, or leafbits when there are too many leafs for the list
+===============
+*/
+static void SV_FindTouchedLeafs (edict_t *ent)
+{
+	int		i, count, bytes, first, last;
+
+	if (SV_LeafsStillValid (ent))
+	{
+		sv_areastats.leafreuses++;
+		return;
+	}
+
+	sv_areastats.leafsearches++;
+	VEC_CLEAR (sv_touchedleafs);
+	ent->leafslack = FLT_MAX;
+	SV_WalkTouchedLeafs (ent, sv.worldmodel->nodes);
+	ent->leafslack -= LEAFCACHE_EPSILON;
+	ent->leafgen = sv_leafgeneration;
+	VectorCopy (ent->v.absmin, ent->leafmins);
+	VectorCopy (ent->v.absmax, ent->leafmaxs);
+
+	count = VEC_SIZE (sv_touchedleafs);
+	ent->num_leafs = q_min (count, MAX_ENT_LEAFS);
+	if (count)
+		memcpy (ent->leafnums, sv_touchedleafs, ent->num_leafs * sizeof (int));
+
+	VEC_CLEAR (ent->leafbits);
+	if (count <= MAX_ENT_LEAFS)
+		return;
+
+	sv_areastats.leafoverflows++;
+	first = last = sv_touchedleafs[0];
+	for (i = 1; i < count; i++)
+	{
+		first = q_min (first, sv_touchedleafs[i]);
+		last = q_max (last, sv_touchedleafs[i]);
+	}
+
+	ent->leafstart = first >> 3;
+	bytes = (last >> 3) - ent->leafstart + 1;
+	Vec_Grow ((void **) &ent->leafbits, 1, bytes);
+	VEC_HEADER (ent->leafbits).size = bytes;
+	memset (ent->leafbits, 0, bytes);
+	for (i = 0; i < count; i++)
+	{
+		int leafnum = sv_touchedleafs[i];
+		ent->leafbits[(leafnum >> 3) - ent->leafstart] |= 1 << (leafnum & 7);
+	}
+}
+
+/*
+===============
+SV_BoxInPVS
+===============
+*/
+qboolean SV_BoxInPVS (vec3_t mins, vec3_t maxs, byte *pvs, mnode_t *node)
+{
+	mplane_t	*splitplane;
+	mleaf_t		*leaf;
+	int			sides;
+	int			leafnum;
+
+	if (node->contents == CONTENTS_SOLID)
+		return false;
+
+	if (node->contents < 0)
+	{
+		leaf = (mleaf_t *)node;
+		leafnum = leaf - sv.worldmodel->leafs - 1;
+		return pvs[leafnum >> 3] & (1 << (leafnum & 7));
+	}
+
+	splitplane = node->plane;
+	sides = BOX_ON_PLANE_SIDE(mins, maxs, splitplane);
+
+	if (sides & 1 && SV_BoxInPVS (mins, maxs, pvs, node->children[0]))
+		return true;
+
+	if (sides & 2 && SV_BoxInPVS (mins, maxs, pvs, node->children[1]))
+		return true;
+
+	return false;
+}
+
+/*
+===============
+SV_LinkEdict
+
+===============
+*/
+void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
+{
+	areanode_t	*node;
+
+	if (ent->area.prev)
+		SV_UnlinkEdict (ent);	// unlink from old position
+
+	if (ent == qcvm->edicts)
+		return;		// don't add the world
+
+	if (ent->free)
+		return;
+
+	SV_IndexEdict (ent);
+
+// set the abs box
+	VectorAdd (ent->v.origin, ent->v.mins, ent->v.absmin);
+	VectorAdd (ent->v.origin, ent->v.maxs, ent->v.absmax);
+
+//
+// to make items easier to pick up and allow them to be grabbed off
+// of shelves, the abs sizes are expanded
+//
+	if ((int)ent->v.flags & FL_ITEM)
+	{
+		ent->v.absmin[0] -= 15;
+		ent->v.absmin[1] -= 15;
+		ent->v.absmax[0] += 15;
+		ent->v.absmax[1] += 15;
+	}
+	else
+	{	// because movement is clipped an epsilon away from an actual edge,
+		// we must fully check even when bounding boxes don't quite touch
+		ent->v.absmin[0] -= 1;
+		ent->v.absmin[1] -= 1;
+		ent->v.absmin[2] -= 1;
+		ent->v.absmax[0] += 1;
+		ent->v.absmax[1] += 1;
+		ent->v.absmax[2] += 1;
+	}
+
+// link to PVS leafs
+	if (ent->v.modelindex)
+		SV_FindTouchedLeafs (ent);
+	else
+	{
+		ent->num_leafs = 0;
+		ent->leafgen = 0;
+		VEC_CLEAR (ent->leafbits);
+	}
+
+// find the first node that the ent's box crosses
+	node = sv_areanodes;
+	while (1)
+	{
+		if (node->axis == -1)
+			break;
+		if (ent->v.absmin[node->axis] > node->dist)
+			node = node->children[0];
+		else if (ent->v.absmax[node->axis] < node->dist)
+			node = node->children[1];
+		else
+			break;		// crosses the node
+	}
+
+// link it in
+
+	if (ent->v.solid == SOLID_NOT)
+	{
+		// kept out of the node counts, nothing but SV_AreaEdicts looks for these
+		InsertLinkBefore (&ent->area, &node->nonsolid_edicts);
+		SV_AddAreaBox (&node->nonsolid_boxes, ent);
+		ent->areanode = node - sv_areanodes;
+		return;
+	}
+
+	if (ent->v.solid == SOLID_TRIGGER)
+	{
+		InsertLinkBefore (&ent->area, &node->trigger_edicts);
+		SV_AddAreaBox (&node->trigger_boxes, ent);
+		SV_FileTrigger (ent);
+	}
+	else
+	{
+		InsertLinkBefore (&ent->area, &node->solid_edicts);
+		SV_AddAreaBox (&node->solid_boxes, ent);
+	}
+	ent->areanode = node - sv_areanodes;
+	node->numlinks++;
+
+	if (node->axis == -1 && sv_areasplit.value > 0 && node->numlinks > q_max (sv_areasplit.value, node->nextsplit))
+		SV_SplitAreaNode (node);
+
+// if touch_triggers, touch all entities at this node and decend for more
+	if (touch_triggers)
+		SV_TouchLinks ( ent );
+}
+
+
+
+/*
+===============================================================================
+
+ENTITY QUERY INDEX
+
+Accelerates PF_findradius and PF_Find without changing their results.
+
+Every edict is filed in a 2D grid cell by the center findradius uses, refreshed
+whenever SV_LinkEdict is called. Edicts that changed in a way the grid can't
+see (QC writes to watched fields, engine-side spawning/freeing) are put on a
+dirty list instead; those are always tested exactly during the current frame
+and refiled by SV_FlushEntityIndex at the start of the next one, so it doesn't
+matter whether a query happens before or after the actual store.
+
+PF_Find results are cached as sorted lists of matching edicts per field/value
+pair, kept up to date from the same dirty list.
+
+For SV_PushMove, edicts on the ground are also chained by their groundentity,
+and edicts that aren't linked into the area tree get a chain of their own.
+Every link and every change flag goes on a log that is cleared with the dirty
+list, so that a pusher can pick up whatever changed after it gathered.
+===============================================================================
+*/
+
+cvar_t	sv_findindex = {"sv_findindex", "1", CVAR_NONE};
+
+#define ENTGRID_CELLSIZE		256
+#define ENTGRID_BUCKETS			4096						// must be a power of two
+#define ENTGRID_OVERFLOW		ENTGRID_BUCKETS				// bucket for edicts too far out to be filed
+#define ENTGRID_MAXCELLS		1024						// larger queries just scan all the edicts
+#define ENTGRID_MAXCOORD		(1 << 20)
+
+#define MAX_FINDCACHE			32
+
+typedef struct findcache_s
+{
+	int			field;
+	char		*value;
+	int			*ents;				// VEC, sorted
+	int			lastused;
+} findcache_t;
+
+typedef struct entindex_s
+{
+	int			maxents;
+	int			head[ENTGRID_BUCKETS + 1];
+	int			stamp[ENTGRID_BUCKETS + 1];
+	int			querynum;
+	int			findtime;
+	int			*next, *prev;		// bucket chains, per edict
+	int			*bucket;			// -1 if not filed
+	int			*cell;				// 2 per edict
+	byte		*dirty;				// per edict
+	int			*dirtylist;			// VEC
+	int			*candidates;		// VEC, scratch space for queries
+
+	int			*ground;			// chain each edict is on: -1 none, 0 unlinked, else its groundentity
+	int			*gnext, *gprev;		// ground chains, per edict
+	int			*ghead;				// per groundentity, world's slot holding the unlinked edicts
+	int			*changelog;			// VEC, edicts linked or flagged since the last flush
+
+	findcache_t	findcache[MAX_FINDCACHE];
+	int			findcount;
+} entindex_t;
+
+static entindex_t	sv_entindex;
+
+/*
+===============
+SV_EntityCenter
+
+Same computation as the original findradius, so that cells match the exact test
+===============
+*/
+static void SV_EntityCenter (edict_t *ent, double center[2])
+{
+	center[0] = ent->v.origin[0] + (ent->v.mins[0] + ent->v.maxs[0]) * 0.5;
+	center[1] = ent->v.origin[1] + (ent->v.mins[1] + ent->v.maxs[1]) * 0.5;
+}
+
+static int SV_EntityCell (double coord)
+{
+	double c = floor (coord / ENTGRID_CELLSIZE);
+	if (!(c > -ENTGRID_MAXCOORD && c < ENTGRID_MAXCOORD)) // also catches NaN
+		return INT_MIN;
+	return (int) c;
+}
+
+static int SV_CellBucket (int cx, int cy)
+{
+	return (((unsigned int)cx * 73856093u) ^ ((unsigned int)cy * 19349663u)) & (ENTGRID_BUCKETS - 1);
+}
+
+/*
+===============
+SV_UnfileEdict
+===============
+*/
+static void SV_UnfileEdict (int num)
+{
+	entindex_t	*idx = &sv_entindex;
+	int			b = idx->bucket[num];
+
+	if (b < 0)
+		return;
+	if (idx->prev[num] >= 0)
+		idx->next[idx->prev[num]] = idx->next[num];
+	else
+		idx->head[b] = idx->next[num];
+	if (idx->next[num] >= 0)
+		idx->prev[idx->next[num]] = idx->prev[num];
+	idx->bucket[num] = -1;
+}
+
+/*
+===============
+SV_FileEdict
+===============
+*/
+static void SV_FileEdict (int num)
+{
+	entindex_t	*idx = &sv_entindex;
+	edict_t		*ent = EDICT_NUM (num);
+	double		center[2];
+	int			cx, cy, b;
+
+	SV_UnfileEdict (num);
+	if (ent->free)
+		return;
+
+	SV_EntityCenter (ent, center);
+	cx = SV_EntityCell (center[0]);
+	cy = SV_EntityCell (center[1]);
+	if (cx == INT_MIN || cy == INT_MIN)
+		b = ENTGRID_OVERFLOW;
+	else
+		b = SV_CellBucket (cx, cy);
+
+	idx->cell[num*2 + 0] = cx;
+	idx->cell[num*2 + 1] = cy;
+	idx->bucket[num] = b;
+	idx->prev[num] = -1;
+	idx->next[num] = idx->head[b];
+	if (idx->head[b] >= 0)
+		idx->prev[idx->head[b]] = num;
+	idx->head[b] = num;
+}
+
+/*
+===============
+SV_FileRider
+
+Puts an edict on the chain of its groundentity if it's on the ground, or on
+the chain of unlinked edicts
+===============
+*/
+static void SV_FileRider (int num, qboolean linked)
+{
+	entindex_t	*idx = &sv_entindex;
+	edict_t		*ent = EDICT_NUM (num);
+	int			key, ground;
+
+	if (ent->free)
+		key = -1;
+	else if (!linked)
+		key = 0;
+	else if ((int)ent->v.flags & FL_ONGROUND)
+	{
+		ground = ent->v.groundentity / qcvm->edict_size;
+		key = (ground > 0 && ground < idx->maxents) ? ground : -1;
+	}
+	else
+		key = -1;
+
+	if (key == idx->ground[num])
+		return;
+
+	if (idx->ground[num] >= 0)
+	{
+		if (idx->gprev[num] >= 0)
+			idx->gnext[idx->gprev[num]] = idx->gnext[num];
+		else
+			idx->ghead[idx->ground[num]] = idx->gnext[num];
+		if (idx->gnext[num] >= 0)
+			idx->gprev[idx->gnext[num]] = idx->gprev[num];
+	}
+
+	idx->ground[num] = key;
+	if (key < 0)
+		return;
+	idx->gprev[num] = -1;
+	idx->gnext[num] = idx->ghead[key];
+	if (idx->ghead[key] >= 0)
+		idx->gprev[idx->ghead[key]] = num;
+	idx->ghead[key] = num;
+}
+
+/*
+===============
+SV_IndexEdict
+
+Called from SV_LinkEdict. Dirty edicts are left alone until the next flush.
+===============
+*/
+static void SV_IndexEdict (edict_t *ent)
+{
+	entindex_t	*idx = &sv_entindex;
+	int			num;
+
+	if (qcvm != &sv.qcvm || !idx->maxents)
+		return;
+	num = NUM_FOR_EDICT (ent);
+	if (num <= 0 || num >= idx->maxents)
+		return;
+	VEC_PUSH (idx->changelog, num);
+	if (!idx->dirty[num])
+	{
+		SV_FileEdict (num);
+		SV_FileRider (num, true);
+	}
+}
+
+/*
+===============
+SV_ClearEntityIndex
+
+Called from SV_ClearWorld, after the edicts have been allocated
+===============
+*/
+static void SV_ClearEntityIndex (void)
+{
+	entindex_t	*idx = &sv_entindex;
+	int			i;
+
+	for (i = 0; i < idx->findcount; i++)
+	{
+		Z_Free (idx->findcache[i].value);
+		VEC_FREE (idx->findcache[i].ents);
+	}
+	idx->findcount = 0;
+
+	if (idx->maxents != qcvm->max_edicts)
+	{
+		free (idx->next);
+		free (idx->dirty);
+		idx->maxents = qcvm->max_edicts;
+		idx->next = (int *) malloc (idx->maxents * 9 * sizeof (int));
+		idx->prev = idx->next + idx->maxents;
+		idx->bucket = idx->prev + idx->maxents;
+		idx->cell = idx->bucket + idx->maxents;
+		idx->ground = idx->cell + idx->maxents * 2;
+		idx->gnext = idx->ground + idx->maxents;
+		idx->gprev = idx->gnext + idx->maxents;
+		idx->ghead = idx->gprev + idx->maxents;
+		idx->dirty = (byte *) malloc (idx->maxents);
+		if (!idx->next || !idx->dirty)
+			Sys_Error ("SV_ClearEntityIndex: out of memory");
+	}
 
-		pr_global_struct->self = old_self;
-		pr_global_struct->other = old_other;
+	for (i = 0; i <= ENTGRID_BUCKETS; i++)
+	{
+		idx->head[i] = -1;
+		idx->stamp[i] = 0;
+	}
+	idx->querynum = 0;
+	for (i = 0; i < idx->maxents; i++)
+		idx->bucket[i] = idx->ground[i] = idx->ghead[i] = -1;
+	memset (idx->dirty, 0, idx->maxents);
+	VEC_CLEAR (idx->dirtylist);
+	VEC_CLEAR (idx->changelog);
+
+	// everything that exists at this point gets filed on the next flush
+	for (i = 1; i < qcvm->num_edicts; i++)
+		SV_EdictChanged (EDICT_NUM (i));
+
+	// origin, mins and maxs writes from QC move edicts around in the grid
+	if (qcvm->fieldwatch)
+	{
+		for (i = 0; i < 3; i++)
+		{
+			qcvm->fieldwatch[offsetof (entvars_t, origin) / 4 + i] = true;
+			qcvm->fieldwatch[offsetof (entvars_t, mins) / 4 + i] = true;
+			qcvm->fieldwatch[offsetof (entvars_t, maxs) / 4 + i] = true;
+			qcvm->fieldwatch[offsetof (entvars_t, absmin) / 4 + i] = true;
+			qcvm->fieldwatch[offsetof (entvars_t, absmax) / 4 + i] = true;
+		}
+		// and these decide who rides on a pusher
+		qcvm->fieldwatch[offsetof (entvars_t, flags) / 4] = true;
+		qcvm->fieldwatch[offsetof (entvars_t, groundentity) / 4] = true;
 	}
 }
 
-
 /*
 ===============
-SV_FindTouchedLeafs
+SV_EdictChanged
 
+Flags an edict whose fields may have changed without SV_LinkEdict being called
 ===============
 */
-void SV_FindTouchedLeafs (edict_t *ent, mnode_t *node)
+void SV_EdictChanged (edict_t *ent)
 {
-	mplane_t	*splitplane;
-	mleaf_t		*leaf;
-	int			sides;
-	int			leafnum;
+	entindex_t	*idx = &sv_entindex;
+	int			num;
 
-	if (node->contents == CONTENTS_SOLID)
+	if (!idx->maxents || !sv.qcvm.edicts || (byte *)ent < (byte *)sv.qcvm.edicts)
 		return;
 
-// add an efrag if the node is a leaf
+	// may be called with another vm active
+	num = ((byte *)ent - (byte *)sv.qcvm.edicts) / sv.qcvm.edict_size;
+	if (num <= 0 || num >= idx->maxents)
+		return;
 
-	if ( node->contents < 0)
-	{
-		if (ent->num_leafs == MAX_ENT_LEAFS)
-			return;
+	VEC_PUSH (idx->changelog, num);
+	if (idx->dirty[num])
+		return;
+	idx->dirty[num] = true;
+	VEC_PUSH (idx->dirtylist, num);
+}
 
-		leaf = (mleaf_t *)node;
-		leafnum = leaf - sv.worldmodel->leafs - 1;
+/*
+===============
+SV_GroundChanged
+
+Called by the engine after it puts an edict on the ground
+===============
+*/
+void SV_GroundChanged (edict_t *ent)
+{
+	entindex_t	*idx = &sv_entindex;
+	int			num;
 
-		ent->leafnums[ent->num_leafs] = leafnum;
-		ent->num_leafs++;
+	if (qcvm != &sv.qcvm || !idx->maxents)
 		return;
-	}
+	num = NUM_FOR_EDICT (ent);
+	if (num <= 0 || num >= idx->maxents)
+		return;
+	VEC_PUSH (idx->changelog, num);
+	if (!idx->dirty[num])
+		SV_FileRider (num, ent->area.prev != NULL);
+}
 
-// NODE_MIXED
+/*
+===============
+SV_RiderEdicts
 
-	splitplane = node->plane;
-	sides = BOX_ON_PLANE_SIDE(ent->v.absmin, ent->v.absmax, splitplane);
+Fills in every edict that may be standing on ground: the ones on its chain,
+the unlinked ones and the dirty ones. Returns -1 if the index isn't set up,
+otherwise the count, which is never more than qcvm->num_edicts.
+===============
+*/
+int SV_RiderEdicts (edict_t *ground, edict_t **list)
+{
+	entindex_t	*idx = &sv_entindex;
+	int			i, num, count, key;
+
+	if (qcvm != &sv.qcvm || !idx->maxents || !qcvm->fieldwatch)
+		return -1;
+	key = NUM_FOR_EDICT (ground);
+	if (key <= 0 || key >= idx->maxents)
+		return -1;
+
+	count = 0;
+	for (num = idx->ghead[key]; num >= 0; num = idx->gnext[num])
+		if (!idx->dirty[num] && num < qcvm->num_edicts)
+			list[count++] = EDICT_NUM (num);
+	for (num = idx->ghead[0]; num >= 0; num = idx->gnext[num])
+		if (!idx->dirty[num] && num < qcvm->num_edicts)
+			list[count++] = EDICT_NUM (num);
+	for (i = 0; i < (int) VEC_SIZE (idx->dirtylist); i++)
+		if (idx->dirtylist[i] < qcvm->num_edicts)
+			list[count++] = EDICT_NUM (idx->dirtylist[i]);
+
+	return count;
+}
+
+/*
+===============
+SV_ChangeLog
+
+Returns how many edicts have been linked or flagged since the start of the
+frame, and points log at their numbers (repeats included)
+===============
+*/
+int SV_ChangeLog (const int **log)
+{
+	*log = sv_entindex.changelog;
+	return VEC_SIZE (sv_entindex.changelog);
+}
 
-// recurse down the contacted sides
-	if (sides & 1)
-		SV_FindTouchedLeafs (ent, node->children[0]);
+static qboolean SV_StringFieldMatches (edict_t *ent, int field, const char *s)
+{
+	const char *t;
 
-	if (sides & 2)
-		SV_FindTouchedLeafs (ent, node->children[1]);
+	if (ent->free)
+		return false;
+	t = E_STRING (ent, field);
+	return t && !strcmp (t, s);
 }
 
 /*
 ===============
-SV_BoxInPVS
+SV_FindCacheUpdate
+
+Adds or removes an edict from a cached PF_Find result
 ===============
 */
-qboolean SV_BoxInPVS (vec3_t mins, vec3_t maxs, byte *pvs, mnode_t *node)
+static void SV_FindCacheUpdate (findcache_t *fc, int num)
 {
-	mplane_t	*splitplane;
-	mleaf_t		*leaf;
-	int			sides;
-	int			leafnum;
+	edict_t		*ent = EDICT_NUM (num);
+	qboolean	match;
+	int			lo, hi, count;
 
-	if (node->contents == CONTENTS_SOLID)
-		return false;
+	match = SV_StringFieldMatches (ent, fc->field, fc->value);
 
-	if (node->contents < 0)
+	count = VEC_SIZE (fc->ents);
+	for (lo = 0, hi = count; lo < hi; )
 	{
-		leaf = (mleaf_t *)node;
-		leafnum = leaf - sv.worldmodel->leafs - 1;
-		return pvs[leafnum >> 3] & (1 << (leafnum & 7));
+		int mid = (lo + hi) / 2;
+		if (fc->ents[mid] < num)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	splitplane = node->plane;
-	sides = BOX_ON_PLANE_SIDE(mins, maxs, splitplane);
+	if (lo < count && fc->ents[lo] == num)
+	{
+		if (!match)
+		{
+			memmove (fc->ents + lo, fc->ents + lo + 1, (count - lo - 1) * sizeof (int));
+			VEC_POP (fc->ents);
+		}
+	}
+	else if (match)
+	{
+		VEC_PUSH (fc->ents, 0);
+		memmove (fc->ents + lo + 1, fc->ents + lo, (count - lo) * sizeof (int));
+		fc->ents[lo] = num;
+	}
+}
 
-	if (sides & 1 && SV_BoxInPVS (mins, maxs, pvs, node->children[0]))
-		return true;
+/*
+===============
+SV_FlushEntityIndex
 
-	if (sides & 2 && SV_BoxInPVS (mins, maxs, pvs, node->children[1]))
-		return true;
+Refiles the edicts that changed during the last frame. Called at the start of SV_Physics.
+===============
+*/
+void SV_FlushEntityIndex (void)
+{
+	entindex_t	*idx = &sv_entindex;
+	int			i, j, num;
 
-	return false;
+	for (i = 0; i < (int) VEC_SIZE (idx->dirtylist); i++)
+	{
+		num = idx->dirtylist[i];
+		idx->dirty[num] = false;
+		if (num >= qcvm->num_edicts)
+			continue;
+		SV_FileEdict (num);
+		SV_FileRider (num, EDICT_NUM (num)->area.prev != NULL);
+		for (j = 0; j < idx->findcount; j++)
+			SV_FindCacheUpdate (&idx->findcache[j], num);
+	}
+	VEC_CLEAR (idx->dirtylist);
+	VEC_CLEAR (idx->changelog);
 }
 
 /*
 ===============
-SV_LinkEdict
+SV_InRadius
 
+The findradius test, also used for the edicts picked by the index
 ===============
 */
-void SV_LinkEdict (edict_t *ent, qboolean touch_triggers)
+static qboolean SV_InRadius (edict_t *ent, const float *org, float rad)
 {
-	areanode_t	*node;
+	float d, lensq;
 
-	if (ent->area.prev)
-		SV_UnlinkEdict (ent);	// unlink from old position
+	if (ent->free)
+		return false;
+	if (ent->v.solid == SOLID_NOT)
+		return false;
 
-	if (ent == qcvm->edicts)
-		return;		// don't add the world
+	d = org[0] - (ent->v.origin[0] + (ent->v.mins[0] + ent->v.maxs[0]) * 0.5);
+	lensq = d * d;
+	if (lensq > rad)
+		return false;
+	d = org[1] - (ent->v.origin[1] + (ent->v.mins[1] + ent->v.maxs[1]) * 0.5);
+	lensq += d * d;
+	if (lensq > rad)
+		return false;
+	d = org[2] - (ent->v.origin[2] + (ent->v.mins[2] + ent->v.maxs[2]) * 0.5);
+	lensq += d * d;
+	if (lensq > rad)
+		return false;
 
-	if (ent->free)
-		return;
+	return true;
+}
 
-// set the abs box
-	VectorAdd (ent->v.origin, ent->v.mins, ent->v.absmin);
-	VectorAdd (ent->v.origin, ent->v.maxs, ent->v.absmax);
+static int SV_CompareEdictNums (const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
 
-//
-// to make items easier to pick up and allow them to be grabbed off
-// of shelves, the abs sizes are expanded
-//
-	if ((int)ent->v.flags & FL_ITEM)
+/*
+===============
+SV_FindRadius
+
+Returns the head of the chain of edicts within rad units of org, in the same
+order as a scan of all the edicts would (highest edict number first).
+===============
+*/
+edict_t *SV_FindRadius (const float *org, float rad)
+{
+	entindex_t	*idx = &sv_entindex;
+	edict_t		*ent, *chain;
+	float		radsq = rad * rad;
+	int			mincx, maxcx, mincy, maxcy, cx, cy;
+	int			i, b, num;
+
+	chain = (edict_t *)qcvm->edicts;
+	rad = fabs (rad);
+
+	mincx = SV_EntityCell (org[0] - rad);
+	maxcx = SV_EntityCell (org[0] + rad);
+	mincy = SV_EntityCell (org[1] - rad);
+	maxcy = SV_EntityCell (org[1] + rad);
+
+	if (!sv_findindex.value || qcvm != &sv.qcvm || !idx->maxents ||
+		mincx == INT_MIN || maxcx == INT_MIN || mincy == INT_MIN || maxcy == INT_MIN ||
+		(double)(maxcx - mincx + 3) * (maxcy - mincy + 3) > ENTGRID_MAXCELLS)
 	{
-		ent->v.absmin[0] -= 15;
-		ent->v.absmin[1] -= 15;
-		ent->v.absmax[0] += 15;
-		ent->v.absmax[1] += 15;
+		ent = NEXT_EDICT(qcvm->edicts);
+		for (i = 1; i < qcvm->num_edicts; i++, ent = NEXT_EDICT(ent))
+		{
+			if (!SV_InRadius (ent, org, radsq))
+				continue;
+			ent->v.chain = EDICT_TO_PROG(chain);
+			chain = ent;
+		}
+		return chain;
 	}
-	else
-	{	// because movement is clipped an epsilon away from an actual edge,
-		// we must fully check even when bounding boxes don't quite touch
-		ent->v.absmin[0] -= 1;
-		ent->v.absmin[1] -= 1;
-		ent->v.absmin[2] -= 1;
-		ent->v.absmax[0] += 1;
-		ent->v.absmax[1] += 1;
-		ent->v.absmax[2] += 1;
+
+	// edicts moved by the engine without being relinked yet (e.g. inside touch
+	// functions) can only have drifted by one physics step, so search one extra cell
+	mincx--; mincy--;
+	maxcx++; maxcy++;
+
+	VEC_CLEAR (idx->candidates);
+	if (++idx->querynum == INT_MAX)
+	{
+		memset (idx->stamp, 0, sizeof (idx->stamp));
+		idx->querynum = 1;
 	}
 
-// link to PVS leafs
-	ent->num_leafs = 0;
-	if (ent->v.modelindex)
-		SV_FindTouchedLeafs (ent, sv.worldmodel->nodes);
+	for (cy = mincy; cy <= maxcy; cy++)
+	{
+		for (cx = mincx; cx <= maxcx; cx++)
+		{
+			b = SV_CellBucket (cx, cy);
+			if (idx->stamp[b] == idx->querynum)
+				continue;
+			idx->stamp[b] = idx->querynum;
+			for (num = idx->head[b]; num >= 0; num = idx->next[num])
+			{
+				const int *cell = &idx->cell[num*2];
+				if (idx->dirty[num] || cell[0] < mincx || cell[0] > maxcx || cell[1] < mincy || cell[1] > maxcy)
+					continue;
+				VEC_PUSH (idx->candidates, num);
+			}
+		}
+	}
+	for (num = idx->head[ENTGRID_OVERFLOW]; num >= 0; num = idx->next[num])
+		if (!idx->dirty[num])
+			VEC_PUSH (idx->candidates, num);
+	for (i = 0; i < (int) VEC_SIZE (idx->dirtylist); i++)
+		VEC_PUSH (idx->candidates, idx->dirtylist[i]);
 
-	if (ent->v.solid == SOLID_NOT)
-		return;
+	qsort (idx->candidates, VEC_SIZE (idx->candidates), sizeof (int), SV_CompareEdictNums);
 
-// find the first node that the ent's box crosses
-	node = sv_areanodes;
-	while (1)
+	for (i = 0; i < (int) VEC_SIZE (idx->candidates); i++)
 	{
-		if (node->axis == -1)
+		num = idx->candidates[i];
+		if (num >= qcvm->num_edicts)
+			continue;
+		ent = EDICT_NUM (num);
+		if (!SV_InRadius (ent, org, radsq))
+			continue;
+		ent->v.chain = EDICT_TO_PROG(chain);
+		chain = ent;
+	}
+
+	return chain;
+}
+
+/*
+===============
+SV_FindString
+
+Returns the number of the first edict after start whose string field matches s,
+0 if there is none, or -1 if the cache can't be used for this query
+===============
+*/
+int SV_FindString (int start, int field, const char *s)
+{
+	entindex_t	*idx = &sv_entindex;
+	findcache_t	*fc;
+	edict_t		*ent;
+	int			i, lo, hi, count, best;
+
+	if (!sv_findindex.value || qcvm != &sv.qcvm || !idx->maxents || !qcvm->fieldwatch)
+		return -1;
+	if (field < 0 || field >= qcvm->progs->entityfields)
+		return -1;
+
+	for (i = 0, fc = idx->findcache; i < idx->findcount; i++, fc++)
+		if (fc->field == field && !strcmp (fc->value, s))
 			break;
-		if (ent->v.absmin[node->axis] > node->dist)
-			node = node->children[0];
-		else if (ent->v.absmax[node->axis] < node->dist)
-			node = node->children[1];
+
+	if (i == idx->findcount)
+	{
+		if (idx->findcount < MAX_FINDCACHE)
+			fc = &idx->findcache[idx->findcount++];
 		else
-			break;		// crosses the node
+		{	// replace the least recently used entry
+			fc = idx->findcache;
+			for (i = 1; i < MAX_FINDCACHE; i++)
+				if (idx->findcache[i].lastused < fc->lastused)
+					fc = &idx->findcache[i];
+			Z_Free (fc->value);
+			VEC_CLEAR (fc->ents);
+		}
+
+		fc->field = field;
+		fc->value = Z_Strdup (s);
+		qcvm->fieldwatch[field] = true;
+
+		ent = NEXT_EDICT(qcvm->edicts);
+		for (i = 1; i < qcvm->num_edicts; i++, ent = NEXT_EDICT(ent))
+			if (SV_StringFieldMatches (ent, field, s))
+				VEC_PUSH (fc->ents, i);
 	}
+	fc->lastused = ++idx->findtime;
 
-// link it in
+	// first cached match after start that is still valid
+	best = 0;
+	count = VEC_SIZE (fc->ents);
+	for (lo = 0, hi = count; lo < hi; )
+	{
+		int mid = (lo + hi) / 2;
+		if (fc->ents[mid] <= start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	for (; lo < count; lo++)
+	{
+		int num = fc->ents[lo];
+		if (num >= qcvm->num_edicts)
+			break;
+		if (idx->dirty[num])
+			continue;
+		ent = EDICT_NUM (num);
+		if (SV_StringFieldMatches (ent, field, s))
+		{
+			best = num;
+			break;
+		}
+	}
 
-	if (ent->v.solid == SOLID_TRIGGER)
-		InsertLinkBefore (&ent->area, &node->trigger_edicts);
-	else
-		InsertLinkBefore (&ent->area, &node->solid_edicts);
+	// edicts changed during this frame
+	for (i = 0; i < (int) VEC_SIZE (idx->dirtylist); i++)
+	{
+		int num = idx->dirtylist[i];
+		if (num <= start || num >= qcvm->num_edicts || (best && num >= best))
+			continue;
+		ent = EDICT_NUM (num);
+		if (SV_StringFieldMatches (ent, field, s))
+			best = num;
+	}
 
-// if touch_triggers, touch all entities at this node and decend for more
-	if (touch_triggers)
-		SV_TouchLinks ( ent );
+	return best;
 }
 
 
-
 /*
 ===============================================================================
 
@@ -551,21 +2561,19 @@ SV_HullPointContents
 int SV_HullPointContents (hull_t *hull, int num, vec3_t p)
 {
 	float		d;
-	mclipnode_t	*node; //johnfitz -- was dclipnode_t
-	mplane_t	*plane;
+	mhullnode_t	*node;
 
 	while (num >= 0)
 	{
 		if (num < hull->firstclipnode || num > hull->lastclipnode)
 			Sys_Error ("SV_HullPointContents: bad node number");
 
-		node = hull->clipnodes + num;
-		plane = hull->planes + node->planenum;
+		node = hull->nodes + num;
 
-		if (plane->type < 3)
-			d = p[plane->type] - plane->dist;
+		if (node->type < 3)
+			d = p[node->type] - node->dist;
 		else
-			d = DoublePrecisionDotProduct (plane->normal, p) - plane->dist;
+			d = DoublePrecisionDotProduct (node->normal, p) - node->dist;
 		if (d < 0)
 			num = node->children[1];
 		else
@@ -586,7 +2594,7 @@ int SV_PointContents (vec3_t p)
 {
 	int		cont;
 
-	cont = SV_HullPointContents (&sv.worldmodel->hulls[0], 0, p);
+	cont = SV_CachedPointContents (p);
 	if (cont <= CONTENTS_CURRENT_0 && cont >= CONTENTS_CURRENT_DOWN)
 		cont = CONTENTS_WATER;
 	return cont;
@@ -594,7 +2602,111 @@ int SV_PointContents (vec3_t p)
 
 int SV_TruePointContents (vec3_t p)
 {
-	return SV_HullPointContents (&sv.worldmodel->hulls[0], 0, p);
+	return SV_CachedPointContents (p);
+}
+
+/*
+==================
+SV_HullPointContentsPlanes
+
+The walk over separate clipnode and plane arrays that the flattened nodes
+replaced, kept for sv_hullbench
+==================
+*/
+static int SV_HullPointContentsPlanes (hull_t *hull, int num, vec3_t p)
+{
+	float		d;
+	mclipnode_t	*node;
+	mplane_t	*plane;
+
+	while (num >= 0)
+	{
+		node = hull->clipnodes + num;
+		plane = hull->planes + node->planenum;
+
+		if (plane->type < 3)
+			d = p[plane->type] - plane->dist;
+		else
+			d = DoublePrecisionDotProduct (plane->normal, p) - plane->dist;
+		if (d < 0)
+			num = node->children[1];
+		else
+			num = node->children[0];
+	}
+
+	return num;
+}
+
+/*
+==================
+SV_HullBench_f
+
+Times point contents queries against the world hulls, through the clipnode
+and plane arrays and through the flattened nodes
+
+sv_hullbench [count]
+==================
+*/
+void SV_HullBench_f (void)
+{
+	hull_t			*hull;
+	vec3_t			*points, center, size;
+	int				*results;
+	double			time[3];
+	unsigned int	seed = 1;
+	int				i, j, h, count, mismatches;
+
+	if (!sv.active)
+	{
+		Con_Printf ("server is not running\n");
+		return;
+	}
+
+	count = Cmd_Argc () >= 2 ? Q_atoi (Cmd_Argv (1)) : 1000000;
+	if (count <= 0)
+		return;
+
+	points = (vec3_t *) malloc (count * sizeof (vec3_t));
+	results = (int *) malloc (count * 2 * sizeof (int));
+	if (!points || !results)
+	{
+		free (points);
+		free (results);
+		Con_Printf ("sv_hullbench: out of memory\n");
+		return;
+	}
+
+	VectorAdd (sv.worldmodel->mins, sv.worldmodel->maxs, center);
+	VectorScale (center, 0.5f, center);
+	VectorSubtract (sv.worldmodel->maxs, center, size);
+	for (i = 0; i < count; i++)
+		for (j = 0; j < 3; j++)
+			points[i][j] = center[j] + SV_BenchRandom (&seed) * size[j];
+
+	for (h = 0; h < 3; h++)
+	{
+		hull = &sv.worldmodel->hulls[h];
+
+		time[0] = Sys_DoubleTime ();
+		for (i = 0; i < count; i++)
+			results[i*2 + 0] = SV_HullPointContentsPlanes (hull, hull->firstclipnode, points[i]);
+		time[1] = Sys_DoubleTime ();
+		for (i = 0; i < count; i++)
+			results[i*2 + 1] = SV_HullPointContents (hull, hull->firstclipnode, points[i]);
+		time[2] = Sys_DoubleTime ();
+
+		for (i = mismatches = 0; i < count; i++)
+			if (results[i*2 + 0] != results[i*2 + 1])
+				mismatches++;
+
+		time[0] = q_max (time[1] - time[0], 1e-6);
+		time[1] = q_max (time[2] - time[1], 1e-6);
+		Con_Printf ("hull %i: %.1fM/s with planes, %.1fM/s flattened (%.2fx), %i mismatches\n", h,
+			count / time[0] / 1e6, count / time[1] / 1e6, time[0] / time[1], mismatches);
+	}
+
+	free (points);
+	free (results);
 }
 
 //===========================================================================
@@ -627,144 +2739,191 @@ LINE TESTING IN HULLS
 ===============================================================================
 */
 
+#define	HULLCHECK_STACK		128		// deeper trees fall back to recursion
+
+typedef struct hullframe_s
+{
+	mhullnode_t	*node;
+	int			side;
+	float		p1f, p2f, midf, frac;
+	vec3_t		p1, p2, mid;
+} hullframe_t;
+
 /*
 ==================
 SV_RecursiveHullCheck
 
+Walks the hull with an explicit stack rather than by recursion.  Only a
+crossing of a node needs a frame, so that the far side can be visited once
+the near side comes back empty; every other step just moves down a child.
+Results are identical to the recursive walk.
 ==================
 */
 qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace)
 {
-	mclipnode_t	*node; //johnfitz -- was dclipnode_t
-	mplane_t	*plane;
+	hullframe_t	stack[HULLCHECK_STACK];
+	hullframe_t	*frame;
+	mhullnode_t	*node;
 	float		t1, t2;
 	float		frac;
 	int			i;
-	vec3_t		mid;
 	int			side;
-	float		midf;
+	int			depth = 0;
+	qboolean	deep;
+	vec3_t		start, end;
 
-// check for empty
-	if (num < 0)
-	{
-		if (num != CONTENTS_SOLID)
-		{
-			trace->allsolid = false;
-			if (num == CONTENTS_EMPTY)
-				trace->inopen = true;
-			else
-				trace->inwater = true;
-		}
-		else
-			trace->startsolid = true;
-		return true;		// empty
-	}
-
-	if (num < hull->firstclipnode || num > hull->lastclipnode)
-		Sys_Error ("SV_RecursiveHullCheck: bad node number");
-
-//
-// find the point distances
-//
-	node = hull->clipnodes + num;
-	plane = hull->planes + node->planenum;
+	VectorCopy (p1, start);
+	VectorCopy (p2, end);
 
-	if (plane->type < 3)
-	{
-		t1 = p1[plane->type] - plane->dist;
-		t2 = p2[plane->type] - plane->dist;
-	}
-	else
+	while (1)
 	{
-		t1 = DoublePrecisionDotProduct (plane->normal, p1) - plane->dist;
-		t2 = DoublePrecisionDotProduct (plane->normal, p2) - plane->dist;
-	}
+	// move down until a leaf is reached or the segment crosses a node
+		deep = false;
+		while (num >= 0)
+		{
+			if (num < hull->firstclipnode || num > hull->lastclipnode)
+				Sys_Error ("SV_RecursiveHullCheck: bad node number");
 
-#if 1
-	if (t1 >= 0 && t2 >= 0)
-		return SV_RecursiveHullCheck (hull, node->children[0], p1f, p2f, p1, p2, trace);
-	if (t1 < 0 && t2 < 0)
-		return SV_RecursiveHullCheck (hull, node->children[1], p1f, p2f, p1, p2, trace);
-#else
-	if ( (t1 >= DIST_EPSILON && t2 >= DIST_EPSILON) || (t2 > t1 && t1 >= 0) )
-		return SV_RecursiveHullCheck (hull, node->children[0], p1f, p2f, p1, p2, trace);
-	if ( (t1 <= -DIST_EPSILON && t2 <= -DIST_EPSILON) || (t2 < t1 && t1 <= 0) )
-		return SV_RecursiveHullCheck (hull, node->children[1], p1f, p2f, p1, p2, trace);
-#endif
+		//
+		// find the point distances
+		//
+			node = hull->nodes + num;
 
-// put the crosspoint DIST_EPSILON pixels on the near side
-	if (t1 < 0)
-		frac = (t1 + DIST_EPSILON)/(t1-t2);
-	else
-		frac = (t1 - DIST_EPSILON)/(t1-t2);
-	if (frac < 0)
-		frac = 0;
-	if (frac > 1)
-		frac = 1;
+			if (node->type < 3)
+			{
+				t1 = start[node->type] - node->dist;
+				t2 = end[node->type] - node->dist;
+			}
+			else
+			{
+				t1 = DoublePrecisionDotProduct (node->normal, start) - node->dist;
+				t2 = DoublePrecisionDotProduct (node->normal, end) - node->dist;
+			}
 
-	midf = p1f + (p2f - p1f)*frac;
-	for (i=0 ; i<3 ; i++)
-		mid[i] = p1[i] + frac*(p2[i] - p1[i]);
+			if (t1 >= 0 && t2 >= 0)
+			{
+				num = node->children[0];
+				continue;
+			}
+			if (t1 < 0 && t2 < 0)
+			{
+				num = node->children[1];
+				continue;
+			}
 
-	side = (t1 < 0);
+			if (depth == HULLCHECK_STACK)
+			{
+				if (!SV_RecursiveHullCheck (hull, num, p1f, p2f, start, end, trace))
+					return false;
+				deep = true;
+				break;
+			}
 
-// move up to the node
-	if (!SV_RecursiveHullCheck (hull, node->children[side], p1f, midf, p1, mid, trace) )
-		return false;
+		// put the crosspoint DIST_EPSILON pixels on the near side
+			if (t1 < 0)
+				frac = (t1 + DIST_EPSILON)/(t1-t2);
+			else
+				frac = (t1 - DIST_EPSILON)/(t1-t2);
+			if (frac < 0)
+				frac = 0;
+			if (frac > 1)
+				frac = 1;
+
+			side = (t1 < 0);
+
+			frame = &stack[depth++];
+			frame->node = node;
+			frame->side = side;
+			frame->frac = frac;
+			frame->p1f = p1f;
+			frame->p2f = p2f;
+			frame->midf = p1f + (p2f - p1f)*frac;
+			VectorCopy (start, frame->p1);
+			VectorCopy (end, frame->p2);
+			for (i=0 ; i<3 ; i++)
+				frame->mid[i] = start[i] + frac*(end[i] - start[i]);
+
+		// move up to the node
+			num = node->children[side];
+			p2f = frame->midf;
+			VectorCopy (frame->mid, end);
+		}
 
-#ifdef PARANOID
-	if (SV_HullPointContents (sv_hullmodel, mid, node->children[side])
-	== CONTENTS_SOLID)
-	{
-		Con_Printf ("mid PointInHullSolid\n");
-		return false;
-	}
-#endif
+	// check for empty (a subtree handed to the nested walk has been checked already)
+		if (!deep)
+		{
+			if (num != CONTENTS_SOLID)
+			{
+				trace->allsolid = false;
+				if (num == CONTENTS_EMPTY)
+					trace->inopen = true;
+				else
+					trace->inwater = true;
+			}
+			else
+				trace->startsolid = true;
+		}
 
-	if (SV_HullPointContents (hull, node->children[side^1], mid)
-	!= CONTENTS_SOLID)
-// go past the node
-		return SV_RecursiveHullCheck (hull, node->children[side^1], midf, p2f, mid, p2, trace);
+	// the near side of the innermost crossing was empty
+		if (!depth)
+			return true;
+		frame = &stack[--depth];
+		node = frame->node;
+		side = frame->side;
 
-	if (trace->allsolid)
-		return false;		// never got out of the solid area
+		if (SV_HullPointContents (hull, node->children[side^1], frame->mid)
+		!= CONTENTS_SOLID)
+		{
+		// go past the node
+			num = node->children[side^1];
+			p1f = frame->midf;
+			p2f = frame->p2f;
+			VectorCopy (frame->mid, start);
+			VectorCopy (frame->p2, end);
+			continue;
+		}
 
-//==================
-// the other side of the node is solid, this is the impact point
-//==================
-	if (!side)
-	{
-		VectorCopy (plane->normal, trace->plane.normal);
-		trace->plane.dist = plane->dist;
-	}
-	else
-	{
-		VectorSubtract (vec3_origin, plane->normal, trace->plane.normal);
-		trace->plane.dist = -plane->dist;
-	}
+		if (trace->allsolid)
+			return false;		// never got out of the solid area
 
-	while (SV_HullPointContents (hull, hull->firstclipnode, mid)
-	== CONTENTS_SOLID)
-	{ // shouldn't really happen, but does occasionally
-		frac -= 0.1;
-		if (frac < 0)
+	//==================
+	// the other side of the node is solid, this is the impact point
+	//==================
+		if (!side)
 		{
-			trace->fraction = midf;
-			VectorCopy (mid, trace->endpos);
-			Con_DPrintf ("backup past 0\n");
-			return false;
+			VectorCopy (node->normal, trace->plane.normal);
+			trace->plane.dist = node->dist;
+		}
+		else
+		{
+			VectorSubtract (vec3_origin, node->normal, trace->plane.normal);
+			trace->plane.dist = -node->dist;
 		}
-		midf = p1f + (p2f - p1f)*frac;
-		for (i=0 ; i<3 ; i++)
-			mid[i] = p1[i] + frac*(p2[i] - p1[i]);
-	}
 
-	trace->fraction = midf;
-	VectorCopy (mid, trace->endpos);
+		frac = frame->frac;
+		while (SV_HullPointContents (hull, hull->firstclipnode, frame->mid)
+		== CONTENTS_SOLID)
+		{ // shouldn't really happen, but does occasionally
+			frac -= 0.1;
+			if (frac < 0)
+			{
+				trace->fraction = frame->midf;
+				VectorCopy (frame->mid, trace->endpos);
+				if (!sv_tracebatch_active)
+					Con_DPrintf ("backup past 0\n");
+				return false;
+			}
+			frame->midf = frame->p1f + (frame->p2f - frame->p1f)*frac;
+			for (i=0 ; i<3 ; i++)
+				frame->mid[i] = frame->p1[i] + frac*(frame->p2[i] - frame->p1[i]);
+		}
 
-	return false;
-}
+		trace->fraction = frame->midf;
+		VectorCopy (frame->mid, trace->endpos);
 
+		return false;
+	}
+}
 
 /*
 ==================
@@ -794,7 +2953,7 @@ trace_t SV_ClipMoveToEntity (edict_t *ent, vec3_t start, vec3_t mins, vec3_t max
 	VectorSubtract (end, offset, end_l);
 
 // trace a line through the apropriate clipping hull
-	SV_RecursiveHullCheck (hull, hull->firstclipnode, 0, 1, start_l, end_l, &trace);
+	SV_CachedHullCheck (hull, start_l, end_l, &trace);
 
 // fix trace up by the offset
 	if (trace.fraction != 1)
@@ -818,65 +2977,64 @@ Mins and maxs enclose the entire area swept by the move
 */
 void SV_ClipToLinks ( areanode_t *node, moveclip_t *clip )
 {
-	link_t		*l, *next;
+	edict_t		*batch[AREA_BATCH];
 	edict_t		*touch;
 	trace_t		trace;
+	int			pos, i, count;
+
+	sv_areastats.movenodes++;
+	sv_areastats.movelinks += node->solid_boxes.count - node->solid_boxes.dead;
 
 // touch linked edicts
-	for (l = node->solid_edicts.next ; l != &node->solid_edicts ; l = next)
+	for (pos = 0; pos < node->solid_boxes.count; )
 	{
-		next = l->next;
-		touch = EDICT_FROM_AREA(l);
-		if (touch->v.solid == SOLID_NOT)
-			continue;
-		if (touch == clip->passedict)
-			continue;
-		if (touch->v.solid == SOLID_TRIGGER)
-			Sys_Error ("Trigger in clipping list");
-
-		if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
-			continue;
-
-		if (clip->boxmins[0] > touch->v.absmax[0]
-		|| clip->boxmins[1] > touch->v.absmax[1]
-		|| clip->boxmins[2] > touch->v.absmax[2]
-		|| clip->boxmaxs[0] < touch->v.absmin[0]
-		|| clip->boxmaxs[1] < touch->v.absmin[1]
-		|| clip->boxmaxs[2] < touch->v.absmin[2] )
-			continue;
-
-		if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0])
-			continue;	// points never interact
-
-	// might intersect, so do an exact clip
-		if (clip->trace.allsolid)
-			return;
-		if (clip->passedict)
-		{
-		 	if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
-				continue;	// don't clip against own missiles
-			if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
-				continue;	// don't clip against owner
-		}
-
-		if ((int)touch->v.flags & FL_MONSTER)
-			trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins2, clip->maxs2, clip->end);
-		else
-			trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins, clip->maxs, clip->end);
-		if (trace.allsolid || trace.startsolid ||
-		trace.fraction < clip->trace.fraction)
+		count = SV_AreaBoxCandidates (&node->solid_boxes, &pos, clip->boxmins, clip->boxmaxs, batch);
+		for (i = 0; i < count; i++)
 		{
-			trace.ent = touch;
-		 	if (clip->trace.startsolid)
+			touch = batch[i];
+			if (touch->v.solid == SOLID_NOT)
+				continue;
+			if (touch == clip->passedict)
+				continue;
+			if (touch->v.solid == SOLID_TRIGGER)
+				Sys_Error ("Trigger in clipping list");
+
+			if (clip->type == MOVE_NOMONSTERS && touch->v.solid != SOLID_BSP)
+				continue;
+
+			if (clip->passedict && clip->passedict->v.size[0] && !touch->v.size[0])
+				continue;	// points never interact
+
+		// might intersect, so do an exact clip
+			if (clip->trace.allsolid)
+				return;
+			if (clip->passedict)
 			{
-				clip->trace = trace;
-				clip->trace.startsolid = true;
+			 	if (PROG_TO_EDICT(touch->v.owner) == clip->passedict)
+					continue;	// don't clip against own missiles
+				if (PROG_TO_EDICT(clip->passedict->v.owner) == touch)
+					continue;	// don't clip against owner
 			}
+
+			if ((int)touch->v.flags & FL_MONSTER)
+				trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins2, clip->maxs2, clip->end);
 			else
-				clip->trace = trace;
+				trace = SV_ClipMoveToEntity (touch, clip->start, clip->mins, clip->maxs, clip->end);
+			if (trace.allsolid || trace.startsolid ||
+			trace.fraction < clip->trace.fraction)
+			{
+				trace.ent = touch;
+			 	if (clip->trace.startsolid)
+				{
+					clip->trace = trace;
+					clip->trace.startsolid = true;
+				}
+				else
+					clip->trace = trace;
+			}
+			else if (trace.startsolid)
+				clip->trace.startsolid = true;
 		}
-		else if (trace.startsolid)
-			clip->trace.startsolid = true;
 	}
 
 // recurse down both sides
@@ -960,8 +3118,375 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 	SV_MoveBounds ( start, clip.mins2, clip.maxs2, end, clip.boxmins, clip.boxmaxs );
 
 // clip to entities
+	sv_areastats.moves++;
+	sv_movecount++;
 	SV_ClipToLinks ( sv_areanodes, &clip );
 
 	return clip.trace;
 }
 
+/*
+===============================================================================
+
+TRACE SERVICE
+
+Runs batches of MOVE_NOMONSTERS line traces on a pool of worker threads.  Such
+traces only read the world and brush entity hulls and the area tree, none of
+which change while the QC thread waits for the batch, so the workers can walk
+them at the same time.  The hull query cache is bypassed during a batch.
+
+The same workers can also trace boxes against the world alone ahead of time,
+with the results going into the hull query cache (see SV_PrefetchWorldMoves),
+or run any other function that only reads the server state over a range of
+indices (see SV_ParallelJobs).
+
+===============================================================================
+*/
+
+cvar_t	sv_traceworkers = {"sv_traceworkers", "0", CVAR_ARCHIVE};	// threads per batch, 0 = one per core
+
+#define	TRACE_CHUNK			8		// jobs claimed at a time
+#define	TRACE_MIN_BATCH		32		// smaller batches aren't worth waking the workers for
+#define	PREFETCH_MIN_BATCH	4		// the same for world-only prefetches, which are fewer but always clip the full hull
+
+static struct
+{
+	int				numworkers;
+	SDL_Thread		*threads[MAX_TRACE_WORKERS];
+	SDL_sem			*start;
+	SDL_sem			*done;
+	SDL_atomic_t	quit;
+	SDL_atomic_t	next;
+	tracejob_t		*jobs;
+	int				count;
+	qboolean		worldonly;		// SV_PrefetchWorldMoves batch
+	void			(*func) (int index, void *data);	// SV_ParallelJobs batch
+	void			*data;
+} sv_traceservice;
+
+/*
+===============
+SV_RunTraceJobs
+
+===============
+*/
+static void SV_RunTraceJobs (void)
+{
+	tracejob_t	*job;
+	int			i, end;
+
+	if (sv_traceservice.func)
+	{
+		// these are big enough to be claimed one at a time
+		while ((i = SDL_AtomicAdd (&sv_traceservice.next, 1)) < sv_traceservice.count)
+			sv_traceservice.func (i, sv_traceservice.data);
+		return;
+	}
+
+	while ((i = SDL_AtomicAdd (&sv_traceservice.next, TRACE_CHUNK)) < sv_traceservice.count)
+	{
+		end = q_min (i + TRACE_CHUNK, sv_traceservice.count);
+		for (; i < end; i++)
+		{
+			job = &sv_traceservice.jobs[i];
+			if (sv_traceservice.worldonly)
+			{
+				vec3_t	start_l, end_l;
+
+				VectorSubtract (job->start, job->offset, start_l);
+				VectorSubtract (job->end, job->offset, end_l);
+				SV_RecursiveHullCheck (job->hull, job->hull->firstclipnode, 0, 1, start_l, end_l, &job->trace);
+			}
+			else
+				job->trace = SV_Move (job->start, vec3_origin, vec3_origin, job->end, MOVE_NOMONSTERS, job->passedict);
+		}
+	}
+}
+
+/*
+===============
+SV_TraceWorker
+
+===============
+*/
+static int SV_TraceWorker (void *num)
+{
+	qcvm = &sv.qcvm;	// thread local, EDICT_NUM and friends go through it
+	sv_traceworkernum = (int)(intptr_t) num;
+
+	while (1)
+	{
+		SDL_SemWait (sv_traceservice.start);
+		if (SDL_AtomicGet (&sv_traceservice.quit))
+			break;
+		SV_RunTraceJobs ();
+		SDL_SemPost (sv_traceservice.done);
+	}
+
+	return 0;
+}
+
+/*
+===============
+SV_StopTraceWorkers
+
+===============
+*/
+static void SV_StopTraceWorkers (void)
+{
+	int		i;
+
+	if (!sv_traceservice.numworkers)
+		return;
+
+	SDL_AtomicSet (&sv_traceservice.quit, 1);
+	for (i = 0; i < sv_traceservice.numworkers; i++)
+		SDL_SemPost (sv_traceservice.start);
+	for (i = 0; i < sv_traceservice.numworkers; i++)
+		SDL_WaitThread (sv_traceservice.threads[i], NULL);
+	SDL_AtomicSet (&sv_traceservice.quit, 0);
+	sv_traceservice.numworkers = 0;
+}
+
+/*
+===============
+SV_ShutdownTraceWorkers
+
+Joins the worker threads and frees the semaphores, they're brought back by
+the next batch that needs them
+===============
+*/
+void SV_ShutdownTraceWorkers (void)
+{
+	SV_StopTraceWorkers ();
+
+	if (sv_traceservice.start)
+	{
+		SDL_DestroySemaphore (sv_traceservice.start);
+		SDL_DestroySemaphore (sv_traceservice.done);
+		sv_traceservice.start = NULL;
+		sv_traceservice.done = NULL;
+	}
+}
+
+/*
+===============
+SV_StartTraceWorkers
+
+Brings the pool to the size sv_traceworkers asks for
+===============
+*/
+static void SV_StartTraceWorkers (void)
+{
+	int		wanted = (int) sv_traceworkers.value;
+
+	if (wanted <= 0)
+		wanted = SDL_GetCPUCount ();
+	wanted = CLAMP (0, wanted - 1, MAX_TRACE_WORKERS);	// the calling thread does its share too
+
+	if (wanted == sv_traceservice.numworkers)
+		return;
+	SV_StopTraceWorkers ();
+
+	if (!sv_traceservice.start)
+	{
+		sv_traceservice.start = SDL_CreateSemaphore (0);
+		sv_traceservice.done = SDL_CreateSemaphore (0);
+		if (!sv_traceservice.start || !sv_traceservice.done)
+			Sys_Error ("SV_StartTraceWorkers: %s", SDL_GetError ());
+	}
+
+	while (sv_traceservice.numworkers < wanted)
+	{
+		SDL_Thread *thread = SDL_CreateThread (SV_TraceWorker, "Trace worker", (void *)(intptr_t)(sv_traceservice.numworkers + 1));
+		if (!thread)
+		{
+			Con_DPrintf ("SV_StartTraceWorkers: %s\n", SDL_GetError ());
+			break;
+		}
+		sv_traceservice.threads[sv_traceservice.numworkers++] = thread;
+	}
+}
+
+/*
+===============
+SV_BrushEdictValid
+
+SV_HullForEntity raises a host error for broken SOLID_BSP edicts, which must
+only ever happen on the QC thread
+===============
+*/
+static qboolean SV_BrushEdictValid (edict_t *ent)
+{
+	qmodel_t	*model = sv.models[(int)ent->v.modelindex];
+
+	return ent->v.movetype == MOVETYPE_PUSH && model && model->type == mod_brush;
+}
+
+/*
+===============
+SV_BrushEdictsValid
+
+Checked before every batch, QC can change solid or movetype without
+relinking the edict
+===============
+*/
+static qboolean SV_BrushEdictsValid (void)
+{
+	edict_t		*ent;
+	int			i;
+
+	for (i = 0; i < qcvm->num_edicts; i++)
+	{
+		ent = EDICT_NUM (i);
+		if (!ent->free && ent->v.solid == SOLID_BSP && !SV_BrushEdictValid (ent))
+			return false;
+	}
+
+	return true;
+}
+
+/*
+===============
+SV_TraceBatch
+
+Fills in the trace of every job, exactly as the same SV_Move calls made one
+after the other would.  Must be called with the server VM active.
+===============
+*/
+void SV_TraceBatch (tracejob_t *jobs, int count)
+{
+	int		i;
+
+	if (count <= 0)
+		return;
+
+	if (count >= TRACE_MIN_BATCH)
+		SV_StartTraceWorkers ();
+
+	sv_traceservice.jobs = jobs;
+	sv_traceservice.count = count;
+	SDL_AtomicSet (&sv_traceservice.next, 0);
+
+	if (count < TRACE_MIN_BATCH || !sv_traceservice.numworkers || !SV_BrushEdictsValid ())
+	{
+		SV_RunTraceJobs ();
+		return;
+	}
+
+	sv_tracebatch_active = true;
+	for (i = 0; i < sv_traceservice.numworkers; i++)
+		SDL_SemPost (sv_traceservice.start);
+	SV_RunTraceJobs ();
+	for (i = 0; i < sv_traceservice.numworkers; i++)
+		SDL_SemWait (sv_traceservice.done);
+	sv_tracebatch_active = false;
+}
+
+/*
+===============
+SV_PrefetchWorldMoves
+
+Clips the boxes of a batch of upcoming moves against the world on the trace
+workers and files the results in the hull query cache, so that SV_Move only
+has to clip those moves against entities when they are actually made.  Jobs
+whose moves end up being different are just never looked up.  Does nothing
+unless the batch is big enough to be worth spreading over the workers.
+===============
+*/
+void SV_PrefetchWorldMoves (tracejob_t *jobs, int count)
+{
+	tracejob_t		*job;
+	tracekey_t		key;
+	tracecache_t	*entry;
+	vec3_t			start_l, end_l;
+	int				i;
+
+	if (count < PREFETCH_MIN_BATCH || !sv_tracecache.value || qcvm != &sv.qcvm)
+		return;
+
+	SV_StartTraceWorkers ();
+	if (!sv_traceservice.numworkers)
+		return;
+
+	// the same default trace and hull SV_ClipMoveToEntity would use for the world
+	for (i = 0; i < count; i++)
+	{
+		job = &jobs[i];
+		memset (&job->trace, 0, sizeof (job->trace));
+		job->trace.fraction = 1;
+		job->trace.allsolid = true;
+		VectorCopy (job->end, job->trace.endpos);
+		job->hull = SV_HullForEntity (qcvm->edicts, job->mins, job->maxs, job->offset);
+	}
+
+	sv_traceservice.jobs = jobs;
+	sv_traceservice.count = count;
+	sv_traceservice.worldonly = true;
+	SDL_AtomicSet (&sv_traceservice.next, 0);
+
+	sv_tracebatch_active = true;
+	for (i = 0; i < sv_traceservice.numworkers; i++)
+		SDL_SemPost (sv_traceservice.start);
+	SV_RunTraceJobs ();
+	for (i = 0; i < sv_traceservice.numworkers; i++)
+		SDL_SemWait (sv_traceservice.done);
+	sv_tracebatch_active = false;
+	sv_traceservice.worldonly = false;
+
+	for (i = 0; i < count; i++)
+	{
+		job = &jobs[i];
+		if (job->hull == &box_hull)
+			continue;
+		VectorSubtract (job->start, job->offset, start_l);
+		VectorSubtract (job->end, job->offset, end_l);
+		entry = SV_TraceCacheEntry (&key, job->hull, start_l, end_l, job->end);
+		entry->key = key;
+		entry->generation = sv_tracecache_generation;
+		entry->trace = job->trace;
+		sv_tracecachestats.prefetches++;
+	}
+}
+
+/*
+===============
+SV_ParallelJobs
+
+Calls func for every index from 0 to count-1, spread over the trace workers
+and the calling thread, and returns once they're all done.  func can't
+touch anything another index might, and apart from that may only read the
+server state.  Must be called with the server VM active.
+===============
+*/
+void SV_ParallelJobs (void (*func) (int index, void *data), void *data, int count)
+{
+	int		i;
+
+	if (count <= 0)
+		return;
+
+	if (count > 1)
+		SV_StartTraceWorkers ();
+
+	if (count == 1 || !sv_traceservice.numworkers)
+	{
+		for (i = 0; i < count; i++)
+			func (i, data);
+		return;
+	}
+
+	sv_traceservice.func = func;
+	sv_traceservice.data = data;
+	sv_traceservice.count = count;
+	SDL_AtomicSet (&sv_traceservice.next, 0);
+
+	for (i = 0; i < sv_traceservice.numworkers; i++)
+		SDL_SemPost (sv_traceservice.start);
+	SV_RunTraceJobs ();
+	for (i = 0; i < sv_traceservice.numworkers; i++)
+		SDL_SemWait (sv_traceservice.done);
+
+	sv_traceservice.func = NULL;
+	sv_traceservice.data = NULL;
+}
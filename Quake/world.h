@@ -60,6 +60,60 @@ void SV_LinkEdict (edict_t *ent, qboolean touch_triggers);
 // sets ent->v.absmin and ent->v.absmax
 // if touchtriggers, calls prog functions for the intersected triggers
 
+extern cvar_t sv_findindex;
+extern cvar_t sv_areasplit;
+extern cvar_t sv_tracecache;
+extern cvar_t sv_leafcache;
+extern cvar_t sv_triggerindex;
+
+typedef struct
+{
+	int		checks;		// SV_TouchLinks calls
+	int		reused;		// answered with the edict's previous list
+	int		tested;		// trigger boxes tested by the trigger index
+	int		calls;		// touch functions run
+} touchstats_t;
+
+extern touchstats_t sv_touchstats;
+// accumulated until host_speeds reports them
+
+void SV_AreaStats_f (void);
+// prints the shape of the area node tree and the cost of queries against it
+
+int SV_AreaEdicts (const vec3_t mins, const vec3_t maxs, edict_t **list, int maxcount);
+// fills in the linked edicts (SOLID_NOT included) whose boxes overlap mins/maxs,
+// sorted by edict number, and returns how many there were
+
+void SV_TraceBench_f (void);
+// times a batch of random SV_Move calls against the current map
+
+void SV_HullBench_f (void);
+// times point contents queries against the world hulls, old layout against flattened
+
+void SV_EdictChanged (edict_t *ent);
+// flags an edict whose fields may have changed without it being relinked,
+// so that the query index below rechecks it
+
+void SV_GroundChanged (edict_t *ent);
+// the engine put ent on the ground, refiles it by its groundentity
+
+void SV_FlushEntityIndex (void);
+// refiles the edicts flagged during the previous frame
+
+int SV_RiderEdicts (edict_t *ground, edict_t **list);
+// fills in every edict that might be on the ground and standing on ground,
+// unsorted, or returns -1 if the caller has to scan the edicts itself
+
+int SV_ChangeLog (const int **log);
+// numbers of the edicts linked or flagged so far this frame, repeats included
+
+edict_t *SV_FindRadius (const float *org, float rad);
+// same chain PF_findradius would build, using the index when possible
+
+int SV_FindString (int start, int field, const char *s);
+// first edict after start whose string field matches s, 0 for none,
+// or -1 if the caller has to scan the edicts itself
+
 int SV_PointContents (vec3_t p);
 int SV_TruePointContents (vec3_t p);
 // returns the CONTENTS_* value from the world at the given point.
@@ -83,5 +137,39 @@ trace_t SV_Move (vec3_t start, vec3_t mins, vec3_t maxs, vec3_t end, int type, e
 
 qboolean SV_RecursiveHullCheck (hull_t *hull, int num, float p1f, float p2f, vec3_t p1, vec3_t p2, trace_t *trace);
 
+typedef struct tracejob_s
+{
+	vec3_t		start, end;
+	edict_t		*passedict;
+	trace_t		trace;
+
+	vec3_t		mins, maxs;		// SV_PrefetchWorldMoves only
+	hull_t		*hull;			// set up by SV_PrefetchWorldMoves
+	vec3_t		offset;
+} tracejob_t;
+
+extern cvar_t sv_traceworkers;
+
+void SV_TraceBatch (tracejob_t *jobs, int count);
+// runs a MOVE_NOMONSTERS line trace for each job, spread over worker threads
+
+void SV_PrefetchWorldMoves (tracejob_t *jobs, int count);
+// clips each job's box move against the world only, ahead of time, and keeps
+// the results in the hull trace cache for the SV_Move calls that follow
+
+void SV_ParallelJobs (void (*func) (int index, void *data), void *data, int count);
+// calls func (i, data) for i = 0 .. count-1 on the same worker threads
+
+void SV_ShutdownTraceWorkers (void);
+// joins the worker threads, the next batch starts them again
+
+extern THREAD_LOCAL unsigned int sv_movecount;
+// SV_Move calls made on this thread
+
+#define	MAX_TRACE_WORKERS	16
+
+extern THREAD_LOCAL int sv_traceworkernum;
+// 1 .. MAX_TRACE_WORKERS on the trace workers, 0 on every other thread
+
 #endif	/* _QUAKE_WORLD_H */
 